@@ -0,0 +1,230 @@
+// Host checks and benchmark of the IMA-ADPCM codec (env:adpcm_bench).
+//
+//   pio run -e adpcm_bench -t exec              built-in signals
+//   .pio/build/adpcm_bench/program speech.wav   a 16-bit WAV file as well
+//
+// For each signal it
+//   - encodes 256-byte blocks with adpcmEncodeBlock() and requires the
+//     streaming AdpcmEncoder, fed the same audio in random chunk sizes, to
+//     produce the same bytes
+//   - decodes every block on its own and reports the signal-to-noise ratio
+//     of the round trip, which must reach the signal's floor
+//   - times the encoder, in ns and host cycles per block
+// It also requires malformed blocks to be refused, and exits non-zero if
+// any check fails.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <chrono>
+#include <vector>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define BENCH_HAS_TSC 1
+#else
+#define BENCH_HAS_TSC 0
+#endif
+#include "../Codec/adpcm.h"
+#include "../Hal/synthetic_source.h"
+#include "../Hal/wav_source.h"
+
+static constexpr uint32_t SAMPLE_RATE = 16000;
+static constexpr size_t BLOCK_BYTES = ADPCM_BLOCK_BYTES;
+static constexpr size_t BLOCK_SAMPLES = adpcmBlockSamples(BLOCK_BYTES);
+
+// Round-trip floor for a recording given on the command line
+#ifndef BENCH_MIN_WAV_SNR_DB
+#define BENCH_MIN_WAV_SNR_DB 20.0
+#endif
+// Budget per 505-sample block (31.6 ms of audio at 16 kHz). The host
+// default leaves room for slow CI machines and still catches gross regressions.
+#ifndef BENCH_MAX_NS_PER_BLOCK
+#define BENCH_MAX_NS_PER_BLOCK 50000
+#endif
+
+typedef std::chrono::steady_clock Clock;
+
+static uint32_t lcg(uint32_t& seed) {
+  seed = seed * 1664525 + 1013904223;
+  return seed >> 8;
+}
+
+static int16_t toSample(double x) {
+  x = x < 0 ? x - 0.5 : x + 0.5;
+  if (x > 32767) return 32767;
+  if (x < -32768) return -32768;
+  return (int16_t)x;
+}
+
+//----------------------------------------------------------------------
+// Signals
+//----------------------------------------------------------------------
+struct Signal {
+  const char* name;
+  std::vector<int16_t> samples;
+  uint32_t sampleRate;
+  double minSnrDb;
+};
+
+static Signal speechLike() {
+  Signal s = { "Synthetic speech-like bursts", std::vector<int16_t>(SAMPLE_RATE * 30), SAMPLE_RATE, 25.0 };
+  SyntheticSource source;
+  source.begin(SyntheticSource::Config());
+  source.record(s.samples.data(), s.samples.size(), SAMPLE_RATE);
+  return s;
+}
+
+// 100 Hz to 7 kHz in 10 s at -12 dBFS
+static Signal sweep() {
+  Signal s = { "Sweep 0.1-7 kHz, -12 dBFS", std::vector<int16_t>(SAMPLE_RATE * 10), SAMPLE_RATE, 15.0 };
+  double phase = 0;
+  for (size_t i = 0; i < s.samples.size(); i++) {
+    double hz = 100 * pow(70.0, (double)i / s.samples.size());
+    phase += 2 * M_PI * hz / SAMPLE_RATE;
+    s.samples[i] = toSample(8192 * sin(phase));
+  }
+  return s;
+}
+
+// White noise at -20 dBFS: nothing to predict, the codec's worst case
+static Signal noise() {
+  Signal s = { "White noise, -20 dBFS", std::vector<int16_t>(SAMPLE_RATE * 10), SAMPLE_RATE, 8.0 };
+  uint32_t seed = 7;
+  for (int16_t& x : s.samples) {
+    x = toSample(((double)(lcg(seed) % 20001) - 10000) * 0.5672);
+  }
+  return s;
+}
+
+static bool loadWav(const char* path, Signal& s) {
+  WavFileSource wav;
+  if (!wav.open(path) || wav.frames() < BLOCK_SAMPLES) {
+    return false;
+  }
+  s.name = path;
+  s.samples.resize(wav.frames());
+  s.sampleRate = wav.sampleRate();
+  s.minSnrDb = BENCH_MIN_WAV_SNR_DB;
+  return wav.record(s.samples.data(), s.samples.size(), wav.sampleRate());
+}
+
+//----------------------------------------------------------------------
+// Checks
+//----------------------------------------------------------------------
+static bool checkMalformed() {
+  uint8_t block[BLOCK_BYTES] = {};
+  int16_t out[BLOCK_SAMPLES];
+  block[2] = 89;
+  bool ok = adpcmDecodeBlock(block, BLOCK_BYTES, out) == 0;
+  block[2] = 88;
+  ok = adpcmDecodeBlock(block, ADPCM_BLOCK_HEADER_BYTES, out) == 0 && ok;
+  ok = adpcmDecodeBlock(block, BLOCK_BYTES, out) == BLOCK_SAMPLES && ok;
+  printf("Malformed blocks %s\n", ok ? "refused" : "accepted  FAIL");
+  return ok;
+}
+
+static double snrDb(const int16_t* reference, const int16_t* decoded, size_t count) {
+  double signal = 0;
+  double error = 0;
+  for (size_t i = 0; i < count; i++) {
+    double e = (double)decoded[i] - reference[i];
+    signal += (double)reference[i] * reference[i];
+    error += e * e;
+  }
+  return error > 0 ? 10 * log10(signal / error) : INFINITY;
+}
+
+static bool runSignal(const Signal& s) {
+  size_t blocks = s.samples.size() / BLOCK_SAMPLES;
+  size_t count = blocks * BLOCK_SAMPLES;
+  printf("\n%s: %.1f s, %u blocks\n", s.name, (double)s.samples.size() / s.sampleRate, (unsigned)blocks);
+
+  // One block at a time, step index carried across blocks as the encoder does
+  std::vector<uint8_t> encoded(blocks * BLOCK_BYTES);
+  uint8_t stepIndex = 0;
+  for (size_t b = 0; b < blocks; b++) {
+    adpcmEncodeBlock(s.samples.data() + b * BLOCK_SAMPLES, BLOCK_BYTES, stepIndex, encoded.data() + b * BLOCK_BYTES);
+  }
+
+  // The streaming encoder, in the chunk sizes captures come in and others
+  AdpcmEncoder encoder;
+  encoder.begin(BLOCK_BYTES);
+  std::vector<uint8_t> streamed(encoded.size() + BLOCK_BYTES);
+  size_t streamedBytes = 0;
+  uint32_t seed = 5;
+  for (size_t taken = 0; taken < count;) {
+    size_t chunk = 1 + lcg(seed) % 1200;
+    if (chunk > count - taken) chunk = count - taken;
+    streamedBytes += encoder.encode(s.samples.data() + taken, chunk, streamed.data() + streamedBytes,
+                                    streamed.size() - streamedBytes);
+    taken += chunk;
+  }
+  bool sameBytes = streamedBytes == encoded.size() && memcmp(streamed.data(), encoded.data(), encoded.size()) == 0;
+  printf("  streaming encoder %s\n", sameBytes ? "matches the block encoder" : "differs from the block encoder  FAIL");
+
+  // Every block decodes on its own
+  std::vector<int16_t> decoded(count);
+  bool decodes = true;
+  for (size_t b = 0; b < blocks; b++) {
+    size_t n = adpcmDecodeBlock(encoded.data() + b * BLOCK_BYTES, BLOCK_BYTES, decoded.data() + b * BLOCK_SAMPLES);
+    decodes = decodes && n == BLOCK_SAMPLES && decoded[b * BLOCK_SAMPLES] == s.samples[b * BLOCK_SAMPLES];
+  }
+  if (!decodes) {
+    printf("  a block failed to decode or lost its first sample  FAIL\n");
+  }
+  double snr = snrDb(s.samples.data(), decoded.data(), count);
+  bool snrOk = snr >= s.minSnrDb;
+  printf("  round trip SNR %.1f dB (floor %.1f dB)%s, %.2f bits per sample\n", snr, s.minSnrDb,
+         snrOk ? "" : "  FAIL", 8.0 * BLOCK_BYTES / BLOCK_SAMPLES);
+
+  // Encode cost, repeated so the run takes long enough to time
+  size_t repeats = 1 + 20000 / blocks;
+  uint8_t out[BLOCK_BYTES];
+  uint32_t checksum = 0;
+  Clock::time_point start = Clock::now();
+#if BENCH_HAS_TSC
+  uint64_t startCycles = __rdtsc();
+#endif
+  for (size_t r = 0; r < repeats; r++) {
+    stepIndex = 0;
+    for (size_t b = 0; b < blocks; b++) {
+      adpcmEncodeBlock(s.samples.data() + b * BLOCK_SAMPLES, BLOCK_BYTES, stepIndex, out);
+      checksum += out[BLOCK_BYTES - 1];
+    }
+  }
+#if BENCH_HAS_TSC
+  double cycles = (double)(__rdtsc() - startCycles) / (repeats * blocks);
+#endif
+  double ns = std::chrono::duration<double, std::nano>(Clock::now() - start).count() / (repeats * blocks);
+  bool costOk = ns <= BENCH_MAX_NS_PER_BLOCK;
+#if BENCH_HAS_TSC
+  printf("  encode: %.0f ns, %.0f host cycles per block (%.1f per sample)%s (checksum %u)\n", ns, cycles,
+         cycles / BLOCK_SAMPLES, costOk ? "" : "  FAIL", checksum);
+#else
+  printf("  encode: %.0f ns per block%s (checksum %u)\n", ns, costOk ? "" : "  FAIL", checksum);
+#endif
+  return sameBytes && decodes && snrOk && costOk;
+}
+
+int main(int argc, char** argv) {
+  std::vector<Signal> signals;
+  signals.push_back(speechLike());
+  signals.push_back(sweep());
+  signals.push_back(noise());
+  for (int i = 1; i < argc; i++) {
+    Signal s;
+    if (!loadWav(argv[i], s)) {
+      printf("%s: not a 16-bit WAV file of at least one block\n", argv[i]);
+      return 2;
+    }
+    signals.push_back(s);
+  }
+
+  printf("IMA-ADPCM, %u-byte blocks of %u samples\n", (unsigned)BLOCK_BYTES, (unsigned)BLOCK_SAMPLES);
+  bool ok = checkMalformed();
+  for (const Signal& s : signals) {
+    ok = runSignal(s) && ok;
+  }
+  printf("\n%s\n", ok ? "ADPCM within spec" : "ADPCM regression");
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,237 @@
+// Host checks and benchmark of the 48 kHz capture decimator (env:decimator_bench).
+//
+//   pio run -e decimator_bench -t exec
+//
+// For every output rate it
+//   - feeds noise, tones and clipped bursts through CaptureDecimator in
+//     random block sizes and requires the output to match the plain
+//     reference loop (firDecimateReference) bit for bit
+//   - sweeps tones across the band the stream keeps and the band that
+//     would alias into it, and requires the passband flat and the
+//     stopband down by REQUIRED_REJECTION_DB
+//   - times the kernel, in ns and host cycles per output sample, next to
+//     the multiplies per output that set its cost on the device
+// and exits non-zero if any of them fails.
+#include <stdio.h>
+#include <math.h>
+#include <chrono>
+#include <vector>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define BENCH_HAS_TSC 1
+#else
+#define BENCH_HAS_TSC 0
+#endif
+#include "../Dsp/decimator.h"
+
+static constexpr uint32_t INPUT_RATE = CaptureDecimator::INPUT_RATE;
+static constexpr double REQUIRED_REJECTION_DB = 60.0;
+static constexpr double MAX_PASSBAND_ERROR_DB = 0.05;
+static constexpr double TONE_AMPLITUDE = 16000.0;   // -6 dBFS
+
+// Budget per output sample; the device has 62500 ns at 16 kHz. The host
+// default leaves room for slow CI machines and still catches gross regressions.
+#ifndef BENCH_MAX_NS_PER_OUTPUT
+#define BENCH_MAX_NS_PER_OUTPUT 500
+#endif
+
+typedef std::chrono::steady_clock Clock;
+
+struct RatePlan {
+  uint32_t outputRate;
+  double passEdgeHz;   // band the stream keeps
+  const FirDecimator::Design* stages[2];
+};
+
+static const RatePlan PLANS[] = {
+  { 24000, 10000, { &DECIMATE_BY_2, nullptr } },
+  { 16000, 7000, { &DECIMATE_BY_3, nullptr } },
+  { 12000, 5000, { &DECIMATE_BY_2, &DECIMATE_BY_2 } },
+  { 8000, 3500, { &DECIMATE_BY_2, &DECIMATE_BY_3 } },
+};
+
+static uint32_t lcg(uint32_t& seed) {
+  seed = seed * 1664525 + 1013904223;
+  return seed >> 8;
+}
+
+static int16_t toSample(double x) {
+  x = x < 0 ? x - 0.5 : x + 0.5;
+  if (x > 32767) return 32767;
+  if (x < -32768) return -32768;
+  return (int16_t)x;
+}
+
+//----------------------------------------------------------------------
+// Bit-exactness
+//----------------------------------------------------------------------
+static bool checkBitExact(const RatePlan& plan) {
+  const size_t count = INPUT_RATE * 3;
+  std::vector<int16_t> input(count);
+  uint32_t seed = 12345;
+  for (size_t i = 0; i < count; i++) {
+    double t = (double)i / INPUT_RATE;
+    double x = 6000 * sin(2 * M_PI * 440 * t) + 4000 * sin(2 * M_PI * 15500 * t) +
+               (double)(lcg(seed) % 8001) - 4000;
+    // A clipped burst every second drives the makeup gain into saturation
+    if (i % INPUT_RATE < INPUT_RATE / 20) {
+      x *= 8;
+    }
+    input[i] = toSample(x);
+  }
+
+  // Reference: one stage at a time over the whole signal
+  std::vector<int16_t> expected(input);
+  size_t expectedCount = count;
+  for (const FirDecimator::Design* stage : plan.stages) {
+    if (stage != nullptr) {
+      std::vector<int16_t> next(expectedCount / stage->factor + 1);
+      expectedCount = firDecimateReference(*stage, expected.data(), expectedCount, next.data());
+      expected.swap(next);
+    }
+  }
+
+  // Kernel: in place, in blocks of random size
+  CaptureDecimator decimator;
+  decimator.begin(plan.outputRate, false);
+  std::vector<int16_t> buffer(input);
+  size_t produced = 0;
+  size_t taken = 0;
+  while (taken < count) {
+    size_t block = 1 + lcg(seed) % 1500;
+    if (block > count - taken) block = count - taken;
+    size_t n = decimator.process(buffer.data() + taken, block);
+    for (size_t i = 0; i < n; i++) {
+      buffer[produced + i] = buffer[taken + i];
+    }
+    produced += n;
+    taken += block;
+  }
+
+  size_t mismatches = 0;
+  for (size_t i = 0; i < produced && i < expectedCount; i++) {
+    mismatches += buffer[i] != expected[i];
+  }
+  bool ok = produced == expectedCount && mismatches == 0;
+  printf("  bit-exact: %u outputs, %u differ from the reference%s\n", (unsigned)produced,
+         (unsigned)mismatches, produced == expectedCount ? "" : " (count differs)");
+  return ok;
+}
+
+//----------------------------------------------------------------------
+// Frequency response
+//----------------------------------------------------------------------
+// Output level of a tone relative to its input level, in dB
+static double toneGainDb(uint32_t outputRate, double hz) {
+  static std::vector<int16_t> buffer;
+  const size_t count = INPUT_RATE / 4;
+  buffer.resize(count);
+  for (size_t i = 0; i < count; i++) {
+    buffer[i] = toSample(TONE_AMPLITUDE * sin(2 * M_PI * hz * i / INPUT_RATE));
+  }
+  CaptureDecimator decimator;
+  decimator.begin(outputRate, false);
+  size_t n = decimator.process(buffer.data(), count);
+  // Skip the filters' start-up
+  const size_t settle = 100;
+  double energy = 0;
+  for (size_t i = settle; i < n; i++) {
+    energy += (double)buffer[i] * buffer[i];
+  }
+  double rms = sqrt(energy / (n - settle));
+  double inputRms = TONE_AMPLITUDE / sqrt(2.0);
+  return 20 * log10((rms > 0 ? rms : 0.5) / inputRms);
+}
+
+static bool checkResponse(const RatePlan& plan) {
+  double passMin = 1e9;
+  double passMax = -1e9;
+  for (double hz = 100; hz <= plan.passEdgeHz; hz += 100) {
+    double gain = toneGainDb(plan.outputRate, hz);
+    if (gain < passMin) passMin = gain;
+    if (gain > passMax) passMax = gain;
+  }
+  // Everything from here to the input Nyquist lands inside the kept band
+  double stopStart = plan.outputRate - plan.passEdgeHz;
+  double worst = -1e9;
+  double worstHz = 0;
+  for (double hz = stopStart; hz < INPUT_RATE / 2; hz += 125) {
+    double gain = toneGainDb(plan.outputRate, hz);
+    if (gain > worst) {
+      worst = gain;
+      worstHz = hz;
+    }
+  }
+  bool passOk = passMax <= MAX_PASSBAND_ERROR_DB && passMin >= -MAX_PASSBAND_ERROR_DB;
+  bool stopOk = -worst >= REQUIRED_REJECTION_DB;
+  printf("  passband 0.1-%.1f kHz: %+.3f..%+.3f dB%s\n", plan.passEdgeHz / 1000, passMin, passMax,
+         passOk ? "" : "  FAIL");
+  printf("  stopband %.1f-24 kHz: rejected by %.1f dB at worst (%.0f Hz)%s\n", stopStart / 1000, -worst,
+         worstHz, stopOk ? "" : "  FAIL");
+  return passOk && stopOk;
+}
+
+//----------------------------------------------------------------------
+// Cost
+//----------------------------------------------------------------------
+static size_t multipliesPerOutput(const FirDecimator::Design& d) {
+  return d.halfBand ? d.tapCount / 4 + 1 : d.tapCount / 2;
+}
+
+static bool checkCost(const RatePlan& plan) {
+  const size_t block = 2400;  // 50 ms, a multiple of every factor
+  const size_t blocks = 2000;
+  std::vector<int16_t> source(block);
+  std::vector<int16_t> buffer(block);
+  uint32_t seed = 99;
+  for (size_t i = 0; i < block; i++) {
+    source[i] = (int16_t)(lcg(seed) & 0xffff);
+  }
+  CaptureDecimator decimator;
+  decimator.begin(plan.outputRate, false);
+
+  size_t outputs = 0;
+  int64_t checksum = 0;
+  Clock::time_point start = Clock::now();
+#if BENCH_HAS_TSC
+  uint64_t startCycles = __rdtsc();
+#endif
+  for (size_t b = 0; b < blocks; b++) {
+    buffer = source;
+    size_t n = decimator.process(buffer.data(), block);
+    outputs += n;
+    checksum += buffer[n - 1];
+  }
+#if BENCH_HAS_TSC
+  double cycles = (double)(__rdtsc() - startCycles) / outputs;
+#endif
+  double ns = std::chrono::duration<double, std::nano>(Clock::now() - start).count() / outputs;
+
+  size_t multiplies = multipliesPerOutput(*plan.stages[0]) * (plan.stages[1] != nullptr ? plan.stages[1]->factor : 1);
+  if (plan.stages[1] != nullptr) {
+    multiplies += multipliesPerOutput(*plan.stages[1]);
+  }
+  bool ok = ns <= BENCH_MAX_NS_PER_OUTPUT;
+#if BENCH_HAS_TSC
+  printf("  cost: %u multiplies, %.1f ns, %.0f host cycles per output sample%s (checksum %lld)\n",
+         (unsigned)multiplies, ns, cycles, ok ? "" : "  FAIL", (long long)checksum);
+#else
+  printf("  cost: %u multiplies, %.1f ns per output sample%s (checksum %lld)\n",
+         (unsigned)multiplies, ns, ok ? "" : "  FAIL", (long long)checksum);
+#endif
+  return ok;
+}
+
+int main() {
+  printf("48 kHz capture decimation; stopband must be down %.0f dB, passband within %.2f dB\n",
+         REQUIRED_REJECTION_DB, MAX_PASSBAND_ERROR_DB);
+  bool ok = true;
+  for (const RatePlan& plan : PLANS) {
+    printf("\n48 kHz -> %u Hz (/%u)\n", plan.outputRate, INPUT_RATE / plan.outputRate);
+    ok = checkBitExact(plan) && ok;
+    ok = checkResponse(plan) && ok;
+    ok = checkCost(plan) && ok;
+  }
+  printf("\n%s\n", ok ? "Decimator within spec" : "Decimator regression");
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,311 @@
+// Host checks and benchmark of the log-mel feature extractor (env:log_mel_bench).
+//
+//   pio run -e log_mel_bench -t exec
+//
+// It
+//   - feeds a stream with a gap in it to LogMelExtractor in random block
+//     sizes and requires every frame, and where it starts, to match
+//     computeFrame() on the same window
+//   - compares the fixed-point bytes with the double-precision reference
+//     (logMelReference) on speech-like bursts, noise, a sweep, a clipped
+//     tone and near-silence; bands within DYNAMIC_RANGE_DB of the frame's
+//     loudest must agree to within MAX_MEAN_ERROR steps on average and
+//     MAX_ERROR at worst
+//   - times one frame, in ns and host cycles
+//   - packs ten seconds of frames and reports the stream's byte rate, which
+//     must stay within MAX_WIRE_BYTES_PER_SECOND with packet headers
+// and exits non-zero if any of them fails.
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <chrono>
+#include <vector>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define BENCH_HAS_TSC 1
+#else
+#define BENCH_HAS_TSC 0
+#endif
+#include "../Dsp/log_mel.h"
+#include "../Hal/synthetic_source.h"
+#include "../Protocol/feature_packetizer.h"
+
+typedef LogMelExtractor LM;
+
+static constexpr uint32_t RATE = LM::SAMPLE_RATE;
+// Below this the 16-bit FFT's rounding noise, some 65 dB under a frame's
+// loudest band, takes over from the signal
+static constexpr double DYNAMIC_RANGE_DB = 40.0;
+static constexpr double MAX_MEAN_ERROR = 0.25;  // steps of DB_STEP
+static constexpr int MAX_ERROR = 2;
+// The frames alone are 80 bytes every 10 ms, 8000 B/s; the 16 bytes of
+// headers per packet add 800 B/s at the default 244-byte payload (two
+// frames a packet) and 267 B/s at 509 bytes (six)
+static constexpr double MAX_WIRE_BYTES_PER_SECOND = 8800;
+
+// Budget per frame; the device has 10 ms per hop on a core it shares with
+// capture. The host default leaves room for slow CI machines and still
+// catches gross regressions.
+#ifndef BENCH_MAX_NS_PER_FRAME
+#define BENCH_MAX_NS_PER_FRAME 100000
+#endif
+
+typedef std::chrono::steady_clock Clock;
+
+static uint32_t lcg(uint32_t& seed) {
+  seed = seed * 1664525 + 1013904223;
+  return seed >> 8;
+}
+
+static int16_t toSample(double x) {
+  x = x < 0 ? x - 0.5 : x + 0.5;
+  if (x > 32767) return 32767;
+  if (x < -32768) return -32768;
+  return (int16_t)x;
+}
+
+//----------------------------------------------------------------------
+// Signals
+//----------------------------------------------------------------------
+struct Signal {
+  const char* name;
+  std::vector<int16_t> (*make)(size_t count);
+};
+
+static std::vector<int16_t> speechLike(size_t count) {
+  std::vector<int16_t> out(count);
+  SyntheticSource source;
+  source.begin(SyntheticSource::Config());
+  source.record(out.data(), count, RATE);
+  return out;
+}
+
+static std::vector<int16_t> noise(size_t count) {
+  std::vector<int16_t> out(count);
+  uint32_t seed = 7;
+  for (size_t i = 0; i < count; i++) {
+    out[i] = (int16_t)((int32_t)(lcg(seed) % 6001) - 3000);
+  }
+  return out;
+}
+
+static std::vector<int16_t> sweep(size_t count) {
+  std::vector<int16_t> out(count);
+  double phase = 0;
+  for (size_t i = 0; i < count; i++) {
+    double hz = 100 + 7800.0 * i / count;
+    phase += 2 * M_PI * hz / RATE;
+    out[i] = toSample(20000 * sin(phase));
+  }
+  return out;
+}
+
+static std::vector<int16_t> clipped(size_t count) {
+  std::vector<int16_t> out(count);
+  for (size_t i = 0; i < count; i++) {
+    out[i] = toSample(60000 * sin(2 * M_PI * 440 * i / RATE));
+  }
+  return out;
+}
+
+static std::vector<int16_t> nearSilence(size_t count) {
+  std::vector<int16_t> out(count);
+  uint32_t seed = 11;
+  for (size_t i = 0; i < count; i++) {
+    out[i] = (int16_t)((int32_t)(lcg(seed) % 9) - 4);
+  }
+  return out;
+}
+
+static const Signal SIGNALS[] = {
+  { "speech-like bursts", speechLike },
+  { "noise, -21 dBFS", noise },
+  { "sweep 0.1-7.9 kHz", sweep },
+  { "clipped 440 Hz", clipped },
+  { "near-silence, +-4 LSB", nearSilence },
+};
+
+//----------------------------------------------------------------------
+// Framing
+//----------------------------------------------------------------------
+static bool checkFraming(LogMelExtractor& extractor) {
+  std::vector<int16_t> input = speechLike(RATE * 3);
+  const size_t gapAt = RATE + 1234;
+  const size_t gapLength = 777;
+
+  extractor.reset();
+  uint32_t seed = 3;
+  size_t position = 0;
+  size_t frames = 0;
+  size_t mismatches = 0;
+  uint32_t expectedStart = 0;
+  uint8_t frame[LM::MEL_BANDS];
+  uint8_t direct[LM::MEL_BANDS];
+  while (position < input.size()) {
+    if (position == gapAt) {
+      extractor.skip(gapLength);
+      position += gapLength;
+      // The first whole window after the gap, on the hop grid
+      expectedStart = (uint32_t)((position + LM::HOP_SAMPLES - 1) / LM::HOP_SAMPLES * LM::HOP_SAMPLES);
+    }
+    size_t block = 1 + lcg(seed) % 700;
+    size_t end = position + block;
+    if (position < gapAt && end > gapAt) end = gapAt;
+    if (end > input.size()) end = input.size();
+    while (position < end) {
+      position += extractor.append(input.data() + position, end - position);
+      while (extractor.frameReady()) {
+        uint32_t start = extractor.takeFrame(frame);
+        extractor.computeFrame(input.data() + start, direct);
+        bool same = start == expectedStart;
+        for (size_t b = 0; b < LM::MEL_BANDS; b++) {
+          same = same && frame[b] == direct[b];
+        }
+        mismatches += !same;
+        expectedStart = start + LM::HOP_SAMPLES;
+        frames++;
+      }
+    }
+  }
+  // Windows that fit before and after the gap
+  size_t before = (gapAt - LM::WINDOW_SAMPLES) / LM::HOP_SAMPLES + 1;
+  size_t resume = (gapAt + gapLength + LM::HOP_SAMPLES - 1) / LM::HOP_SAMPLES * LM::HOP_SAMPLES;
+  size_t after = (input.size() - resume - LM::WINDOW_SAMPLES) / LM::HOP_SAMPLES + 1;
+  bool ok = mismatches == 0 && frames == before + after;
+  printf("streaming: %u frames in random blocks across a %u-sample gap, %u differ%s\n", (unsigned)frames,
+         (unsigned)gapLength, (unsigned)mismatches, frames == before + after ? "" : " (count differs)");
+  return ok;
+}
+
+//----------------------------------------------------------------------
+// Accuracy
+//----------------------------------------------------------------------
+static bool checkAccuracy(LogMelExtractor& extractor, const Signal& signal) {
+  std::vector<int16_t> input = signal.make(RATE * 2);
+  uint8_t fixed[LM::MEL_BANDS];
+  uint8_t reference[LM::MEL_BANDS];
+  double db[LM::MEL_BANDS];
+  size_t compared = 0;
+  double errorSum = 0;
+  int worst = 0;
+  size_t allBands = 0;
+  double allErrorSum = 0;
+  for (size_t start = 0; start + LM::WINDOW_SAMPLES <= input.size(); start += LM::HOP_SAMPLES * 3) {
+    extractor.computeFrame(input.data() + start, fixed);
+    logMelReference(input.data() + start, reference, db);
+    double loudest = -HUGE_VAL;
+    for (size_t b = 0; b < LM::MEL_BANDS; b++) {
+      if (db[b] > loudest) loudest = db[b];
+    }
+    for (size_t b = 0; b < LM::MEL_BANDS; b++) {
+      int error = abs((int)fixed[b] - (int)reference[b]);
+      allErrorSum += error;
+      allBands++;
+      if (db[b] >= loudest - DYNAMIC_RANGE_DB) {
+        errorSum += error;
+        compared++;
+        if (error > worst) worst = error;
+      }
+    }
+  }
+  double mean = compared > 0 ? errorSum / compared : 0;
+  bool ok = mean <= MAX_MEAN_ERROR && worst <= MAX_ERROR;
+  printf("  %-24s mean %.3f, worst %d steps over %u bands in range; mean %.3f over all%s\n", signal.name,
+         mean, worst, (unsigned)compared, allBands > 0 ? allErrorSum / allBands : 0.0, ok ? "" : "  FAIL");
+  return ok;
+}
+
+//----------------------------------------------------------------------
+// Cost
+//----------------------------------------------------------------------
+static bool checkCost(LogMelExtractor& extractor) {
+  std::vector<int16_t> input = speechLike(RATE * 2);
+  const size_t frames = 20000;
+  const size_t positions = (input.size() - LM::WINDOW_SAMPLES) / LM::HOP_SAMPLES;
+  uint8_t out[LM::MEL_BANDS];
+  uint32_t checksum = 0;
+  Clock::time_point start = Clock::now();
+#if BENCH_HAS_TSC
+  uint64_t startCycles = __rdtsc();
+#endif
+  for (size_t f = 0; f < frames; f++) {
+    extractor.computeFrame(input.data() + (f % positions) * LM::HOP_SAMPLES, out);
+    checksum += out[f % LM::MEL_BANDS];
+  }
+#if BENCH_HAS_TSC
+  double cycles = (double)(__rdtsc() - startCycles) / frames;
+#endif
+  double ns = std::chrono::duration<double, std::nano>(Clock::now() - start).count() / frames;
+  bool ok = ns <= BENCH_MAX_NS_PER_FRAME;
+#if BENCH_HAS_TSC
+  printf("cost: %.0f ns, %.0f host cycles per frame, %.2f%% of a hop%s (checksum %u)\n", ns, cycles,
+         ns / (1e7 / RATE * LM::HOP_SAMPLES), ok ? "" : "  FAIL", (unsigned)checksum);
+#else
+  printf("cost: %.0f ns per frame, %.2f%% of a hop%s (checksum %u)\n", ns,
+         ns / (1e7 / RATE * LM::HOP_SAMPLES), ok ? "" : "  FAIL", (unsigned)checksum);
+#endif
+  return ok;
+}
+
+//----------------------------------------------------------------------
+// Byte rate
+//----------------------------------------------------------------------
+static bool checkRate(LogMelExtractor& extractor, size_t maxPacketBytes) {
+  std::vector<int16_t> input = speechLike(RATE * 10);
+  FeaturePacketizer packetizer;
+  packetizer.begin(maxPacketBytes, RATE, LM::MEL_BANDS, LM::HOP_SAMPLES, LM::WINDOW_MS);
+  extractor.reset();
+  uint8_t frame[LM::MEL_BANDS];
+  uint8_t packet[FEATURE_PACKETIZER_MAX_BYTES];
+  size_t frameBytes = 0;
+  size_t wireBytes = 0;
+  size_t packets = 0;
+  size_t position = 0;
+  while (position < input.size()) {
+    position += extractor.append(input.data() + position, input.size() - position);
+    while (extractor.frameReady()) {
+      uint32_t start = extractor.takeFrame(frame);
+      frameBytes += LM::MEL_BANDS;
+      while (!packetizer.append(frame, start)) {
+        wireBytes += packetizer.nextPacket(packet);
+        packets++;
+      }
+    }
+  }
+  packetizer.flush();
+  while (packetizer.hasPacket()) {
+    wireBytes += packetizer.nextPacket(packet);
+    packets++;
+  }
+  double seconds = (double)input.size() / RATE;
+  double frameRate = frameBytes / seconds;
+  double wireRate = wireBytes / seconds;
+  bool ok = wireRate <= MAX_WIRE_BYTES_PER_SECOND;
+  printf("  %3u-byte packets: %u frames per packet, %.0f B/s of frames, %.0f B/s with headers "
+         "(PCM16 %.0f B/s)%s\n",
+         (unsigned)maxPacketBytes, (unsigned)packetizer.framesPerPacket(), frameRate, wireRate,
+         RATE * 2.0, ok ? "" : "  FAIL");
+  return ok;
+}
+
+int main() {
+  LogMelExtractor extractor;
+  if (!extractor.begin(false)) {
+    printf("Extractor did not start\n");
+    return 1;
+  }
+  printf("%u mel bands, %u ms window, %u ms hop, %.1f dB steps from %.0f dB\n", (unsigned)LM::MEL_BANDS,
+         (unsigned)LM::WINDOW_MS, (unsigned)(LM::HOP_SAMPLES * 1000 / RATE), LM::DB_STEP, LM::DB_FLOOR);
+  bool ok = checkFraming(extractor);
+  printf("accuracy against the double-precision reference, bands within %.0f dB of the frame's loudest:\n",
+         DYNAMIC_RANGE_DB);
+  for (const Signal& signal : SIGNALS) {
+    ok = checkAccuracy(extractor, signal) && ok;
+  }
+  ok = checkCost(extractor) && ok;
+  printf("byte rate:\n");
+  ok = checkRate(extractor, 244) && ok;
+  ok = checkRate(extractor, 509) && ok;
+  printf("\n%s\n", ok ? "Log-mel features within spec" : "Log-mel regression");
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,344 @@
+// Host checks and benchmark of the lossless codec (env:lossless_bench).
+//
+//   pio run -e lossless_bench -t exec               built-in signals
+//   .pio/build/lossless_bench/program speech.wav    a 16-bit WAV file as well
+//
+// First random blocks straight through losslessEncodeBlock(): lengths from
+// 1 sample to LOSSLESS_MAX_BLOCK_SAMPLES, noise at every level, full-scale
+// extremes, constants, ramps and tones. Each must decode to exactly its
+// input and never grow past the verbatim size; longer blocks, truncated and
+// corrupted ones must be refused or decode within capacity. Then signals the way the firmware
+// sends them: AudioPacketizer packs 2500-sample captures into 509-byte
+// packets, and every packet is parsed and decoded on its own. The decoded
+// stream must equal the input bit for bit; the bench reports the
+// compression ratio and the slowest capture's encode time (the best of a
+// few runs, so host preemption does not count) against the capture's own
+// duration, the deadline recordTask has to meet. It exits
+// non-zero if any check fails.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <algorithm>
+#include <chrono>
+#include <vector>
+#include "../Codec/lossless.h"
+#include "../Hal/synthetic_source.h"
+#include "../Hal/wav_source.h"
+#include "../Pipeline/pipeline_config.h"
+#include "../Protocol/packetizer.h"
+
+// Same shape as the firmware's live path
+static constexpr uint32_t SAMPLE_RATE = 16000;
+typedef PipelineConfig<SAMPLE_RATE, 2500, 5, 512, 200, 400> LivePipeline;
+static constexpr size_t CHUNK_SAMPLES = LivePipeline::CHUNK_SAMPLES;
+static constexpr size_t MAX_PACKET_BYTES = LivePipeline::MAX_PACKET_BYTES;
+
+// Host budget for the slowest capture, each capture timed at the best of
+// TIMING_RUNS. The device has the capture's duration (156 ms) for everything
+// recordTask does and runs the encoder some 20-40 times slower; the default
+// keeps the host figure far enough below that to notice a regression.
+// Raise it on slow machines.
+#ifndef BENCH_MAX_CHUNK_US
+#define BENCH_MAX_CHUNK_US 3000
+#endif
+static constexpr size_t TIMING_RUNS = 5;
+
+typedef std::chrono::steady_clock Clock;
+
+static bool failed = false;
+
+static void check(bool condition, const char* what) {
+  if (!condition) {
+    printf("  FAIL: %s\n", what);
+    failed = true;
+  }
+}
+
+static uint32_t lcg(uint32_t& seed) {
+  seed = seed * 1664525 + 1013904223;
+  return seed >> 8;
+}
+
+static int16_t toSample(double x) {
+  x = x < 0 ? x - 0.5 : x + 0.5;
+  if (x > 32767) return 32767;
+  if (x < -32768) return -32768;
+  return (int16_t)x;
+}
+
+//----------------------------------------------------------------------
+// Random blocks
+//----------------------------------------------------------------------
+enum BlockKind { NOISE, EXTREMES, CONSTANT, RAMP, TONE, SPARSE, BLOCK_KINDS };
+static const char* const BLOCK_KIND_NAMES[BLOCK_KINDS] = {
+  "noise", "extremes", "constant", "ramp", "tone", "sparse",
+};
+
+static void fillBlock(BlockKind kind, int16_t* x, size_t count, uint32_t& seed) {
+  int32_t level = 1 << (lcg(seed) % 16);  // 1..32768
+  switch (kind) {
+    case NOISE:
+      for (size_t i = 0; i < count; i++) x[i] = toSample((double)(lcg(seed) % (2 * level + 1)) - level);
+      break;
+    case EXTREMES:
+      // Largest residuals the predictors can see
+      for (size_t i = 0; i < count; i++) x[i] = lcg(seed) & 1 ? 32767 : -32768;
+      break;
+    case CONSTANT: {
+      int16_t v = (int16_t)lcg(seed);
+      for (size_t i = 0; i < count; i++) x[i] = v;
+      break;
+    }
+    case RAMP: {
+      int32_t v = (int16_t)lcg(seed);
+      int32_t step = (int32_t)(lcg(seed) % 64) - 32;
+      for (size_t i = 0; i < count; i++, v += step) x[i] = (int16_t)v;  // wraps at full scale
+      break;
+    }
+    case TONE: {
+      double hz = 50 + lcg(seed) % 7900;
+      for (size_t i = 0; i < count; i++) x[i] = toSample(level * sin(2 * M_PI * hz * i / SAMPLE_RATE));
+      break;
+    }
+    default:
+      for (size_t i = 0; i < count; i++) x[i] = lcg(seed) % 50 == 0 ? (int16_t)lcg(seed) : 0;
+      break;
+  }
+}
+
+static void checkBlocks() {
+  printf("Random blocks\n");
+  const size_t maxCount = LOSSLESS_MAX_BLOCK_SAMPLES;
+  std::vector<int16_t> input(maxCount + 1);
+  std::vector<int16_t> output(maxCount + 1);
+  std::vector<uint8_t> block(losslessMaxBlockBytes(maxCount + 1));
+  uint32_t seed = 11;
+  size_t blocks = 0;
+  size_t mismatches = 0;
+  size_t oversized = 0;
+  size_t kindMismatches[BLOCK_KINDS] = {};
+
+  // Short blocks exhaustively, then random lengths, then the longest
+  std::vector<size_t> lengths;
+  for (size_t n = 1; n <= 64; n++) lengths.push_back(n);
+  for (int i = 0; i < 400; i++) lengths.push_back(1 + lcg(seed) % LOSSLESS_MAX_PACKET_SAMPLES);
+  for (int i = 0; i < 20; i++) lengths.push_back(1 + lcg(seed) % maxCount);
+  lengths.push_back(maxCount);
+
+  for (size_t count : lengths) {
+    for (int kind = 0; kind < BLOCK_KINDS; kind++) {
+      fillBlock((BlockKind)kind, input.data(), count, seed);
+      size_t bytes = losslessEncodeBlock(input.data(), count, block.data(), block.size());
+      size_t decoded = losslessDecodeBlock(block.data(), bytes, output.data(), count);
+      bool same = bytes > 0 && decoded == count && memcmp(input.data(), output.data(), count * sizeof(int16_t)) == 0;
+      mismatches += !same;
+      kindMismatches[kind] += !same;
+      oversized += bytes > losslessMaxBlockBytes(count);
+      blocks++;
+    }
+  }
+  printf("  %u blocks of 1-%u samples, %u differ after the round trip, %u larger than verbatim\n",
+         (unsigned)blocks, (unsigned)maxCount, (unsigned)mismatches, (unsigned)oversized);
+  for (int kind = 0; kind < BLOCK_KINDS; kind++) {
+    if (kindMismatches[kind] > 0) {
+      printf("  %s: %u differ\n", BLOCK_KIND_NAMES[kind], (unsigned)kindMismatches[kind]);
+    }
+  }
+  check(mismatches == 0, "decode(encode(x)) != x");
+  check(oversized == 0, "a block grew past the verbatim size");
+
+  // Capacity and truncation
+  check(losslessEncodeBlock(input.data(), maxCount + 1, block.data(), block.size()) == 0,
+        "encodes a block too long for its size field");
+  fillBlock(TONE, input.data(), 500, seed);
+  size_t bytes = losslessEncodeBlock(input.data(), 500, block.data(), block.size());
+  check(losslessEncodeBlock(input.data(), 500, block.data(), losslessMaxBlockBytes(500) - 1) == 0,
+        "encodes into less than the verbatim size");
+  check(losslessDecodeBlock(block.data(), bytes, output.data(), 499) == 0, "decodes past the output capacity");
+  check(losslessDecodeBlock(block.data(), bytes - 1, output.data(), 500) == 0, "decodes a truncated block");
+  check(losslessBlockBytes(block.data(), LOSSLESS_HEADER_BYTES - 1) == 0, "sizes a truncated header");
+
+  // Corrupted blocks: refused, or decoded within capacity
+  size_t overruns = 0;
+  for (int i = 0; i < 20000; i++) {
+    std::vector<uint8_t> corrupt(block.begin(), block.begin() + bytes);
+    for (int flips = 1 + lcg(seed) % 4; flips > 0; flips--) {
+      corrupt[lcg(seed) % bytes] ^= (uint8_t)(1 << (lcg(seed) % 8));
+    }
+    output[500] = 0x5A5A;
+    size_t n = losslessDecodeBlock(corrupt.data(), corrupt.size(), output.data(), 500);
+    overruns += n > 500 || output[500] != 0x5A5A;
+  }
+  check(overruns == 0, "a corrupted block decoded past the output capacity");
+}
+
+//----------------------------------------------------------------------
+// Signals through the packetizer
+//----------------------------------------------------------------------
+struct Signal {
+  const char* name;
+  std::vector<int16_t> samples;
+  uint32_t sampleRate;
+};
+
+static Signal speechLike() {
+  Signal s = { "Synthetic speech-like bursts", std::vector<int16_t>(SAMPLE_RATE * 60), SAMPLE_RATE };
+  SyntheticSource source;
+  source.begin(SyntheticSource::Config());
+  source.record(s.samples.data(), s.samples.size(), SAMPLE_RATE);
+  return s;
+}
+
+// Full-scale white noise: nothing compresses, every block falls back to verbatim
+static Signal noise() {
+  Signal s = { "Full-scale white noise", std::vector<int16_t>(SAMPLE_RATE * 20), SAMPLE_RATE };
+  uint32_t seed = 3;
+  for (int16_t& x : s.samples) {
+    x = (int16_t)lcg(seed);
+  }
+  return s;
+}
+
+// Near-silence, the best case
+static Signal quiet() {
+  Signal s = { "Room tone, -60 dBFS", std::vector<int16_t>(SAMPLE_RATE * 20), SAMPLE_RATE };
+  uint32_t seed = 4;
+  for (int16_t& x : s.samples) {
+    x = toSample(((double)(lcg(seed) % 101) - 50) * 0.65);
+  }
+  return s;
+}
+
+static bool loadWav(const char* path, Signal& s) {
+  WavFileSource wav;
+  if (!wav.open(path) || wav.frames() == 0) {
+    return false;
+  }
+  s.name = path;
+  s.samples.resize(wav.frames());
+  s.sampleRate = wav.sampleRate();
+  return wav.record(s.samples.data(), s.samples.size(), wav.sampleRate());
+}
+
+// Parses and decodes one packet, appending its samples to decoded
+static bool decodePacket(const uint8_t* packet, size_t length, uint32_t& nextSample, std::vector<int16_t>& decoded) {
+  static int16_t samples[LOSSLESS_MAX_PACKET_SAMPLES];
+  PacketHeader header;
+  if (!packetParseHeader(packet, length, header) || header.format != PACKET_FORMAT_LOSSLESS ||
+      header.firstSample != nextSample) {
+    return false;
+  }
+  size_t n = losslessDecodeBlock(packet + PACKET_HEADER_BYTES, header.payloadBytes, samples, LOSSLESS_MAX_PACKET_SAMPLES);
+  if (n == 0) {
+    return false;
+  }
+  decoded.insert(decoded.end(), samples, samples + n);
+  nextSample += (uint32_t)n;
+  return true;
+}
+
+static bool runSignal(const Signal& s) {
+  printf("\n%s: %.1f s\n", s.name, (double)s.samples.size() / s.sampleRate);
+  AudioPacketizer packetizer;
+  uint8_t sampleRateCode;
+  uint32_t headerRate = packetSampleRateCode(s.sampleRate, sampleRateCode) ? s.sampleRate : SAMPLE_RATE;
+  packetizer.begin(PACKET_FORMAT_LOSSLESS, MAX_PACKET_BYTES, true, headerRate);
+
+  std::vector<int16_t> decoded;
+  decoded.reserve(s.samples.size());
+  uint8_t packet[MAX_PACKET_BYTES];
+  size_t packets = 0;
+  size_t payloadBytes = 0;
+  size_t packetBytes = 0;
+  bool decodes = true;
+  uint32_t nextSample = 0;
+  double worstUs = 0;     // slowest capture, each timed at its fastest run
+  double rawWorstUs = 0;  // slowest single run, for information
+  static AudioPacketizer saved;
+  double totalUs = 0;
+  size_t captures = 0;
+
+  // Encoding is timed per capture, decoding is not
+  std::vector<std::vector<uint8_t>> built;
+  for (size_t start = 0; start < s.samples.size(); start += CHUNK_SAMPLES) {
+    size_t count = std::min(CHUNK_SAMPLES, s.samples.size() - start);
+    const int16_t* chunk = s.samples.data() + start;
+    bool last = start + count == s.samples.size();
+    built.clear();
+
+    // Each capture is encoded TIMING_RUNS times from the same state and the
+    // fastest run counts, so a preemption on the host cannot fail the gate
+    saved = packetizer;
+    double bestUs = 0;
+    for (size_t run = 0; run < TIMING_RUNS; run++) {
+      if (run > 0) {
+        packetizer = saved;
+        built.clear();
+      }
+      Clock::time_point begin = Clock::now();
+      for (size_t taken = 0; taken < count;) {
+        taken += packetizer.append(chunk + taken, count - taken);
+        if (last && taken == count) {
+          packetizer.flush();
+        }
+        while (packetizer.hasPacket()) {
+          size_t length = packetizer.nextPacket(packet);
+          built.emplace_back(packet, packet + length);
+        }
+      }
+      double us = std::chrono::duration<double, std::micro>(Clock::now() - begin).count();
+      rawWorstUs = std::max(rawWorstUs, us);
+      bestUs = run == 0 ? us : std::min(bestUs, us);
+    }
+    worstUs = std::max(worstUs, bestUs);
+    totalUs += bestUs;
+    captures++;
+
+    for (const std::vector<uint8_t>& p : built) {
+      decodes = decodePacket(p.data(), p.size(), nextSample, decoded) && decodes;
+      packets++;
+      packetBytes += p.size();
+      payloadBytes += p.size() - PACKET_HEADER_BYTES;
+    }
+  }
+
+  bool exact = decodes && decoded.size() == s.samples.size() &&
+               memcmp(decoded.data(), s.samples.data(), decoded.size() * sizeof(int16_t)) == 0;
+  double pcmBytes = s.samples.size() * sizeof(int16_t);
+  double chunkUs = CHUNK_SAMPLES * 1e6 / s.sampleRate;
+  bool timeOk = worstUs <= BENCH_MAX_CHUNK_US;
+  printf("  %u packets, %s\n", (unsigned)packets,
+         exact ? "decoded bit for bit" : "decoded stream differs from the input  FAIL");
+  printf("  compression %.2f:1 (payload), %.2f:1 with headers, %.1f KB/s\n", pcmBytes / payloadBytes,
+         pcmBytes / packetBytes, packetBytes * (double)s.sampleRate / s.samples.size() / 1024);
+  printf("  encode per %u-sample capture, best of %u: %.0f us mean, %.0f us worst, %.2f%% of its %.0f ms%s\n",
+         (unsigned)CHUNK_SAMPLES, (unsigned)TIMING_RUNS, totalUs / captures, worstUs, 100 * worstUs / chunkUs,
+         chunkUs / 1000, timeOk ? "" : "  FAIL");
+  printf("  slowest single run %.0f us (not checked: includes host preemption)\n", rawWorstUs);
+  return exact && timeOk;
+}
+
+int main(int argc, char** argv) {
+  std::vector<Signal> signals;
+  signals.push_back(speechLike());
+  signals.push_back(quiet());
+  signals.push_back(noise());
+  for (int i = 1; i < argc; i++) {
+    Signal s;
+    if (!loadWav(argv[i], s)) {
+      printf("%s: not a 16-bit WAV file\n", argv[i]);
+      return 2;
+    }
+    signals.push_back(s);
+  }
+
+  printf("Lossless blocks in %u-byte packets\n\n", (unsigned)MAX_PACKET_BYTES);
+  checkBlocks();
+  bool ok = !failed;
+  for (const Signal& s : signals) {
+    ok = runSignal(s) && ok;
+  }
+  printf("\n%s\n", ok ? "Lossless codec within spec" : "Lossless codec regression");
+  return ok ? 0 : 1;
+}
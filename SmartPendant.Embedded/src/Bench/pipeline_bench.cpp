@@ -0,0 +1,381 @@
+// Host benchmark of the capture -> buffer -> send path (env:native).
+//
+//   pio run -e native -t exec                    synthetic signal
+//   .pio/build/native/program speech.wav -s 120  a 16 kHz WAV file, 120 s
+//
+// Runs the same modules as recordTask and sendTask (front-end, VAD,
+// packetizer, slot ring) for every codec, with a synthetic or WAV source
+// and a loopback transport in place of the mic and the link (BLE
+// notifications, or the SPP byte stream read back in arbitrary pieces). Reports throughput,
+// per-chunk latency percentiles of each stage and heap allocations per
+// second, and exits non-zero when a configuration misses its budget, so a
+// performance regression fails the run.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+#include <new>
+#include <vector>
+#include "../Hal/synthetic_source.h"
+#include "../Hal/wav_source.h"
+#include "../Hal/loopback_transport.h"
+#include "../Dsp/frontend.h"
+#include "../Dsp/level_meter.h"
+#include "../Dsp/vad.h"
+#include "../Pipeline/pipeline_config.h"
+#include "../Pipeline/slot_ring.h"
+#include "../Protocol/packetizer.h"
+
+// Same shape as the firmware's pipeline
+static constexpr uint32_t SAMPLE_RATE = 16000;
+static constexpr size_t CHUNK_SAMPLES = 2500;
+typedef PipelineConfig<SAMPLE_RATE, CHUNK_SAMPLES, 5, 512, 200, 400> LivePipeline;
+static constexpr size_t MAX_PACKET_BYTES = LivePipeline::MAX_PACKET_BYTES;
+static constexpr size_t RING_SLOTS = LivePipeline::RING_SLOTS;
+static constexpr size_t VAD_FRAME_SAMPLES = CHUNK_SAMPLES / 10;
+static constexpr float HIGH_PASS_HZ = 80.0f;
+
+// Protocol headers each link adds around the packets, radio framing aside.
+// A notification carries ATT (3) and L2CAP (4) headers; SPP carries the
+// byte stream in RFCOMM frames of up to SPP_FRAME_BYTES with L2CAP (4) and
+// RFCOMM (5) headers.
+static constexpr size_t BLE_NOTIFY_OVERHEAD_BYTES = 7;
+static constexpr size_t SPP_FRAME_BYTES = 990;
+static constexpr size_t SPP_FRAME_OVERHEAD_BYTES = 9;
+// BluetoothClassicService in the app reads the stream 1024 bytes at a time
+static constexpr size_t SPP_APP_READ_BYTES = 1024;
+
+// Budgets. The device has 62500 ns per sample at 16 kHz; the host default
+// leaves room for slow CI machines and still catches gross regressions.
+#ifndef BENCH_MAX_NS_PER_SAMPLE
+#define BENCH_MAX_NS_PER_SAMPLE 1000
+#endif
+#ifndef BENCH_MAX_ALLOCATIONS_PER_SECOND
+#define BENCH_MAX_ALLOCATIONS_PER_SECOND 0
+#endif
+
+//----------------------------------------------------------------------
+// Heap accounting: every C++ allocation goes through here
+//----------------------------------------------------------------------
+static uint64_t allocationCount = 0;
+
+void* operator new(size_t bytes) {
+  allocationCount++;
+  void* p = malloc(bytes > 0 ? bytes : 1);
+  if (p == nullptr) {
+    throw std::bad_alloc();
+  }
+  return p;
+}
+
+void* operator new[](size_t bytes) {
+  return operator new(bytes);
+}
+
+void operator delete(void* p) noexcept {
+  free(p);
+}
+
+void operator delete[](void* p) noexcept {
+  free(p);
+}
+
+void operator delete(void* p, size_t) noexcept {
+  free(p);
+}
+
+void operator delete[](void* p, size_t) noexcept {
+  free(p);
+}
+
+//----------------------------------------------------------------------
+// Stage timing
+//----------------------------------------------------------------------
+typedef std::chrono::steady_clock Clock;
+
+enum Stage {
+  STAGE_CAPTURE = 0,
+  STAGE_DSP,
+  STAGE_ENCODE,
+  STAGE_SEND,
+  STAGE_COUNT
+};
+static const char* const STAGE_NAMES[STAGE_COUNT] = { "capture", "dsp", "encode", "send" };
+
+// Per-chunk durations of one stage, in ns
+class StageTimes {
+public:
+  void reserve(size_t chunks) { _ns.reserve(chunks); }
+  void add(uint64_t ns) { _ns.push_back(ns); _total += ns; }
+  uint64_t total() const { return _total; }
+
+  // Sorts in place; call once measuring is over
+  uint64_t percentile(double p) {
+    if (_ns.empty()) {
+      return 0;
+    }
+    if (!_sorted) {
+      std::sort(_ns.begin(), _ns.end());
+      _sorted = true;
+    }
+    size_t index = (size_t)(p / 100.0 * (_ns.size() - 1) + 0.5);
+    return _ns[index];
+  }
+
+private:
+  std::vector<uint64_t> _ns;
+  uint64_t _total = 0;
+  bool _sorted = false;
+};
+
+struct BenchConfig {
+  const char* name;
+  PacketFormat format;
+  bool inPlace;  // PCM captured straight into ring slots
+  bool vad;
+  size_t streamReads;  // SPP: receiver reads of this many bytes; 0 for BLE notifications
+};
+
+static const BenchConfig CONFIGS[] = {
+  { "pcm in place", PACKET_FORMAT_PCM16, true, false, 0 },
+  { "pcm + vad", PACKET_FORMAT_PCM16, false, true, 0 },
+  { "adpcm", PACKET_FORMAT_ADPCM, false, false, 0 },
+  { "lossless", PACKET_FORMAT_LOSSLESS, false, false, 0 },
+  { "mu-law", PACKET_FORMAT_MULAW, false, false, 0 },
+  { "pcm over spp", PACKET_FORMAT_PCM16, true, false, SPP_APP_READ_BYTES },
+  { "adpcm over spp", PACKET_FORMAT_ADPCM, false, false, 100 },
+};
+
+struct Pipeline {
+  AudioFrontEnd frontEnd;
+  LevelMeter levelMeter;
+  VoiceActivityDetector vad;
+  AudioPacketizer packetizer;
+  SlotRing ring;
+  LoopbackTransport transport;
+  uint8_t scratch[MAX_PACKET_BYTES];
+  uint32_t dropped = 0;
+};
+
+static uint64_t elapsedNs(Clock::time_point start) {
+  return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start).count();
+}
+
+// Moves every ready packet into the ring, like drainPackets() on the device
+static void drainPackets(Pipeline& p) {
+  while (p.packetizer.hasPacket()) {
+    uint8_t* slot = p.ring.reserve();
+    size_t bytes = p.packetizer.nextPacket(slot != nullptr ? slot : p.scratch);
+    if (slot != nullptr) {
+      p.ring.commit(bytes, 0);
+    } else {
+      p.packetizer.packetDropped();
+      p.dropped++;
+    }
+  }
+}
+
+static void packetize(Pipeline& p, const int16_t* samples, size_t count) {
+  size_t taken = 0;
+  while (taken < count) {
+    taken += p.packetizer.append(samples + taken, count - taken);
+    drainPackets(p);
+  }
+}
+
+// Sends everything in the ring, like sendTask with an unlimited window
+static void sendAll(Pipeline& p) {
+  size_t length;
+  uint32_t tag;
+  uint8_t* packet;
+  uint16_t sequence = (uint16_t)p.transport.packets();
+  while ((packet = p.ring.peek(length, tag)) != nullptr) {
+    packetSetSequence(packet, sequence++);
+    p.transport.send(0, packet, length);
+    p.ring.release();
+  }
+}
+
+// Runs one configuration; false if it missed a budget
+static bool runConfig(const BenchConfig& config, AudioSource& source, double seconds) {
+  static Pipeline p;
+  static int16_t chunk[CHUNK_SAMPLES];
+  static uint8_t ringStorage[SlotRing::storageBytes(MAX_PACKET_BYTES, RING_SLOTS)];
+
+  if (!p.frontEnd.begin(SAMPLE_RATE, HIGH_PASS_HZ, Agc::Config()) ||
+      !p.levelMeter.begin(SAMPLE_RATE / 20) ||
+      !p.vad.begin(SAMPLE_RATE, VAD_FRAME_SAMPLES, 1) ||
+      !p.packetizer.begin(config.format, MAX_PACKET_BYTES, true) ||
+      !p.ring.begin(ringStorage, MAX_PACKET_BYTES, RING_SLOTS)) {
+    printf("%-14s setup failed\n", config.name);
+    return false;
+  }
+  p.transport.begin(true);
+  p.transport.setStreamReads(config.streamReads);
+  p.dropped = 0;
+
+  size_t chunks = (size_t)(seconds * SAMPLE_RATE / CHUNK_SAMPLES);
+  StageTimes times[STAGE_COUNT];
+  for (size_t i = 0; i < STAGE_COUNT; i++) {
+    times[i].reserve(chunks);
+  }
+  uint64_t captured = 0;
+  uint64_t allocationsBefore = 0;
+  Clock::time_point runStart = Clock::now();
+
+  for (size_t c = 0; c < chunks; c++) {
+    if (c == 1) {
+      // The first chunk may warm up lazily initialized state
+      allocationsBefore = allocationCount;
+    }
+    uint64_t ns[STAGE_COUNT] = {};
+
+    if (config.inPlace) {
+      // One capture per packet, straight into its ring slot
+      size_t done = 0;
+      while (done < CHUNK_SAMPLES) {
+        size_t count = std::min(p.packetizer.samplesPerPacket(), CHUNK_SAMPLES - done);
+        Clock::time_point t = Clock::now();
+        uint8_t* slot = p.ring.reserve();
+        int16_t* samples = (int16_t*)(slot != nullptr ? slot + p.packetizer.headerBytes() : p.scratch);
+        source.record(samples, count, SAMPLE_RATE);
+        ns[STAGE_CAPTURE] += elapsedNs(t);
+
+        t = Clock::now();
+        p.frontEnd.process(samples, count);
+        p.levelMeter.process(samples, count);
+        ns[STAGE_DSP] += elapsedNs(t);
+
+        t = Clock::now();
+        if (slot != nullptr) {
+          p.ring.commit(p.packetizer.packInPlace(slot, count), 0);
+        } else {
+          p.packetizer.skip(count);
+          p.dropped++;
+        }
+        ns[STAGE_ENCODE] += elapsedNs(t);
+        done += count;
+      }
+    } else {
+      Clock::time_point t = Clock::now();
+      source.record(chunk, CHUNK_SAMPLES, SAMPLE_RATE);
+      ns[STAGE_CAPTURE] = elapsedNs(t);
+
+      t = Clock::now();
+      p.frontEnd.process(chunk, CHUNK_SAMPLES);
+      p.levelMeter.process(chunk, CHUNK_SAMPLES);
+      ns[STAGE_DSP] = elapsedNs(t);
+
+      t = Clock::now();
+      if (config.vad) {
+        for (size_t offset = 0; offset < CHUNK_SAMPLES; offset += VAD_FRAME_SAMPLES) {
+          size_t frame = std::min(VAD_FRAME_SAMPLES, CHUNK_SAMPLES - offset);
+          if (p.vad.process(chunk + offset, frame)) {
+            packetize(p, chunk + offset, frame);
+          } else {
+            p.packetizer.appendSilence(frame);
+            drainPackets(p);
+          }
+        }
+      } else {
+        packetize(p, chunk, CHUNK_SAMPLES);
+      }
+      ns[STAGE_ENCODE] = elapsedNs(t);
+    }
+    captured += CHUNK_SAMPLES;
+
+    Clock::time_point t = Clock::now();
+    sendAll(p);
+    ns[STAGE_SEND] = elapsedNs(t);
+
+    for (size_t i = 0; i < STAGE_COUNT; i++) {
+      times[i].add(ns[i]);
+    }
+  }
+
+  double wallSeconds = elapsedNs(runStart) / 1e9;
+  uint64_t busyNs = 0;
+  for (size_t i = 0; i < STAGE_COUNT; i++) {
+    busyNs += times[i].total();
+  }
+  double nsPerSample = captured > 0 ? (double)busyNs / captured : 0;
+  double audioSeconds = (double)captured / SAMPLE_RATE;
+  // Allocations per second of audio, past the first chunk
+  double allocationsPerSecond = chunks > 1 ? (allocationCount - allocationsBefore) / audioSeconds : 0;
+  const PacketLossTracker& tracker = p.transport.tracker();
+
+  printf("%-14s %7.1f ns/sample  %6.0fx real time  %6.1f MB/s in  %6.1f KB/s out  %.2f allocs/s\n",
+         config.name, nsPerSample, nsPerSample > 0 ? 1e9 / SAMPLE_RATE / nsPerSample : 0,
+         captured * 2 / wallSeconds / 1e6, p.transport.bytes() / audioSeconds / 1000,
+         allocationsPerSecond);
+  uint64_t payloadBytes = p.transport.bytes();
+  uint64_t linkBytes = config.streamReads > 0
+      ? payloadBytes + (payloadBytes + SPP_FRAME_BYTES - 1) / SPP_FRAME_BYTES * SPP_FRAME_OVERHEAD_BYTES
+      : payloadBytes + (uint64_t)p.transport.packets() * BLE_NOTIFY_OVERHEAD_BYTES;
+  printf("  %-8s %6.1f KB/s with %s headers, %.1f%% overhead\n", "link", linkBytes / audioSeconds / 1000,
+         config.streamReads > 0 ? "SPP" : "notification",
+         payloadBytes > 0 ? (linkBytes - payloadBytes) * 100.0 / payloadBytes : 0.0);
+  for (size_t i = 0; i < STAGE_COUNT; i++) {
+    printf("  %-8s p50 %7.1f us  p95 %7.1f us  p99 %7.1f us  max %7.1f us\n", STAGE_NAMES[i],
+           times[i].percentile(50) / 1e3, times[i].percentile(95) / 1e3,
+           times[i].percentile(99) / 1e3, times[i].percentile(100) / 1e3);
+  }
+
+  bool ok = true;
+  if (nsPerSample > BENCH_MAX_NS_PER_SAMPLE) {
+    printf("  FAIL: %.1f ns/sample over the budget of %d\n", nsPerSample, BENCH_MAX_NS_PER_SAMPLE);
+    ok = false;
+  }
+  if (allocationsPerSecond > BENCH_MAX_ALLOCATIONS_PER_SECOND) {
+    printf("  FAIL: the steady state allocates\n");
+    ok = false;
+  }
+  // The loopback drains after every chunk, so nothing may go missing
+  // and a byte stream never loses its framing
+  uint32_t skippedBytes = p.transport.streamReader().skippedBytes();
+  if (p.dropped > 0 || p.transport.malformed() > 0 || tracker.packetsLost() > 0 ||
+      tracker.samplesLost() > 0 || skippedBytes > 0) {
+    printf("  FAIL: %u dropped, %u malformed, %u packets and %u samples lost, %u stream bytes skipped\n",
+           p.dropped, p.transport.malformed(), tracker.packetsLost(), tracker.samplesLost(), skippedBytes);
+    ok = false;
+  }
+  return ok;
+}
+
+int main(int argc, char** argv) {
+  const char* wavPath = nullptr;
+  double seconds = 60;
+  for (int i = 1; i < argc; i++) {
+    if ((strcmp(argv[i], "-s") == 0 || strcmp(argv[i], "--seconds") == 0) && i + 1 < argc) {
+      seconds = atof(argv[++i]);
+    } else {
+      wavPath = argv[i];
+    }
+  }
+
+  SyntheticSource synthetic;
+  WavFileSource wav;
+  AudioSource* source = &synthetic;
+  if (wavPath != nullptr) {
+    if (!wav.open(wavPath) || wav.sampleRate() != SAMPLE_RATE) {
+      printf("%s: not a 16-bit %u Hz WAV file\n", wavPath, SAMPLE_RATE);
+      return 2;
+    }
+    source = &wav;
+    printf("Source: %s, %u channels, %.1f s (looped)\n", wavPath, wav.channels(),
+           (double)wav.frames() / SAMPLE_RATE);
+  } else {
+    printf("Source: synthetic\n");
+  }
+  printf("%.0f s of audio per configuration, %u-sample chunks, %u-byte packets\n\n",
+         seconds, (unsigned)CHUNK_SAMPLES, (unsigned)MAX_PACKET_BYTES);
+
+  bool ok = true;
+  for (const BenchConfig& config : CONFIGS) {
+    synthetic.begin(SyntheticSource::Config());
+    ok = runConfig(config, *source, seconds) && ok;
+  }
+  printf("\n%s\n", ok ? "All configurations within budget" : "Budget exceeded");
+  return ok ? 0 : 1;
+}
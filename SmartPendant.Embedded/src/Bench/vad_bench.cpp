@@ -0,0 +1,382 @@
+// Evaluation of the voice activity detector on labelled audio
+// (env:vad_bench).
+//
+//   pio run -e vad_bench -t exec                        built-in signals
+//   .pio/build/vad_bench/program talk.wav talk.txt      a labelled recording as well
+//
+// Labels are an Audacity label track: one "start end [text]" line per
+// stretch of speech, in seconds. The built-in signals place synthetic
+// voiced syllables and fricatives at known times over a quiet room, a fan,
+// loud steady noise, noise that steps up mid-file, and clicks between words.
+//
+// Each signal goes through the detector frame by frame as recordTask feeds
+// it (2500-sample captures, 250-sample frames) at every aggressiveness
+// level, and for each it reports
+//   - detection rate: labelled speech frames the detector held open
+//   - false-alarm rate: frames outside speech it held open, not counting
+//     the hangover it keeps after each labelled stretch on purpose
+//   - bytes saved: framed PCM packets with silence markers for closed
+//     frames, against the same stream without the detector
+// At the firmware's default level each signal must reach its detection
+// floor and stay under its false-alarm ceiling, and at every level the
+// detector must save something wherever the signal has silence. The run
+// exits non-zero if any check fails.
+#include <stdio.h>
+#include <math.h>
+#include <algorithm>
+#include <vector>
+#include "../Dsp/vad.h"
+#include "../Hal/wav_source.h"
+#include "../Protocol/packetizer.h"
+
+static constexpr uint32_t SAMPLE_RATE = 16000;
+static constexpr size_t CHUNK_SAMPLES = 2500;
+static constexpr size_t VAD_FRAME_SAMPLES = CHUNK_SAMPLES / 10;
+static constexpr size_t MAX_PACKET_BYTES = 509;
+// As main.cpp's AUDIO_VAD_AGGRESSIVENESS
+static constexpr uint8_t DEFAULT_AGGRESSIVENESS = 1;
+// Hangover at level 0, the longest; frames this soon after speech are not false alarms
+static constexpr uint32_t TAIL_MS = 400;
+
+// Floors for a recording given on the command line
+#ifndef BENCH_MIN_WAV_DETECTION
+#define BENCH_MIN_WAV_DETECTION 0.90
+#endif
+#ifndef BENCH_MAX_WAV_FALSE_ALARM
+#define BENCH_MAX_WAV_FALSE_ALARM 0.20
+#endif
+
+static uint32_t lcg(uint32_t& seed) {
+  seed = seed * 1664525 + 1013904223;
+  return seed >> 8;
+}
+
+// Uniform in [-1, 1)
+static double uniform(uint32_t& seed) {
+  return (double)(lcg(seed) & 0xFFFFFF) / 0x800000 - 1.0;
+}
+
+static int16_t toSample(double x) {
+  x = x < 0 ? x - 0.5 : x + 0.5;
+  if (x > 32767) return 32767;
+  if (x < -32768) return -32768;
+  return (int16_t)x;
+}
+
+static double dbfs(double db) {
+  return 32768.0 * pow(10.0, db / 20);
+}
+
+//----------------------------------------------------------------------
+// Signals
+//----------------------------------------------------------------------
+struct Segment {
+  double start;
+  double end;
+};
+
+struct Signal {
+  const char* name;
+  std::vector<int16_t> samples;
+  uint32_t sampleRate;
+  std::vector<Segment> speech;
+  double minDetection;
+  double maxFalseAlarm;
+};
+
+enum Background {
+  BACKGROUND_QUIET_ROOM,
+  BACKGROUND_FAN,
+  BACKGROUND_LOUD_NOISE,
+  BACKGROUND_NOISE_STEP,
+  BACKGROUND_CLICKS,
+};
+
+// Syllables of voiced harmonics under a raised-cosine envelope, with a
+// fricative now and then; short pauses between syllables stay labelled
+static void addUtterance(std::vector<double>& out, size_t start, size_t end, double levelDb, uint32_t& seed) {
+  double amplitude = dbfs(levelDb);
+  for (size_t s = start; s < end;) {
+    size_t length = (size_t)(SAMPLE_RATE * (0.12 + 0.13 * (uniform(seed) + 1) / 2));
+    length = std::min(length, end - s);
+    bool fricative = lcg(seed) % 5 == 0;
+    double pitch = 110 + 70 * (uniform(seed) + 1);
+    double glide = 0.3 * uniform(seed);
+    double phase = 0;
+    double lowpass = 0;
+    for (size_t i = 0; i < length; i++) {
+      double t = (double)i / length;
+      double envelope = 0.5 - 0.5 * cos(2 * M_PI * t);
+      double x = 0;
+      if (fricative) {
+        // High-passed noise, as in "s" and "f"
+        double n = uniform(seed);
+        lowpass += (n - lowpass) * 0.3;
+        x = (n - lowpass) * 0.6;
+      } else {
+        phase += 2 * M_PI * pitch * (1 + glide * t) / SAMPLE_RATE;
+        for (int k = 1; k * pitch < 3500; k++) {
+          x += sin(k * phase) / k;
+        }
+        x *= 0.5;
+      }
+      out[s + i] += amplitude * envelope * x;
+    }
+    s += length;
+    // Pause inside the utterance
+    s += (size_t)(SAMPLE_RATE * (0.03 + 0.05 * (uniform(seed) + 1) / 2));
+  }
+}
+
+static Signal labelled(const char* name, Background background, double speechDb, double minDetection,
+                       double maxFalseAlarm, uint32_t seed) {
+  Signal s = { name, {}, SAMPLE_RATE, {}, minDetection, maxFalseAlarm };
+  size_t total = SAMPLE_RATE * 60;
+  std::vector<double> mix(total, 0.0);
+
+  // Speech stretches of 0.4-2.5 s with gaps of 0.5-3 s, after a quiet second
+  double t = 1.0;
+  while (true) {
+    double length = 0.4 + 1.05 * (uniform(seed) + 1);
+    if (t + length > 59) break;
+    s.speech.push_back({ t, t + length });
+    addUtterance(mix, (size_t)(t * SAMPLE_RATE), (size_t)((t + length) * SAMPLE_RATE),
+                 speechDb + 3 * uniform(seed), seed);
+    t += length + 0.5 + 1.25 * (uniform(seed) + 1);
+  }
+
+  double lowpass = 0;
+  double hum = 0;
+  for (size_t i = 0; i < total; i++) {
+    double n = uniform(seed);
+    switch (background) {
+      case BACKGROUND_QUIET_ROOM:
+        mix[i] += dbfs(-62) * n;
+        break;
+      case BACKGROUND_FAN:
+        lowpass += (n - lowpass) * 0.05;
+        hum += 2 * M_PI * 120 / SAMPLE_RATE;
+        mix[i] += dbfs(-36) * lowpass * 4 + dbfs(-48) * sin(hum);
+        break;
+      case BACKGROUND_LOUD_NOISE:
+        mix[i] += dbfs(-38) * n;
+        break;
+      case BACKGROUND_NOISE_STEP:
+        mix[i] += dbfs(i < total / 2 ? -58 : -44) * n;
+        break;
+      case BACKGROUND_CLICKS:
+        mix[i] += dbfs(-60) * n;
+        if (lcg(seed) % (SAMPLE_RATE / 3) == 0) {
+          // A 2 ms knock
+          for (size_t k = 0; k < SAMPLE_RATE / 500 && i + k < total; k++) {
+            mix[i + k] += dbfs(-12) * exp(-(double)k / 6) * uniform(seed);
+          }
+        }
+        break;
+    }
+  }
+  s.samples.resize(total);
+  for (size_t i = 0; i < total; i++) {
+    s.samples[i] = toSample(mix[i]);
+  }
+  return s;
+}
+
+static bool loadLabels(const char* path, std::vector<Segment>& speech) {
+  FILE* file = fopen(path, "r");
+  if (file == nullptr) {
+    return false;
+  }
+  char line[256];
+  while (fgets(line, sizeof(line), file) != nullptr) {
+    Segment segment;
+    if (sscanf(line, "%lf %lf", &segment.start, &segment.end) == 2 && segment.end > segment.start) {
+      speech.push_back(segment);
+    }
+  }
+  fclose(file);
+  std::sort(speech.begin(), speech.end(), [](const Segment& a, const Segment& b) { return a.start < b.start; });
+  return !speech.empty();
+}
+
+static bool loadWav(const char* wavPath, const char* labelPath, Signal& s) {
+  WavFileSource wav;
+  if (!wav.open(wavPath) || wav.frames() < CHUNK_SAMPLES || !loadLabels(labelPath, s.speech)) {
+    return false;
+  }
+  uint8_t code;
+  s.name = wavPath;
+  s.samples.resize(wav.frames());
+  s.sampleRate = packetSampleRateCode(wav.sampleRate(), code) ? wav.sampleRate() : 0;
+  s.minDetection = BENCH_MIN_WAV_DETECTION;
+  s.maxFalseAlarm = BENCH_MAX_WAV_FALSE_ALARM;
+  return s.sampleRate != 0 && wav.record(s.samples.data(), s.samples.size(), wav.sampleRate());
+}
+
+//----------------------------------------------------------------------
+// Evaluation
+//----------------------------------------------------------------------
+enum FrameLabel : uint8_t {
+  FRAME_SILENCE,
+  FRAME_SPEECH,
+  FRAME_TAIL,   // silence within TAIL_MS of speech
+};
+
+// A frame is speech when most of it lies inside a labelled stretch
+static std::vector<FrameLabel> frameLabels(const Signal& s, size_t frameSamples) {
+  size_t frames = s.samples.size() / frameSamples;
+  std::vector<uint32_t> inside(frames, 0);
+  for (const Segment& segment : s.speech) {
+    size_t from = (size_t)std::max(0.0, segment.start * s.sampleRate);
+    size_t to = std::min(s.samples.size(), (size_t)(segment.end * s.sampleRate));
+    for (size_t i = from; i < to && i / frameSamples < frames; i++) {
+      inside[i / frameSamples]++;
+    }
+  }
+  std::vector<FrameLabel> labels(frames, FRAME_SILENCE);
+  size_t tailFrames = (size_t)TAIL_MS * s.sampleRate / 1000 / frameSamples;
+  size_t sinceSpeech = SIZE_MAX;
+  for (size_t f = 0; f < frames; f++) {
+    if (inside[f] * 2 >= frameSamples) {
+      labels[f] = FRAME_SPEECH;
+      sinceSpeech = 0;
+    } else if (sinceSpeech != SIZE_MAX && ++sinceSpeech <= tailFrames) {
+      labels[f] = FRAME_TAIL;
+    }
+  }
+  return labels;
+}
+
+struct Score {
+  size_t speechFrames = 0;
+  size_t detected = 0;
+  size_t silenceFrames = 0;
+  size_t falseAlarms = 0;
+  size_t openFrames = 0;
+  size_t frames = 0;
+  size_t bytes = 0;        // framed PCM with silence markers
+  size_t baselineBytes = 0;
+
+  double detection() const { return speechFrames > 0 ? (double)detected / speechFrames : 1.0; }
+  double falseAlarm() const { return silenceFrames > 0 ? (double)falseAlarms / silenceFrames : 0.0; }
+  double saved() const { return baselineBytes > 0 ? 1.0 - (double)bytes / baselineBytes : 0.0; }
+};
+
+static size_t drain(AudioPacketizer& packetizer, uint8_t* packet) {
+  size_t bytes = 0;
+  while (packetizer.hasPacket()) {
+    bytes += packetizer.nextPacket(packet);
+  }
+  return bytes;
+}
+
+static size_t packetize(AudioPacketizer& packetizer, const int16_t* samples, size_t count, uint8_t* packet) {
+  size_t bytes = 0;
+  for (size_t taken = 0; taken < count;) {
+    taken += packetizer.append(samples + taken, count - taken);
+    bytes += drain(packetizer, packet);
+  }
+  return bytes;
+}
+
+static Score evaluate(const Signal& s, uint8_t aggressiveness, const std::vector<FrameLabel>& labels) {
+  Score score;
+  VoiceActivityDetector vad;
+  vad.begin(s.sampleRate, VAD_FRAME_SAMPLES, aggressiveness);
+  AudioPacketizer packetizer;
+  packetizer.begin(PACKET_FORMAT_PCM16, MAX_PACKET_BYTES, true, s.sampleRate);
+  AudioPacketizer baseline;
+  baseline.begin(PACKET_FORMAT_PCM16, MAX_PACKET_BYTES, true, s.sampleRate);
+  uint8_t packet[MAX_PACKET_BYTES];
+
+  // Whole frames only, so every frame has a label
+  size_t count = labels.size() * VAD_FRAME_SAMPLES;
+  for (size_t start = 0; start < count; start += CHUNK_SAMPLES) {
+    size_t capture = std::min(CHUNK_SAMPLES, count - start);
+    const int16_t* samples = s.samples.data() + start;
+    score.baselineBytes += packetize(baseline, samples, capture, packet);
+
+    // As recordTask does with AUDIO_VAD
+    for (size_t offset = 0; offset < capture; offset += VAD_FRAME_SAMPLES) {
+      size_t frame = std::min(VAD_FRAME_SAMPLES, capture - offset);
+      bool open = vad.process(samples + offset, frame);
+      if (open) {
+        score.bytes += packetize(packetizer, samples + offset, frame, packet);
+      } else {
+        packetizer.appendSilence(frame);
+        score.bytes += drain(packetizer, packet);
+      }
+
+      FrameLabel label = labels[(start + offset) / VAD_FRAME_SAMPLES];
+      score.frames++;
+      score.openFrames += open;
+      if (label == FRAME_SPEECH) {
+        score.speechFrames++;
+        score.detected += open;
+      } else if (label == FRAME_SILENCE) {
+        score.silenceFrames++;
+        score.falseAlarms += open;
+      }
+    }
+  }
+  baseline.flush();
+  score.baselineBytes += drain(baseline, packet);
+  packetizer.flush();
+  score.bytes += drain(packetizer, packet);
+  return score;
+}
+
+static bool runSignal(const Signal& s) {
+  std::vector<FrameLabel> labels = frameLabels(s, VAD_FRAME_SAMPLES);
+  size_t speech = std::count(labels.begin(), labels.end(), FRAME_SPEECH);
+  printf("\n%s: %.1f s, %u labelled stretches, %.0f%% speech\n", s.name, (double)s.samples.size() / s.sampleRate,
+         (unsigned)s.speech.size(), 100.0 * speech / labels.size());
+
+  bool ok = true;
+  for (uint8_t level = 0; level <= VAD_MAX_AGGRESSIVENESS; level++) {
+    Score score = evaluate(s, level, labels);
+    bool checked = level == DEFAULT_AGGRESSIVENESS;
+    bool detectionOk = !checked || score.detection() >= s.minDetection;
+    bool falseAlarmOk = !checked || score.falseAlarm() <= s.maxFalseAlarm;
+    bool savesOk = score.silenceFrames == 0 || score.bytes < score.baselineBytes;
+    printf("  level %u%s: detection %5.1f%%%s, false alarms %5.1f%%%s, open %5.1f%%, "
+           "%u of %u bytes saved (%.1f%%)%s\n",
+           level, checked ? "*" : " ", 100 * score.detection(), detectionOk ? "" : " FAIL",
+           100 * score.falseAlarm(), falseAlarmOk ? "" : " FAIL", 100.0 * score.openFrames / score.frames,
+           (unsigned)(score.baselineBytes - std::min(score.bytes, score.baselineBytes)), (unsigned)score.baselineBytes,
+           100 * score.saved(), savesOk ? "" : "  FAIL");
+    ok = ok && detectionOk && falseAlarmOk && savesOk;
+  }
+  printf("  floors at level %u: detection %.0f%%, false alarms %.0f%%\n", DEFAULT_AGGRESSIVENESS,
+         100 * s.minDetection, 100 * s.maxFalseAlarm);
+  return ok;
+}
+
+int main(int argc, char** argv) {
+  std::vector<Signal> signals;
+  signals.push_back(labelled("Quiet room, speech at -24 dBFS", BACKGROUND_QUIET_ROOM, -24, 0.95, 0.05, 1));
+  signals.push_back(labelled("Fan and mains hum, speech at -24 dBFS", BACKGROUND_FAN, -24, 0.90, 0.10, 2));
+  signals.push_back(labelled("Loud steady noise, speech at -24 dBFS", BACKGROUND_LOUD_NOISE, -24, 0.80, 0.10, 3));
+  signals.push_back(labelled("Noise up 14 dB mid-file, speech at -24 dBFS", BACKGROUND_NOISE_STEP, -24, 0.90, 0.10, 4));
+  signals.push_back(labelled("Clicks between words, speech at -24 dBFS", BACKGROUND_CLICKS, -24, 0.95, 0.08, 5));
+  if (argc % 2 == 0) {
+    printf("usage: %s [recording.wav labels.txt]...\n", argv[0]);
+    return 2;
+  }
+  for (int i = 1; i + 1 < argc; i += 2) {
+    Signal s;
+    if (!loadWav(argv[i], argv[i + 1], s)) {
+      printf("%s, %s: not a 16-bit WAV file at a packet sample rate with speech labels\n", argv[i], argv[i + 1]);
+      return 2;
+    }
+    signals.push_back(s);
+  }
+
+  printf("Voice activity detector, %u-sample frames; * marks the firmware's level\n", (unsigned)VAD_FRAME_SAMPLES);
+  bool ok = true;
+  for (const Signal& s : signals) {
+    ok = runSignal(s) && ok;
+  }
+  printf("\n%s\n", ok ? "VAD within spec" : "VAD regression");
+  return ok ? 0 : 1;
+}
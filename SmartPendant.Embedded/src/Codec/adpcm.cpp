@@ -0,0 +1,148 @@
+#include "adpcm.h"
+#include <string.h>
+
+static const int16_t STEP_TABLE[89] = {
+  7, 8, 9, 10, 11, 12, 13, 14, 16, 17, 19, 21, 23, 25, 28, 31, 34, 37, 41, 45,
+  50, 55, 60, 66, 73, 80, 88, 97, 107, 118, 130, 143, 157, 173, 190, 209, 230,
+  253, 279, 307, 337, 371, 408, 449, 494, 544, 598, 658, 724, 796, 876, 963,
+  1060, 1166, 1282, 1411, 1552, 1707, 1878, 2066, 2272, 2499, 2749, 3024, 3327,
+  3660, 4026, 4428, 4871, 5358, 5894, 6484, 7132, 7845, 8630, 9493, 10442,
+  11487, 12635, 13899, 15289, 16818, 18500, 20350, 22385, 24623, 27086, 29794,
+  32767
+};
+
+static const int8_t INDEX_TABLE[16] = {
+  -1, -1, -1, -1, 2, 4, 6, 8,
+  -1, -1, -1, -1, 2, 4, 6, 8
+};
+
+// Applies one nibble to the predictor state. Shared by encoder and decoder
+// so both sides reconstruct exactly the same signal.
+static inline void applyNibble(uint8_t nibble, int32_t& predictor, int32_t& index) {
+  int32_t step = STEP_TABLE[index];
+  int32_t diff = step >> 3;
+  if (nibble & 4) diff += step;
+  if (nibble & 2) diff += step >> 1;
+  if (nibble & 1) diff += step >> 2;
+
+  predictor += (nibble & 8) ? -diff : diff;
+  if (predictor > 32767) predictor = 32767;
+  else if (predictor < -32768) predictor = -32768;
+
+  index += INDEX_TABLE[nibble];
+  if (index < 0) index = 0;
+  else if (index > 88) index = 88;
+}
+
+static inline uint8_t quantize(int32_t sample, int32_t predictor, int32_t index) {
+  int32_t diff = sample - predictor;
+  uint8_t nibble = 0;
+  if (diff < 0) {
+    nibble = 8;
+    diff = -diff;
+  }
+
+  int32_t step = STEP_TABLE[index];
+  if (diff >= step) { nibble |= 4; diff -= step; }
+  step >>= 1;
+  if (diff >= step) { nibble |= 2; diff -= step; }
+  step >>= 1;
+  if (diff >= step) { nibble |= 1; }
+  return nibble;
+}
+
+void adpcmEncodeBlock(const int16_t* samples, size_t blockBytes, uint8_t& stepIndex, uint8_t* out) {
+  size_t count = adpcmBlockSamples(blockBytes);
+  int32_t predictor = samples[0];
+  int32_t index = stepIndex > 88 ? 88 : stepIndex;
+
+  out[0] = (uint8_t)(predictor & 0xFF);
+  out[1] = (uint8_t)((predictor >> 8) & 0xFF);
+  out[2] = (uint8_t)index;
+  out[3] = 0;
+
+  uint8_t* data = out + ADPCM_BLOCK_HEADER_BYTES;
+  for (size_t i = 1; i < count; i += 2) {
+    uint8_t lo = quantize(samples[i], predictor, index);
+    applyNibble(lo, predictor, index);
+    uint8_t hi = quantize(samples[i + 1], predictor, index);
+    applyNibble(hi, predictor, index);
+    *data++ = (uint8_t)(lo | (hi << 4));
+  }
+
+  stepIndex = (uint8_t)index;
+}
+
+size_t adpcmDecodeBlock(const uint8_t* block, size_t blockBytes, int16_t* out) {
+  if (blockBytes <= ADPCM_BLOCK_HEADER_BYTES || block[2] > 88) {
+    return 0;
+  }
+
+  int32_t predictor = (int16_t)(block[0] | (block[1] << 8));
+  int32_t index = block[2];
+  out[0] = (int16_t)predictor;
+
+  size_t n = 1;
+  for (size_t i = ADPCM_BLOCK_HEADER_BYTES; i < blockBytes; i++) {
+    applyNibble(block[i] & 0x0F, predictor, index);
+    out[n++] = (int16_t)predictor;
+    applyNibble(block[i] >> 4, predictor, index);
+    out[n++] = (int16_t)predictor;
+  }
+  return n;
+}
+
+bool AdpcmEncoder::begin(size_t blockBytes) {
+  if (blockBytes <= ADPCM_BLOCK_HEADER_BYTES || blockBytes > ADPCM_MAX_BLOCK_BYTES) {
+    return false;
+  }
+  _blockBytes = blockBytes;
+  _blockSamples = adpcmBlockSamples(blockBytes);
+  reset();
+  return true;
+}
+
+void AdpcmEncoder::reset() {
+  _pendingCount = 0;
+  _stepIndex = 0;
+  _blocksEncoded = 0;
+  _samplesDiscarded = 0;
+}
+
+size_t AdpcmEncoder::encode(const int16_t* samples, size_t count, uint8_t* out, size_t outCapacity) {
+  size_t written = 0;
+
+  while (count > 0) {
+    size_t take = _blockSamples - _pendingCount;
+    if (take > count) take = count;
+
+    // Encode straight from the caller's buffer when a whole block is available
+    const int16_t* blockSource = nullptr;
+    if (_pendingCount == 0 && take == _blockSamples) {
+      blockSource = samples;
+    } else {
+      memcpy(_pending + _pendingCount, samples, take * sizeof(int16_t));
+      _pendingCount += take;
+      if (_pendingCount == _blockSamples) {
+        blockSource = _pending;
+      }
+    }
+    samples += take;
+    count -= take;
+
+    if (blockSource == nullptr) {
+      break; // partial block kept for the next call
+    }
+
+    if (written + _blockBytes <= outCapacity) {
+      adpcmEncodeBlock(blockSource, _blockBytes, _stepIndex, out + written);
+      written += _blockBytes;
+      _blocksEncoded++;
+    } else {
+      _samplesDiscarded += _blockSamples;
+    }
+    _pendingCount = 0;
+  }
+
+  return written;
+}
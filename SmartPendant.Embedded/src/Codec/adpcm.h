@@ -0,0 +1,67 @@
+#ifndef ADPCM_H
+#define ADPCM_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Block-based IMA-ADPCM (4 bits per sample), mono.
+//
+// Block layout (same as the WAV IMA-ADPCM mono block):
+//   [0..1] first sample, int16 little-endian (also the initial predictor)
+//   [2]    step index (0..88)
+//   [3]    reserved, 0
+//   [4..]  one nibble per following sample, low nibble first
+//
+// Every block carries its own predictor state, so blocks decode
+// independently and a lost block never corrupts the ones after it.
+
+static constexpr size_t ADPCM_BLOCK_HEADER_BYTES = 4;
+// 256-byte blocks / 505 samples, the common WAV block align for mono
+static constexpr size_t ADPCM_BLOCK_BYTES = 256;
+static constexpr size_t ADPCM_MAX_BLOCK_BYTES = 512;
+
+// Number of samples held by a block of the given size
+constexpr size_t adpcmBlockSamples(size_t blockBytes) {
+  return (blockBytes - ADPCM_BLOCK_HEADER_BYTES) * 2 + 1;
+}
+
+static constexpr size_t ADPCM_MAX_BLOCK_SAMPLES = adpcmBlockSamples(ADPCM_MAX_BLOCK_BYTES);
+
+// Encodes exactly adpcmBlockSamples(blockBytes) samples into one block.
+// stepIndex carries the quantizer step across blocks for better tracking;
+// pass the same variable for consecutive blocks of a stream.
+void adpcmEncodeBlock(const int16_t* samples, size_t blockBytes, uint8_t& stepIndex, uint8_t* out);
+
+// Decodes one block into adpcmBlockSamples(blockBytes) samples.
+// Returns the number of samples written, or 0 for a malformed block.
+size_t adpcmDecodeBlock(const uint8_t* block, size_t blockBytes, int16_t* out);
+
+// Streaming encoder: accepts arbitrarily sized chunks of PCM and emits
+// whole blocks, keeping the leftover samples for the next call.
+class AdpcmEncoder {
+public:
+  // blockBytes must be in (ADPCM_BLOCK_HEADER_BYTES, ADPCM_MAX_BLOCK_BYTES]
+  bool begin(size_t blockBytes = ADPCM_BLOCK_BYTES);
+  void reset();
+
+  // Appends complete blocks to out (at most outCapacity bytes) and returns
+  // the number of bytes written. Samples that do not yet fill a block are
+  // kept; samples that would overflow out are discarded and counted.
+  size_t encode(const int16_t* samples, size_t count, uint8_t* out, size_t outCapacity);
+
+  size_t blockBytes() const { return _blockBytes; }
+  size_t blockSamples() const { return _blockSamples; }
+  uint32_t blocksEncoded() const { return _blocksEncoded; }
+  uint32_t samplesDiscarded() const { return _samplesDiscarded; }
+
+private:
+  int16_t _pending[ADPCM_MAX_BLOCK_SAMPLES];
+  size_t _pendingCount = 0;
+  size_t _blockBytes = ADPCM_BLOCK_BYTES;
+  size_t _blockSamples = adpcmBlockSamples(ADPCM_BLOCK_BYTES);
+  uint8_t _stepIndex = 0;
+  uint32_t _blocksEncoded = 0;
+  uint32_t _samplesDiscarded = 0;
+};
+
+#endif
@@ -0,0 +1,317 @@
+#include "lossless.h"
+#include <string.h>
+
+static constexpr uint32_t PARTITIONS_MAX = 1u << LOSSLESS_MAX_PARTITION_ORDER;
+static constexpr uint32_t RICE_PARAMETER_BITS = 5;
+static constexpr uint32_t RICE_PARAMETER_MAX = 30;
+
+static inline int32_t predict(const int16_t* x, size_t i, uint8_t order) {
+  switch (order) {
+    case 0: return 0;
+    case 1: return x[i - 1];
+    case 2: return 2 * x[i - 1] - x[i - 2];
+    case 3: return 3 * x[i - 1] - 3 * x[i - 2] + x[i - 3];
+    default: return 4 * x[i - 1] - 6 * x[i - 2] + 4 * x[i - 3] - x[i - 4];
+  }
+}
+
+static inline uint32_t zigzag(int32_t v) {
+  return ((uint32_t)v << 1) ^ (uint32_t)(v >> 31);
+}
+
+static inline int32_t unzigzag(uint32_t u) {
+  return (int32_t)(u >> 1) ^ -(int32_t)(u & 1);
+}
+
+static inline void putU16(uint8_t* p, uint32_t v) {
+  p[0] = (uint8_t)(v & 0xFF);
+  p[1] = (uint8_t)(v >> 8);
+}
+
+static inline uint16_t getU16(const uint8_t* p) {
+  return (uint16_t)(p[0] | (p[1] << 8));
+}
+
+// Highest partition order usable for a block: every partition must be
+// non-empty and the first one must hold more than the warm-up samples.
+static uint8_t maxPartitionOrder(size_t count, uint8_t order) {
+  uint8_t p = LOSSLESS_MAX_PARTITION_ORDER;
+  while (p > 0 && (count >> p) <= order) {
+    p--;
+  }
+  return p;
+}
+
+// Partition i of 2^partitionOrder covers [start, end). Partitions are built
+// from units of count >> maxOrder samples so that lower orders are exact
+// unions of higher ones; the last partition takes any remainder.
+static void partitionBounds(size_t count, uint8_t maxOrder, uint8_t partitionOrder, uint32_t i,
+                            size_t& start, size_t& end) {
+  size_t size = (count >> maxOrder) << (maxOrder - partitionOrder);
+  start = i * size;
+  end = (i + 1 == (1u << partitionOrder)) ? count : start + size;
+}
+
+struct BitWriter {
+  uint8_t* out;
+  size_t capacity;
+  size_t bytes;
+  uint64_t acc;
+  uint32_t bits;
+  bool overflow;
+
+  void put(uint32_t value, uint32_t count) {
+    acc = (acc << count) | (value & ((count == 32) ? 0xFFFFFFFFu : ((1u << count) - 1)));
+    bits += count;
+    while (bits >= 8) {
+      bits -= 8;
+      if (bytes < capacity) out[bytes++] = (uint8_t)(acc >> bits);
+      else overflow = true;
+    }
+  }
+
+  void putUnary(uint32_t zeros) {
+    while (zeros >= 24) {
+      put(0, 24);
+      zeros -= 24;
+      if (overflow) return;
+    }
+    put(1, zeros + 1);
+  }
+
+  void flush() {
+    if (bits > 0) put(0, 8 - bits);
+  }
+};
+
+struct BitReader {
+  const uint8_t* in;
+  size_t size;
+  size_t pos;
+  uint32_t bit;
+  bool error;
+
+  uint32_t get(uint32_t count) {
+    uint32_t value = 0;
+    while (count-- > 0) {
+      if (pos >= size) {
+        error = true;
+        return 0;
+      }
+      value = (value << 1) | ((in[pos] >> (7 - bit)) & 1);
+      if (++bit == 8) {
+        bit = 0;
+        pos++;
+      }
+    }
+    return value;
+  }
+
+  uint32_t getUnary() {
+    uint32_t zeros = 0;
+    while (true) {
+      if (pos >= size) {
+        error = true;
+        return 0;
+      }
+      // Skip whole zero bytes quickly
+      if (bit == 0 && in[pos] == 0) {
+        zeros += 8;
+        pos++;
+        continue;
+      }
+      if ((in[pos] >> (7 - bit)) & 1) {
+        if (++bit == 8) { bit = 0; pos++; }
+        return zeros;
+      }
+      zeros++;
+      if (++bit == 8) { bit = 0; pos++; }
+    }
+  }
+};
+
+static uint32_t bestRiceParameter(uint64_t sum, size_t n, uint64_t& bits) {
+  uint32_t best = 0;
+  bits = UINT64_MAX;
+  for (uint32_t k = 0; k <= RICE_PARAMETER_MAX; k++) {
+    // Estimated cost: a stop bit and k low bits per residual plus the quotients
+    uint64_t cost = (uint64_t)n * (k + 1) + (sum >> k);
+    if (cost < bits) {
+      bits = cost;
+      best = k;
+    }
+    if ((sum >> k) == 0) break;
+  }
+  return best;
+}
+
+static size_t encodeVerbatim(const int16_t* samples, size_t count, uint8_t* out) {
+  out[0] = LOSSLESS_METHOD_VERBATIM;
+  out[1] = 0;
+  putU16(out + 2, (uint32_t)count);
+  size_t bytes = losslessMaxBlockBytes(count);
+  putU16(out + 4, (uint32_t)bytes);
+  uint8_t* p = out + LOSSLESS_HEADER_BYTES;
+  for (size_t i = 0; i < count; i++) {
+    putU16(p, (uint16_t)samples[i]);
+    p += 2;
+  }
+  return bytes;
+}
+
+size_t losslessEncodeBlock(const int16_t* samples, size_t count, uint8_t* out, size_t outCapacity) {
+  size_t verbatimBytes = losslessMaxBlockBytes(count);
+  if (count == 0 || count > LOSSLESS_MAX_BLOCK_SAMPLES || outCapacity < verbatimBytes) {
+    return 0;
+  }
+
+  // Pick the predictor order with the smallest total absolute residual,
+  // comparing orders over the same sample range.
+  uint8_t order = 0;
+  if (count > LOSSLESS_MAX_ORDER * 2) {
+    uint64_t error[LOSSLESS_MAX_ORDER + 1] = {0};
+    for (size_t i = LOSSLESS_MAX_ORDER; i < count; i++) {
+      for (uint8_t o = 0; o <= LOSSLESS_MAX_ORDER; o++) {
+        int32_t r = samples[i] - predict(samples, i, o);
+        error[o] += (uint32_t)(r < 0 ? -r : r);
+      }
+    }
+    for (uint8_t o = 1; o <= LOSSLESS_MAX_ORDER; o++) {
+      if (error[o] < error[order]) order = o;
+    }
+  }
+
+  // Residual sums per finest partition, merged for coarser orders below
+  uint8_t maxOrder = maxPartitionOrder(count, order);
+  uint64_t sums[PARTITIONS_MAX] = {0};
+  for (uint32_t i = 0; i < (1u << maxOrder); i++) {
+    size_t start, end;
+    partitionBounds(count, maxOrder, maxOrder, i, start, end);
+    if (start < order) start = order;
+    for (size_t j = start; j < end; j++) {
+      sums[i] += zigzag(samples[j] - predict(samples, j, order));
+    }
+  }
+
+  uint8_t bestPartitionOrder = 0;
+  uint64_t bestBits = UINT64_MAX;
+  uint8_t parameters[PARTITIONS_MAX];
+  for (int p = maxOrder; p >= 0; p--) {
+    uint32_t partitions = 1u << p;
+    uint32_t merge = 1u << (maxOrder - p);
+    uint64_t total = 0;
+    uint8_t params[PARTITIONS_MAX];
+    for (uint32_t i = 0; i < partitions; i++) {
+      uint64_t sum = 0;
+      for (uint32_t m = 0; m < merge; m++) sum += sums[i * merge + m];
+      size_t start, end;
+      partitionBounds(count, maxOrder, (uint8_t)p, i, start, end);
+      if (start < order) start = order;
+      uint64_t bits;
+      params[i] = (uint8_t)bestRiceParameter(sum, end - start, bits);
+      total += bits + RICE_PARAMETER_BITS;
+    }
+    if (total < bestBits) {
+      bestBits = total;
+      bestPartitionOrder = (uint8_t)p;
+      memcpy(parameters, params, partitions);
+    }
+  }
+
+  // Cheap early out before producing the bitstream
+  size_t estimate = LOSSLESS_HEADER_BYTES + order * sizeof(int16_t) + (size_t)((bestBits + 7) / 8);
+  if (estimate >= verbatimBytes) {
+    return encodeVerbatim(samples, count, out);
+  }
+
+  out[0] = (uint8_t)(order + 1);
+  out[1] = bestPartitionOrder;
+  putU16(out + 2, (uint32_t)count);
+
+  size_t headerBytes = LOSSLESS_HEADER_BYTES + order * sizeof(int16_t);
+  for (uint8_t i = 0; i < order; i++) {
+    putU16(out + LOSSLESS_HEADER_BYTES + i * 2, (uint16_t)samples[i]);
+  }
+
+  // Limit the bitstream to less than the verbatim size, falling back if it doesn't fit
+  BitWriter w = {out + headerBytes, verbatimBytes - headerBytes - 1, 0, 0, 0, false};
+  for (uint32_t i = 0; i < (1u << bestPartitionOrder) && !w.overflow; i++) {
+    size_t start, end;
+    partitionBounds(count, maxOrder, bestPartitionOrder, i, start, end);
+    if (start < order) start = order;
+    uint32_t k = parameters[i];
+    w.put(k, RICE_PARAMETER_BITS);
+    for (size_t j = start; j < end && !w.overflow; j++) {
+      uint32_t u = zigzag(samples[j] - predict(samples, j, order));
+      w.putUnary(u >> k);
+      if (k > 0) w.put(u, k);
+    }
+  }
+  w.flush();
+
+  if (w.overflow) {
+    return encodeVerbatim(samples, count, out);
+  }
+
+  size_t bytes = headerBytes + w.bytes;
+  putU16(out + 4, (uint32_t)bytes);
+  return bytes;
+}
+
+size_t losslessBlockBytes(const uint8_t* data, size_t available) {
+  if (available < LOSSLESS_HEADER_BYTES || data[0] > LOSSLESS_MAX_ORDER + 1 ||
+      data[1] > LOSSLESS_MAX_PARTITION_ORDER) {
+    return 0;
+  }
+  size_t bytes = getU16(data + 4);
+  return bytes >= LOSSLESS_HEADER_BYTES ? bytes : 0;
+}
+
+size_t losslessDecodeBlock(const uint8_t* block, size_t blockBytes, int16_t* out, size_t outCapacity) {
+  if (losslessBlockBytes(block, blockBytes) != blockBytes) {
+    return 0;
+  }
+
+  uint8_t method = block[0];
+  uint8_t partitionOrder = block[1];
+  size_t count = getU16(block + 2);
+  if (count == 0 || count > outCapacity) {
+    return 0;
+  }
+
+  const uint8_t* p = block + LOSSLESS_HEADER_BYTES;
+  if (method == LOSSLESS_METHOD_VERBATIM) {
+    if (blockBytes != losslessMaxBlockBytes(count)) return 0;
+    for (size_t i = 0; i < count; i++, p += 2) {
+      out[i] = (int16_t)getU16(p);
+    }
+    return count;
+  }
+
+  uint8_t order = method - 1;
+  size_t headerBytes = LOSSLESS_HEADER_BYTES + order * sizeof(int16_t);
+  uint8_t maxOrder = maxPartitionOrder(count, order);
+  if (count <= order || blockBytes < headerBytes || partitionOrder > maxOrder) {
+    return 0;
+  }
+
+  for (uint8_t i = 0; i < order; i++, p += 2) {
+    out[i] = (int16_t)getU16(p);
+  }
+
+  BitReader r = {block + headerBytes, blockBytes - headerBytes, 0, 0, false};
+  for (uint32_t i = 0; i < (1u << partitionOrder); i++) {
+    size_t start, end;
+    partitionBounds(count, maxOrder, partitionOrder, i, start, end);
+    if (start < order) start = order;
+    uint32_t k = r.get(RICE_PARAMETER_BITS);
+    if (k > RICE_PARAMETER_MAX) return 0;
+    for (size_t j = start; j < end; j++) {
+      uint32_t u = (r.getUnary() << k);
+      if (k > 0) u |= r.get(k);
+      if (r.error) return 0;
+      out[j] = (int16_t)(predict(out, j, order) + unzigzag(u));
+    }
+  }
+  return count;
+}
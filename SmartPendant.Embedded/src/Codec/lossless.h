@@ -0,0 +1,51 @@
+#ifndef LOSSLESS_H
+#define LOSSLESS_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Lossless block codec for 16-bit mono PCM (FLAC-style).
+//
+// Each block is a fixed-order polynomial predictor (order 0..4) followed by
+// partitioned Rice coding of the residual. Blocks that do not compress are
+// stored verbatim, so the output is never more than the header larger
+// than the input.
+//
+// Block layout:
+//   [0]    method: 0 = verbatim, 1..5 = fixed predictor of order (method - 1)
+//   [1]    Rice partition order (0..LOSSLESS_MAX_PARTITION_ORDER)
+//   [2..3] sample count, uint16 little-endian
+//   [4..5] total block size in bytes including this header, uint16 little-endian
+//   [6..]  verbatim: int16 little-endian samples
+//          predicted: `order` warm-up samples as int16 little-endian, then a
+//          bitstream (MSB first) of 2^partitionOrder partitions, each a 5-bit
+//          Rice parameter followed by zigzag residuals (unary quotient
+//          terminated by a 1 bit, then `parameter` low bits)
+
+static constexpr size_t LOSSLESS_HEADER_BYTES = 6;
+static constexpr uint8_t LOSSLESS_MAX_ORDER = 4;
+static constexpr uint8_t LOSSLESS_MAX_PARTITION_ORDER = 4;
+static constexpr uint8_t LOSSLESS_METHOD_VERBATIM = 0;
+
+// Largest possible block for the given number of samples (the verbatim case)
+constexpr size_t losslessMaxBlockBytes(size_t samples) {
+  return LOSSLESS_HEADER_BYTES + samples * sizeof(int16_t);
+}
+
+// Longest block whose verbatim form still fits the 16-bit size field
+static constexpr size_t LOSSLESS_MAX_BLOCK_SAMPLES = (0xFFFF - LOSSLESS_HEADER_BYTES) / sizeof(int16_t);
+
+// Encodes count samples (at most LOSSLESS_MAX_BLOCK_SAMPLES) into one block.
+// Returns the block size, or 0 if outCapacity is smaller than
+// losslessMaxBlockBytes(count).
+size_t losslessEncodeBlock(const int16_t* samples, size_t count, uint8_t* out, size_t outCapacity);
+
+// Returns the size of the block starting at data, or 0 if fewer than
+// LOSSLESS_HEADER_BYTES are available or the header is invalid.
+size_t losslessBlockBytes(const uint8_t* data, size_t available);
+
+// Decodes one block. Returns the number of samples written to out, or 0 if
+// the block is malformed or holds more than outCapacity samples.
+size_t losslessDecodeBlock(const uint8_t* block, size_t blockBytes, int16_t* out, size_t outCapacity);
+
+#endif
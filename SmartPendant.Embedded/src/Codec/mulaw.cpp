@@ -0,0 +1,39 @@
+#include "mulaw.h"
+
+static constexpr int32_t MULAW_BIAS = 0x84;
+static constexpr int32_t MULAW_CLIP = 32635;
+
+uint8_t mulawEncodeSample(int16_t sample) {
+  int32_t magnitude = sample;
+  uint8_t sign = 0;
+  if (magnitude < 0) {
+    magnitude = -magnitude;
+    sign = 0x80;
+  }
+  if (magnitude > MULAW_CLIP) magnitude = MULAW_CLIP;
+  magnitude += MULAW_BIAS;
+
+  // Segment: position of the leading one above bit 7
+  uint8_t exponent = (uint8_t)(31 - __builtin_clz((uint32_t)magnitude) - 7);
+  uint8_t mantissa = (uint8_t)((magnitude >> (exponent + 3)) & 0x0F);
+  return (uint8_t)~(sign | (exponent << 4) | mantissa);
+}
+
+int16_t mulawDecodeSample(uint8_t code) {
+  code = (uint8_t)~code;
+  int32_t exponent = (code >> 4) & 0x07;
+  int32_t magnitude = ((((code & 0x0F) << 3) + MULAW_BIAS) << exponent) - MULAW_BIAS;
+  return (int16_t)((code & 0x80) ? -magnitude : magnitude);
+}
+
+void mulawEncode(const int16_t* samples, size_t count, uint8_t* out) {
+  for (size_t i = 0; i < count; i++) {
+    out[i] = mulawEncodeSample(samples[i]);
+  }
+}
+
+void mulawDecode(const uint8_t* codes, size_t count, int16_t* out) {
+  for (size_t i = 0; i < count; i++) {
+    out[i] = mulawDecodeSample(codes[i]);
+  }
+}
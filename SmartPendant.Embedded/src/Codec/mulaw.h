@@ -0,0 +1,18 @@
+#ifndef MULAW_H
+#define MULAW_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// G.711 mu-law: 8 bits per sample, logarithmic, ~14-bit dynamic range.
+// Stateless, so any run of bytes decodes on its own; the payload of a
+// mu-law packet is simply one byte per sample.
+
+uint8_t mulawEncodeSample(int16_t sample);
+int16_t mulawDecodeSample(uint8_t code);
+
+// count samples in, count bytes out
+void mulawEncode(const int16_t* samples, size_t count, uint8_t* out);
+void mulawDecode(const uint8_t* codes, size_t count, int16_t* out);
+
+#endif
@@ -0,0 +1,103 @@
+#include "agc.h"
+#include "q15.h"
+#include <string.h>
+
+// Envelope smoothing per sub-block: ~4 ms attack, ~0.5 s release at 16 kHz
+static constexpr int ENVELOPE_ATTACK_SHIFT = 2;
+static constexpr int ENVELOPE_RELEASE_SHIFT = 9;
+// Level-driven gain changes per sub-block: rise ~8 dB/s, fall ~130 dB/s.
+// The limiter may cut the gain further at once.
+static constexpr int GAIN_RISE_SHIFT = 10;
+static constexpr int GAIN_FALL_SHIFT = 6;
+// The gain is applied in Q12 so sample * gain fits 32 bits
+static constexpr int APPLY_SHIFT = 4;
+
+bool Agc::begin(const Config& config) {
+  if (config.targetLevel <= 0 || config.limitLevel < config.targetLevel || config.gateLevel < 0 ||
+      config.minGain == 0 || config.maxGain < config.minGain || config.maxGain > (8u << 16)) {
+    return false;
+  }
+  _config = config;
+  reset();
+  return true;
+}
+
+void Agc::reset() {
+  memset(_delay, 0, sizeof(_delay));
+  memset(_peaks, 0, sizeof(_peaks));
+  _delayPos = 0;
+  _subblockFill = 0;
+  _subblockPeak = 0;
+  _peakPos = 0;
+  _envelope = 0;
+  _gain = 1 << 16;
+  _rampGain = 1 << 16;
+  _rampStep = 0;
+}
+
+void Agc::updateGain() {
+  int32_t peak = _subblockPeak;
+  _peaks[_peakPos] = peak;
+  _peakPos = (_peakPos + 1) % PEAK_WINDOW;
+  _subblockPeak = 0;
+
+  int32_t level = peak << ENVELOPE_FRACTION_BITS;
+  if (level > _envelope) {
+    _envelope += (level - _envelope) >> ENVELOPE_ATTACK_SHIFT;
+  } else {
+    _envelope -= (_envelope - level) >> ENVELOPE_RELEASE_SHIFT;
+  }
+
+  uint32_t gain = _gain;
+  int32_t envelope = _envelope >> ENVELOPE_FRACTION_BITS;
+  if (envelope >= _config.gateLevel && envelope > 0) {
+    uint32_t wanted = ((uint32_t)_config.targetLevel << 16) / (uint32_t)envelope;
+    if (wanted > gain) {
+      gain += gain >> GAIN_RISE_SHIFT;
+      if (gain > wanted) gain = wanted;
+    } else {
+      gain -= gain >> GAIN_FALL_SHIFT;
+      if (gain < wanted) gain = wanted;
+    }
+  }
+  if (gain > _config.maxGain) gain = _config.maxGain;
+  if (gain < _config.minGain) gain = _config.minGain;
+
+  // Every sample still in the delay line has to fit under the limit
+  int32_t windowPeak = 0;
+  for (size_t i = 0; i < PEAK_WINDOW; i++) {
+    if (_peaks[i] > windowPeak) windowPeak = _peaks[i];
+  }
+  if (windowPeak > 0) {
+    uint32_t ceiling = ((uint32_t)_config.limitLevel << 16) / (uint32_t)windowPeak;
+    if (gain > ceiling) gain = ceiling;
+  }
+
+  // Ramp from the gain just reached to the new one over the next sub-block
+  _rampGain = (int32_t)_gain;
+  _rampStep = ((int32_t)gain - (int32_t)_gain) >> 4; // AGC_SUBBLOCK_SAMPLES == 16
+  _gain = gain;
+}
+
+void Agc::process(int16_t* samples, size_t count) {
+  static_assert(AGC_SUBBLOCK_SAMPLES == 16, "ramp step assumes 16-sample sub-blocks");
+
+  for (size_t i = 0; i < count; i++) {
+    int32_t x = samples[i];
+    int32_t delayed = _delay[_delayPos];
+    _delay[_delayPos] = (int16_t)x;
+    if (++_delayPos == AGC_DELAY_SAMPLES) _delayPos = 0;
+
+    int32_t magnitude = x < 0 ? -x : x;
+    if (magnitude > _subblockPeak) _subblockPeak = magnitude;
+
+    _rampGain += _rampStep;
+    int32_t y = (delayed * (_rampGain >> APPLY_SHIFT) + (1 << (15 - APPLY_SHIFT))) >> (16 - APPLY_SHIFT);
+    samples[i] = saturate16(y);
+
+    if (++_subblockFill == AGC_SUBBLOCK_SAMPLES) {
+      _subblockFill = 0;
+      updateGain();
+    }
+  }
+}
@@ -0,0 +1,62 @@
+#ifndef AGC_H
+#define AGC_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+static constexpr size_t AGC_SUBBLOCK_SAMPLES = 16;
+// Output delay in sub-blocks; 4 ms at 16 kHz
+static constexpr size_t AGC_LOOKAHEAD_SUBBLOCKS = 4;
+static constexpr size_t AGC_DELAY_SAMPLES = AGC_SUBBLOCK_SAMPLES * AGC_LOOKAHEAD_SUBBLOCKS;
+
+// Look-ahead automatic gain control in fixed point.
+//
+// The output is the input delayed by AGC_DELAY_SAMPLES. A slow envelope of
+// the signal sets the gain that brings speech to the target level; the
+// peaks of the samples still in the delay line cap it so that nothing
+// exceeds the limit. Because the cap is known before those samples leave,
+// the gain can ramp down smoothly instead of clipping. Below the gate the
+// gain is held, so pauses do not pump up the background noise.
+//
+// Gains are recomputed every AGC_SUBBLOCK_SAMPLES and ramped linearly in
+// between.
+class Agc {
+public:
+  struct Config {
+    int16_t targetLevel = 8192;   // envelope peak the gain aims for (-12 dBFS)
+    int16_t limitLevel = 29204;   // hard ceiling for output peaks (-1 dBFS)
+    int16_t gateLevel = 128;      // below this the gain is held (-48 dBFS)
+    uint32_t maxGain = 8 << 16;   // Q16, +18 dB
+    uint32_t minGain = 1 << 14;   // Q16, -12 dB
+  };
+
+  bool begin(const Config& config);
+  void reset();
+
+  // Processes samples in place; the output lags by AGC_DELAY_SAMPLES
+  void process(int16_t* samples, size_t count);
+
+  uint32_t gain() const { return _gain; } // Q16
+  int32_t envelope() const { return _envelope >> ENVELOPE_FRACTION_BITS; }
+
+private:
+  static constexpr int ENVELOPE_FRACTION_BITS = 8;
+  static constexpr size_t PEAK_WINDOW = AGC_LOOKAHEAD_SUBBLOCKS + 1;
+
+  void updateGain();
+
+  Config _config;
+  int16_t _delay[AGC_DELAY_SAMPLES];
+  size_t _delayPos = 0;
+  size_t _subblockFill = 0;
+  int32_t _subblockPeak = 0;
+  int32_t _peaks[PEAK_WINDOW];
+  size_t _peakPos = 0;
+  int32_t _envelope = 0;        // Q8
+
+  uint32_t _gain = 1 << 16;     // Q16, reached at the end of the current ramp
+  int32_t _rampGain = 1 << 16;  // Q16, applied to the next sample
+  int32_t _rampStep = 0;
+};
+
+#endif
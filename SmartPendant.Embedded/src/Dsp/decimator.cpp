@@ -0,0 +1,240 @@
+#include "decimator.h"
+#include "q15.h"
+
+#if defined(ESP_PLATFORM) && __has_include(<esp_dsp.h>)
+#include <esp_dsp.h>
+#define DECIMATOR_ESP_DSP 1
+#else
+#define DECIMATOR_ESP_DSP 0
+#endif
+
+static constexpr int MAKEUP_BITS = 14;
+
+// Kaiser windowed sinc, quantized with the magnitude sum held at 32767
+alignas(4) static const int16_t HALF_BAND_48_TAPS[48] = {
+      -4,      0,     14,      0,    -33,      0,     65,      0,   -115,      0,    190,      0,
+    -299,      0,    459,      0,   -703,      0,   1119,      0,  -2029,      0,   6344,  10017,
+    6344,      0,  -2029,      0,   1119,      0,   -703,      0,    459,      0,   -299,      0,
+     190,      0,   -115,      0,     65,      0,    -33,      0,     14,      0,     -4,      0,
+};
+
+alignas(4) static const int16_t THIRD_BAND_96_TAPS[96] = {
+      -1,     -2,     -2,      2,      5,      3,     -4,    -10,     -6,      8,     18,     10,
+     -12,    -28,    -16,     19,     43,     24,    -27,    -62,    -35,     39,     88,     49,
+     -54,   -121,    -67,     75,    165,     92,   -102,   -225,   -125,    139,    308,    172,
+    -193,   -434,   -246,    281,    649,    381,   -457,  -1131,   -734,   1035,   3468,   5214,
+    5214,   3468,   1035,   -734,  -1131,   -457,    381,    649,    281,   -246,   -434,   -193,
+     172,    308,    139,   -125,   -225,   -102,     92,    165,     75,    -67,   -121,    -54,
+      49,     88,     39,    -35,    -62,    -27,     24,     43,     19,    -16,    -28,    -12,
+      10,     18,      8,     -6,    -10,     -4,      3,      5,      2,     -2,     -2,     -1,
+};
+
+// DC gains 0.611 and 0.500
+const FirDecimator::Design DECIMATE_BY_2 = { HALF_BAND_48_TAPS, 48, 2, 26799, true };
+const FirDecimator::Design DECIMATE_BY_3 = { THIRD_BAND_96_TAPS, 96, 3, 32764, false };
+
+static inline int16_t applyMakeup(int32_t y, int32_t gain) {
+  return saturate16((y * gain + (1 << (MAKEUP_BITS - 1))) >> MAKEUP_BITS);
+}
+
+static bool validDesign(const FirDecimator::Design& d) {
+  size_t n = d.tapCount;
+  if (d.taps == nullptr || n == 0 || n % 4 != 0 || n > FirDecimator::MAX_TAPS || d.factor == 0) {
+    return false;
+  }
+  int32_t magnitude = 0;
+  for (size_t j = 0; j < n; j++) {
+    magnitude += d.taps[j] < 0 ? -d.taps[j] : d.taps[j];
+  }
+  if (magnitude > INT16_MAX) {
+    return false;
+  }
+  size_t center = n / 2 - 1;
+  for (size_t j = 0; j < n; j++) {
+    if (d.halfBand) {
+      // Zero at even distances from the centre, and the padding
+      size_t distance = j > center ? j - center : center - j;
+      if (j != center && (distance % 2 == 0 || j == n - 1) && d.taps[j] != 0) {
+        return false;
+      }
+    } else if (d.taps[j] != d.taps[n - 1 - j]) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool FirDecimator::begin(const Design& design, bool accelerated) {
+  if (!validDesign(design)) {
+    return false;
+  }
+  _design = &design;
+  reset();
+  _accelerated = DECIMATOR_ESP_DSP && accelerated;
+  if (_accelerated && !acceleratedMatches()) {
+    _accelerated = false;
+  }
+  return true;
+}
+
+void FirDecimator::reset() {
+  for (size_t i = 0; i < 2 * MAX_TAPS; i++) {
+    _delay[i] = 0;
+  }
+  _pos = 0;
+  _phase = 0;
+}
+
+size_t FirDecimator::process(const int16_t* in, size_t count, int16_t* out) {
+  const size_t taps = _design->tapCount;
+  const size_t factor = _design->factor;
+  size_t written = 0;
+  for (size_t i = 0; i < count; i++) {
+    // Both copies, so _delay[_pos .. _pos + taps) is always the window
+    int16_t x = in[i];
+    _delay[_pos] = x;
+    _delay[_pos + taps] = x;
+    if (++_pos == taps) {
+      _pos = 0;
+    }
+    if (++_phase < factor) {
+      continue;
+    }
+    _phase = 0;
+    // in[i] has been read, so out may run behind it in the same buffer
+    out[written++] = output(_delay + _pos);
+  }
+  return written;
+}
+
+int16_t FirDecimator::output(const int16_t* window) const {
+#if DECIMATOR_ESP_DSP
+  if (_accelerated) {
+    // Rounds with 0x7fff and shifts by 15 like the scalar path; the tap
+    // scaling keeps the result in range, so nothing wraps
+    int16_t y;
+    dsps_dotprod_s16(_design->taps, window, &y, (int)_design->tapCount, 0);
+    return applyMakeup(y, _design->makeupGain);
+  }
+#endif
+  int32_t y = (dotScalar(window) + 0x7fff) >> 15;
+  return applyMakeup(y, _design->makeupGain);
+}
+
+// The tap sum bounds every partial sum below 2^30, so the order of the
+// additions does not change the result
+int32_t FirDecimator::dotScalar(const int16_t* w) const {
+  const int16_t* h = _design->taps;
+  const size_t n = _design->tapCount;
+  int32_t acc0 = 0;
+  int32_t acc1 = 0;
+  if (_design->halfBand) {
+    // Centre tap, then the non-zero pairs at odd distances around it
+    const size_t center = n / 2 - 1;
+    acc0 = h[center] * (int32_t)w[center];
+    size_t k = 1;
+    for (; k + 2 <= center; k += 4) {
+      acc0 += h[center - k] * ((int32_t)w[center - k] + w[center + k]);
+      acc1 += h[center - k - 2] * ((int32_t)w[center - k - 2] + w[center + k + 2]);
+    }
+    for (; k <= center; k += 2) {
+      acc0 += h[center - k] * ((int32_t)w[center - k] + w[center + k]);
+    }
+    return acc0 + acc1;
+  }
+  // Symmetric: fold the window so each tap multiplies once
+  int32_t acc2 = 0;
+  int32_t acc3 = 0;
+  const size_t half = n / 2;
+  size_t j = 0;
+  for (; j + 4 <= half; j += 4) {
+    acc0 += h[j] * ((int32_t)w[j] + w[n - 1 - j]);
+    acc1 += h[j + 1] * ((int32_t)w[j + 1] + w[n - 2 - j]);
+    acc2 += h[j + 2] * ((int32_t)w[j + 2] + w[n - 3 - j]);
+    acc3 += h[j + 3] * ((int32_t)w[j + 3] + w[n - 4 - j]);
+  }
+  for (; j < half; j++) {
+    acc0 += h[j] * ((int32_t)w[j] + w[n - 1 - j]);
+  }
+  return acc0 + acc1 + acc2 + acc3;
+}
+
+// Full-scale noise and both rails through the esp-dsp kernel and ours
+bool FirDecimator::acceleratedMatches() const {
+#if DECIMATOR_ESP_DSP
+  alignas(4) int16_t window[MAX_TAPS];
+  uint32_t seed = 0x2545F491;
+  for (int round = 0; round < 64; round++) {
+    for (size_t j = 0; j < _design->tapCount; j++) {
+      seed = seed * 1664525 + 1013904223;
+      int16_t noise = (int16_t)(seed >> 16);
+      // Rails matched to the tap signs reach the largest sums
+      int16_t rail = _design->taps[j] < 0 ? INT16_MIN : INT16_MAX;
+      window[j] = round == 0 ? rail : round == 1 ? (int16_t)(-1 - rail) : noise;
+    }
+    int16_t y;
+    dsps_dotprod_s16(_design->taps, window, &y, (int)_design->tapCount, 0);
+    if (y != (int16_t)((dotScalar(window) + 0x7fff) >> 15)) {
+      return false;
+    }
+  }
+  return true;
+#else
+  return false;
+#endif
+}
+
+size_t firDecimateReference(const FirDecimator::Design& design, const int16_t* in, size_t count, int16_t* out) {
+  size_t written = 0;
+  for (size_t n = design.factor - 1; n < count; n += design.factor) {
+    int64_t acc = 0;
+    for (size_t j = 0; j < design.tapCount; j++) {
+      // Tap j sees input n - (tapCount - 1) + j; silence before the first
+      if (n + j + 1 >= design.tapCount) {
+        acc += (int64_t)design.taps[j] * in[n + j + 1 - design.tapCount];
+      }
+    }
+    out[written++] = applyMakeup((int32_t)((acc + 0x7fff) >> 15), design.makeupGain);
+  }
+  return written;
+}
+
+bool CaptureDecimator::supports(uint32_t outputRate) {
+  return outputRate == 24000 || outputRate == 16000 || outputRate == 12000 || outputRate == 8000;
+}
+
+bool CaptureDecimator::begin(uint32_t outputRate, bool accelerated) {
+  const FirDecimator::Design* first = &DECIMATE_BY_2;
+  const FirDecimator::Design* second = nullptr;
+  switch (outputRate) {
+    case 24000: break;
+    case 16000: first = &DECIMATE_BY_3; break;
+    case 12000: second = &DECIMATE_BY_2; break;
+    case 8000: second = &DECIMATE_BY_3; break;
+    default: return false;
+  }
+  if (!_stages[0].begin(*first, accelerated) || (second != nullptr && !_stages[1].begin(*second, accelerated))) {
+    return false;
+  }
+  _stageCount = second != nullptr ? 2 : 1;
+  _factor = first->factor * (second != nullptr ? second->factor : 1);
+  _outputRate = outputRate;
+  return true;
+}
+
+void CaptureDecimator::reset() {
+  for (size_t i = 0; i < _stageCount; i++) {
+    _stages[i].reset();
+  }
+}
+
+size_t CaptureDecimator::process(int16_t* samples, size_t count) {
+  for (size_t i = 0; i < _stageCount; i++) {
+    count = _stages[i].process(samples, count, samples);
+  }
+  return count;
+}
+
+bool CaptureDecimator::accelerated() const {
+  return _stageCount > 0 && _stages[0].accelerated();
+}
@@ -0,0 +1,99 @@
+#ifndef DECIMATOR_H
+#define DECIMATOR_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Sample-rate reduction for a microphone run at 48 kHz, so the anti-alias
+// filter is ours rather than the driver's.
+//
+// Each stage is a fixed-point FIR that only computes the outputs it keeps
+// (the polyphase form of filter-then-drop). Its delay line is stored twice
+// over, so the taps always see one contiguous window and the inner loop
+// needs no wraparound. Tap tables are scaled so the sum of their magnitudes
+// stays below 1.0: no input can overflow a stage before the makeup gain,
+// which lets the device run the dot product through esp-dsp and still match
+// the scalar kernel bit for bit. The cost is up to one bit of precision in
+// the intermediate, well below the microphone's noise.
+//
+// Output of one stage, for the window w of the newest tapCount inputs:
+//   y   = (sum(taps[j] * w[j]) + 0x7fff) >> 15
+//   out = saturate16((y * makeupGain + 0x2000) >> 14)
+
+class FirDecimator {
+public:
+  static constexpr size_t MAX_TAPS = 96;
+
+  struct Design {
+    const int16_t* taps;  // Q15, oldest input first
+    size_t tapCount;      // multiple of 4, at most MAX_TAPS
+    size_t factor;        // keeps one output in factor
+    int32_t makeupGain;   // Q14, brings the DC gain back to 1.0
+    // Every second tap is zero apart from the centre one at tapCount / 2 - 1
+    // (an odd-length half-band padded with a trailing zero). Otherwise the
+    // taps must be symmetric.
+    bool halfBand;
+  };
+
+  // accelerated asks for esp-dsp on the device; it is used only if it
+  // reproduces the scalar kernel on a test signal
+  bool begin(const Design& design, bool accelerated = true);
+  void reset();
+  // Writes one output per factor inputs to out, which may be in; returns
+  // how many. Inputs left over carry to the next call.
+  size_t process(const int16_t* in, size_t count, int16_t* out);
+
+  bool accelerated() const { return _accelerated; }
+  const Design& design() const { return *_design; }
+
+private:
+  int16_t output(const int16_t* window) const;
+  int32_t dotScalar(const int16_t* window) const;
+  bool acceleratedMatches() const;
+
+  const Design* _design = nullptr;
+  bool _accelerated = false;
+  alignas(4) int16_t _delay[2 * MAX_TAPS] = {};
+  size_t _pos = 0;    // where the next input goes
+  size_t _phase = 0;  // inputs since the last output
+};
+
+// The stage arithmetic as one plain loop per output, starting from silence,
+// to check the kernels against
+size_t firDecimateReference(const FirDecimator::Design& design, const int16_t* in, size_t count, int16_t* out);
+
+// 47-tap half-band (Kaiser, beta 6), padded to 48: flat to 0.21 fs (10 kHz at
+// 48 kHz in), down 60 dB from 0.29 fs
+extern const FirDecimator::Design DECIMATE_BY_2;
+// 96-tap low-pass (Kaiser, beta 6), one output in three: flat to 0.146 fs
+// (7 kHz at 48 kHz in), down 60 dB from 0.1875 fs
+extern const FirDecimator::Design DECIMATE_BY_3;
+
+// 48 kHz down to 24 kHz (/2), 16 kHz (/3), 12 kHz (/2 /2) or 8 kHz (/2 /3).
+// Everything that would alias into the band the stream keeps (10, 7, 5 and
+// 3.5 kHz) is down by 60 dB.
+class CaptureDecimator {
+public:
+  static constexpr uint32_t INPUT_RATE = 48000;
+  static constexpr size_t MAX_FACTOR = 6;
+
+  static bool supports(uint32_t outputRate);
+
+  bool begin(uint32_t outputRate, bool accelerated = true);
+  void reset();
+  // Decimates count samples in place and returns how many remain; exactly
+  // count / factor() when every call passes a multiple of factor()
+  size_t process(int16_t* samples, size_t count);
+
+  size_t factor() const { return _factor; }
+  uint32_t outputRate() const { return _outputRate; }
+  bool accelerated() const;
+
+private:
+  FirDecimator _stages[2];
+  size_t _stageCount = 0;
+  size_t _factor = 1;
+  uint32_t _outputRate = INPUT_RATE;
+};
+
+#endif
@@ -0,0 +1,132 @@
+#include "filters.h"
+#include "q15.h"
+#include <math.h>
+
+bool DcBlocker::begin(int32_t pole) {
+  if (pole <= 0 || pole >= Q15_ONE) {
+    return false;
+  }
+  _pole = pole;
+  reset();
+  return true;
+}
+
+void DcBlocker::reset() {
+  _previousIn = 0;
+  _previousOut = 0;
+  _error = 0;
+}
+
+void DcBlocker::process(int16_t* samples, size_t count) {
+  int32_t previousIn = _previousIn;
+  int32_t previousOut = _previousOut;
+  int32_t error = _error;
+
+  for (size_t i = 0; i < count; i++) {
+    int32_t x = samples[i];
+    // |pole * y| < 2^30, so this stays in 32 bits
+    int32_t feedback = _pole * previousOut + error;
+    int32_t y = x - previousIn + (feedback >> 15);
+    error = feedback & (Q15_ONE - 1);
+    previousIn = x;
+    previousOut = saturate16(y);
+    samples[i] = (int16_t)previousOut;
+  }
+
+  _previousIn = previousIn;
+  _previousOut = previousOut;
+  _error = error;
+}
+
+bool Biquad::designHighPass(uint32_t sampleRate, float cornerHz, Coefficients& out) {
+  if (sampleRate == 0 || cornerHz <= 0 || cornerHz >= sampleRate / 2.0f) {
+    return false;
+  }
+  float w0 = 2.0f * (float)M_PI * cornerHz / (float)sampleRate;
+  float alpha = sinf(w0) / (2.0f * 0.70710678f);
+  float cosw0 = cosf(w0);
+  float a0 = 1.0f + alpha;
+
+  out.b0 = toFixed((1.0f + cosw0) / 2.0f / a0, COEFFICIENT_BITS);
+  out.b1 = toFixed(-(1.0f + cosw0) / a0, COEFFICIENT_BITS);
+  out.b2 = out.b0;
+  out.a1 = toFixed(-2.0f * cosw0 / a0, COEFFICIENT_BITS);
+  out.a2 = toFixed((1.0f - alpha) / a0, COEFFICIENT_BITS);
+  return true;
+}
+
+void Biquad::begin(const Coefficients& coefficients) {
+  _c = coefficients;
+  reset();
+}
+
+void Biquad::reset() {
+  _x1 = _x2 = 0;
+  _y1 = _y2 = 0;
+  _error = 0;
+}
+
+void Biquad::process(int16_t* samples, size_t count) {
+  const int32_t b0 = _c.b0, b1 = _c.b1, b2 = _c.b2, a1 = _c.a1, a2 = _c.a2;
+  const int64_t mask = (1 << COEFFICIENT_BITS) - 1;
+  int32_t x1 = _x1, x2 = _x2, y1 = _y1, y2 = _y2;
+  int64_t error = _error;
+
+  for (size_t i = 0; i < count; i++) {
+    int32_t x = samples[i];
+    int64_t acc = (int64_t)b0 * x + (int64_t)b1 * x1 + (int64_t)b2 * x2
+                - (int64_t)a1 * y1 - (int64_t)a2 * y2 + error;
+    error = acc & mask;
+    int16_t y = saturate16(acc >> COEFFICIENT_BITS);
+    x2 = x1;
+    x1 = x;
+    y2 = y1;
+    y1 = y;
+    samples[i] = y;
+  }
+
+  _x1 = x1;
+  _x2 = x2;
+  _y1 = y1;
+  _y2 = y2;
+  _error = error;
+}
+
+// Nonzero taps either side of the center (which is 1/2), Q15, nearest first
+static const int32_t HALF_BAND_TAPS[8] = { 10304, -3113, 1527, -795, 393, -171, 58, -10 };
+
+void HalfBandDecimator::reset() {
+  for (size_t i = 0; i < HISTORY; i++) {
+    _history[i] = 0;
+  }
+  _pos = 0;
+  _emitNext = false;
+}
+
+size_t HalfBandDecimator::process(const int16_t* in, size_t count, int16_t* out) {
+  static constexpr size_t MASK = HISTORY - 1;
+  static constexpr size_t CENTER = (TAPS - 1) / 2;
+  size_t written = 0;
+
+  for (size_t i = 0; i < count; i++) {
+    _history[_pos] = in[i];
+    size_t newest = _pos;
+    _pos = (_pos + 1) & MASK;
+    bool emit = _emitNext;
+    _emitNext = !_emitNext;
+    if (!emit) {
+      continue;
+    }
+
+    // The output lines up with the input CENTER samples back
+    size_t center = (newest - CENTER) & MASK;
+    int32_t acc = (int32_t)_history[center] << 14;
+    for (size_t k = 0; k < 8; k++) {
+      size_t offset = 2 * k + 1;
+      acc += HALF_BAND_TAPS[k] * ((int32_t)_history[(center - offset) & MASK] +
+                                  (int32_t)_history[(center + offset) & MASK]);
+    }
+    out[written++] = saturate16((acc + (1 << 14)) >> 15);
+  }
+  return written;
+}
@@ -0,0 +1,78 @@
+#ifndef FILTERS_H
+#define FILTERS_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Fixed-point filters for the capture front-end. They work on Q15 blocks
+// (the first two in place) and keep their state across blocks, so a stream
+// can be fed in any block size with the same result.
+
+// First-order DC blocker: y[n] = x[n] - x[n-1] + r * y[n-1].
+// The rounding error of the feedback term is carried to the next sample, so
+// the output has no DC offset and no limit cycles.
+class DcBlocker {
+public:
+  // pole is r in Q15; 0.995 puts the corner at ~13 Hz for 16 kHz audio
+  static constexpr int32_t DEFAULT_POLE = 32604;
+
+  bool begin(int32_t pole = DEFAULT_POLE);
+  void reset();
+  void process(int16_t* samples, size_t count);
+
+private:
+  int32_t _pole = DEFAULT_POLE;
+  int32_t _previousIn = 0;
+  int32_t _previousOut = 0;
+  int32_t _error = 0;
+};
+
+// Direct form I biquad with Q14 coefficients (range +-2) and a 64-bit
+// accumulator. The truncation error is fed back into the next output
+// (first-order noise shaping), which keeps low-frequency filters quiet.
+class Biquad {
+public:
+  static constexpr int COEFFICIENT_BITS = 14;
+
+  struct Coefficients {
+    int32_t b0, b1, b2, a1, a2; // Q14; a0 is 1
+  };
+
+  // Second-order Butterworth high-pass (RBJ cookbook, Q = 1/sqrt(2)).
+  // Designed in float once; filtering is integer only.
+  static bool designHighPass(uint32_t sampleRate, float cornerHz, Coefficients& out);
+
+  void begin(const Coefficients& coefficients);
+  void reset();
+  void process(int16_t* samples, size_t count);
+
+  const Coefficients& coefficients() const { return _c; }
+
+private:
+  Coefficients _c = { 1 << COEFFICIENT_BITS, 0, 0, 0, 0 };
+  int32_t _x1 = 0, _x2 = 0;
+  int32_t _y1 = 0, _y2 = 0;
+  int64_t _error = 0;
+};
+
+// Halves the sample rate: a 31-tap half-band low-pass (Kaiser, beta 6),
+// then every second sample. At 16 kHz in, the passband is flat to 3 kHz
+// (< 0.01 dB) and what would alias back below 3 kHz is down by 56 dB.
+// Half of the taps are zero, so an output costs 8 multiplies.
+class HalfBandDecimator {
+public:
+  static constexpr size_t TAPS = 31;
+
+  void reset();
+  // Writes one output per two inputs to out (room for count / 2 + 1) and
+  // returns how many; an odd input count carries over to the next block
+  size_t process(const int16_t* in, size_t count, int16_t* out);
+
+private:
+  static constexpr size_t HISTORY = 32;  // power of two above TAPS
+  int16_t _history[HISTORY] = {};
+  size_t _pos = 0;         // where the next input goes
+  bool _emitNext = false;  // the next input completes an output
+};
+
+#endif
@@ -0,0 +1,23 @@
+#include "frontend.h"
+
+bool AudioFrontEnd::begin(uint32_t sampleRate, float highPassHz, const Agc::Config& agc) {
+  Biquad::Coefficients highPass;
+  if (!Biquad::designHighPass(sampleRate, highPassHz, highPass) ||
+      !_dcBlocker.begin() || !_agc.begin(agc)) {
+    return false;
+  }
+  _highPass.begin(highPass);
+  return true;
+}
+
+void AudioFrontEnd::reset() {
+  _dcBlocker.reset();
+  _highPass.reset();
+  _agc.reset();
+}
+
+void AudioFrontEnd::process(int16_t* samples, size_t count) {
+  _dcBlocker.process(samples, count);
+  _highPass.process(samples, count);
+  _agc.process(samples, count);
+}
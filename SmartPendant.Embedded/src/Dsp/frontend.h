@@ -0,0 +1,26 @@
+#ifndef FRONTEND_H
+#define FRONTEND_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "filters.h"
+#include "agc.h"
+
+// Conditioning applied to captured audio before it is encoded:
+// DC blocker -> high-pass biquad -> look-ahead AGC, all in Q15 and in place.
+// The output lags the input by AGC_DELAY_SAMPLES.
+class AudioFrontEnd {
+public:
+  bool begin(uint32_t sampleRate, float highPassHz, const Agc::Config& agc);
+  void reset();
+  void process(int16_t* samples, size_t count);
+
+  const Agc& agc() const { return _agc; }
+
+private:
+  DcBlocker _dcBlocker;
+  Biquad _highPass;
+  Agc _agc;
+};
+
+#endif
@@ -0,0 +1,66 @@
+#include "level_meter.h"
+#include "q15.h"
+#include <math.h>
+
+// Samples at or beyond this magnitude count as clipped
+static constexpr int32_t CLIP_LEVEL = 32767;
+// Held peak falls by 1/8 per window (~12 dB/s with 50 ms windows)
+static constexpr int PEAK_HOLD_FALL_SHIFT = 3;
+
+bool LevelMeter::begin(size_t windowSamples) {
+  // Keeps the sum of squares within 64 bits and the mean within 32
+  if (windowSamples == 0 || windowSamples > (1u << 20)) {
+    return false;
+  }
+  _windowSamples = windowSamples;
+  reset();
+  return true;
+}
+
+void LevelMeter::reset() {
+  _filled = 0;
+  _sumSquares = 0;
+  _windowPeak = 0;
+  _clipped = 0;
+  _peak.store(0, std::memory_order_relaxed);
+  _rms.store(0, std::memory_order_relaxed);
+  _peakHold.store(0, std::memory_order_relaxed);
+}
+
+void LevelMeter::publish() {
+  uint32_t meanSquare = (uint32_t)(_sumSquares / _filled);
+  uint16_t peak = (uint16_t)_windowPeak;
+  _rms.store((uint16_t)isqrt32(meanSquare), std::memory_order_relaxed);
+  _peak.store(peak, std::memory_order_relaxed);
+
+  uint16_t hold = _peakHold.load(std::memory_order_relaxed);
+  hold -= hold >> PEAK_HOLD_FALL_SHIFT;
+  _peakHold.store(peak > hold ? peak : hold, std::memory_order_relaxed);
+
+  _filled = 0;
+  _sumSquares = 0;
+  _windowPeak = 0;
+}
+
+void LevelMeter::process(const int16_t* samples, size_t count) {
+  if (_windowSamples == 0) {
+    return;
+  }
+  for (size_t i = 0; i < count; i++) {
+    int32_t x = samples[i];
+    int32_t magnitude = x < 0 ? -x : x;
+    if (magnitude > _windowPeak) _windowPeak = magnitude;
+    if (magnitude >= CLIP_LEVEL) _clipped++;
+    _sumSquares += (uint32_t)(x * x);
+    if (++_filled == _windowSamples) {
+      publish();
+    }
+  }
+}
+
+float LevelMeter::toDbfs(uint16_t level) {
+  if (level == 0) {
+    return -96.0f;
+  }
+  return 20.0f * log10f((float)level / 32768.0f);
+}
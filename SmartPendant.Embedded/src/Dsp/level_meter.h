@@ -0,0 +1,41 @@
+#ifndef LEVEL_METER_H
+#define LEVEL_METER_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <atomic>
+
+// Peak and RMS meter over fixed windows.
+//
+// process() runs on the capture path; every windowSamples it publishes the
+// window's peak and RMS (linear, 0..32768), which other tasks may read at
+// any time. The peak also has a slow-falling hold for display.
+class LevelMeter {
+public:
+  bool begin(size_t windowSamples);
+  void reset();
+  void process(const int16_t* samples, size_t count);
+
+  uint16_t peak() const { return _peak.load(std::memory_order_relaxed); }
+  uint16_t rms() const { return _rms.load(std::memory_order_relaxed); }
+  uint16_t peakHold() const { return _peakHold.load(std::memory_order_relaxed); }
+  uint32_t clippedSamples() const { return _clipped; }
+
+  // Linear level to dB relative to full scale; silence reads as -96 dB
+  static float toDbfs(uint16_t level);
+
+private:
+  void publish();
+
+  size_t _windowSamples = 0;
+  size_t _filled = 0;
+  uint64_t _sumSquares = 0;
+  int32_t _windowPeak = 0;
+  uint32_t _clipped = 0;
+
+  std::atomic<uint16_t> _peak{0};
+  std::atomic<uint16_t> _rms{0};
+  std::atomic<uint16_t> _peakHold{0};
+};
+
+#endif
@@ -0,0 +1,432 @@
+#include "log_mel.h"
+#include <math.h>
+#include <string.h>
+
+#if defined(ESP_PLATFORM) && __has_include(<esp_dsp.h>)
+#include <esp_dsp.h>
+#define LOG_MEL_ESP_DSP 1
+#else
+#define LOG_MEL_ESP_DSP 0
+#endif
+
+typedef LogMelExtractor LM;
+
+// The two FFTs round differently at each stage; a few LSB apart is the same result
+static constexpr int FFT_MATCH_LSB = 4;
+
+// The bin power of a full-scale sine: amplitude 32768 times the Hann window's sum / 2
+static constexpr double FULL_SCALE_BIN = 32768.0 * (LM::WINDOW_SAMPLES / 2) / 2;
+
+// log2(1 + i / 32), Q16
+static const int32_t LOG2_TABLE[33] = {
+      0,  2909,  5732,  8473, 11136, 13727, 16248, 18704, 21098, 23433, 25711,
+  27936, 30109, 32234, 34312, 36346, 38336, 40286, 42196, 44068, 45904, 47705,
+  49472, 51207, 52911, 54584, 56229, 57845, 59434, 60997, 62534, 64047, 65536,
+};
+
+// log2(x) in Q16 for x >= 1, from the leading bit and the table
+static int32_t log2Q16(uint32_t x) {
+  int top = 31 - __builtin_clz(x);
+  uint32_t m = top >= 30 ? x >> (top - 30) : x << (30 - top);  // [2^30, 2^31)
+  uint32_t f = m - (1UL << 30);
+  uint32_t i = f >> 25;
+  int32_t frac = (int32_t)((f >> 9) & 0xffff);
+  return (top << 16) + LOG2_TABLE[i] + (((LOG2_TABLE[i + 1] - LOG2_TABLE[i]) * frac) >> 16);
+}
+
+// Slaney's mel scale: linear to 1 kHz, logarithmic above
+static const double MEL_LINEAR_HZ = 200.0 / 3;
+static const double MEL_LOG_STEP = log(6.4) / 27;
+
+static double hzToMel(double hz) {
+  return hz < 1000 ? hz / MEL_LINEAR_HZ : 15 + log(hz / 1000) / MEL_LOG_STEP;
+}
+
+static double melToHz(double mel) {
+  return mel < 15 ? mel * MEL_LINEAR_HZ : 1000 * exp(MEL_LOG_STEP * (mel - 15));
+}
+
+// Weights of one band over the spectrum bins, adding up to one, and the
+// first and last bin with a weight. Shared by the kernel and the reference.
+static bool melBand(size_t band, double* weights, size_t& first, size_t& last) {
+  double top = hzToMel(LM::SAMPLE_RATE / 2);
+  double low = melToHz(top * band / (LM::MEL_BANDS + 1));
+  double center = melToHz(top * (band + 1) / (LM::MEL_BANDS + 1));
+  double high = melToHz(top * (band + 2) / (LM::MEL_BANDS + 1));
+  double sum = 0;
+  first = LM::SPECTRUM_BINS;
+  last = 0;
+  for (size_t k = 0; k < LM::SPECTRUM_BINS; k++) {
+    double hz = (double)k * LM::SAMPLE_RATE / LM::FFT_SIZE;
+    double rising = (hz - low) / (center - low);
+    double falling = (high - hz) / (high - center);
+    double w = rising < falling ? rising : falling;
+    weights[k] = w > 0 ? w : 0;
+    if (weights[k] > 0) {
+      sum += weights[k];
+      if (k < first) first = k;
+      last = k;
+    }
+  }
+  if (sum <= 0) {
+    return false;
+  }
+  for (size_t k = 0; k < LM::SPECTRUM_BINS; k++) {
+    weights[k] /= sum;
+  }
+  return true;
+}
+
+static double hann(size_t n) {
+  return 0.5 - 0.5 * cos(2 * M_PI * n / LM::WINDOW_SAMPLES);
+}
+
+bool LogMelExtractor::begin(bool accelerated) {
+  for (size_t n = 0; n < WINDOW_SAMPLES; n++) {
+    _window[n] = (int16_t)lround(hann(n) * INT16_MAX);
+  }
+  for (size_t k = 0; k <= HALF_FFT; k++) {
+    _cos[k] = (int16_t)lround(cos(2 * M_PI * k / FFT_SIZE) * INT16_MAX);
+    _sin[k] = (int16_t)lround(sin(2 * M_PI * k / FFT_SIZE) * INT16_MAX);
+  }
+
+  double weights[SPECTRUM_BINS];
+  size_t offset = 0;
+  for (size_t b = 0; b < MEL_BANDS; b++) {
+    size_t first, last;
+    if (!melBand(b, weights, first, last)) {
+      return false;
+    }
+    size_t used = last - first + 1;
+    size_t count = (used + 3) & ~(size_t)3;
+    if (count > MAX_BAND_BINS || offset + count > MAX_WEIGHTS) {
+      return false;
+    }
+    // Rounded to Q15, then trimmed so the sum stays below 1.0 and the dot
+    // product cannot leave 16 bits
+    int32_t sum = 0;
+    size_t largest = 0;
+    for (size_t i = 0; i < count; i++) {
+      int16_t w = i < used ? (int16_t)lround(weights[first + i] * INT16_MAX) : 0;
+      _weights[offset + i] = w;
+      sum += w;
+      if (w > _weights[offset + largest]) largest = i;
+    }
+    if (sum > INT16_MAX) {
+      _weights[offset + largest] -= (int16_t)(sum - INT16_MAX);
+    }
+    _bands[b] = { (uint16_t)first, (uint16_t)used, (uint16_t)count, (uint16_t)offset };
+    offset += count;
+  }
+
+  // q = factor * log2(power / FULL_SCALE_BIN^2) + offset. The FFT leaves
+  // |X| / 512 and the band sum is in units of 2^-15 of a Q15 weight sum of one.
+  double perDoubling = 10 * log10(2.0) / DB_STEP;
+  double log2Unit = log2((double)FFT_SIZE * FFT_SIZE) - 2 * log2(FULL_SCALE_BIN);
+  _factor = llround(perDoubling * 65536);
+  _offset = llround((perDoubling * log2Unit - DB_FLOOR / DB_STEP) * 4294967296.0);
+
+  _acceleratedFft = LOG_MEL_ESP_DSP && accelerated && acceleratedFftMatches();
+  _acceleratedBands = LOG_MEL_ESP_DSP && accelerated && acceleratedBandsMatch();
+  _ready = true;
+  reset();
+  return true;
+}
+
+void LogMelExtractor::reset() {
+  _filled = 0;
+  _frameStart = 0;
+  _skipping = 0;
+}
+
+void LogMelExtractor::skip(size_t count) {
+  uint32_t next = _frameStart + (uint32_t)_filled - _skipping + (uint32_t)count;
+  uint32_t aligned = (next + HOP_SAMPLES - 1) / HOP_SAMPLES * HOP_SAMPLES;
+  _filled = 0;
+  _frameStart = aligned;
+  _skipping = aligned - next;
+}
+
+size_t LogMelExtractor::append(const int16_t* samples, size_t count) {
+  size_t taken = 0;
+  if (_skipping > 0) {
+    taken = count < _skipping ? count : _skipping;
+    _skipping -= (uint32_t)taken;
+  }
+  size_t n = count - taken;
+  if (n > WINDOW_SAMPLES - _filled) {
+    n = WINDOW_SAMPLES - _filled;
+  }
+  memcpy(_frame + _filled, samples + taken, n * sizeof(int16_t));
+  _filled += n;
+  return taken + n;
+}
+
+uint32_t LogMelExtractor::takeFrame(uint8_t* out) {
+  computeFrame(_frame, out);
+  uint32_t start = _frameStart;
+  // The next window overlaps this one by all but a hop
+  memmove(_frame, _frame + HOP_SAMPLES, (WINDOW_SAMPLES - HOP_SAMPLES) * sizeof(int16_t));
+  _filled = WINDOW_SAMPLES - HOP_SAMPLES;
+  _frameStart += HOP_SAMPLES;
+  return start;
+}
+
+void LogMelExtractor::computeFrame(const int16_t* window, uint8_t* out) {
+  int shift;
+  if (!_ready || !windowFrame(window, _data, shift)) {
+    memset(out, 0, MEL_BANDS);
+    return;
+  }
+  fft(_data);
+  powerSpectrum(_data, _power);
+
+  alignas(4) int16_t scaled[MAX_BAND_BINS];
+  for (size_t b = 0; b < MEL_BANDS; b++) {
+    const Band& band = _bands[b];
+    const uint32_t* power = _power + band.firstBin;
+    uint32_t peak = 0;
+    for (size_t i = 0; i < band.usedBins; i++) {
+      if (power[i] > peak) peak = power[i];
+    }
+    int bandShift = peak > INT16_MAX ? 17 - __builtin_clz(peak) : 0;
+    for (size_t i = 0; i < band.binCount; i++) {
+      scaled[i] = i < band.usedBins ? (int16_t)(power[i] >> bandShift) : 0;
+    }
+    out[b] = quantize(bandSum(band, scaled), 2 * shift - bandShift);
+  }
+}
+
+bool LogMelExtractor::windowFrame(const int16_t* window, int16_t* data, int& shift) const {
+  int32_t peak = 0;
+  for (size_t n = 0; n < WINDOW_SAMPLES; n++) {
+    int32_t v = window[n] * (int32_t)_window[n];
+    int32_t magnitude = v < 0 ? -v : v;
+    if (magnitude > peak) peak = magnitude;
+  }
+  if (peak == 0) {
+    return false;
+  }
+  // The Q15 products are rounded once, straight to a peak of 8192..16384:
+  // one bit of headroom keeps every FFT stage in range, and quiet frames
+  // keep the bits below the input's LSB
+  int down = 0;
+  while ((peak >> down) > 16383) {
+    down++;
+  }
+  shift = 15 - down;
+  int32_t half = down > 0 ? 1 << (down - 1) : 0;
+  for (size_t n = 0; n < WINDOW_SAMPLES; n++) {
+    int32_t v = window[n] * (int32_t)_window[n];
+    data[n] = (int16_t)(down > 0 ? (v + half) >> down : v);
+  }
+  for (size_t n = WINDOW_SAMPLES; n < FFT_SIZE; n++) {
+    data[n] = 0;
+  }
+  return true;
+}
+
+// Radix-2 decimation in time on 256 complex values, halving at each stage,
+// so the result is the DFT / 256
+void LogMelExtractor::fftPortable(int16_t* data) const {
+  const size_t n = HALF_FFT;
+  for (size_t i = 1, j = 0; i < n; i++) {
+    size_t bit = n >> 1;
+    for (; j & bit; bit >>= 1) {
+      j ^= bit;
+    }
+    j |= bit;
+    if (i < j) {
+      int16_t re = data[2 * i];
+      int16_t im = data[2 * i + 1];
+      data[2 * i] = data[2 * j];
+      data[2 * i + 1] = data[2 * j + 1];
+      data[2 * j] = re;
+      data[2 * j + 1] = im;
+    }
+  }
+  for (size_t half = 1; half < n; half <<= 1) {
+    // Twiddle k of this stage is exp(-2 pi i k / (2 * half)), index k * step of the 512 table
+    size_t step = FFT_SIZE / (2 * half);
+    for (size_t start = 0; start < n; start += 2 * half) {
+      for (size_t k = 0; k < half; k++) {
+        int32_t c = _cos[k * step];
+        int32_t s = _sin[k * step];
+        int16_t* a = data + 2 * (start + k);
+        int16_t* b = a + 2 * half;
+        int32_t tr = (b[0] * c + b[1] * s + 0x4000) >> 15;
+        int32_t ti = (b[1] * c - b[0] * s + 0x4000) >> 15;
+        int32_t ar = a[0];
+        int32_t ai = a[1];
+        a[0] = (int16_t)((ar + tr + 1) >> 1);
+        a[1] = (int16_t)((ai + ti + 1) >> 1);
+        b[0] = (int16_t)((ar - tr + 1) >> 1);
+        b[1] = (int16_t)((ai - ti + 1) >> 1);
+      }
+    }
+  }
+}
+
+void LogMelExtractor::fft(int16_t* data) const {
+#if LOG_MEL_ESP_DSP
+  if (_acceleratedFft) {
+    dsps_fft2r_sc16(data, HALF_FFT);
+    dsps_bit_rev_sc16_ansi(data, HALF_FFT);
+    return;
+  }
+#endif
+  fftPortable(data);
+}
+
+// With Z the FFT of z[n] = x[2n] + i x[2n + 1] and W = exp(-2 pi i k / 512):
+//   X[k] = (Z[k] + conj(Z[256 - k])) / 2 + W (Z[k] - conj(Z[256 - k])) / 2i
+// Z is already the DFT / 256, so a further quarter leaves X / 512.
+void LogMelExtractor::powerSpectrum(const int16_t* data, uint32_t* power) const {
+  for (size_t k = 0; k <= HALF_FFT; k++) {
+    const int16_t* z = data + 2 * (k % HALF_FFT);
+    const int16_t* m = data + 2 * ((HALF_FFT - k) % HALF_FFT);
+    int32_t er = z[0] + m[0];
+    int32_t ei = z[1] - m[1];
+    int32_t odr = z[1] + m[1];
+    int32_t odi = m[0] - z[0];
+    int32_t c = _cos[k];
+    int32_t s = _sin[k];
+    int32_t xr = (er + ((c * odr + s * odi + 0x4000) >> 15) + 2) >> 2;
+    int32_t xi = (ei + ((c * odi - s * odr + 0x4000) >> 15) + 2) >> 2;
+    power[k] = (uint32_t)(xr * xr) + (uint32_t)(xi * xi);
+  }
+}
+
+// The weight sum bounds every partial sum below 2^30, like the decimator's
+// taps, so the order of the additions does not change the result
+int32_t LogMelExtractor::bandSumPortable(const Band& band, const int16_t* scaled) const {
+  const int16_t* w = _weights + band.weightOffset;
+  int32_t acc0 = 0;
+  int32_t acc1 = 0;
+  for (size_t i = 0; i < band.binCount; i += 4) {
+    acc0 += w[i] * (int32_t)scaled[i] + w[i + 2] * (int32_t)scaled[i + 2];
+    acc1 += w[i + 1] * (int32_t)scaled[i + 1] + w[i + 3] * (int32_t)scaled[i + 3];
+  }
+  return (acc0 + acc1 + 0x7fff) >> 15;
+}
+
+int32_t LogMelExtractor::bandSum(const Band& band, const int16_t* scaled) const {
+#if LOG_MEL_ESP_DSP
+  if (_acceleratedBands) {
+    int16_t y;
+    dsps_dotprod_s16(_weights + band.weightOffset, scaled, &y, (int)band.binCount, 0);
+    return y;
+  }
+#endif
+  return bandSumPortable(band, scaled);
+}
+
+uint8_t LogMelExtractor::quantize(int32_t sum, int shift) const {
+  if (sum <= 0) {
+    return 0;
+  }
+  int64_t log2Power = log2Q16((uint32_t)sum) - ((int64_t)shift << 16);
+  int64_t q = (log2Power * _factor + _offset + (1LL << 31)) >> 32;
+  return (uint8_t)(q < 0 ? 0 : q > 255 ? 255 : q);
+}
+
+// A windowed tone over noise through the esp-dsp FFT and ours
+bool LogMelExtractor::acceleratedFftMatches() {
+#if LOG_MEL_ESP_DSP
+  if (dsps_fft2r_init_sc16(NULL, HALF_FFT) != ESP_OK) {
+    return false;
+  }
+  alignas(4) int16_t expected[FFT_SIZE];
+  uint32_t seed = 0x2545F491;
+  for (size_t n = 0; n < WINDOW_SAMPLES; n++) {
+    seed = seed * 1664525 + 1013904223;
+    _frame[n] = (int16_t)(12000 * sin(2 * M_PI * 1000 * n / SAMPLE_RATE) + (int16_t)(seed >> 16) / 4);
+  }
+  int shift;
+  windowFrame(_frame, expected, shift);
+  memcpy(_data, expected, sizeof(expected));
+  fftPortable(expected);
+  dsps_fft2r_sc16(_data, HALF_FFT);
+  dsps_bit_rev_sc16_ansi(_data, HALF_FFT);
+  for (size_t i = 0; i < FFT_SIZE; i++) {
+    int32_t difference = _data[i] - expected[i];
+    if (difference > FFT_MATCH_LSB || difference < -FFT_MATCH_LSB) {
+      return false;
+    }
+  }
+  return true;
+#else
+  return false;
+#endif
+}
+
+// Full-scale and random powers through every band, esp-dsp against ours
+bool LogMelExtractor::acceleratedBandsMatch() const {
+#if LOG_MEL_ESP_DSP
+  alignas(4) int16_t scaled[MAX_BAND_BINS];
+  uint32_t seed = 0x2545F491;
+  for (int round = 0; round < 4; round++) {
+    for (size_t b = 0; b < MEL_BANDS; b++) {
+      const Band& band = _bands[b];
+      for (size_t i = 0; i < band.binCount; i++) {
+        seed = seed * 1664525 + 1013904223;
+        scaled[i] = round == 0 ? INT16_MAX : (int16_t)((seed >> 17) & INT16_MAX);
+      }
+      int16_t y;
+      dsps_dotprod_s16(_weights + band.weightOffset, scaled, &y, (int)band.binCount, 0);
+      if (y != bandSumPortable(band, scaled)) {
+        return false;
+      }
+    }
+  }
+  return true;
+#else
+  return false;
+#endif
+}
+
+void logMelReference(const int16_t* window, uint8_t* out, double* db) {
+  static double cosTable[LM::FFT_SIZE];
+  static double sinTable[LM::FFT_SIZE];
+  static double weights[LM::MEL_BANDS][LM::SPECTRUM_BINS];
+  static bool ready = false;
+  if (!ready) {
+    for (size_t i = 0; i < LM::FFT_SIZE; i++) {
+      cosTable[i] = cos(2 * M_PI * i / LM::FFT_SIZE);
+      sinTable[i] = sin(2 * M_PI * i / LM::FFT_SIZE);
+    }
+    for (size_t b = 0; b < LM::MEL_BANDS; b++) {
+      size_t first, last;
+      melBand(b, weights[b], first, last);
+    }
+    ready = true;
+  }
+
+  double x[LM::WINDOW_SAMPLES];
+  for (size_t n = 0; n < LM::WINDOW_SAMPLES; n++) {
+    x[n] = window[n] * hann(n);
+  }
+  double power[LM::SPECTRUM_BINS];
+  for (size_t k = 0; k < LM::SPECTRUM_BINS; k++) {
+    double re = 0;
+    double im = 0;
+    for (size_t n = 0; n < LM::WINDOW_SAMPLES; n++) {
+      size_t i = (k * n) % LM::FFT_SIZE;
+      re += x[n] * cosTable[i];
+      im -= x[n] * sinTable[i];
+    }
+    power[k] = re * re + im * im;
+  }
+  for (size_t b = 0; b < LM::MEL_BANDS; b++) {
+    double sum = 0;
+    for (size_t k = 0; k < LM::SPECTRUM_BINS; k++) {
+      sum += weights[b][k] * power[k];
+    }
+    double level = sum > 0 ? 10 * log10(sum / (FULL_SCALE_BIN * FULL_SCALE_BIN)) : -HUGE_VAL;
+    double q = floor((level - LM::DB_FLOOR) / LM::DB_STEP + 0.5);
+    out[b] = (uint8_t)(q < 0 ? 0 : q > 255 ? 255 : q);
+    if (db != nullptr) {
+      db[b] = level;
+    }
+  }
+}
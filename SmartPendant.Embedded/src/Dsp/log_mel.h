@@ -0,0 +1,116 @@
+#ifndef LOG_MEL_H
+#define LOG_MEL_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Log-mel spectrogram of the 16 kHz stream, for clients that want speech
+// features rather than audio.
+//
+// Every HOP_SAMPLES (10 ms) the newest WINDOW_SAMPLES (25 ms) go through a
+// Hann window, a 512-point real FFT and MEL_BANDS triangular filters spread
+// over 0-8 kHz on the Slaney mel scale. Each filter's weights add up to
+// one, so a band is the mean power of the bins it covers, and it leaves as
+// one byte:
+//   q = clamp(round((10 * log10(power) - DB_FLOOR) / DB_STEP), 0, 255)
+// with 0 dB the power a full-scale sine puts in the FFT bin at its
+// frequency, so q = 240 there and each step is 0.5 dB.
+//
+// The arithmetic is fixed point throughout. The windowed frame is scaled up
+// by a power of two until its peak uses 14 bits (block floating point), the
+// FFT halves its values at every stage so nothing overflows, and each band
+// brings its bin powers down to 16 bits with its own shift before the
+// weighted sum. The shifts come back in as whole powers of two in the log.
+// Bands more than about 65 dB below a frame's loudest read the FFT's
+// rounding noise rather than the signal; those within 40 dB of it match a
+// double-precision computation to within a step.
+// On the device the complex FFT and the band sums run through esp-dsp when
+// it agrees with the portable kernels on a test frame.
+class LogMelExtractor {
+public:
+  static constexpr uint32_t SAMPLE_RATE = 16000;
+  static constexpr size_t WINDOW_SAMPLES = 400;
+  static constexpr size_t HOP_SAMPLES = 160;
+  static constexpr size_t FFT_SIZE = 512;
+  static constexpr size_t SPECTRUM_BINS = FFT_SIZE / 2 + 1;
+  static constexpr size_t MEL_BANDS = 80;
+  static constexpr float DB_FLOOR = -120.0f;
+  static constexpr float DB_STEP = 0.5f;
+  static constexpr uint32_t WINDOW_MS = WINDOW_SAMPLES * 1000 / SAMPLE_RATE;
+
+  // accelerated asks for esp-dsp on the device; each kernel is used only if
+  // it reproduces the portable one on a test frame
+  bool begin(bool accelerated = true);
+  // Starts a new stream: the next sample appended is sample 0
+  void reset();
+  // count samples of the stream were lost. Frames resume with the first
+  // full window after them, on the same hop grid.
+  void skip(size_t count);
+
+  // Takes samples up to the next full window and returns how many; call
+  // takeFrame() once frameReady(), then append the rest
+  size_t append(const int16_t* samples, size_t count);
+  bool frameReady() const { return _filled == WINDOW_SAMPLES; }
+  // Writes the ready frame's MEL_BANDS bytes to out and returns the stream
+  // index of its first sample
+  uint32_t takeFrame(uint8_t* out);
+
+  // One frame from WINDOW_SAMPLES samples, what takeFrame() runs
+  void computeFrame(const int16_t* window, uint8_t* out);
+
+  bool acceleratedFft() const { return _acceleratedFft; }
+  bool acceleratedBands() const { return _acceleratedBands; }
+
+private:
+  static constexpr size_t HALF_FFT = FFT_SIZE / 2;
+  static constexpr size_t MAX_WEIGHTS = 1024;
+  static constexpr size_t MAX_BAND_BINS = 32;
+
+  struct Band {
+    uint16_t firstBin;
+    uint16_t usedBins;  // bins with a weight
+    uint16_t binCount;  // usedBins rounded up to a multiple of 4, zero weights at the end
+    uint16_t weightOffset;
+  };
+
+  // Windows the frame into data, the 512 real values read as 256 complex
+  // ones, at 2^shift times the input's scale. False if it is all zeros.
+  bool windowFrame(const int16_t* window, int16_t* data, int& shift) const;
+  void fftPortable(int16_t* data) const;
+  void fft(int16_t* data) const;
+  // Power of bins 0..256 from the complex FFT of the even/odd packing, in
+  // units of (|X| / 512)^2
+  void powerSpectrum(const int16_t* data, uint32_t* power) const;
+  // Weighted mean of a band's scaled powers, rounded to 16 bits
+  int32_t bandSumPortable(const Band& band, const int16_t* scaled) const;
+  int32_t bandSum(const Band& band, const int16_t* scaled) const;
+  // The byte for a band sum that is the true power scaled by 2^-shift
+  uint8_t quantize(int32_t sum, int shift) const;
+  bool acceleratedFftMatches();
+  bool acceleratedBandsMatch() const;
+
+  bool _ready = false;
+  bool _acceleratedFft = false;
+  bool _acceleratedBands = false;
+  alignas(4) int16_t _window[WINDOW_SAMPLES];   // Q15 Hann
+  int16_t _cos[HALF_FFT + 1];                   // of 2 pi k / 512, Q15
+  int16_t _sin[HALF_FFT + 1];
+  Band _bands[MEL_BANDS];
+  alignas(4) int16_t _weights[MAX_WEIGHTS];     // Q15, each band's add up to at most 32767
+  int64_t _factor = 0;  // q per doubling of the power, Q16
+  int64_t _offset = 0;  // q for a band sum of 1 and no shift, Q32
+  alignas(4) int16_t _data[FFT_SIZE];
+  uint32_t _power[SPECTRUM_BINS];
+
+  alignas(4) int16_t _frame[WINDOW_SAMPLES];
+  size_t _filled = 0;
+  uint32_t _frameStart = 0;  // stream index of _frame[0]
+  uint32_t _skipping = 0;    // samples still to drop to get back on the hop grid
+};
+
+// The same frame in double precision (exact window, DFT, weights and log),
+// to measure the fixed-point path against. Writes the quantized bytes to
+// out and, if db is not null, each band's level in dB.
+void logMelReference(const int16_t* window, uint8_t* out, double* db = nullptr);
+
+#endif
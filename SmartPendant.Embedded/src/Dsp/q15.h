@@ -0,0 +1,47 @@
+#ifndef Q15_H
+#define Q15_H
+
+#include <stdint.h>
+
+// Helpers shared by the fixed-point DSP kernels. Samples are Q15
+// (int16 full scale = 1.0). Everything here is plain integer arithmetic so
+// the kernels give bit-identical results on the device and on a host.
+
+static constexpr int32_t Q15_ONE = 1 << 15;
+
+static inline int16_t saturate16(int32_t x) {
+  if (x > INT16_MAX) return INT16_MAX;
+  if (x < INT16_MIN) return INT16_MIN;
+  return (int16_t)x;
+}
+
+static inline int16_t saturate16(int64_t x) {
+  if (x > INT16_MAX) return INT16_MAX;
+  if (x < INT16_MIN) return INT16_MIN;
+  return (int16_t)x;
+}
+
+// Converts a coefficient to fixed point with the given number of fraction bits, rounding to nearest
+static inline int32_t toFixed(float x, int fractionBits) {
+  float scaled = x * (float)(1L << fractionBits);
+  return (int32_t)(scaled < 0 ? scaled - 0.5f : scaled + 0.5f);
+}
+
+// Floor of the square root
+static inline uint32_t isqrt32(uint32_t x) {
+  uint32_t root = 0;
+  uint32_t bit = 1UL << 30;
+  while (bit > x) bit >>= 2;
+  while (bit != 0) {
+    if (x >= root + bit) {
+      x -= root + bit;
+      root = (root >> 1) + bit;
+    } else {
+      root >>= 1;
+    }
+    bit >>= 2;
+  }
+  return root;
+}
+
+#endif
@@ -0,0 +1,125 @@
+#include "vad.h"
+#include <math.h>
+
+// Per aggressiveness level
+static const float THRESHOLD_DB[VAD_MAX_AGGRESSIVENESS + 1] = { 6.0f, 9.0f, 12.0f, 15.0f };
+static const uint16_t ONSET_MS[VAD_MAX_AGGRESSIVENESS + 1] = { 10, 20, 30, 40 };
+static const uint16_t HANGOVER_MS[VAD_MAX_AGGRESSIVENESS + 1] = { 400, 300, 200, 120 };
+
+// Frames quieter than this never count as speech (RMS ~16 LSB)
+static constexpr float MIN_SPEECH_DB = 24.0f;
+// Frames where the signal flips sign this often are hiss or clicks, not voice
+static constexpr float MAX_SPEECH_ZCR = 0.6f;
+// Weak frames still count as speech when their crossing rate looks voiced
+static constexpr float VOICED_ZCR_MIN = 0.02f;
+static constexpr float VOICED_ZCR_MAX = 0.25f;
+
+// Noise floor tracking rates per frame: fall fast, rise slowly, and only
+// creep upwards while the frame looks like speech
+static constexpr float FLOOR_FALL_RATE = 0.25f;
+static constexpr float FLOOR_RISE_RATE = 0.03f;
+static constexpr float FLOOR_RISE_RATE_SPEECH = 0.002f;
+// Initial frames used only to learn the floor
+static constexpr uint16_t TRAINING_MS = 200;
+// A click or a noise peak fills one frame at the firmware's frame size, so
+// an onset never takes less than two
+static constexpr uint16_t MIN_ONSET_FRAMES = 2;
+
+static uint16_t msToFrames(uint32_t ms, uint32_t sampleRate, size_t frameSamples) {
+  uint32_t frames = (uint32_t)((uint64_t)ms * sampleRate / 1000 / frameSamples);
+  return frames > 0 ? (uint16_t)frames : 1;
+}
+
+bool VoiceActivityDetector::begin(uint32_t sampleRate, size_t frameSamples, uint8_t aggressiveness) {
+  if (sampleRate == 0 || frameSamples < 2 || aggressiveness > VAD_MAX_AGGRESSIVENESS) {
+    return false;
+  }
+  _aggressiveness = aggressiveness;
+  _thresholdDb = THRESHOLD_DB[aggressiveness];
+  _onsetFrames = msToFrames(ONSET_MS[aggressiveness], sampleRate, frameSamples);
+  if (_onsetFrames < MIN_ONSET_FRAMES) {
+    _onsetFrames = MIN_ONSET_FRAMES;
+  }
+  _hangoverFrames = msToFrames(HANGOVER_MS[aggressiveness], sampleRate, frameSamples);
+  _trainingFrames = msToFrames(TRAINING_MS, sampleRate, frameSamples);
+  reset();
+  return true;
+}
+
+void VoiceActivityDetector::reset() {
+  _active = false;
+  _speechRun = 0;
+  _hangoverLeft = 0;
+  _framesSeen = 0;
+  _noiseFloorDb = 0;
+  _lastEnergyDb = 0;
+  _lastZcr = 0;
+}
+
+bool VoiceActivityDetector::isSpeechLike(float energyDb, float zcr) const {
+  if (energyDb < MIN_SPEECH_DB || zcr > MAX_SPEECH_ZCR) {
+    return false;
+  }
+  float aboveFloor = energyDb - _noiseFloorDb;
+  if (aboveFloor >= _thresholdDb) {
+    return true;
+  }
+  return aboveFloor >= _thresholdDb * 0.5f && zcr >= VOICED_ZCR_MIN && zcr <= VOICED_ZCR_MAX;
+}
+
+void VoiceActivityDetector::trackNoiseFloor(float energyDb) {
+  if (_framesSeen == 0) {
+    _noiseFloorDb = energyDb;
+  } else if (energyDb < _noiseFloorDb) {
+    _noiseFloorDb += (energyDb - _noiseFloorDb) * FLOOR_FALL_RATE;
+  } else {
+    float rate = (_framesSeen < _trainingFrames || !isSpeechLike(energyDb, _lastZcr)) ?
+                 FLOOR_RISE_RATE : FLOOR_RISE_RATE_SPEECH;
+    _noiseFloorDb += (energyDb - _noiseFloorDb) * rate;
+  }
+}
+
+bool VoiceActivityDetector::process(const int16_t* samples, size_t count) {
+  if (count < 2) {
+    return _active;
+  }
+
+  uint64_t energy = 0;
+  uint32_t crossings = 0;
+  for (size_t i = 0; i < count; i++) {
+    int32_t s = samples[i];
+    energy += (uint64_t)(s * s);
+    if (i > 0 && ((samples[i - 1] ^ s) < 0)) {
+      crossings++;
+    }
+  }
+
+  float energyDb = 10.0f * log10f((float)energy / (float)count + 1.0f);
+  _lastEnergyDb = energyDb;
+  _lastZcr = (float)crossings / (float)(count - 1);
+
+  // Decide against the floor as it was before this frame
+  bool speechLike = _framesSeen >= _trainingFrames && isSpeechLike(energyDb, _lastZcr);
+  trackNoiseFloor(energyDb);
+  if (_framesSeen < UINT16_MAX) {
+    _framesSeen++;
+  }
+
+  if (speechLike) {
+    if (_speechRun < UINT16_MAX) {
+      _speechRun++;
+    }
+    if (_speechRun >= _onsetFrames) {
+      _active = true;
+      _hangoverLeft = _hangoverFrames;
+    }
+  } else {
+    _speechRun = 0;
+    if (_hangoverLeft > 0) {
+      _hangoverLeft--;
+    } else {
+      _active = false;
+    }
+  }
+  return _active;
+}
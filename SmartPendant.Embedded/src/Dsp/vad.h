@@ -0,0 +1,57 @@
+#ifndef VAD_H
+#define VAD_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Frame-based voice activity detector for the capture path.
+//
+// Each 10-20 ms frame is classified from its energy and zero-crossing rate.
+// The noise floor is tracked continuously: it follows quiet frames quickly
+// downwards and slowly upwards, so a steady fan or corridor noise ends up
+// below the threshold. A frame counts as speech when it stands far enough
+// above the floor; an onset needs a few such frames in a row (rejecting
+// clicks) and a hangover keeps the detector open after the last one so word
+// tails are not clipped.
+//
+// Aggressiveness 0..3 trades missed speech for suppressed silence: higher
+// levels raise the threshold and shorten the hangover.
+
+static constexpr uint8_t VAD_MAX_AGGRESSIVENESS = 3;
+
+class VoiceActivityDetector {
+public:
+  bool begin(uint32_t sampleRate, size_t frameSamples, uint8_t aggressiveness);
+
+  // Forgets the noise floor and closes the detector
+  void reset();
+
+  // Classifies one frame, returns true while speech is active (hangover included)
+  bool process(const int16_t* samples, size_t count);
+
+  bool active() const { return _active; }
+  uint8_t aggressiveness() const { return _aggressiveness; }
+  float noiseFloorDb() const { return _noiseFloorDb; }
+  float lastEnergyDb() const { return _lastEnergyDb; }
+  float lastZeroCrossingRate() const { return _lastZcr; }
+
+private:
+  bool isSpeechLike(float energyDb, float zcr) const;
+  void trackNoiseFloor(float energyDb);
+
+  uint8_t _aggressiveness = 1;
+  float _thresholdDb = 0;
+  uint16_t _onsetFrames = 1;
+  uint16_t _hangoverFrames = 0;
+  uint16_t _trainingFrames = 0;
+
+  bool _active = false;
+  uint16_t _speechRun = 0;
+  uint16_t _hangoverLeft = 0;
+  uint16_t _framesSeen = 0;
+  float _noiseFloorDb = 0;
+  float _lastEnergyDb = 0;
+  float _lastZcr = 0;
+};
+
+#endif
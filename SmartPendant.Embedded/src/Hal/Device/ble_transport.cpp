@@ -0,0 +1,14 @@
+#include "ble_transport.h"
+
+void BleNotifyTransport::begin(BLECharacteristic* characteristic) {
+  _characteristic = characteristic;
+}
+
+bool BleNotifyTransport::send(uint16_t connId, const uint8_t* packet, size_t length) {
+  if (_characteristic == nullptr || _gattsIf == ESP_GATT_IF_NONE) {
+    return false;
+  }
+  // The stack copies the value before this returns
+  return esp_ble_gatts_send_indicate(_gattsIf, connId, _characteristic->getHandle(), length,
+                                     (uint8_t*)packet, false) == ESP_OK;
+}
@@ -0,0 +1,25 @@
+#ifndef BLE_TRANSPORT_H
+#define BLE_TRANSPORT_H
+
+#include <BLEDevice.h>
+#include <esp_gatts_api.h>
+#include "../transport.h"
+
+// Sends packets as notifications of one characteristic, each to a single
+// connection, so every client can be paced on its own. A notification the
+// stack refuses to queue is a failed send; how queued ones went arrives as
+// ESP_GATTS_CONF_EVT with the connection handle.
+class BleNotifyTransport : public AudioTransport {
+public:
+  void begin(BLECharacteristic* characteristic);
+  // The server's GATT interface, known from the first connect event
+  void setInterface(esp_gatt_if_t gattsIf) { _gattsIf = gattsIf; }
+
+  bool send(uint16_t connId, const uint8_t* packet, size_t length) override;
+
+private:
+  BLECharacteristic* _characteristic = nullptr;
+  volatile esp_gatt_if_t _gattsIf = ESP_GATT_IF_NONE;
+};
+
+#endif
@@ -0,0 +1,32 @@
+#ifndef FREERTOS_TRACE_HOOKS_H
+#define FREERTOS_TRACE_HOOKS_H
+
+// FreeRTOS trace macros feeding TraceRecorder (trace_recorder.h).
+//
+// The kernel only expands these where it is compiled, so they take effect
+// when FreeRTOS is built from source with this header force-included, e.g.
+// framework = arduino, espidf with
+//   -include src/Hal/Device/freertos_trace_hooks.h
+// in the freertos component's flags. The prebuilt Arduino kernel never sees
+// them. The task number is FreeRTOS's own (TaskStatus_t::xTaskNumber),
+// which the dump lists by name.
+#ifndef __ASSEMBLER__
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+void traceTaskSwitchedIn(uint32_t taskNumber);
+#ifdef __cplusplus
+}
+#endif
+
+// Expanded in tasks.c once pxCurrentTCB points at the task about to run;
+// needs configUSE_TRACE_FACILITY for uxTCBNumber. Files that include
+// FreeRTOS.h first keep its empty default.
+#ifndef traceTASK_SWITCHED_IN
+#define traceTASK_SWITCHED_IN() traceTaskSwitchedIn(pxCurrentTCB[xPortGetCoreID()]->uxTCBNumber)
+#endif
+#endif
+
+#endif
@@ -0,0 +1,16 @@
+#include "m5_display.h"
+
+void M5DisplayPanel::endWrite() {
+  _display->waitDMA();
+  _display->endWrite();
+}
+
+void M5DisplayPanel::pushImage(int16_t x, int16_t y, int16_t w, int16_t h, const uint16_t* pixels, bool dma) {
+  // Sprite buffers already hold the panel's byte order
+  const lgfx::swap565_t* rows = (const lgfx::swap565_t*)pixels;
+  if (dma) {
+    _display->pushImageDMA(x, y, w, h, rows);
+  } else {
+    _display->pushImage(x, y, w, h, rows);
+  }
+}
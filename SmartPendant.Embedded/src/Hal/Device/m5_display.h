@@ -0,0 +1,27 @@
+#ifndef M5_DISPLAY_H
+#define M5_DISPLAY_H
+
+#include <M5Unified.h>
+#include "../display.h"
+
+// The Core2's ILI9342C panel through M5GFX
+class M5DisplayPanel : public DisplayPanel {
+public:
+  void begin(M5GFX* display) { _display = display; }
+
+  int16_t width() const override { return _display->width(); }
+  int16_t height() const override { return _display->height(); }
+
+  void startWrite() override { _display->startWrite(); }
+  void endWrite() override;
+  void pushImage(int16_t x, int16_t y, int16_t w, int16_t h, const uint16_t* pixels, bool dma) override;
+
+  void setBrightness(uint8_t level) override { _display->setBrightness(level); }
+  void sleep() override { _display->sleep(); }
+  void wakeup() override { _display->wakeup(); }
+
+private:
+  M5GFX* _display = nullptr;
+};
+
+#endif
@@ -0,0 +1,20 @@
+#include "m5_mic_source.h"
+#include <M5Unified.h>
+
+bool M5MicSource::begin(bool driverFilters) {
+  if (!driverFilters) {
+    auto config = M5.Mic.config();
+    config.over_sampling = 1;
+    config.noise_filter_level = 0;
+    M5.Mic.config(config);
+  }
+  return M5.Mic.begin();
+}
+
+bool M5MicSource::record(int16_t* samples, size_t count, uint32_t sampleRate) {
+  return M5.Mic.record(samples, count, sampleRate, false);
+}
+
+size_t M5MicSource::pending() const {
+  return M5.Mic.isRecording();
+}
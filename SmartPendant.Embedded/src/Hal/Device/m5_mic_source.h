@@ -0,0 +1,17 @@
+#ifndef M5_MIC_SOURCE_H
+#define M5_MIC_SOURCE_H
+
+#include "../audio_source.h"
+
+// The Core2's PDM microphone through M5.Mic, which holds up to two captures
+class M5MicSource : public AudioSource {
+public:
+  // driverFilters false turns off the driver's averaging and smoothing, for
+  // captures that are decimated by Dsp/decimator.h instead
+  bool begin(bool driverFilters = true);
+
+  bool record(int16_t* samples, size_t count, uint32_t sampleRate) override;
+  size_t pending() const override;
+};
+
+#endif
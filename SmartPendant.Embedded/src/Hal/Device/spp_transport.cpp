@@ -0,0 +1,52 @@
+#include "spp_transport.h"
+
+// BluetoothSerial takes a single callback; the server has one transport
+static SppTransport* sppInstance = nullptr;
+
+bool SppTransport::begin(const char* name, esp_spp_cb_t callback) {
+  _callback = callback;
+  sppInstance = this;
+  if (_serial.register_callback(onEvent) != ESP_OK) {
+    return false;
+  }
+  return _serial.begin(name);
+}
+
+void SppTransport::onEvent(esp_spp_cb_event_t event, esp_spp_cb_param_t* param) {
+  SppTransport& self = *sppInstance;
+  if (event == ESP_SPP_WRITE_EVT) {
+    // BluetoothSerial's queue has handed these bytes to the stack
+    uint32_t queued = self._queuedBytes.load(std::memory_order_relaxed);
+    uint32_t done;
+    do {
+      done = param->write.len < queued ? param->write.len : queued;
+    } while (!self._queuedBytes.compare_exchange_weak(queued, queued - done, std::memory_order_relaxed));
+  } else if (event == ESP_SPP_SRV_OPEN_EVT || event == ESP_SPP_CLOSE_EVT) {
+    // A closed link drops whatever was queued for it
+    self._queuedBytes.store(0, std::memory_order_relaxed);
+  }
+  if (self._callback != nullptr) {
+    self._callback(event, param);
+  }
+}
+
+bool SppTransport::canSend(size_t length) const {
+  return _queuedBytes.load(std::memory_order_relaxed) + length <= SPP_TX_BUDGET_BYTES;
+}
+
+bool SppTransport::send(uint16_t /*client*/, const uint8_t* packet, size_t length) {
+  if (!_serial.hasClient() || !canSend(length)) {
+    return false;
+  }
+  _queuedBytes.fetch_add((uint32_t)length, std::memory_order_relaxed);
+  // A partial write leaves the receiver mid-packet; its reader skips to the
+  // next header
+  size_t written = _serial.write(packet, length);
+  if (written != length) {
+    // Bytes never queued see no write event
+    _queuedBytes.fetch_sub((uint32_t)(length - written), std::memory_order_relaxed);
+    _shortWrites++;
+    return false;
+  }
+  return true;
+}
@@ -0,0 +1,44 @@
+#ifndef SPP_TRANSPORT_H
+#define SPP_TRANSPORT_H
+
+#include <BluetoothSerial.h>
+#include <atomic>
+#include "../transport.h"
+
+// Bytes handed to BluetoothSerial and not yet written to the stack that a
+// send may leave queued. Well under its transmit queue, so a write never
+// waits for the queue to drain.
+static constexpr size_t SPP_TX_BUDGET_BYTES = 4096;
+
+// Sends packets over a Bluetooth Classic SPP (RFCOMM) link as one byte
+// stream, back to back; framed packets delimit themselves through their
+// header (Protocol/packet_stream.h). RFCOMM credits pace the link, and
+// BluetoothSerial's write() blocks while its transmit queue is full; so a
+// send is refused unless the packet fits in what is left of
+// SPP_TX_BUDGET_BYTES, counted down by the stack's write events. It also
+// fails when the link is down.
+class SppTransport : public AudioTransport {
+public:
+  // Starts the SPP server under name. callback sees the stack's SPP events
+  // (open, close, ...) in the Bluetooth task.
+  bool begin(const char* name, esp_spp_cb_t callback);
+
+  // client is the SPP connection handle; the server takes one connection
+  bool send(uint16_t client, const uint8_t* packet, size_t length) override;
+
+  // True if a packet of length bytes can be sent without blocking
+  bool canSend(size_t length) const;
+  bool connected() { return _serial.hasClient(); }
+  uint32_t shortWrites() const { return _shortWrites; }
+
+private:
+  static void onEvent(esp_spp_cb_event_t event, esp_spp_cb_param_t* param);
+
+  BluetoothSerial _serial;
+  esp_spp_cb_t _callback = nullptr;
+  // Written by send(), drained by the write events in the Bluetooth task
+  std::atomic<uint32_t> _queuedBytes{0};
+  uint32_t _shortWrites = 0;
+};
+
+#endif
@@ -0,0 +1,134 @@
+#include "trace_recorder.h"
+#include "freertos_trace_hooks.h"
+#include "../../Protocol/trace_dump.h"
+#include <esp_ipc.h>
+#include <esp_pm.h>
+#include <esp_timer.h>
+#include <esp_freertos_hooks.h>
+#include <freertos/task.h>
+
+TraceRecorder traceRecorder;
+
+// A trigger waits at most this long for its events before the dump
+static constexpr uint32_t TRACE_TRIGGER_WAIT_MS = 2000;
+// Tasks listed in a dump
+static constexpr size_t TRACE_MAX_TASKS = 32;
+// Events timed by measureCost()
+static constexpr uint32_t TRACE_COST_EVENTS = 64;
+
+// Counted per core by the tick hooks
+static uint32_t keepaliveTicks[TRACE_CORES];
+
+static void IRAM_ATTR keepaliveTick() {
+  // Once a second, so a core that records nothing else still unwraps
+  uint32_t& ticks = keepaliveTicks[xPortGetCoreID()];
+  if (++ticks >= configTICK_RATE_HZ) {
+    ticks = 0;
+    traceRecorder.record(TRACE_KEEPALIVE);
+  }
+}
+
+extern "C" void IRAM_ATTR traceTaskSwitchedIn(uint32_t taskNumber) {
+  traceRecorder.record(TRACE_TASK_SWITCH, (uint16_t)taskNumber);
+}
+
+bool TraceRecorder::begin(TraceEvent* storage, size_t eventsPerCore) {
+  for (size_t core = 0; core < TRACE_CORES; core++) {
+    if (!_rings[core].begin(storage + core * eventsPerCore, eventsPerCore)) {
+      return false;
+    }
+  }
+#if CONFIG_PM_ENABLE
+  // Cycles only map to time at a known clock
+  static esp_pm_lock_handle_t clockLock = nullptr;
+  if (clockLock == nullptr && esp_pm_lock_create(ESP_PM_CPU_FREQ_MAX, 0, "trace", &clockLock) == ESP_OK) {
+    esp_pm_lock_acquire(clockLock);
+  }
+#endif
+  _mhz = (uint16_t)ESP.getCpuFreqMHz();
+  for (size_t core = 0; core < TRACE_CORES; core++) {
+    _coreMhz[core] = _mhz;
+    esp_register_freertos_tick_hook_for_cpu(keepaliveTick, core);
+  }
+  _ready = true;
+  return true;
+}
+
+void TraceRecorder::trigger(TraceTrigger reason) {
+  if (!_ready || _triggered) {
+    return;
+  }
+  record(TRACE_TRIGGER, reason);
+  // As much after the trigger as before it
+  for (TraceRing& ring : _rings) {
+    ring.stopAfter(ring.capacity() / 2);
+  }
+  _reason = reason;
+  _triggerMs = millis();
+  _triggered = true;
+}
+
+bool TraceRecorder::dumpDue(uint32_t nowMs) const {
+  if (!_triggered) {
+    return false;
+  }
+  bool complete = true;
+  for (const TraceRing& ring : _rings) {
+    complete = complete && ring.stopped();
+  }
+  return complete || nowMs - _triggerMs >= TRACE_TRIGGER_WAIT_MS;
+}
+
+// Reads this core's cycle counter against esp_timer; runs on the core asked for
+static void readCoreClock(void* arg) {
+  TraceCoreClock& clock = *(TraceCoreClock*)arg;
+  clock.us = (uint64_t)esp_timer_get_time();
+  clock.cycles = esp_cpu_get_ccount();
+  clock.mhz = ESP.getCpuFreqMHz();
+}
+
+void TraceRecorder::dump(Print& out) {
+  if (!_ready) {
+    return;
+  }
+  for (TraceRing& ring : _rings) {
+    ring.stopAfter(0);
+  }
+  // A writer still inside record() finishes within a few instructions
+  vTaskDelay(1);
+
+  TraceCoreClock clocks[TRACE_CORES];
+  for (size_t core = 0; core < TRACE_CORES; core++) {
+    esp_ipc_call_blocking(core, readCoreClock, &clocks[core]);
+  }
+
+  char line[TRACE_DUMP_LINE_BYTES];
+  out.write((const uint8_t*)line, traceDumpBegin(line, TRACE_CORES, _triggered ? _reason : TRACE_TRIGGER_REQUEST));
+  static TaskStatus_t tasks[TRACE_MAX_TASKS];
+  UBaseType_t taskCount = uxTaskGetSystemState(tasks, TRACE_MAX_TASKS, nullptr);
+  for (UBaseType_t i = 0; i < taskCount; i++) {
+    out.write((const uint8_t*)line, traceDumpTask(line, tasks[i].xTaskNumber, tasks[i].pcTaskName));
+  }
+  for (size_t core = 0; core < TRACE_CORES; core++) {
+    const TraceRing& ring = _rings[core];
+    out.write((const uint8_t*)line, traceDumpCore(line, core, clocks[core], ring));
+    size_t count = 0;
+    for (size_t first = 0; first < ring.size(); first += count) {
+      out.write((const uint8_t*)line, traceDumpEvents(line, core, ring, first, count));
+    }
+  }
+  out.write((const uint8_t*)line, traceDumpEnd(line));
+
+  for (TraceRing& ring : _rings) {
+    ring.resume();
+  }
+  _triggered = false;
+}
+
+uint32_t TraceRecorder::measureCost() {
+  uint32_t start = esp_cpu_get_ccount();
+  for (uint32_t i = 0; i < TRACE_COST_EVENTS; i++) {
+    record(TRACE_NONE, (uint16_t)i);
+  }
+  return (esp_cpu_get_ccount() - start) / TRACE_COST_EVENTS;
+}
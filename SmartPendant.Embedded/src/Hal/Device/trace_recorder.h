@@ -0,0 +1,76 @@
+#ifndef TRACE_RECORDER_H
+#define TRACE_RECORDER_H
+
+#include <Arduino.h>
+#include <esp_cpu.h>
+#include <freertos/FreeRTOS.h>
+#include "../../Pipeline/trace_ring.h"
+
+static constexpr size_t TRACE_CORES = 2;
+
+// Flight recorder of what both cores ran: a TraceRing per core, written
+// only by that core with interrupts masked for the few instructions an
+// event takes, so recording needs no lock and is safe from the tick and
+// the scheduler. Timestamps are the core's cycle counter.
+//
+// The cycle counter runs at the CPU clock, so recording holds the clock at
+// its ceiling (an esp_pm CPU_FREQ_MAX lock, which also keeps the chip out
+// of light sleep) and the ceiling's changes are logged with setClock():
+// each core notes the change with its next event.
+//
+// trigger() keeps half a ring of events after it on each core, then both
+// rings stop until dump() has printed them (Protocol/trace_dump.h).
+// Task switches need the kernel built with freertos_trace_hooks.h;
+// without it the rings hold the audio path's events only.
+class TraceRecorder {
+public:
+  // storage holds eventsPerCore events for each core, in internal RAM;
+  // eventsPerCore is a power of two
+  bool begin(TraceEvent* storage, size_t eventsPerCore);
+  bool ready() const { return _ready; }
+
+  inline void IRAM_ATTR record(TraceEventType type, uint16_t arg = 0) {
+    if (!_ready) {
+      return;
+    }
+    uint32_t interrupts = portSET_INTERRUPT_MASK_FROM_ISR();
+    uint32_t core = xPortGetCoreID();
+    uint32_t cycles = esp_cpu_get_ccount();
+    TraceRing& ring = _rings[core];
+    if (_coreMhz[core] != _mhz) {
+      ring.record(cycles, TRACE_CPU_CLOCK, _coreMhz[core]);
+      _coreMhz[core] = _mhz;
+    }
+    ring.record(cycles, type, arg);
+    portCLEAR_INTERRUPT_MASK_FROM_ISR(interrupts);
+  }
+
+  // The CPU clock changed to mhz
+  void setClock(uint32_t mhz) { _mhz = (uint16_t)mhz; }
+
+  // Freezes the trace around this moment; later triggers are ignored until
+  // it has been dumped
+  void trigger(TraceTrigger reason);
+  bool triggered() const { return _triggered; }
+  // A trigger's events are complete, or have waited long enough
+  bool dumpDue(uint32_t nowMs) const;
+  // Stops both rings, prints them and records again. Blocks for as long
+  // as the serial port takes (about 1 s per 1000 events at 115200 baud).
+  void dump(Print& out);
+
+  // Cycles one event costs, measured on the calling core
+  uint32_t measureCost();
+
+private:
+  bool _ready = false;
+  TraceRing _rings[TRACE_CORES];
+  volatile uint16_t _mhz = 0;
+  uint16_t _coreMhz[TRACE_CORES] = {};  // each core's, written only by it
+  volatile bool _triggered = false;
+  TraceTrigger _reason = TRACE_TRIGGER_REQUEST;
+  uint32_t _triggerMs = 0;
+};
+
+extern TraceRecorder traceRecorder;
+
+#endif
@@ -0,0 +1,23 @@
+#ifndef AUDIO_SOURCE_H
+#define AUDIO_SOURCE_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Where captured audio comes from.
+//
+// Captures are queued the way the M5 mic driver takes them: record() hands
+// the source a buffer to fill, and a buffer may be read once pending() has
+// dropped below the number of captures queued after it. Sources that fill
+// the buffer inside record() always report 0 pending.
+class AudioSource {
+public:
+  virtual ~AudioSource() {}
+
+  // Queues a capture of count mono samples; false if the source cannot take it now
+  virtual bool record(int16_t* samples, size_t count, uint32_t sampleRate) = 0;
+  // Captures queued and not filled yet
+  virtual size_t pending() const = 0;
+};
+
+#endif
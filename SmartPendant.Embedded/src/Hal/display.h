@@ -0,0 +1,28 @@
+#ifndef DISPLAY_H
+#define DISPLAY_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// The panel the UI compositor pushes to
+class DisplayPanel {
+public:
+  virtual ~DisplayPanel() {}
+
+  virtual int16_t width() const = 0;
+  virtual int16_t height() const = 0;
+
+  // Brackets a batch of pushes; endWrite() first waits for a DMA push still running
+  virtual void startWrite() = 0;
+  virtual void endWrite() = 0;
+  // Pushes w * h byte-swapped RGB565 pixels. With dma the call returns while
+  // the transfer runs, so the pixels must stay untouched until endWrite().
+  virtual void pushImage(int16_t x, int16_t y, int16_t w, int16_t h, const uint16_t* pixels, bool dma) = 0;
+
+  virtual void setBrightness(uint8_t level) = 0;
+  // A sleeping panel keeps its contents but draws no power for the backlight
+  virtual void sleep() = 0;
+  virtual void wakeup() = 0;
+};
+
+#endif
@@ -0,0 +1,58 @@
+#include "loopback_transport.h"
+
+void LoopbackTransport::begin(bool framed) {
+  _framed = framed;
+  _sends = 0;
+  _packets = 0;
+  _bytes = 0;
+  _refused = 0;
+  _malformed = 0;
+  _samples = 0;
+  _tracker.reset();
+  _reader.reset();
+}
+
+bool LoopbackTransport::send(uint16_t /*client*/, const uint8_t* packet, size_t length) {
+  _sends++;
+  if (_refuseEvery > 0 && _sends % _refuseEvery == 0) {
+    _refused++;
+    return false;
+  }
+  _packets++;
+  _bytes += length;
+
+  if (!_framed) {
+    // Bare PCM is all the receiver gets without framing
+    _samples += length / sizeof(int16_t);
+    return true;
+  }
+  if (_streamReads == 0) {
+    receive(packet, length);
+    return true;
+  }
+  // Reads cut packets anywhere; the reader joins the pieces back up
+  size_t offset = 0;
+  while (offset < length) {
+    size_t read = length - offset < _streamReads ? length - offset : _streamReads;
+    offset += _reader.feed(packet + offset, read);
+    const uint8_t* received;
+    size_t receivedBytes;
+    while (_reader.next(received, receivedBytes)) {
+      receive(received, receivedBytes);
+    }
+  }
+  return true;
+}
+
+void LoopbackTransport::receive(const uint8_t* packet, size_t length) {
+  PacketHeader header;
+  if (!packetParseHeader(packet, length, header)) {
+    _malformed++;
+    return;
+  }
+  size_t sampleCount = packetTimelineSamples(header, packet + PACKET_HEADER_BYTES);
+  uint32_t gapSamples;
+  if (_tracker.accept(header, sampleCount, gapSamples)) {
+    _samples += sampleCount;
+  }
+}
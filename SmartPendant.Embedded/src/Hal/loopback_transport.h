@@ -0,0 +1,51 @@
+#ifndef LOOPBACK_TRANSPORT_H
+#define LOOPBACK_TRANSPORT_H
+
+#include "transport.h"
+#include "../Protocol/packet.h"
+#include "../Protocol/packet_stream.h"
+
+// Receives packets in memory in place of the BLE link. Framed packets are
+// checked the way a client would, so the loss counters tell whether the
+// pipeline delivered a complete timeline. It stands for one client; the
+// client argument of send() is ignored, so simulated fan-out uses one
+// loopback per client.
+class LoopbackTransport : public AudioTransport {
+public:
+  void begin(bool framed);
+
+  bool send(uint16_t client, const uint8_t* packet, size_t length) override;
+
+  // Refuses every n-th send to exercise the error paths; 0 never refuses
+  void setRefuseEvery(uint32_t n) { _refuseEvery = n; }
+  // Framed packets travel as one byte stream handed to the receiver in
+  // reads of readBytes, as over SPP; 0 delivers every send as one message,
+  // as a BLE notification
+  void setStreamReads(size_t readBytes) { _streamReads = readBytes; }
+
+  uint32_t packets() const { return _packets; }
+  uint64_t bytes() const { return _bytes; }
+  uint32_t refused() const { return _refused; }
+  uint32_t malformed() const { return _malformed; }  // framed packets that failed to parse
+  uint64_t samples() const { return _samples; }      // audio samples delivered, silence included
+  const PacketLossTracker& tracker() const { return _tracker; }
+  const PacketStreamReader& streamReader() const { return _reader; }
+
+private:
+  // Checks one framed packet as a client would
+  void receive(const uint8_t* packet, size_t length);
+
+  bool _framed = false;
+  uint32_t _refuseEvery = 0;
+  size_t _streamReads = 0;
+  uint32_t _sends = 0;
+  uint32_t _packets = 0;
+  uint64_t _bytes = 0;
+  uint32_t _refused = 0;
+  uint32_t _malformed = 0;
+  uint64_t _samples = 0;
+  PacketLossTracker _tracker;
+  PacketStreamReader _reader;
+};
+
+#endif
@@ -0,0 +1,41 @@
+#include "synthetic_source.h"
+#include <math.h>
+
+static constexpr float TWO_PI = 6.28318531f;
+
+void SyntheticSource::begin(const Config& config) {
+  _config = config;
+  _position = 0;
+  _phase = 0;
+  _noiseState = config.seed != 0 ? config.seed : 1;
+}
+
+bool SyntheticSource::record(int16_t* samples, size_t count, uint32_t sampleRate) {
+  if (sampleRate == 0) {
+    return false;
+  }
+  uint64_t burst = (uint64_t)_config.burstMs * sampleRate / 1000;
+  uint64_t period = burst + (uint64_t)_config.pauseMs * sampleRate / 1000;
+  float step = TWO_PI * _config.toneHz / (float)sampleRate;
+
+  for (size_t i = 0; i < count; i++, _position++) {
+    float value = _config.dcOffset;
+    if (period == 0 || _position % period < burst) {
+      value += _config.amplitude * (sinf(_phase) + 0.5f * sinf(2 * _phase) + 0.25f * sinf(3 * _phase)) / 1.75f;
+    }
+    _phase += step;
+    if (_phase > TWO_PI) {
+      _phase -= TWO_PI;
+    }
+    // xorshift32 noise, uniform in [-noise, noise]
+    _noiseState ^= _noiseState << 13;
+    _noiseState ^= _noiseState >> 17;
+    _noiseState ^= _noiseState << 5;
+    value += (float)(int32_t)(_noiseState % (2 * (uint32_t)_config.noise + 1)) - _config.noise;
+
+    if (value > 32767.0f) value = 32767.0f;
+    if (value < -32768.0f) value = -32768.0f;
+    samples[i] = (int16_t)value;
+  }
+  return true;
+}
@@ -0,0 +1,35 @@
+#ifndef SYNTHETIC_SOURCE_H
+#define SYNTHETIC_SOURCE_H
+
+#include "audio_source.h"
+
+// Deterministic test signal: a tone with two harmonics that comes and goes
+// like speech, over a low noise floor, with a DC offset like the real mic.
+// Captures are filled right away.
+class SyntheticSource : public AudioSource {
+public:
+  struct Config {
+    float toneHz = 180.0f;       // fundamental of the bursts
+    int16_t amplitude = 6000;    // peak of the fundamental
+    int16_t noise = 150;         // peak of the noise floor
+    int16_t dcOffset = -300;
+    uint32_t burstMs = 700;      // tone on
+    uint32_t pauseMs = 500;      // tone off, noise only
+    uint32_t seed = 1;
+  };
+
+  void begin(const Config& config);
+
+  bool record(int16_t* samples, size_t count, uint32_t sampleRate) override;
+  size_t pending() const override { return 0; }
+
+  uint64_t samplesGenerated() const { return _position; }
+
+private:
+  Config _config;
+  uint64_t _position = 0;
+  float _phase = 0;
+  uint32_t _noiseState = 1;
+};
+
+#endif
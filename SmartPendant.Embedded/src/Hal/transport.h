@@ -0,0 +1,17 @@
+#ifndef TRANSPORT_H
+#define TRANSPORT_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Where packets go, one call per packet and client
+class AudioTransport {
+public:
+  virtual ~AudioTransport() {}
+
+  // Sends one packet to a client (a connection handle on BLE); false if the
+  // link refused it
+  virtual bool send(uint16_t client, const uint8_t* packet, size_t length) = 0;
+};
+
+#endif
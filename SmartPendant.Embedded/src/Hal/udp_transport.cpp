@@ -0,0 +1,58 @@
+#include "udp_transport.h"
+#include <string.h>
+#ifdef ESP_PLATFORM
+#include <lwip/sockets.h>
+#include <lwip/netdb.h>
+#else
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netdb.h>
+#include <unistd.h>
+#endif
+
+bool UdpTransport::open(const char* host, uint16_t port) {
+  static_assert(sizeof(sockaddr_in) <= sizeof(_destination), "sockaddr_in does not fit");
+  close();
+  addrinfo hints;
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_INET;
+  hints.ai_socktype = SOCK_DGRAM;
+  addrinfo* found = nullptr;
+  if (getaddrinfo(host, nullptr, &hints, &found) != 0 || found == nullptr) {
+    return false;
+  }
+  sockaddr_in destination;
+  memcpy(&destination, found->ai_addr, sizeof(destination));
+  freeaddrinfo(found);
+  destination.sin_port = htons(port);
+
+  _socket = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+  if (_socket < 0) {
+    return false;
+  }
+  memcpy(_destination, &destination, sizeof(destination));
+  _datagrams = 0;
+  _refused = 0;
+  return true;
+}
+
+void UdpTransport::close() {
+  if (_socket >= 0) {
+    ::close(_socket);
+    _socket = -1;
+  }
+}
+
+bool UdpTransport::send(uint16_t /*client*/, const uint8_t* packet, size_t length) {
+  if (_socket < 0) {
+    return false;
+  }
+  ssize_t sent = sendto(_socket, packet, length, MSG_DONTWAIT, (const sockaddr*)_destination,
+                        sizeof(sockaddr_in));
+  if (sent != (ssize_t)length) {
+    _refused++;
+    return false;
+  }
+  _datagrams++;
+  return true;
+}
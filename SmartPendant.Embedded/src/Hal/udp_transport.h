@@ -0,0 +1,38 @@
+#ifndef UDP_TRANSPORT_H
+#define UDP_TRANSPORT_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "transport.h"
+
+// Sends every packet as one UDP datagram to a fixed receiver, such as a ward
+// gateway on the local Wi-Fi. Framed packets carry their own sequence
+// numbers and sample indexes, so the receiver measures loss and reordering
+// from the headers alone. Sends never block: a datagram the network stack
+// has no buffer for is a failed send, and the packet is lost like any other.
+//
+// BSD sockets, so the same code runs over lwIP on the device and over the
+// host's stack in the reference sender.
+class UdpTransport : public AudioTransport {
+public:
+  ~UdpTransport() { close(); }
+
+  // Resolves host (name or dotted quad) and opens a socket towards host:port
+  bool open(const char* host, uint16_t port);
+  void close();
+  bool isOpen() const { return _socket >= 0; }
+
+  // client is ignored; there is one receiver
+  bool send(uint16_t client, const uint8_t* packet, size_t length) override;
+
+  uint32_t datagrams() const { return _datagrams; }
+  uint32_t refused() const { return _refused; }
+
+private:
+  int _socket = -1;
+  alignas(4) uint8_t _destination[16];  // sockaddr_in; socket headers stay out of this header
+  uint32_t _datagrams = 0;
+  uint32_t _refused = 0;
+};
+
+#endif
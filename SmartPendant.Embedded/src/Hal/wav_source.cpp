@@ -0,0 +1,109 @@
+#include "wav_source.h"
+#include <string.h>
+
+static constexpr uint16_t WAV_FORMAT_PCM = 1;
+static constexpr uint16_t WAV_FORMAT_EXTENSIBLE = 0xFFFE;
+
+static inline uint16_t getU16(const uint8_t* p) {
+  return (uint16_t)(p[0] | (p[1] << 8));
+}
+
+static inline uint32_t getU32(const uint8_t* p) {
+  return getU16(p) | ((uint32_t)getU16(p + 2) << 16);
+}
+
+bool WavFileSource::open(const char* path) {
+  close();
+  _file = fopen(path, "rb");
+  if (_file == nullptr) {
+    return false;
+  }
+  if (!parseHeader()) {
+    close();
+    return false;
+  }
+  return true;
+}
+
+void WavFileSource::close() {
+  if (_file != nullptr) {
+    fclose(_file);
+    _file = nullptr;
+  }
+  _frames = 0;
+  _position = 0;
+  _loops = 0;
+}
+
+// Walks the RIFF chunks up to the data chunk, checking the format on the way
+bool WavFileSource::parseHeader() {
+  uint8_t riff[12];
+  if (fread(riff, 1, sizeof(riff), _file) != sizeof(riff) ||
+      memcmp(riff, "RIFF", 4) != 0 || memcmp(riff + 8, "WAVE", 4) != 0) {
+    return false;
+  }
+
+  bool haveFormat = false;
+  while (true) {
+    uint8_t chunk[8];
+    if (fread(chunk, 1, sizeof(chunk), _file) != sizeof(chunk)) {
+      return false;
+    }
+    uint32_t chunkBytes = getU32(chunk + 4);
+
+    if (memcmp(chunk, "fmt ", 4) == 0) {
+      uint8_t format[16];
+      if (chunkBytes < sizeof(format) || fread(format, 1, sizeof(format), _file) != sizeof(format)) {
+        return false;
+      }
+      uint16_t tag = getU16(format);
+      _channels = getU16(format + 2);
+      _sampleRate = getU32(format + 4);
+      uint16_t bits = getU16(format + 14);
+      if ((tag != WAV_FORMAT_PCM && tag != WAV_FORMAT_EXTENSIBLE) || bits != 16 ||
+          _channels == 0 || _channels > MAX_CHANNELS || _sampleRate == 0) {
+        return false;
+      }
+      haveFormat = true;
+      chunkBytes -= sizeof(format);
+    } else if (memcmp(chunk, "data", 4) == 0) {
+      if (!haveFormat) {
+        return false;
+      }
+      _dataStart = ftell(_file);
+      _frames = chunkBytes / (2 * _channels);
+      return _frames > 0;
+    }
+    // Chunks are padded to an even size
+    if (fseek(_file, (long)(chunkBytes + (chunkBytes & 1)), SEEK_CUR) != 0) {
+      return false;
+    }
+  }
+}
+
+bool WavFileSource::record(int16_t* samples, size_t count, uint32_t sampleRate) {
+  if (_file == nullptr || sampleRate != _sampleRate) {
+    return false;
+  }
+  size_t frameBytes = 2 * (size_t)_channels;
+  size_t done = 0;
+  while (done < count) {
+    if (_position >= _frames) {
+      fseek(_file, _dataStart, SEEK_SET);
+      _position = 0;
+      _loops++;
+    }
+    size_t frames = count - done;
+    if (frames > BLOCK_FRAMES) frames = BLOCK_FRAMES;
+    if (frames > _frames - _position) frames = _frames - _position;
+    if (fread(_block, frameBytes, frames, _file) != frames) {
+      return false;
+    }
+    for (size_t i = 0; i < frames; i++) {
+      samples[done + i] = (int16_t)getU16(_block + i * frameBytes);
+    }
+    done += frames;
+    _position += frames;
+  }
+  return true;
+}
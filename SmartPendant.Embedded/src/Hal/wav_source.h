@@ -0,0 +1,43 @@
+#ifndef WAV_SOURCE_H
+#define WAV_SOURCE_H
+
+#include <stdio.h>
+#include "audio_source.h"
+
+// Plays a 16-bit PCM WAV file as the capture source, looping at the end so
+// a short recording can feed a long run. Multichannel files contribute their
+// first channel. Captures are filled right away, and only at the file's
+// own sample rate.
+class WavFileSource : public AudioSource {
+public:
+  static constexpr size_t MAX_CHANNELS = 8;
+
+  ~WavFileSource() { close(); }
+
+  bool open(const char* path);
+  void close();
+
+  bool record(int16_t* samples, size_t count, uint32_t sampleRate) override;
+  size_t pending() const override { return 0; }
+
+  uint32_t sampleRate() const { return _sampleRate; }
+  uint16_t channels() const { return _channels; }
+  uint32_t frames() const { return _frames; }
+  uint32_t loops() const { return _loops; }
+
+private:
+  static constexpr size_t BLOCK_FRAMES = 256;
+
+  bool parseHeader();
+
+  FILE* _file = nullptr;
+  long _dataStart = 0;
+  uint32_t _frames = 0;
+  uint32_t _position = 0;  // frame index in the data chunk
+  uint32_t _sampleRate = 0;
+  uint16_t _channels = 0;
+  uint32_t _loops = 0;
+  uint8_t _block[BLOCK_FRAMES * MAX_CHANNELS * 2];
+};
+
+#endif
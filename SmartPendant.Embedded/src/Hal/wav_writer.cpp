@@ -0,0 +1,80 @@
+#include "wav_writer.h"
+#include <string.h>
+
+static constexpr size_t WAV_HEADER_BYTES = 44;
+
+static inline void putU16(uint8_t* p, uint32_t v) {
+  p[0] = (uint8_t)(v & 0xFF);
+  p[1] = (uint8_t)((v >> 8) & 0xFF);
+}
+
+static inline void putU32(uint8_t* p, uint32_t v) {
+  putU16(p, v & 0xFFFF);
+  putU16(p + 2, v >> 16);
+}
+
+bool WavFileWriter::open(const char* path, uint32_t sampleRate) {
+  close();
+  _file = fopen(path, "wb");
+  if (_file == nullptr) {
+    return false;
+  }
+  _sampleRate = sampleRate;
+  _samples = 0;
+  writeHeader(0);
+  return true;
+}
+
+void WavFileWriter::close() {
+  if (_file == nullptr) {
+    return;
+  }
+  uint64_t dataBytes = _samples * sizeof(int16_t);
+  writeHeader(dataBytes > UINT32_MAX - WAV_HEADER_BYTES ? UINT32_MAX - WAV_HEADER_BYTES : (uint32_t)dataBytes);
+  fclose(_file);
+  _file = nullptr;
+}
+
+void WavFileWriter::writeHeader(uint32_t dataBytes) {
+  uint8_t h[WAV_HEADER_BYTES];
+  memcpy(h, "RIFF", 4);
+  putU32(h + 4, 36 + dataBytes);
+  memcpy(h + 8, "WAVEfmt ", 8);
+  putU32(h + 16, 16);
+  putU16(h + 20, 1);                     // PCM
+  putU16(h + 22, 1);                     // mono
+  putU32(h + 24, _sampleRate);
+  putU32(h + 28, _sampleRate * sizeof(int16_t));
+  putU16(h + 32, sizeof(int16_t));
+  putU16(h + 34, 16);
+  memcpy(h + 36, "data", 4);
+  putU32(h + 40, dataBytes);
+  long position = ftell(_file);
+  fseek(_file, 0, SEEK_SET);
+  fwrite(h, 1, sizeof(h), _file);
+  if (position > (long)WAV_HEADER_BYTES) {
+    fseek(_file, position, SEEK_SET);
+  }
+}
+
+bool WavFileWriter::write(const int16_t* samples, size_t count) {
+  if (_file == nullptr) {
+    return false;
+  }
+  // WAV is little-endian, like every host this runs on
+  size_t written = fwrite(samples, sizeof(int16_t), count, _file);
+  _samples += written;
+  return written == count;
+}
+
+bool WavFileWriter::writeSilence(size_t count) {
+  static const int16_t zeros[256] = {};
+  while (count > 0) {
+    size_t n = count < 256 ? count : 256;
+    if (!write(zeros, n)) {
+      return false;
+    }
+    count -= n;
+  }
+  return true;
+}
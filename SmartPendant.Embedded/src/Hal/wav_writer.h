@@ -0,0 +1,33 @@
+#ifndef WAV_WRITER_H
+#define WAV_WRITER_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+
+// Writes mono 16-bit PCM WAV files, the counterpart of WavFileSource for
+// host tools. The lengths in the header are filled in by close().
+class WavFileWriter {
+public:
+  ~WavFileWriter() { close(); }
+
+  bool open(const char* path, uint32_t sampleRate);
+  void close();
+  bool isOpen() const { return _file != nullptr; }
+
+  bool write(const int16_t* samples, size_t count);
+  // Appends count zero samples
+  bool writeSilence(size_t count);
+
+  uint32_t sampleRate() const { return _sampleRate; }
+  uint64_t samples() const { return _samples; }
+
+private:
+  void writeHeader(uint32_t dataBytes);
+
+  FILE* _file = nullptr;
+  uint32_t _sampleRate = 0;
+  uint64_t _samples = 0;
+};
+
+#endif
@@ -0,0 +1,82 @@
+#include "connection_state.h"
+
+// Next settled state for each event; DRAINING never appears here because
+// handle() inserts it whenever STREAMING is left
+static const ConnectionState TRANSITIONS[CONNECTION_STATE_COUNT][CONNECTION_EVENT_COUNT] = {
+  //                       CONNECT                 DISCONNECT              SUBSCRIBE               UNSUBSCRIBE             START                   DRAINED
+  /* ADVERTISING */ { CONNECTION_CONNECTED,   CONNECTION_ADVERTISING, CONNECTION_ADVERTISING, CONNECTION_ADVERTISING, CONNECTION_ADVERTISING, CONNECTION_ADVERTISING },
+  /* CONNECTED   */ { CONNECTION_CONNECTED,   CONNECTION_ADVERTISING, CONNECTION_SUBSCRIBED,  CONNECTION_CONNECTED,   CONNECTION_STREAMING,   CONNECTION_CONNECTED },
+  /* SUBSCRIBED  */ { CONNECTION_SUBSCRIBED,  CONNECTION_ADVERTISING, CONNECTION_SUBSCRIBED,  CONNECTION_CONNECTED,   CONNECTION_STREAMING,   CONNECTION_SUBSCRIBED },
+  /* STREAMING   */ { CONNECTION_STREAMING,   CONNECTION_ADVERTISING, CONNECTION_STREAMING,   CONNECTION_CONNECTED,   CONNECTION_STREAMING,   CONNECTION_STREAMING },
+  /* DRAINING    */ { CONNECTION_DRAINING,    CONNECTION_DRAINING,    CONNECTION_DRAINING,    CONNECTION_DRAINING,    CONNECTION_DRAINING,    CONNECTION_DRAINING },
+};
+
+static const char* const STATE_NAMES[CONNECTION_STATE_COUNT] = {
+  "advertising", "connected", "subscribed", "streaming", "draining"
+};
+static const char* const EVENT_NAMES[CONNECTION_EVENT_COUNT] = {
+  "connect", "disconnect", "subscribe", "unsubscribe", "start", "drained"
+};
+
+void ConnectionStateMachine::reset() {
+  _state.store(CONNECTION_ADVERTISING, std::memory_order_release);
+  _drainTarget.store(CONNECTION_ADVERTISING, std::memory_order_release);
+  _transitions = 0;
+  _ignoredEvents = 0;
+}
+
+ConnectionState ConnectionStateMachine::settledState() const {
+  ConnectionState current = state();
+  return current == CONNECTION_DRAINING ? _drainTarget.load(std::memory_order_acquire) : current;
+}
+
+bool ConnectionStateMachine::connected() const {
+  return settledState() != CONNECTION_ADVERTISING;
+}
+
+bool ConnectionStateMachine::handle(ConnectionEvent event) {
+  if (event >= CONNECTION_EVENT_COUNT) {
+    _ignoredEvents++;
+    return false;
+  }
+  ConnectionState current = state();
+
+  if (current == CONNECTION_DRAINING) {
+    ConnectionState target = _drainTarget.load(std::memory_order_relaxed);
+    if (event == CONNECTION_EVENT_DRAINED) {
+      _state.store(target, std::memory_order_release);
+      _transitions++;
+      return true;
+    }
+    ConnectionState next = TRANSITIONS[target][event];
+    if (next == target) {
+      _ignoredEvents++;
+      return false;
+    }
+    _drainTarget.store(next, std::memory_order_release);
+    _transitions++;
+    return true;
+  }
+
+  ConnectionState next = TRANSITIONS[current][event];
+  if (next == current) {
+    _ignoredEvents++;
+    return false;
+  }
+  if (current == CONNECTION_STREAMING) {
+    // The target is published before the state so readers never see a stale one
+    _drainTarget.store(next, std::memory_order_release);
+    next = CONNECTION_DRAINING;
+  }
+  _state.store(next, std::memory_order_release);
+  _transitions++;
+  return true;
+}
+
+const char* ConnectionStateMachine::stateName(ConnectionState state) {
+  return state < CONNECTION_STATE_COUNT ? STATE_NAMES[state] : "?";
+}
+
+const char* ConnectionStateMachine::eventName(ConnectionEvent event) {
+  return event < CONNECTION_EVENT_COUNT ? EVENT_NAMES[event] : "?";
+}
@@ -0,0 +1,64 @@
+#ifndef CONNECTION_STATE_H
+#define CONNECTION_STATE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <atomic>
+
+enum ConnectionState : uint8_t {
+  CONNECTION_ADVERTISING = 0, // no client
+  CONNECTION_CONNECTED,       // client connected, notifications off
+  CONNECTION_SUBSCRIBED,      // notifications on, audio not started yet
+  CONNECTION_STREAMING,       // capturing and sending audio
+  CONNECTION_DRAINING,        // stream stopped, capture buffers still with the driver
+  CONNECTION_STATE_COUNT
+};
+
+enum ConnectionEvent : uint8_t {
+  CONNECTION_EVENT_CONNECT = 0,
+  CONNECTION_EVENT_DISCONNECT,
+  CONNECTION_EVENT_SUBSCRIBE,   // client enabled notifications
+  CONNECTION_EVENT_UNSUBSCRIBE, // client disabled notifications
+  CONNECTION_EVENT_START,       // start command or the start fallback
+  CONNECTION_EVENT_DRAINED,     // the capture side let go of the stopped stream
+  CONNECTION_EVENT_COUNT
+};
+
+// Connection and streaming state of the audio link.
+//
+// Leaving STREAMING always passes through DRAINING, which lasts until the
+// capture side reports DRAINED, so it sees every stop even when the client
+// disconnects and reconnects in between. Events arriving while draining
+// update the state the drain will end in.
+//
+// handle() must be serialized by the caller; state() and the predicates may
+// be read from any task.
+class ConnectionStateMachine {
+public:
+  void reset();
+
+  // Applies an event. Returns true if the state or the drain target changed;
+  // events that mean nothing in the current state are counted and ignored.
+  bool handle(ConnectionEvent event);
+
+  ConnectionState state() const { return _state.load(std::memory_order_acquire); }
+  // Where DRAINING ends; the current state otherwise
+  ConnectionState settledState() const;
+  // A client is connected, or will be once the drain ends
+  bool connected() const;
+  bool streaming() const { return state() == CONNECTION_STREAMING; }
+
+  uint32_t transitions() const { return _transitions; }
+  uint32_t ignoredEvents() const { return _ignoredEvents; }
+
+  static const char* stateName(ConnectionState state);
+  static const char* eventName(ConnectionEvent event);
+
+private:
+  std::atomic<ConnectionState> _state{CONNECTION_ADVERTISING};
+  std::atomic<ConnectionState> _drainTarget{CONNECTION_ADVERTISING};
+  uint32_t _transitions = 0;
+  uint32_t _ignoredEvents = 0;
+};
+
+#endif
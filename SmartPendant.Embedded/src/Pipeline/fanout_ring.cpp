@@ -0,0 +1,161 @@
+#include "fanout_ring.h"
+
+bool FanoutRing::begin(void* storage, size_t slotBytes, size_t slotCount) {
+  for (size_t i = 0; i < MAX_READERS; i++) {
+    _readers[i].attached.store(false, std::memory_order_relaxed);
+    _readers[i].offset.store(0, std::memory_order_relaxed);
+  }
+  return _ring.begin(storage, slotBytes, slotCount);
+}
+
+uint8_t FanoutRing::attach() {
+  bool first = readers() == 0;
+  for (size_t i = 0; i < MAX_READERS; i++) {
+    Reader& r = _readers[i];
+    if (r.attached.load(std::memory_order_relaxed)) {
+      continue;
+    }
+    r.offset.store(first ? 0 : (uint32_t)_ring.occupancy(), std::memory_order_relaxed);
+    r.maxLag = 0;
+    r.skipped = 0;
+    r.taken = 0;
+    r.attached.store(true, std::memory_order_release);
+    return (uint8_t)i;
+  }
+  return NO_READER;
+}
+
+void FanoutRing::detach(uint8_t reader) {
+  if (!attached(reader)) {
+    return;
+  }
+  _readers[reader].attached.store(false, std::memory_order_release);
+  if (readers() > 0) {
+    releasePassed();
+  }
+  // Without readers the ring keeps what it holds for the next first reader
+}
+
+bool FanoutRing::attached(uint8_t reader) const {
+  return reader < MAX_READERS && _readers[reader].attached.load(std::memory_order_acquire);
+}
+
+size_t FanoutRing::readers() const {
+  size_t count = 0;
+  for (size_t i = 0; i < MAX_READERS; i++) {
+    if (_readers[i].attached.load(std::memory_order_acquire)) {
+      count++;
+    }
+  }
+  return count;
+}
+
+uint8_t* FanoutRing::peek(uint8_t reader, size_t& length, uint32_t& tag, SlotTimes& times) {
+  if (!attached(reader)) {
+    return nullptr;
+  }
+  return _ring.peekAt(_readers[reader].offset.load(std::memory_order_relaxed), length, tag, times);
+}
+
+void FanoutRing::release(uint8_t reader) {
+  if (!attached(reader)) {
+    return;
+  }
+  Reader& r = _readers[reader];
+  size_t behind = lag(reader);
+  if (behind == 0) {
+    return;
+  }
+  if (behind > r.maxLag) {
+    r.maxLag = behind;
+  }
+  r.offset.fetch_add(1, std::memory_order_relaxed);
+  r.taken++;
+  releasePassed();
+}
+
+size_t FanoutRing::trim(size_t maxLag) {
+  size_t leading = leadingLag();
+  size_t total = 0;
+  for (size_t i = 0; i < MAX_READERS; i++) {
+    Reader& r = _readers[i];
+    if (!r.attached.load(std::memory_order_relaxed)) {
+      continue;
+    }
+    size_t behind = lag((uint8_t)i);
+    if (behind > r.maxLag) {
+      r.maxLag = behind;
+    }
+    // The leading reader is left to the producer's own overflow policy
+    if (behind <= maxLag || behind <= leading) {
+      continue;
+    }
+    size_t skip = behind - (maxLag > leading ? maxLag : leading);
+    r.offset.fetch_add((uint32_t)skip, std::memory_order_relaxed);
+    r.skipped += (uint32_t)skip;
+    total += skip;
+  }
+  if (total > 0) {
+    releasePassed();
+  }
+  return total;
+}
+
+void FanoutRing::releasePassed() {
+  uint32_t passed = UINT32_MAX;
+  for (size_t i = 0; i < MAX_READERS; i++) {
+    if (_readers[i].attached.load(std::memory_order_relaxed)) {
+      uint32_t offset = _readers[i].offset.load(std::memory_order_relaxed);
+      if (offset < passed) {
+        passed = offset;
+      }
+    }
+  }
+  if (passed == UINT32_MAX || passed == 0) {
+    return;
+  }
+  // Offsets drop before the slots go, so a concurrent lag() never sees a
+  // reader ahead of the newest packet
+  for (size_t i = 0; i < MAX_READERS; i++) {
+    if (_readers[i].attached.load(std::memory_order_relaxed)) {
+      _readers[i].offset.fetch_sub(passed, std::memory_order_relaxed);
+    }
+  }
+  for (uint32_t i = 0; i < passed; i++) {
+    _ring.release();
+  }
+}
+
+size_t FanoutRing::lag(uint8_t reader) const {
+  if (!attached(reader)) {
+    return 0;
+  }
+  size_t held = _ring.occupancy();
+  size_t offset = _readers[reader].offset.load(std::memory_order_relaxed);
+  return held > offset ? held - offset : 0;
+}
+
+size_t FanoutRing::leadingLag() const {
+  size_t leading = SIZE_MAX;
+  for (size_t i = 0; i < MAX_READERS; i++) {
+    if (attached((uint8_t)i)) {
+      size_t behind = lag((uint8_t)i);
+      if (behind < leading) {
+        leading = behind;
+      }
+    }
+  }
+  return leading == SIZE_MAX ? _ring.occupancy() : leading;
+}
+
+size_t FanoutRing::maxLag(uint8_t reader) const {
+  return reader < MAX_READERS ? _readers[reader].maxLag : 0;
+}
+
+uint32_t FanoutRing::skipped(uint8_t reader) const {
+  return reader < MAX_READERS ? _readers[reader].skipped : 0;
+}
+
+uint32_t FanoutRing::taken(uint8_t reader) const {
+  return reader < MAX_READERS ? _readers[reader].taken : 0;
+}
@@ -0,0 +1,92 @@
+#ifndef FANOUT_RING_H
+#define FANOUT_RING_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <atomic>
+#include "slot_ring.h"
+
+// Slot ring read by several clients, each at its own pace.
+//
+// One producer publishes packets exactly as with SlotRing. Every attached
+// reader has its own cursor, and a slot goes back to the producer once all
+// readers have passed it. trim() moves readers that fell too far behind
+// forward over their oldest packets, so a slow client loses audio itself
+// instead of filling the ring for everyone.
+//
+// The producer side belongs to one task and all readers to another, as with
+// SlotRing; lag() and the statistics may be read from any task.
+class FanoutRing {
+public:
+  static constexpr size_t MAX_READERS = 4;
+  static constexpr uint8_t NO_READER = 0xFF;
+
+  static constexpr size_t storageBytes(size_t slotBytes, size_t slotCount) {
+    return SlotRing::storageBytes(slotBytes, slotCount);
+  }
+
+  bool begin(void* storage, size_t slotBytes, size_t slotCount);
+
+  // Producer, as SlotRing
+  uint8_t* reserve() { return _ring.reserve(); }
+  void commit(size_t length, uint32_t tag, const SlotTimes& times = SlotTimes()) {
+    _ring.commit(length, tag, times);
+  }
+  void unreserve() { _ring.unreserve(); }
+  void cancelReservations() { _ring.cancelReservations(); }
+
+  // Adds a reader; NO_READER when all are taken. The first reader starts at
+  // the oldest packet held, later ones at the next packet published.
+  uint8_t attach();
+  // Removes a reader; the slots only it still needed go back to the producer
+  void detach(uint8_t reader);
+
+  // The reader's next packet, or nullptr when it has caught up. The slot
+  // stays valid until release(reader) or trim().
+  uint8_t* peek(uint8_t reader, size_t& length, uint32_t& tag, SlotTimes& times);
+  void release(uint8_t reader);
+  // Moves readers more than maxLag packets behind forward, counting what
+  // they skip; returns the packets skipped. Nobody is moved past the reader
+  // furthest ahead, whose backlog is left to the producer (ring full or a
+  // quality ladder following leadingLag()).
+  size_t trim(size_t maxLag);
+
+  bool attached(uint8_t reader) const;
+  size_t readers() const;
+  // Packets published that the reader has not taken yet
+  size_t lag(uint8_t reader) const;
+  // Lag of the reader furthest ahead, the occupancy without readers. This is
+  // the backlog a producer adapting its rate should look at: trim() bounds
+  // everyone behind it.
+  size_t leadingLag() const;
+  size_t maxLag(uint8_t reader) const;    // since attach
+  uint32_t skipped(uint8_t reader) const; // packets trimmed since attach
+  uint32_t taken(uint8_t reader) const;   // packets released since attach
+
+  size_t slotBytes() const { return _ring.slotBytes(); }
+  size_t slotCount() const { return _ring.slotCount(); }
+  // Slots held for the slowest reader; what reserve() runs out of
+  size_t occupancy() const { return _ring.occupancy(); }
+  size_t highWatermark() const { return _ring.highWatermark(); }
+  uint32_t overruns() const { return _ring.overruns(); }
+  uint32_t committed() const { return _ring.committed(); }
+  void resetStats() { _ring.resetStats(); }
+
+private:
+  struct Reader {
+    std::atomic<bool> attached{false};
+    // Packets taken beyond the oldest slot held; 0 for the slowest reader
+    std::atomic<uint32_t> offset{0};
+    size_t maxLag = 0;
+    uint32_t skipped = 0;
+    uint32_t taken = 0;
+  };
+
+  // Hands back the slots every reader has passed
+  void releasePassed();
+
+  SlotRing _ring;
+  Reader _readers[MAX_READERS];
+};
+
+#endif
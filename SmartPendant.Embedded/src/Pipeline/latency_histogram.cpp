@@ -0,0 +1,60 @@
+#include "latency_histogram.h"
+
+void LatencyHistogram::reset() {
+  for (size_t i = 0; i < BUCKET_COUNT; i++) {
+    _buckets[i] = 0;
+  }
+  _count = 0;
+  _totalUs = 0;
+  _maxUs = 0;
+}
+
+// Values below SUB_BUCKETS get a bucket each; above, the two bits after the
+// leading one pick the sub-bucket within the power of two
+size_t LatencyHistogram::bucketFor(uint32_t us) {
+  if (us < SUB_BUCKETS) {
+    return us;
+  }
+  int msb = 31 - __builtin_clz(us);
+  size_t bucket = (size_t)(msb - 1) * SUB_BUCKETS + ((us >> (msb - 2)) & (SUB_BUCKETS - 1));
+  return bucket < BUCKET_COUNT ? bucket : BUCKET_COUNT - 1;
+}
+
+uint32_t LatencyHistogram::bucketLowUs(size_t bucket) {
+  if (bucket < SUB_BUCKETS) {
+    return (uint32_t)bucket;
+  }
+  size_t octave = bucket / SUB_BUCKETS;
+  size_t sub = bucket % SUB_BUCKETS;
+  return (uint32_t)((SUB_BUCKETS + sub) << (octave - 1));
+}
+
+void LatencyHistogram::record(uint32_t us) {
+  _buckets[bucketFor(us)]++;
+  _count++;
+  _totalUs += us;
+  if (us > _maxUs) {
+    _maxUs = us;
+  }
+}
+
+uint32_t LatencyHistogram::percentileUs(float p) const {
+  uint32_t count = _count;
+  if (count == 0) {
+    return 0;
+  }
+  // Rank of the sample at the percentile, 1-based
+  uint32_t rank = (uint32_t)(p / 100.0f * count + 0.5f);
+  if (rank < 1) rank = 1;
+  if (rank > count) rank = count;
+
+  uint32_t seen = 0;
+  for (size_t b = 0; b < BUCKET_COUNT; b++) {
+    seen += _buckets[b];
+    if (seen >= rank) {
+      uint32_t upper = bucketLowUs(b + 1) - 1;
+      return upper < _maxUs ? upper : _maxUs;
+    }
+  }
+  return _maxUs;
+}
@@ -0,0 +1,43 @@
+#ifndef LATENCY_HISTOGRAM_H
+#define LATENCY_HISTOGRAM_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Fixed-bucket histogram of latencies in microseconds.
+//
+// Buckets grow geometrically, four per power of two, so percentiles come
+// out within 25% of the true value from a few microseconds to half a
+// minute; the maximum is exact. Recording is a handful of instructions and
+// never allocates.
+//
+// record() belongs to one task. Readers on other tasks may see a slightly
+// stale picture, never a torn counter.
+class LatencyHistogram {
+public:
+  static constexpr size_t SUB_BUCKETS = 4;  // per power of two
+  static constexpr size_t OCTAVES = 24;
+  static constexpr size_t BUCKET_COUNT = OCTAVES * SUB_BUCKETS;
+
+  void reset();
+  void record(uint32_t us);
+
+  uint32_t count() const { return _count; }
+  uint32_t maxUs() const { return _maxUs; }
+  uint32_t meanUs() const { return _count > 0 ? (uint32_t)(_totalUs / _count) : 0; }
+  // Upper edge of the bucket holding the p-th percentile (0..100), capped
+  // at the maximum; 0 while empty
+  uint32_t percentileUs(float p) const;
+
+  // Bucket edges: bucket b holds [bucketLowUs(b), bucketLowUs(b + 1))
+  static uint32_t bucketLowUs(size_t bucket);
+  static size_t bucketFor(uint32_t us);
+
+private:
+  uint32_t _buckets[BUCKET_COUNT] = {};
+  uint32_t _count = 0;
+  uint64_t _totalUs = 0;
+  uint32_t _maxUs = 0;
+};
+
+#endif
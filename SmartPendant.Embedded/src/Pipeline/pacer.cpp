@@ -0,0 +1,128 @@
+#include "pacer.h"
+
+bool NotifyPacer::begin(uint8_t initialWindow, uint8_t maxWindow, uint32_t completionTimeoutMs) {
+  if (initialWindow == 0 || maxWindow < initialWindow || completionTimeoutMs == 0) {
+    return false;
+  }
+  _initialWindow = initialWindow;
+  _maxWindow = maxWindow;
+  _completionTimeoutMs = completionTimeoutMs;
+  reset();
+  resetStats();
+  return true;
+}
+
+void NotifyPacer::reset() {
+  _window = _initialWindow;
+  _inFlight = 0;
+  _completedInWindow = 0;
+  _sendFailed = false;
+  _completions.store(0, std::memory_order_relaxed);
+  _congested.store(false, std::memory_order_relaxed);
+  _seenCongestionEvents = _congestionEvents.load(std::memory_order_relaxed);
+  _seenFailedCompletions = _failedCompletions.load(std::memory_order_relaxed);
+}
+
+void NotifyPacer::resetStats() {
+  _sentPackets = 0;
+  _sentBytes = 0;
+  _stalls = 0;
+  _increases = 0;
+  _backoffs = 0;
+  _failures = 0;
+  _timeouts = 0;
+  _maxInFlight = 0;
+}
+
+void NotifyPacer::onComplete(bool ok) {
+  if (!ok) {
+    _failedCompletions.fetch_add(1, std::memory_order_relaxed);
+  }
+  _completions.fetch_add(1, std::memory_order_release);
+}
+
+void NotifyPacer::onCongestion(bool congested) {
+  if (congested) {
+    _congestionEvents.fetch_add(1, std::memory_order_relaxed);
+  }
+  _congested.store(congested, std::memory_order_release);
+}
+
+void NotifyPacer::backOff() {
+  uint8_t halved = _window / 2;
+  _window = halved > 0 ? halved : 1;
+  _completedInWindow = 0;
+  _backoffs++;
+}
+
+size_t NotifyPacer::credits(uint32_t nowMs, uint16_t controllerCredits) {
+  // Fold in what the stack reported since the last call
+  uint32_t completed = _completions.exchange(0, std::memory_order_acquire);
+  if (completed > 0) {
+    _inFlight = completed >= _inFlight ? 0 : (uint8_t)(_inFlight - completed);
+    _lastProgressMs = nowMs;
+  }
+
+  uint32_t congestionEvents = _congestionEvents.load(std::memory_order_relaxed);
+  uint32_t failedCompletions = _failedCompletions.load(std::memory_order_relaxed);
+  bool trouble = _sendFailed || congestionEvents != _seenCongestionEvents ||
+                 failedCompletions != _seenFailedCompletions;
+  if (failedCompletions != _seenFailedCompletions) {
+    _failures += failedCompletions - _seenFailedCompletions;
+  }
+  _seenCongestionEvents = congestionEvents;
+  _seenFailedCompletions = failedCompletions;
+  _sendFailed = false;
+
+  if (_inFlight > 0 && nowMs - _lastProgressMs >= _completionTimeoutMs) {
+    // Completions got lost or the link stalled; do not wait for them forever
+    _inFlight = 0;
+    _timeouts++;
+    trouble = true;
+    _lastProgressMs = nowMs;
+  }
+
+  if (trouble) {
+    backOff();
+  } else if (completed > 0) {
+    _completedInWindow += completed;
+    if (_completedInWindow >= _window) {
+      _completedInWindow = 0;
+      if (_window < _maxWindow) {
+        _window++;
+        _increases++;
+      }
+    }
+  }
+
+  size_t available = 0;
+  if (!_congested.load(std::memory_order_acquire) && _inFlight < _window) {
+    available = _window - _inFlight;
+    if (controllerCredits != UNKNOWN_CONTROLLER_CREDITS && controllerCredits < available) {
+      available = controllerCredits;
+    }
+  }
+  if (available == 0) {
+    _stalls++;
+  }
+  return available;
+}
+
+void NotifyPacer::onSent(size_t bytes, uint32_t nowMs) {
+  if (_inFlight == 0) {
+    _lastProgressMs = nowMs;
+  }
+  if (_inFlight < UINT8_MAX) {
+    _inFlight++;
+  }
+  if (_inFlight > _maxInFlight) {
+    _maxInFlight = _inFlight;
+  }
+  _sentPackets++;
+  _sentBytes += bytes;
+}
+
+void NotifyPacer::onSendFailed() {
+  _failures++;
+  _sendFailed = true;
+}
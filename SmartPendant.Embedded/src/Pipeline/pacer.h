@@ -0,0 +1,84 @@
+#ifndef PACER_H
+#define PACER_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <atomic>
+
+// Credit-based pacing for BLE notifications.
+//
+// The sender may have up to window() notifications queued in the stack at
+// once; each completion reported by the stack returns a credit. The window
+// grows by one after a full window completes without trouble and halves on
+// congestion, failed sends or completions that stop arriving (AIMD), so the
+// sender fills each connection event when the link allows and backs off
+// before the controller's queue overflows.
+//
+// onComplete() and onCongestion() may be called from the BLE stack's task;
+// everything else belongs to the sending task.
+class NotifyPacer {
+public:
+  static constexpr uint16_t UNKNOWN_CONTROLLER_CREDITS = 0xFFFF;
+
+  bool begin(uint8_t initialWindow, uint8_t maxWindow, uint32_t completionTimeoutMs);
+
+  // Starts over for a new connection; counters are kept
+  void reset();
+
+  // Stack side
+  void onComplete(bool ok);
+  void onCongestion(bool congested);
+
+  // Number of notifications that may be sent now. controllerCredits caps the
+  // result with the controller's free buffers when the stack reports them.
+  size_t credits(uint32_t nowMs, uint16_t controllerCredits = UNKNOWN_CONTROLLER_CREDITS);
+
+  void onSent(size_t bytes, uint32_t nowMs);
+  void onSendFailed();
+
+  uint8_t window() const { return _window; }
+  uint8_t inFlight() const { return _inFlight; }
+  bool congested() const { return _congested.load(std::memory_order_relaxed); }
+
+  uint32_t sentPackets() const { return _sentPackets; }
+  uint64_t sentBytes() const { return _sentBytes; }
+  uint32_t stalls() const { return _stalls; }              // credits() returned 0
+  uint32_t increases() const { return _increases; }
+  uint32_t backoffs() const { return _backoffs; }
+  uint32_t congestionEvents() const { return _congestionEvents.load(std::memory_order_relaxed); }
+  uint32_t failures() const { return _failures; }          // rejected sends and failed completions
+  uint32_t timeouts() const { return _timeouts; }          // completions that never came
+  uint8_t maxInFlight() const { return _maxInFlight; }
+  void resetStats();
+
+private:
+  void backOff();
+
+  uint8_t _initialWindow = 4;
+  uint8_t _maxWindow = 8;
+  uint32_t _completionTimeoutMs = 30;
+
+  uint8_t _window = 4;
+  uint8_t _inFlight = 0;
+  uint16_t _completedInWindow = 0;
+  uint32_t _lastProgressMs = 0;
+  uint32_t _seenCongestionEvents = 0;
+  uint32_t _seenFailedCompletions = 0;
+  bool _sendFailed = false;
+
+  std::atomic<uint32_t> _completions{0};
+  std::atomic<uint32_t> _failedCompletions{0};
+  std::atomic<uint32_t> _congestionEvents{0};
+  std::atomic<bool> _congested{false};
+
+  uint32_t _sentPackets = 0;
+  uint64_t _sentBytes = 0;
+  uint32_t _stalls = 0;
+  uint32_t _increases = 0;
+  uint32_t _backoffs = 0;
+  uint32_t _failures = 0;
+  uint32_t _timeouts = 0;
+  uint8_t _maxInFlight = 0;
+};
+
+#endif
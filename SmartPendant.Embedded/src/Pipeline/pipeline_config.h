@@ -0,0 +1,61 @@
+#ifndef PIPELINE_CONFIG_H
+#define PIPELINE_CONFIG_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "slot_ring.h"
+#include "../Protocol/packet.h"
+
+// Shape of the live audio path, fixed at compile time.
+//
+// Everything the tasks share is sized from these parameters so the
+// firmware can reserve it statically. A packet fits one notification by
+// construction (MTU less the 3-byte ATT header), and a shape that breaks
+// one of the invariants below does not compile:
+//   - the MTU leaves room for the framing header and audio
+//   - the ring holds RingChunks whole captures even with every packet
+//     carrying the framing header
+//   - a capture plus the longest send-trigger hold fits the latency budget
+//
+// SampleRateHz is the default rate; a client that negotiates a lower one
+// lengthens the captures unless it also shortens them (CONTROL_CMD_SET_CHUNK).
+template <uint32_t SampleRateHz, size_t ChunkSamples, size_t RingChunks, size_t AttMtu,
+          uint32_t SendHoldMs, uint32_t LatencyBudgetMs>
+struct PipelineConfig {
+  static constexpr size_t ATT_NOTIFY_OVERHEAD_BYTES = 3;
+  static constexpr size_t ATT_MTU_MIN = 23;
+  static constexpr size_t ATT_MTU_MAX = 517;
+
+  static constexpr uint32_t SAMPLE_RATE = SampleRateHz;
+  static constexpr size_t CHUNK_SAMPLES = ChunkSamples;
+  static constexpr size_t CHUNK_BYTES = ChunkSamples * sizeof(int16_t);
+  static constexpr uint32_t CHUNK_US = (uint32_t)(ChunkSamples * 1000000ULL / SampleRateHz);
+  static constexpr size_t MTU = AttMtu;
+
+  // Packets fill the negotiated ATT MTU less the ATT notification header
+  static constexpr size_t MAX_PACKET_BYTES = AttMtu - ATT_NOTIFY_OVERHEAD_BYTES;
+  // Audio in a full framed packet, the least any format carries per slot
+  static constexpr size_t MIN_PAYLOAD_BYTES = MAX_PACKET_BYTES - PACKET_HEADER_BYTES;
+
+  // One packet per slot, rounded up so the ring really holds RingChunks captures
+  static constexpr size_t RING_CHUNKS = RingChunks;
+  static constexpr size_t RING_SLOTS = (RingChunks * CHUNK_BYTES + MIN_PAYLOAD_BYTES - 1) / MIN_PAYLOAD_BYTES;
+  static constexpr size_t RING_STORAGE_BYTES = SlotRing::storageBytes(MAX_PACKET_BYTES, RING_SLOTS);
+
+  // sendTask batches at most half the ring, and holds a partial batch this long
+  static constexpr size_t MAX_SEND_TRIGGER = RING_SLOTS / 2;
+  static constexpr uint32_t SEND_HOLD_US = SendHoldMs * 1000;
+  // Live audio reaches sendTask at most a whole capture plus the hold after it was recorded
+  static constexpr uint32_t WORST_LATENCY_US = CHUNK_US + SEND_HOLD_US;
+  static constexpr uint32_t LATENCY_BUDGET_US = LatencyBudgetMs * 1000;
+
+  static_assert(AttMtu >= ATT_MTU_MIN && AttMtu <= ATT_MTU_MAX, "ATT MTU outside 23..517");
+  static_assert(MAX_PACKET_BYTES > PACKET_HEADER_BYTES + sizeof(int16_t), "MTU leaves no room for audio");
+  static_assert(ChunkSamples > 0 && ChunkSamples <= UINT16_MAX, "chunk size outside the control command's range");
+  static_assert(RingChunks >= 2, "the ring must hold one capture while the previous one is sent");
+  static_assert(RING_SLOTS * MIN_PAYLOAD_BYTES >= RingChunks * CHUNK_BYTES, "ring holds fewer than RingChunks captures");
+  static_assert(MAX_SEND_TRIGGER >= 1 && MAX_SEND_TRIGGER <= UINT8_MAX, "send trigger outside 1..255 packets");
+  static_assert(WORST_LATENCY_US <= LATENCY_BUDGET_US, "a capture plus the send hold exceeds the latency budget");
+};
+
+#endif
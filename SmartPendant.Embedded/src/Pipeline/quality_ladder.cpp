@@ -0,0 +1,84 @@
+#include "quality_ladder.h"
+
+static const char* const LEVEL_NAMES[QUALITY_LEVEL_COUNT] = { "full", "half rate", "mu-law half rate", "silence" };
+
+bool QualityLadder::begin(const Config& config) {
+  if (config.lowPercent >= config.highPercent || config.highPercent > config.silencePercent ||
+      config.silencePercent > 100 ||
+      config.lowest >= QUALITY_LEVEL_COUNT) {
+    return false;
+  }
+  _config = config;
+  reset(0);
+  resetStats();
+  return true;
+}
+
+void QualityLadder::reset(uint32_t nowMs) {
+  _level = QUALITY_FULL;
+  _lastUpdateMs = nowMs;
+  _lastChangeMs = nowMs;
+  _below = false;
+}
+
+void QualityLadder::resetStats() {
+  _stepsDown = 0;
+  _stepsUp = 0;
+  for (size_t i = 0; i < QUALITY_LEVEL_COUNT; i++) {
+    _residencyMs[i] = 0;
+  }
+}
+
+void QualityLadder::changeLevel(QualityLevel level, uint32_t nowMs) {
+  if (level > _level) {
+    _stepsDown++;
+  } else {
+    _stepsUp++;
+  }
+  _level = level;
+  _lastChangeMs = nowMs;
+  _below = false;
+}
+
+QualityLevel QualityLadder::update(size_t occupancy, size_t capacity, uint32_t nowMs) {
+  _residencyMs[_level] += nowMs - _lastUpdateMs;
+  _lastUpdateMs = nowMs;
+  if (capacity == 0) {
+    return _level;
+  }
+
+  uint32_t percent = (uint32_t)(occupancy * 100 / capacity);
+  uint32_t sinceChange = nowMs - _lastChangeMs;
+  if (percent >= _config.highPercent) {
+    _below = false;
+    // The last rung gives up audio, so the ring absorbs what it can first
+    bool toSilence = _level + 1 == QUALITY_SILENCE;
+    if (_level < _config.lowest && sinceChange >= _config.downHoldMs &&
+        (!toSilence || percent >= _config.silencePercent)) {
+      changeLevel((QualityLevel)(_level + 1), nowMs);
+    }
+  } else if (_level == QUALITY_SILENCE) {
+    // Silence costs next to nothing on the link, so a ring that drains at
+    // all means audio fits again
+    if (sinceChange >= _config.downHoldMs) {
+      changeLevel((QualityLevel)(_level - 1), nowMs);
+    }
+  } else if (percent <= _config.lowPercent) {
+    if (!_below) {
+      _below = true;
+      _belowSinceMs = nowMs;
+    }
+    if (_level > QUALITY_FULL && nowMs - _belowSinceMs >= _config.upHoldMs &&
+        sinceChange >= _config.upHoldMs) {
+      changeLevel((QualityLevel)(_level - 1), nowMs);
+    }
+  } else {
+    // Between the watermarks: hold the current level
+    _below = false;
+  }
+  return _level;
+}
+
+const char* QualityLadder::levelName(QualityLevel level) {
+  return level < QUALITY_LEVEL_COUNT ? LEVEL_NAMES[level] : "?";
+}
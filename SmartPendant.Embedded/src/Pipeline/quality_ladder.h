@@ -0,0 +1,65 @@
+#ifndef QUALITY_LADDER_H
+#define QUALITY_LADDER_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Rungs of the ladder, best first. Each one roughly halves the bytes per
+// second of the one above.
+enum QualityLevel : uint8_t {
+  QUALITY_FULL = 0,      // the negotiated format
+  QUALITY_HALF_RATE,     // half the sample rate (PACKET_FLAG_HALF_RATE)
+  QUALITY_COMPANDED,     // half the sample rate, 8-bit mu-law
+  QUALITY_SILENCE,       // silence markers only; the timeline keeps moving
+  QUALITY_LEVEL_COUNT
+};
+
+// Overflow policy for the live stream: instead of dropping whole packets
+// when the ring fills (hard gaps mid-word), the capture steps down the
+// ladder while occupancy sits above the high watermark and back up once it
+// has stayed below the low watermark for a while. Stepping down is quick,
+// stepping up slow, so a link that just recovered is not flooded again.
+//
+// Portable: the caller feeds occupancy and applies the level it gets back.
+class QualityLadder {
+public:
+  struct Config {
+    uint8_t highPercent = 50;      // occupancy that steps down
+    uint8_t silencePercent = 90;   // occupancy that steps down to QUALITY_SILENCE
+    uint8_t lowPercent = 15;       // occupancy that counts towards stepping up
+    uint32_t downHoldMs = 250;     // between steps down, so the last one can take effect
+    uint32_t upHoldMs = 3000;      // below the low watermark this long per step up;
+                                   // QUALITY_SILENCE ends below the high one
+    QualityLevel lowest = QUALITY_SILENCE;
+  };
+
+  bool begin(const Config& config);
+  // Back to QUALITY_FULL, statistics kept
+  void reset(uint32_t nowMs);
+  void resetStats();
+
+  // Call before every capture; returns the level to capture it at
+  QualityLevel update(size_t occupancy, size_t capacity, uint32_t nowMs);
+
+  QualityLevel level() const { return _level; }
+  uint32_t stepsDown() const { return _stepsDown; }
+  uint32_t stepsUp() const { return _stepsUp; }
+  uint32_t residencyMs(QualityLevel level) const { return _residencyMs[level]; }
+
+  static const char* levelName(QualityLevel level);
+
+private:
+  void changeLevel(QualityLevel level, uint32_t nowMs);
+
+  Config _config;
+  QualityLevel _level = QUALITY_FULL;
+  uint32_t _lastUpdateMs = 0;
+  uint32_t _lastChangeMs = 0;
+  uint32_t _belowSinceMs = 0;
+  bool _below = false;
+  uint32_t _stepsDown = 0;
+  uint32_t _stepsUp = 0;
+  uint32_t _residencyMs[QUALITY_LEVEL_COUNT] = {};
+};
+
+#endif
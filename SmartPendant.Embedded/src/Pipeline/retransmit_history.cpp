@@ -0,0 +1,149 @@
+#include "retransmit_history.h"
+#include <string.h>
+
+bool RetransmitHistory::begin(void* storage, size_t slotBytes, size_t slotCount) {
+  if (storage == nullptr || slotBytes == 0 || slotBytes > UINT16_MAX || slotCount < 2 ||
+      slotCount > MAX_SLOTS || (slotCount & (slotCount - 1)) != 0) {
+    return false;
+  }
+  _storage = (uint8_t*)storage;
+  _slotBytes = slotBytes;
+  _slotCount = slotCount;
+  _stride = slotStride(slotBytes);
+  reset();
+  resetStats();
+  return true;
+}
+
+void RetransmitHistory::reset() {
+  for (size_t i = 0; i < _slotCount; i++) {
+    ((SlotHeader*)(_storage + i * _stride))->state = SLOT_EMPTY;
+  }
+  _newest = 0;
+  _held = 0;
+  _pending = 0;
+  _resendFrom = 0;
+  _queueTail.store(_queueHead.load(std::memory_order_acquire), std::memory_order_release);
+}
+
+void RetransmitHistory::resetStats() {
+  _nacked = 0;
+  _resent = 0;
+  _resentBytes = 0;
+  _unrecoverable = 0;
+  _duplicates = 0;
+  _droppedRanges.store(0, std::memory_order_relaxed);
+}
+
+void RetransmitHistory::record(uint16_t sequence, const uint8_t* packet, size_t length) {
+  SlotHeader* slot = slotFor(sequence);
+  if (slot->state == SLOT_PENDING) {
+    // Its NACK came too late to be served
+    _pending--;
+    _unrecoverable++;
+  }
+  slot->sequence = sequence;
+  if (length <= _slotBytes) {
+    memcpy(dataOf(slot), packet, length);
+    slot->length = (uint16_t)length;
+    slot->state = SLOT_HELD;
+  } else {
+    slot->state = SLOT_EMPTY;
+  }
+  _newest = sequence;
+  if (_held < _slotCount) {
+    _held++;
+  }
+}
+
+bool RetransmitHistory::nack(uint16_t first, uint16_t count) {
+  if (count == 0) {
+    return true;
+  }
+  uint32_t head = _queueHead.load(std::memory_order_relaxed);
+  if (head - _queueTail.load(std::memory_order_acquire) >= NACK_QUEUE_RANGES) {
+    _droppedRanges.fetch_add(1, std::memory_order_relaxed);
+    return false;
+  }
+  _queue[head % NACK_QUEUE_RANGES] = { first, count };
+  _queueHead.store(head + 1, std::memory_order_release);
+  return true;
+}
+
+void RetransmitHistory::takeNacks() {
+  uint32_t head = _queueHead.load(std::memory_order_acquire);
+  uint32_t tail = _queueTail.load(std::memory_order_relaxed);
+  while (tail != head) {
+    Range range = _queue[tail % NACK_QUEUE_RANGES];
+    tail++;
+    markRange(range.first, range.count);
+  }
+  _queueTail.store(tail, std::memory_order_release);
+}
+
+void RetransmitHistory::markRange(uint16_t first, uint16_t count) {
+  // Half the sequence space is as far as "before" and "after" can be told apart
+  if (count > 0x8000) {
+    count = 0x8000;
+  }
+  // Ages of the range's first and last packet; negative ones are not sent yet
+  int32_t oldest = (int16_t)age(first);
+  int32_t newest = oldest - (int32_t)(count - 1);
+  if (oldest < 0) {
+    return;
+  }
+  if (newest < 0) {
+    newest = 0;
+  }
+  _nacked += (uint32_t)(oldest - newest + 1);
+
+  int32_t held = (int32_t)_held;
+  if (oldest >= held) {
+    // Overwritten since
+    _unrecoverable += (uint32_t)(oldest - (newest > held ? newest : held) + 1);
+    oldest = held - 1;
+  }
+  for (int32_t a = oldest; a >= newest; a--) {
+    uint16_t sequence = (uint16_t)(_newest - a);
+    SlotHeader* slot = slotFor(sequence);
+    if (slot->state == SLOT_EMPTY || slot->sequence != sequence) {
+      _unrecoverable++;
+    } else if (slot->state == SLOT_PENDING) {
+      _duplicates++;
+    } else {
+      slot->state = SLOT_PENDING;
+      if (_pending == 0 || age(sequence) > age(_resendFrom)) {
+        _resendFrom = sequence;
+      }
+      _pending++;
+    }
+  }
+}
+
+uint8_t* RetransmitHistory::nextResend(size_t& length, uint16_t& sequence) {
+  takeNacks();
+  // Every pending packet lies between _resendFrom and the newest, so one
+  // pass over the history finds the oldest
+  for (size_t scanned = 0; _pending > 0 && scanned <= _held; scanned++) {
+    if (age(_resendFrom) >= _held) {
+      _resendFrom = (uint16_t)(_newest - (_held - 1));
+    }
+    uint16_t s = _resendFrom++;
+    SlotHeader* slot = slotFor(s);
+    if (slot->state == SLOT_PENDING && slot->sequence == s) {
+      slot->state = SLOT_HELD;
+      _pending--;
+      _resent++;
+      _resentBytes += slot->length;
+      length = slot->length;
+      sequence = s;
+      return dataOf(slot);
+    }
+  }
+  return nullptr;
+}
+
+bool RetransmitHistory::pending() const {
+  return _pending > 0 ||
+         _queueHead.load(std::memory_order_acquire) != _queueTail.load(std::memory_order_relaxed);
+}
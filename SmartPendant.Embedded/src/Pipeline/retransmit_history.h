@@ -0,0 +1,122 @@
+#ifndef RETRANSMIT_HISTORY_H
+#define RETRANSMIT_HISTORY_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <atomic>
+
+// Copies of the packets last sent to one client, by sequence number, so the
+// ones it reports missing can be sent again.
+//
+// Packet s lives in slot s % slotCount. Sequence numbers go up by one per
+// packet sent, so the history is always the newest slotCount packets and a
+// lookup is a single compare; slotCount is a power of two, which keeps the
+// mapping intact when the sequence wraps at 65536.
+//
+// The client NACKs ranges of sequence numbers. nack() only queues a range
+// (lock-free, for the task that receives the control writes); the sender
+// works through the queue in nextResend(), marks the packets still held as
+// pending and hands them out oldest first. A packet NACKed again while it
+// is pending is sent once; one NACKed again after it was resent goes out
+// again. Ranges the client could not have seen yet are ignored.
+//
+// Everything except nack() and the statistics belongs to the sending task.
+class RetransmitHistory {
+public:
+  static constexpr size_t MAX_SLOTS = 32768;
+  static constexpr size_t NACK_QUEUE_RANGES = 16;
+
+  // Bytes of storage needed for slotCount slots of slotBytes each
+  static constexpr size_t storageBytes(size_t slotBytes, size_t slotCount) {
+    return slotCount * slotStride(slotBytes);
+  }
+  // The least power of two holding packets, as begin() needs
+  static constexpr size_t slotCountFor(size_t packets) {
+    return packets <= 2 ? 2 : 2 * slotCountFor((packets + 1) / 2);
+  }
+
+  // slotCount must be a power of two, at most MAX_SLOTS
+  bool begin(void* storage, size_t slotBytes, size_t slotCount);
+  // Forgets every packet and queued NACK, for a new connection whose
+  // sequence starts over; the statistics are kept
+  void reset();
+
+  // Keeps a copy of a packet just sent with this sequence number, the one
+  // after the previous packet recorded. Longer packets are not kept.
+  void record(uint16_t sequence, const uint8_t* packet, size_t length);
+
+  // Any task: asks for count packets from first to be sent again. False if
+  // the queue was full and the range was dropped.
+  bool nack(uint16_t first, uint16_t count);
+
+  // The oldest packet waiting to be sent again, or nullptr if none; valid
+  // until the next record(). Each packet is handed out once per NACK.
+  uint8_t* nextResend(size_t& length, uint16_t& sequence);
+  // True if nextResend() may have a packet, queued NACKs included
+  bool pending() const;
+
+  size_t slotCount() const { return _slotCount; }
+  // Packets held, at most slotCount()
+  size_t held() const { return _held; }
+
+  uint32_t nackedPackets() const { return _nacked; }       // in the ranges taken from the queue
+  uint32_t resentPackets() const { return _resent; }
+  uint32_t resentBytes() const { return _resentBytes; }
+  // NACKed packets no longer held, or overwritten before they could be resent
+  uint32_t unrecoverable() const { return _unrecoverable; }
+  uint32_t duplicates() const { return _duplicates; }      // NACKed again while pending
+  uint32_t droppedRanges() const { return _droppedRanges.load(std::memory_order_relaxed); }
+  void resetStats();
+
+private:
+  enum SlotState : uint8_t { SLOT_EMPTY = 0, SLOT_HELD, SLOT_PENDING };
+
+  struct SlotHeader {
+    uint16_t sequence;
+    uint16_t length;
+    uint8_t state;
+  };
+
+  struct Range {
+    uint16_t first;
+    uint16_t count;
+  };
+
+  static constexpr size_t slotStride(size_t slotBytes) {
+    return ((sizeof(SlotHeader) + 3) & ~(size_t)3) + ((slotBytes + 3) & ~(size_t)3);
+  }
+
+  SlotHeader* slotFor(uint16_t sequence) const {
+    return (SlotHeader*)(_storage + (sequence & (_slotCount - 1)) * _stride);
+  }
+  uint8_t* dataOf(SlotHeader* slot) const {
+    return (uint8_t*)slot + ((sizeof(SlotHeader) + 3) & ~(size_t)3);
+  }
+  // Packets recorded after this one; 0xFFFF for the one after the newest
+  uint16_t age(uint16_t sequence) const { return (uint16_t)(_newest - sequence); }
+
+  void takeNacks();
+  void markRange(uint16_t first, uint16_t count);
+
+  uint8_t* _storage = nullptr;
+  size_t _slotBytes = 0;
+  size_t _slotCount = 0;
+  size_t _stride = 0;
+  uint16_t _newest = 0;
+  size_t _held = 0;
+  size_t _pending = 0;
+  uint16_t _resendFrom = 0;  // no pending packet is older than this one
+
+  Range _queue[NACK_QUEUE_RANGES];
+  std::atomic<uint32_t> _queueHead{0};  // written by nack()
+  std::atomic<uint32_t> _queueTail{0};  // written by the sender
+
+  uint32_t _nacked = 0;
+  uint32_t _resent = 0;
+  uint32_t _resentBytes = 0;
+  uint32_t _unrecoverable = 0;
+  uint32_t _duplicates = 0;
+  std::atomic<uint32_t> _droppedRanges{0};
+};
+
+#endif
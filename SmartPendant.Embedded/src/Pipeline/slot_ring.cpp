@@ -0,0 +1,86 @@
+#include "slot_ring.h"
+
+bool SlotRing::begin(void* storage, size_t slotBytes, size_t slotCount) {
+  if (storage == nullptr || slotBytes == 0 || slotCount == 0) {
+    return false;
+  }
+  _storage = (uint8_t*)storage;
+  _slotBytes = slotBytes;
+  _slotCount = slotCount;
+  _stride = slotStride(slotBytes);
+  _head.store(0, std::memory_order_relaxed);
+  _tail.store(0, std::memory_order_relaxed);
+  _reserved = 0;
+  resetStats();
+  return true;
+}
+
+uint8_t* SlotRing::reserve() {
+  uint32_t head = _head.load(std::memory_order_relaxed);
+  uint32_t tail = _tail.load(std::memory_order_acquire);
+  if (distance(tail, head) + _reserved >= _slotCount) {
+    _overruns++;
+    return nullptr;
+  }
+  SlotHeader* slot = slotAt(advance(head, _reserved));
+  _reserved++;
+  return (uint8_t*)(slot + 1);
+}
+
+void SlotRing::commit(size_t length, uint32_t tag, const SlotTimes& times) {
+  if (_reserved == 0) {
+    return;
+  }
+  uint32_t head = _head.load(std::memory_order_relaxed);
+  SlotHeader* slot = slotAt(head);
+  slot->tag = tag;
+  slot->length = (uint32_t)(length > _slotBytes ? _slotBytes : length);
+  slot->times = times;
+  _reserved--;
+  _committed++;
+  _head.store(advance(head, 1), std::memory_order_release);
+
+  size_t used = distance(_tail.load(std::memory_order_relaxed), advance(head, 1));
+  if (used > _highWatermark) {
+    _highWatermark = used;
+  }
+}
+
+uint8_t* SlotRing::peek(size_t& length, uint32_t& tag) {
+  SlotTimes times;
+  return peek(length, tag, times);
+}
+
+uint8_t* SlotRing::peek(size_t& length, uint32_t& tag, SlotTimes& times) {
+  return peekAt(0, length, tag, times);
+}
+
+uint8_t* SlotRing::peekAt(size_t offset, size_t& length, uint32_t& tag, SlotTimes& times) {
+  uint32_t tail = _tail.load(std::memory_order_relaxed);
+  if (offset >= distance(tail, _head.load(std::memory_order_acquire))) {
+    return nullptr;
+  }
+  SlotHeader* slot = slotAt(advance(tail, (uint32_t)offset));
+  length = slot->length;
+  tag = slot->tag;
+  times = slot->times;
+  return (uint8_t*)(slot + 1);
+}
+
+void SlotRing::release() {
+  uint32_t tail = _tail.load(std::memory_order_relaxed);
+  if (tail != _head.load(std::memory_order_acquire)) {
+    _tail.store(advance(tail, 1), std::memory_order_release);
+  }
+}
+
+size_t SlotRing::occupancy() const {
+  uint32_t tail = _tail.load(std::memory_order_acquire);
+  return distance(tail, _head.load(std::memory_order_acquire));
+}
+
+void SlotRing::resetStats() {
+  _highWatermark = 0;
+  _overruns = 0;
+  _committed = 0;
+}
@@ -0,0 +1,100 @@
+#ifndef SLOT_RING_H
+#define SLOT_RING_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <atomic>
+
+// Lock-free single-producer/single-consumer ring of fixed-size slots.
+//
+// The producer fills slots in place and publishes them in order; the
+// consumer reads a published slot in place and releases it when done, so
+// no audio is copied between the two tasks. The producer may hold several
+// reservations at once (e.g. buffers queued with the mic driver); they are
+// committed in the order they were reserved.
+//
+// Storage is supplied by the caller so it can come from DMA-capable RAM.
+
+// Timestamps travelling with a slot, for latency accounting (microseconds)
+struct SlotTimes {
+  uint32_t sampleUs = 0;  // oldest audio in the slot was captured
+  uint32_t commitUs = 0;  // slot was published
+};
+
+class SlotRing {
+public:
+  // Bytes of storage needed for slotCount slots of slotBytes payload each
+  static constexpr size_t storageBytes(size_t slotBytes, size_t slotCount) {
+    return slotCount * slotStride(slotBytes);
+  }
+
+  bool begin(void* storage, size_t slotBytes, size_t slotCount);
+
+  // Producer: returns the next free slot, or nullptr when the ring is full
+  // (counted as an overrun)
+  uint8_t* reserve();
+  // Producer: publishes the oldest reservation with its length and a tag
+  void commit(size_t length, uint32_t tag, const SlotTimes& times = SlotTimes());
+  // Producer: drops the most recent reservation
+  void unreserve() { if (_reserved > 0) _reserved--; }
+  // Producer: drops all outstanding reservations
+  void cancelReservations() { _reserved = 0; }
+
+  // Consumer: returns the oldest published slot, or nullptr when empty.
+  // The slot stays owned by the consumer until release().
+  uint8_t* peek(size_t& length, uint32_t& tag);
+  uint8_t* peek(size_t& length, uint32_t& tag, SlotTimes& times);
+  // Consumer: the published slot offset places after the oldest, or nullptr
+  // if fewer are published. Only release() hands slots back.
+  uint8_t* peekAt(size_t offset, size_t& length, uint32_t& tag, SlotTimes& times);
+  // Consumer: hands the slot returned by peek() back to the producer
+  void release();
+
+  size_t slotBytes() const { return _slotBytes; }
+  size_t slotCount() const { return _slotCount; }
+  size_t occupancy() const;
+  size_t highWatermark() const { return _highWatermark; }
+  uint32_t overruns() const { return _overruns; }
+  uint32_t committed() const { return _committed; }
+  void resetStats();
+
+private:
+  struct SlotHeader {
+    uint32_t tag;
+    uint32_t length;
+    SlotTimes times;
+  };
+
+  static constexpr size_t slotStride(size_t slotBytes) {
+    return sizeof(SlotHeader) + ((slotBytes + 3) & ~(size_t)3);
+  }
+
+  SlotHeader* slotAt(uint32_t index) const {
+    return (SlotHeader*)(_storage + (index % _slotCount) * _stride);
+  }
+
+  // Positions run over [0, 2 * slotCount) so a full ring differs from an empty one
+  uint32_t advance(uint32_t index, uint32_t by) const {
+    return (index + by) % (2 * _slotCount);
+  }
+
+  uint32_t distance(uint32_t from, uint32_t to) const {
+    return (to + 2 * _slotCount - from) % (2 * _slotCount);
+  }
+
+  uint8_t* _storage = nullptr;
+  size_t _slotBytes = 0;
+  size_t _slotCount = 0;
+  size_t _stride = 0;
+
+  // Only the producer writes _head, only the consumer writes _tail
+  std::atomic<uint32_t> _head{0};
+  std::atomic<uint32_t> _tail{0};
+  uint32_t _reserved = 0;
+
+  size_t _highWatermark = 0;
+  uint32_t _overruns = 0;
+  uint32_t _committed = 0;
+};
+
+#endif
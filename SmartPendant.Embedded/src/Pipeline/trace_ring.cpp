@@ -0,0 +1,49 @@
+#include "trace_ring.h"
+
+static const char* const TRACE_EVENT_NAMES[TRACE_EVENT_TYPE_COUNT] = {
+  "none", "task switch", "record begin", "record end", "process end",
+  "ring send", "ring receive", "ring drop", "notify begin", "notify end",
+  "UI frame begin", "UI frame end", "CPU clock", "keepalive", "trigger",
+};
+
+const char* traceEventName(uint8_t type) {
+  return type < TRACE_EVENT_TYPE_COUNT ? TRACE_EVENT_NAMES[type] : "unknown";
+}
+
+bool TraceRing::begin(TraceEvent* storage, size_t capacity) {
+  if (storage == nullptr || capacity == 0 || (capacity & (capacity - 1)) != 0) {
+    return false;
+  }
+  _events = storage;
+  _mask = (uint32_t)(capacity - 1);
+  _head.store(0, std::memory_order_relaxed);
+  _stopping.store(false, std::memory_order_relaxed);
+  return true;
+}
+
+void TraceRing::stopAfter(uint32_t count) {
+  // The writer may be between reading and advancing the head; it stops one
+  // event late at worst
+  uint32_t stopAt = _head.load(std::memory_order_relaxed) + count;
+  if (_stopping.load(std::memory_order_relaxed) &&
+      (int32_t)(stopAt - _stopAt.load(std::memory_order_relaxed)) >= 0) {
+    return;
+  }
+  _stopAt.store(stopAt, std::memory_order_relaxed);
+  _stopping.store(true, std::memory_order_relaxed);
+}
+
+bool TraceRing::stopped() const {
+  return _stopping.load(std::memory_order_relaxed) &&
+         (int32_t)(_head.load(std::memory_order_acquire) - _stopAt.load(std::memory_order_relaxed)) >= 0;
+}
+
+size_t TraceRing::size() const {
+  uint32_t head = _head.load(std::memory_order_acquire);
+  return head < capacity() ? head : capacity();
+}
+
+const TraceEvent& TraceRing::at(size_t i) const {
+  uint32_t head = _head.load(std::memory_order_acquire);
+  return _events[(head - size() + i) & _mask];
+}
@@ -0,0 +1,98 @@
+#ifndef TRACE_RING_H
+#define TRACE_RING_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <atomic>
+
+// What happened, in the order the scheduler and the audio path see it. The
+// argument of each is noted; ids tie an event to the one that ends it.
+enum TraceEventType : uint8_t {
+  TRACE_NONE = 0,
+  TRACE_TASK_SWITCH = 1,      // task (FreeRTOS task number) starts running on the core
+  TRACE_RECORD_BEGIN = 2,     // capture id handed to mic.record()
+  TRACE_RECORD_END = 3,       // capture id back from the mic driver; recordTask processes it
+  TRACE_PROCESS_END = 4,      // packets the capture made
+  TRACE_RING_SEND = 5,        // bytes published to the audio ring
+  TRACE_RING_RECEIVE = 6,     // bytes taken from the audio ring for a client
+  TRACE_RING_DROP = 7,        // bytes lost to a full ring
+  TRACE_NOTIFY_BEGIN = 8,     // connection id a packet is handed to the stack for
+  TRACE_NOTIFY_END = 9,       // 1 if the stack took it, 0 if it refused
+  TRACE_UI_FRAME_BEGIN = 10,
+  TRACE_UI_FRAME_END = 11,
+  TRACE_CPU_CLOCK = 12,       // the clock in MHz the events before this one ran at
+  TRACE_KEEPALIVE = 13,       // once a second, so long quiet spells still unwrap
+  TRACE_TRIGGER = 14,         // why the trace was frozen (a TraceTrigger)
+  TRACE_EVENT_TYPE_COUNT
+};
+
+enum TraceTrigger : uint16_t {
+  TRACE_TRIGGER_REQUEST = 0,  // asked for on the serial console
+  TRACE_TRIGGER_DROP = 1,     // the audio ring overflowed
+};
+
+// One event: the core's cycle counter when it happened (wraps every 18 s
+// at 240 MHz), its type and argument
+struct TraceEvent {
+  uint32_t cycles;
+  uint8_t type;
+  uint8_t reserved;
+  uint16_t arg;
+};
+static_assert(sizeof(TraceEvent) == 8, "trace events are dumped as 8 bytes");
+
+const char* traceEventName(uint8_t type);
+
+// Flight recorder of one core's events: the newest capacity events, oldest
+// overwritten first.
+//
+// record() belongs to one writer, the core the ring is for; the caller keeps
+// it from being re-entered (interrupts masked around it). Appending is a few
+// loads and stores and never blocks. Any core may arm a stop with
+// stopAfter(); the ring then keeps that many more events and ignores the rest
+// until resume(), so the events around a trigger survive until they are read.
+// Read the events only once stopped().
+//
+// Storage is supplied by the caller so it can sit in internal RAM.
+class TraceRing {
+public:
+  // capacity must be a power of two
+  bool begin(TraceEvent* storage, size_t capacity);
+
+  inline void record(uint32_t cycles, uint8_t type, uint16_t arg) {
+    uint32_t head = _head.load(std::memory_order_relaxed);
+    if (_stopping.load(std::memory_order_relaxed) &&
+        (int32_t)(head - _stopAt.load(std::memory_order_relaxed)) >= 0) {
+      return;
+    }
+    TraceEvent& e = _events[head & _mask];
+    e.cycles = cycles;
+    e.type = type;
+    e.arg = arg;
+    _head.store(head + 1, std::memory_order_release);
+  }
+
+  // Keeps the next count events, then stops; 0 stops now. Of two stops
+  // armed, the earlier one wins.
+  void stopAfter(uint32_t count);
+  bool stopping() const { return _stopping.load(std::memory_order_relaxed); }
+  bool stopped() const;
+  // Records again, overwriting the oldest events
+  void resume() { _stopping.store(false, std::memory_order_relaxed); }
+
+  size_t capacity() const { return _mask + 1; }
+  // Events held, and the i-th of them, 0 the oldest
+  size_t size() const;
+  const TraceEvent& at(size_t i) const;
+  // Events recorded since begin(), including those overwritten
+  uint32_t recorded() const { return _head.load(std::memory_order_acquire); }
+
+private:
+  TraceEvent* _events = nullptr;
+  uint32_t _mask = 0;
+  std::atomic<uint32_t> _head{0};
+  std::atomic<uint32_t> _stopAt{0};
+  std::atomic<bool> _stopping{false};
+};
+
+#endif
@@ -0,0 +1,173 @@
+#include "power_manager.h"
+
+// Advertising slows down the longer nobody connects (0.625 ms units)
+static constexpr uint32_t ADVERTISING_FAST_MS = 30000;
+static constexpr uint32_t ADVERTISING_MEDIUM_MS = 300000;
+static constexpr uint16_t ADVERTISING_FAST_INTERVAL = 160;    // 100 ms
+static constexpr uint16_t ADVERTISING_MEDIUM_INTERVAL = 800;  // 500 ms
+static constexpr uint16_t ADVERTISING_SLOW_INTERVAL = 2048;   // 1.28 s
+
+// Backlight after this long without activity
+static constexpr uint32_t BACKLIGHT_DIM_MS = 30000;
+static constexpr uint32_t BACKLIGHT_OFF_MS = 60000;
+
+// CPU clocks usable with the radio on; the capture path may use at most
+// this share of each chunk's deadline at the chosen clock
+static const uint16_t CPU_CLOCKS_MHZ[] = { 80, 160, 240 };
+static constexpr size_t CPU_CLOCK_COUNT = sizeof(CPU_CLOCKS_MHZ) / sizeof(CPU_CLOCKS_MHZ[0]);
+static constexpr float CAPTURE_CPU_BUDGET = 0.4f;
+// A slower clock must have been enough for this long before switching down
+static constexpr uint32_t CLOCK_DOWN_HOLD_MS = 10000;
+
+// Current model, rough figures for a Core2 on battery
+static constexpr float BASE_MA = 10.0f;                 // PMIC, codec, sensors
+static const float CPU_MA[CPU_CLOCK_COUNT] = { 20.0f, 30.0f, 42.0f };
+static constexpr float LIGHT_SLEEP_CPU_SHARE = 0.2f;    // share of the CPU current left when idle sleeping
+static constexpr float ADVERTISING_EVENT_MA_MS = 30.0f; // charge per advertising event
+static constexpr float CONNECTED_RADIO_MA = 8.0f;
+static constexpr float STREAMING_RADIO_MA = 18.0f;
+static constexpr float MIC_MA = 4.0f;
+static const float BACKLIGHT_MA[BACKLIGHT_COUNT] = { 60.0f, 15.0f, 0.0f };
+// Time constant of the average used for the runtime estimate
+static constexpr float AVERAGE_WINDOW_MS = 300000.0f;
+
+static const char* const STATE_NAMES[POWER_STATE_COUNT] = { "advertising", "connected", "streaming" };
+static const char* const BACKLIGHT_NAMES[BACKLIGHT_COUNT] = { "on", "dim", "off" };
+
+void PowerManager::begin(uint32_t nowMs, uint16_t batteryCapacityMah) {
+  _batteryCapacityMah = batteryCapacityMah;
+  _lastUpdateMs = nowMs;
+  _disconnectedSinceMs = nowMs;
+  _wasConnected = false;
+  _lowerClockSinceMs = nowMs;
+  _lowerClockCandidate = 0;
+  _decision = PowerDecision();
+  _decision.advertisingInterval = ADVERTISING_FAST_INTERVAL;
+  for (size_t i = 0; i < POWER_STATE_COUNT; i++) _residencyMs[i] = 0;
+  for (size_t i = 0; i < BACKLIGHT_COUNT; i++) _backlightMs[i] = 0;
+  _estimatedMa = modelMa(_decision);
+  _averageMa = _estimatedMa;
+  _clockChanges = 0;
+}
+
+uint16_t PowerManager::advertisingIntervalFor(uint32_t unconnectedMs) {
+  if (unconnectedMs < ADVERTISING_FAST_MS) return ADVERTISING_FAST_INTERVAL;
+  if (unconnectedMs < ADVERTISING_MEDIUM_MS) return ADVERTISING_MEDIUM_INTERVAL;
+  return ADVERTISING_SLOW_INTERVAL;
+}
+
+Backlight PowerManager::backlightFor(uint32_t idleMs) {
+  if (idleMs < BACKLIGHT_DIM_MS) return BACKLIGHT_ON;
+  if (idleMs < BACKLIGHT_OFF_MS) return BACKLIGHT_DIM;
+  return BACKLIGHT_OFF;
+}
+
+uint16_t PowerManager::chooseCpuMHz(const PowerInputs& in) {
+  if (!in.streaming) {
+    return CPU_CLOCKS_MHZ[0];
+  }
+  uint16_t current = _decision.cpuMHz;
+  if (in.worstChunkCycles == 0 || in.chunkDeadlineUs == 0) {
+    // Nothing measured for this stream yet
+    return CPU_CLOCKS_MHZ[CPU_CLOCK_COUNT - 1];
+  }
+
+  // Cycles per microsecond is MHz
+  float neededMHz = (float)in.worstChunkCycles / ((float)in.chunkDeadlineUs * CAPTURE_CPU_BUDGET);
+  uint16_t wanted = CPU_CLOCKS_MHZ[CPU_CLOCK_COUNT - 1];
+  for (size_t i = 0; i < CPU_CLOCK_COUNT; i++) {
+    if (CPU_CLOCKS_MHZ[i] >= neededMHz) {
+      wanted = CPU_CLOCKS_MHZ[i];
+      break;
+    }
+  }
+
+  if (wanted >= current) {
+    // More headroom is needed now
+    _lowerClockCandidate = 0;
+    return wanted;
+  }
+  // Slow down only once the lower clock has been enough for a while
+  if (_lowerClockCandidate != wanted) {
+    _lowerClockCandidate = wanted;
+    _lowerClockSinceMs = in.nowMs;
+  }
+  if (in.nowMs - _lowerClockSinceMs >= CLOCK_DOWN_HOLD_MS) {
+    _lowerClockCandidate = 0;
+    return wanted;
+  }
+  return current;
+}
+
+float PowerManager::modelMa(const PowerDecision& d) {
+  float cpu = CPU_MA[CPU_CLOCK_COUNT - 1];
+  for (size_t i = 0; i < CPU_CLOCK_COUNT; i++) {
+    if (CPU_CLOCKS_MHZ[i] == d.cpuMHz) cpu = CPU_MA[i];
+  }
+  float ma = BASE_MA + BACKLIGHT_MA[d.backlight];
+  switch (d.state) {
+    case POWER_ADVERTISING:
+      ma += cpu * (d.lightSleep ? LIGHT_SLEEP_CPU_SHARE : 1.0f);
+      if (d.advertisingInterval > 0) {
+        ma += ADVERTISING_EVENT_MA_MS / (d.advertisingInterval * 0.625f);
+      }
+      break;
+    case POWER_CONNECTED:
+      ma += cpu + CONNECTED_RADIO_MA;
+      break;
+    default:
+      ma += cpu + STREAMING_RADIO_MA + MIC_MA;
+      break;
+  }
+  return ma;
+}
+
+const PowerDecision& PowerManager::update(const PowerInputs& in) {
+  // Account the time since the last update to the previous decision
+  uint32_t elapsed = in.nowMs - _lastUpdateMs;
+  _lastUpdateMs = in.nowMs;
+  _residencyMs[_decision.state] += elapsed;
+  _backlightMs[_decision.backlight] += elapsed;
+  float alpha = (float)elapsed / AVERAGE_WINDOW_MS;
+  if (alpha > 1.0f) alpha = 1.0f;
+  _averageMa += (_estimatedMa - _averageMa) * alpha;
+
+  if (in.connected != _wasConnected) {
+    _wasConnected = in.connected;
+    if (!in.connected) {
+      _disconnectedSinceMs = in.nowMs;
+    }
+  }
+
+  PowerDecision next = _decision;
+  next.state = in.streaming ? POWER_STREAMING : (in.connected ? POWER_CONNECTED : POWER_ADVERTISING);
+  next.backlight = backlightFor(in.nowMs - in.lastActivityMs);
+  next.advertisingInterval = in.connected ? _decision.advertisingInterval
+                                          : advertisingIntervalFor(in.nowMs - _disconnectedSinceMs);
+  // Without esp_pm the chip never sleeps, so neither the decision nor the
+  // current estimate may count on it
+  next.lightSleep = in.lightSleepAvailable && !in.connected && !in.streaming;
+  next.cpuMHz = chooseCpuMHz(in);
+  if (next.cpuMHz != _decision.cpuMHz) {
+    _clockChanges++;
+  }
+
+  _decision = next;
+  _estimatedMa = modelMa(_decision);
+  return _decision;
+}
+
+float PowerManager::hoursRemaining(int batteryPercent) const {
+  if (_averageMa <= 0 || batteryPercent <= 0) {
+    return 0;
+  }
+  return (float)_batteryCapacityMah * (float)batteryPercent / 100.0f / _averageMa;
+}
+
+const char* PowerManager::stateName(PowerState state) {
+  return state < POWER_STATE_COUNT ? STATE_NAMES[state] : "?";
+}
+
+const char* PowerManager::backlightName(Backlight level) {
+  return level < BACKLIGHT_COUNT ? BACKLIGHT_NAMES[level] : "?";
+}
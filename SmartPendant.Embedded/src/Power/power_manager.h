@@ -0,0 +1,93 @@
+#ifndef POWER_MANAGER_H
+#define POWER_MANAGER_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+enum PowerState : uint8_t {
+  POWER_ADVERTISING = 0, // no client
+  POWER_CONNECTED,       // client connected, no audio yet
+  POWER_STREAMING,       // capturing and sending audio
+  POWER_STATE_COUNT
+};
+
+enum Backlight : uint8_t {
+  BACKLIGHT_ON = 0,
+  BACKLIGHT_DIM,
+  BACKLIGHT_OFF,
+  BACKLIGHT_COUNT
+};
+
+// What the device is doing, sampled once per update
+struct PowerInputs {
+  uint32_t nowMs = 0;
+  bool connected = false;
+  bool streaming = false;
+  uint32_t lastActivityMs = 0;     // last touch or screen change
+  uint32_t worstChunkCycles = 0;   // capture processing per chunk, 0 = not measured yet
+  uint32_t chunkDeadlineUs = 0;
+  bool lightSleepAvailable = false; // the build can light sleep (esp_pm, CONFIG_PM_ENABLE)
+};
+
+// What the hardware should be set to
+struct PowerDecision {
+  PowerState state = POWER_ADVERTISING;
+  Backlight backlight = BACKLIGHT_ON;
+  uint16_t cpuMHz = 240;
+  uint16_t advertisingInterval = 0; // 0.625 ms units
+  bool lightSleep = false;          // automatic light sleep while idle, only where available
+};
+
+// Power policy and consumption estimate.
+//
+// The policy stretches the advertising interval the longer nobody connects,
+// dims and then blanks the backlight after a while without activity, and
+// runs the CPU at the slowest clock that leaves the capture path enough
+// headroom. update() also accounts the time spent in each state and clock,
+// which feeds a current estimate from a per-state model (rough Core2
+// figures, not a measurement) and a runtime estimate for the battery.
+//
+// Portable: the caller applies the decision to the hardware.
+class PowerManager {
+public:
+  void begin(uint32_t nowMs, uint16_t batteryCapacityMah);
+
+  // Call about once a second
+  const PowerDecision& update(const PowerInputs& in);
+  const PowerDecision& decision() const { return _decision; }
+
+  uint32_t residencyMs(PowerState state) const { return _residencyMs[state]; }
+  uint32_t backlightMs(Backlight level) const { return _backlightMs[level]; }
+  float estimatedMa() const { return _estimatedMa; }
+  float averageMa() const { return _averageMa; }
+  // Runtime left from batteryPercent at the recent average current
+  float hoursRemaining(int batteryPercent) const;
+  uint32_t clockChanges() const { return _clockChanges; }
+
+  // Backlight level after idleMs without activity
+  static Backlight backlightFor(uint32_t idleMs);
+
+  static const char* stateName(PowerState state);
+  static const char* backlightName(Backlight level);
+
+private:
+  uint16_t chooseCpuMHz(const PowerInputs& in);
+  static uint16_t advertisingIntervalFor(uint32_t unconnectedMs);
+  static float modelMa(const PowerDecision& d);
+
+  PowerDecision _decision;
+  uint16_t _batteryCapacityMah = 0;
+  uint32_t _lastUpdateMs = 0;
+  uint32_t _disconnectedSinceMs = 0;
+  bool _wasConnected = false;
+  uint32_t _lowerClockSinceMs = 0;   // the slower clock has been sufficient since
+  uint16_t _lowerClockCandidate = 0;
+
+  uint32_t _residencyMs[POWER_STATE_COUNT] = {};
+  uint32_t _backlightMs[BACKLIGHT_COUNT] = {};
+  float _estimatedMa = 0;
+  float _averageMa = 0;
+  uint32_t _clockChanges = 0;
+};
+
+#endif
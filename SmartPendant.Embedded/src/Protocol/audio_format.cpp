@@ -0,0 +1,44 @@
+#include "audio_format.h"
+#include "packet.h"
+
+static inline void putU16(uint8_t* p, uint32_t v) {
+  p[0] = (uint8_t)(v & 0xFF);
+  p[1] = (uint8_t)((v >> 8) & 0xFF);
+}
+
+static inline uint16_t getU16(const uint8_t* p) {
+  return (uint16_t)(p[0] | (p[1] << 8));
+}
+
+void audioFormatEncode(const AudioFormat& format, uint8_t* out) {
+  putU16(out, format.sampleRate);
+  out[2] = format.encoding;
+  out[3] = 0;
+  putU16(out + 4, format.frameMs);
+}
+
+bool audioFormatDecode(const uint8_t* data, size_t bytes, AudioFormat& format) {
+  if (bytes < AUDIO_FORMAT_BYTES) {
+    return false;
+  }
+  AudioFormat decoded;
+  decoded.sampleRate = getU16(data);
+  decoded.encoding = data[2];
+  decoded.frameMs = getU16(data + 4);
+
+  // Every rate must be expressible in the packet header
+  uint8_t rateCode;
+  if (!packetSampleRateCode(decoded.sampleRate, rateCode)) {
+    return false;
+  }
+  if (decoded.encoding != AUDIO_ENCODING_16BIT && decoded.encoding != AUDIO_ENCODING_MULAW &&
+      decoded.encoding != AUDIO_ENCODING_LOG_MEL) {
+    return false;
+  }
+  // The mel filterbank is laid out for 16 kHz
+  if (decoded.encoding == AUDIO_ENCODING_LOG_MEL && decoded.sampleRate != 16000) {
+    return false;
+  }
+  format = decoded;
+  return true;
+}
@@ -0,0 +1,41 @@
+#ifndef AUDIO_FORMAT_H
+#define AUDIO_FORMAT_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Audio format negotiated over the control characteristic.
+//
+// Written by the client after CONTROL_CMD_SET_FORMAT, and read back from
+// the control characteristic as the format in effect (little-endian):
+//   [0..1] sample rate in Hz: 8000, 12000, 16000 or 24000
+//   [2]    sample encoding (AudioEncoding)
+//   [3]    reserved, 0
+//   [4..5] frame duration in ms, the audio in one capture. 0 in a request
+//          keeps the current duration; the device clamps it to what it
+//          can buffer and reports the duration it actually uses.
+//
+// A new format starts a new stream: framed packets restart at sample 0
+// with PACKET_FLAG_STREAM_START and carry the new rate in their header.
+
+static constexpr size_t AUDIO_FORMAT_BYTES = 6;
+
+enum AudioEncoding : uint8_t {
+  AUDIO_ENCODING_16BIT = 0,  // 16-bit samples through the build's codec (PCM16, ADPCM or lossless)
+  AUDIO_ENCODING_MULAW = 1,  // 8-bit G.711 mu-law
+  AUDIO_ENCODING_LOG_MEL = 2, // log-mel frames instead of audio (PACKET_FORMAT_LOG_MEL); 16 kHz only
+};
+
+struct AudioFormat {
+  uint32_t sampleRate = 16000;
+  uint8_t encoding = AUDIO_ENCODING_16BIT;
+  uint16_t frameMs = 0;
+};
+
+// Writes AUDIO_FORMAT_BYTES to out
+void audioFormatEncode(const AudioFormat& format, uint8_t* out);
+
+// Fails on short data, unsupported rates and unknown encodings
+bool audioFormatDecode(const uint8_t* data, size_t bytes, AudioFormat& format);
+
+#endif
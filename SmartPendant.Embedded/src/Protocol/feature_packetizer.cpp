@@ -0,0 +1,119 @@
+#include "feature_packetizer.h"
+#include <string.h>
+
+bool FeaturePacketizer::begin(size_t maxPacketBytes, uint32_t sampleRate, size_t frameBytes,
+                              uint16_t hopSamples, uint8_t windowMs) {
+  uint8_t rateCode;
+  if (!packetSampleRateCode(sampleRate, rateCode) || frameBytes == 0 || frameBytes > UINT8_MAX ||
+      hopSamples == 0) {
+    return false;
+  }
+  size_t previousFrameBytes = _frameBytes;
+  _frameBytes = frameBytes;
+  if (!setMaxPacketBytes(maxPacketBytes)) {
+    _frameBytes = previousFrameBytes;
+    return false;
+  }
+  _sampleRate = rateCode;
+  _hopSamples = hopSamples;
+  _windowMs = windowMs;
+  reset();
+  return true;
+}
+
+bool FeaturePacketizer::setMaxPacketBytes(size_t maxPacketBytes) {
+  if (maxPacketBytes > FEATURE_PACKETIZER_MAX_BYTES) {
+    maxPacketBytes = FEATURE_PACKETIZER_MAX_BYTES;
+  }
+  size_t overhead = PACKET_HEADER_BYTES + LOG_MEL_PAYLOAD_HEADER_BYTES;
+  if (_frameBytes == 0 || maxPacketBytes < overhead + _frameBytes) {
+    return false;
+  }
+  _maxPacketBytes = maxPacketBytes;
+  _framesPerPacket = (maxPacketBytes - overhead) / _frameBytes;
+  return true;
+}
+
+void FeaturePacketizer::reset() {
+  _pendingFrames = 0;
+  _started = false;
+  _streamStart = true;
+  _discontinuity = false;
+  _flushing = false;
+}
+
+bool FeaturePacketizer::append(const uint8_t* frame, uint32_t firstSample) {
+  if (_framesPerPacket == 0 || hasPacket()) {
+    return false;
+  }
+  if (_started && firstSample != _nextSample) {
+    // Samples were skipped: what is pending goes out before the gap
+    if (_pendingFrames > 0) {
+      _flushing = true;
+      return false;
+    }
+    _discontinuity = true;
+  }
+  if (_pendingFrames == 0) {
+    _firstSample = firstSample;
+  }
+  memcpy(_pending + _pendingFrames * _frameBytes, frame, _frameBytes);
+  _pendingFrames++;
+  _nextSample = firstSample + _hopSamples;
+  _started = true;
+  return true;
+}
+
+void FeaturePacketizer::flush() {
+  _flushing = true;
+}
+
+bool FeaturePacketizer::hasPacket() const {
+  return _pendingFrames >= _framesPerPacket || (_flushing && _pendingFrames > 0);
+}
+
+size_t FeaturePacketizer::nextPacket(uint8_t* out) {
+  if (!hasPacket()) {
+    return 0;
+  }
+  size_t frames = _pendingFrames < _framesPerPacket ? _pendingFrames : _framesPerPacket;
+  size_t frameBytes = frames * _frameBytes;
+
+  PacketHeader h;
+  h.version = PACKET_VERSION;
+  h.format = PACKET_FORMAT_LOG_MEL;
+  h.flags = (_streamStart ? PACKET_FLAG_STREAM_START : 0) | (_discontinuity ? PACKET_FLAG_DISCONTINUITY : 0);
+  h.sampleRate = _sampleRate;
+  h.sequence = 0; // stamped by the sender
+  h.payloadBytes = (uint16_t)(LOG_MEL_PAYLOAD_HEADER_BYTES + frameBytes);
+  h.firstSample = _firstSample;
+  packetWriteHeader(h, out);
+
+  uint8_t* payload = out + PACKET_HEADER_BYTES;
+  payload[0] = (uint8_t)(_hopSamples & 0xFF);
+  payload[1] = (uint8_t)(_hopSamples >> 8);
+  payload[2] = (uint8_t)_frameBytes;
+  payload[3] = _windowMs;
+  memcpy(payload + LOG_MEL_PAYLOAD_HEADER_BYTES, _pending, frameBytes);
+
+  // Frames beyond a shrunken packet size wait for the next one
+  _pendingFrames -= frames;
+  memmove(_pending, _pending + frameBytes, _pendingFrames * _frameBytes);
+  _firstSample += (uint32_t)(frames * _hopSamples);
+  if (_pendingFrames == 0) {
+    _flushing = false;
+  }
+
+  _lastPacketStartedStream = _streamStart;
+  _streamStart = false;
+  _discontinuity = false;
+  return PACKET_HEADER_BYTES + h.payloadBytes;
+}
+
+void FeaturePacketizer::packetDropped() {
+  _discontinuity = true;
+  // The receiver must still see where the new stream begins
+  if (_lastPacketStartedStream) {
+    _streamStart = true;
+  }
+}
@@ -0,0 +1,68 @@
+#ifndef FEATURE_PACKETIZER_H
+#define FEATURE_PACKETIZER_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "packet.h"
+
+static constexpr size_t FEATURE_PACKETIZER_MAX_BYTES = 512;
+
+// Packs fixed-size feature frames (PACKET_FORMAT_LOG_MEL) into framed
+// packets, as many whole frames as the packet size allows. Frames arrive
+// one hop apart on the stream's sample timeline; a frame that does not
+// follow on from the pending ones (samples were skipped before it) flushes
+// them first and goes out flagged PACKET_FLAG_DISCONTINUITY, just like a
+// skip in AudioPacketizer.
+class FeaturePacketizer {
+public:
+  // maxPacketBytes is the largest notification payload (ATT MTU - 3).
+  // frameBytes and hopSamples describe every frame; windowMs is only
+  // recorded in the payload. sampleRate must be a PacketSampleRate.
+  bool begin(size_t maxPacketBytes, uint32_t sampleRate, size_t frameBytes, uint16_t hopSamples,
+             uint8_t windowMs);
+
+  // Changes the packet size mid-stream, keeping pending frames
+  bool setMaxPacketBytes(size_t maxPacketBytes);
+
+  // Starts a new stream: pending frames are discarded and the next packet
+  // is flagged PACKET_FLAG_STREAM_START
+  void reset();
+
+  // Queues a frame whose first sample is firstSample. False, and nothing
+  // taken, while a packet is waiting to be built: drain it and try again.
+  bool append(const uint8_t* frame, uint32_t firstSample);
+
+  // Lets the pending frames go out as a short packet; applies until nothing is pending
+  void flush();
+
+  bool hasPacket() const;
+  // Builds the next packet into out (at least maxPacketBytes). Returns the
+  // packet size, or 0 if not ready yet.
+  size_t nextPacket(uint8_t* out);
+  // The last packet returned by nextPacket could not be delivered
+  void packetDropped();
+
+  size_t framesPerPacket() const { return _framesPerPacket; }
+  size_t pendingFrames() const { return _pendingFrames; }
+  size_t maxPacketBytes() const { return _maxPacketBytes; }
+
+private:
+  size_t _maxPacketBytes = 0;
+  size_t _framesPerPacket = 0;
+  size_t _frameBytes = 0;
+  uint16_t _hopSamples = 0;
+  uint8_t _windowMs = 0;
+  uint8_t _sampleRate = PACKET_RATE_16000;
+  bool _flushing = false;
+
+  uint8_t _pending[FEATURE_PACKETIZER_MAX_BYTES];
+  size_t _pendingFrames = 0;
+  uint32_t _firstSample = 0;  // of the first pending frame
+  uint32_t _nextSample = 0;   // where the frame after the last one queued starts
+  bool _started = false;      // a frame has been queued since reset()
+  bool _streamStart = true;
+  bool _discontinuity = false;
+  bool _lastPacketStartedStream = false;
+};
+
+#endif
@@ -0,0 +1,202 @@
+#include "packet.h"
+#include "../Codec/adpcm.h"
+#include "../Codec/lossless.h"
+#include "../Codec/mulaw.h"
+#include <string.h>
+
+static inline void putU16(uint8_t* p, uint32_t v) {
+  p[0] = (uint8_t)(v & 0xFF);
+  p[1] = (uint8_t)((v >> 8) & 0xFF);
+}
+
+static inline void putU32(uint8_t* p, uint32_t v) {
+  putU16(p, v & 0xFFFF);
+  putU16(p + 2, v >> 16);
+}
+
+static inline uint16_t getU16(const uint8_t* p) {
+  return (uint16_t)(p[0] | (p[1] << 8));
+}
+
+static inline uint32_t getU32(const uint8_t* p) {
+  return getU16(p) | ((uint32_t)getU16(p + 2) << 16);
+}
+
+void packetWriteHeader(const PacketHeader& header, uint8_t* out) {
+  out[0] = header.version;
+  out[1] = header.format;
+  out[2] = header.flags;
+  out[3] = header.sampleRate;
+  putU16(out + 4, header.sequence);
+  putU16(out + 6, header.payloadBytes);
+  putU32(out + 8, header.firstSample);
+}
+
+bool packetParseHeader(const uint8_t* packet, size_t packetBytes, PacketHeader& header) {
+  if (packetBytes < PACKET_HEADER_BYTES || packet[0] != PACKET_VERSION) {
+    return false;
+  }
+  header.version = packet[0];
+  header.format = packet[1];
+  header.flags = packet[2];
+  header.sampleRate = packet[3];
+  header.sequence = getU16(packet + 4);
+  header.payloadBytes = getU16(packet + 6);
+  header.firstSample = getU32(packet + 8);
+  return header.payloadBytes == packetBytes - PACKET_HEADER_BYTES;
+}
+
+size_t packetWriteSegment(uint8_t* out, uint32_t streamStart, uint8_t flags) {
+  PacketHeader h;
+  h.version = PACKET_VERSION;
+  h.format = PACKET_FORMAT_SEGMENT;
+  h.flags = flags;
+  h.sampleRate = PACKET_RATE_16000;
+  h.sequence = 0;
+  h.payloadBytes = SEGMENT_PAYLOAD_BYTES;
+  h.firstSample = 0;
+  packetWriteHeader(h, out);
+  putU32(out + PACKET_HEADER_BYTES, streamStart);
+  return PACKET_HEADER_BYTES + SEGMENT_PAYLOAD_BYTES;
+}
+
+static const uint32_t SAMPLE_RATES_HZ[] = { 16000, 8000, 12000, 24000 };
+
+uint32_t packetSampleRateHz(uint8_t code) {
+  return code < sizeof(SAMPLE_RATES_HZ) / sizeof(SAMPLE_RATES_HZ[0]) ? SAMPLE_RATES_HZ[code] : 0;
+}
+
+bool packetSampleRateCode(uint32_t hz, uint8_t& code) {
+  for (size_t i = 0; i < sizeof(SAMPLE_RATES_HZ) / sizeof(SAMPLE_RATES_HZ[0]); i++) {
+    if (SAMPLE_RATES_HZ[i] == hz) {
+      code = (uint8_t)i;
+      return true;
+    }
+  }
+  return false;
+}
+
+void packetSetSequence(uint8_t* packet, uint16_t sequence) {
+  putU16(packet + 4, sequence);
+}
+
+size_t packetSampleCount(uint8_t format, const uint8_t* payload, size_t payloadBytes) {
+  switch (format) {
+    case PACKET_FORMAT_PCM16:
+      return payloadBytes / sizeof(int16_t);
+    case PACKET_FORMAT_ADPCM:
+      return payloadBytes > ADPCM_BLOCK_HEADER_BYTES ? adpcmBlockSamples(payloadBytes) : 0;
+    case PACKET_FORMAT_LOSSLESS:
+      return losslessBlockBytes(payload, payloadBytes) == payloadBytes ? (size_t)(payload[2] | (payload[3] << 8)) : 0;
+    case PACKET_FORMAT_MULAW:
+      return payloadBytes;
+    case PACKET_FORMAT_SILENCE:
+      if (payloadBytes != SILENCE_PAYLOAD_BYTES) return 0;
+      return getU32(payload);
+    case PACKET_FORMAT_LOG_MEL: {
+      if (payloadBytes <= LOG_MEL_PAYLOAD_HEADER_BYTES || payload[2] == 0) return 0;
+      size_t frameBytes = payloadBytes - LOG_MEL_PAYLOAD_HEADER_BYTES;
+      if (frameBytes % payload[2] != 0) return 0;
+      return frameBytes / payload[2] * getU16(payload);
+    }
+    default:
+      return 0;
+  }
+}
+
+size_t packetTimelineSamples(const PacketHeader& header, const uint8_t* payload) {
+  size_t samples = packetSampleCount(header.format, payload, header.payloadBytes);
+  return (header.flags & PACKET_FLAG_HALF_RATE) ? samples * 2 : samples;
+}
+
+size_t packetDecodeAudio(const PacketHeader& header, const uint8_t* payload, int16_t* out, size_t capacity) {
+  size_t timeline = packetTimelineSamples(header, payload);
+  if (timeline == 0 || timeline > capacity) {
+    return 0;
+  }
+  // Half-rate samples are decoded into the second half, then spread out
+  bool halfRate = (header.flags & PACKET_FLAG_HALF_RATE) != 0;
+  size_t count = halfRate ? timeline / 2 : timeline;
+  int16_t* decoded = halfRate ? out + count : out;
+  switch (header.format) {
+    case PACKET_FORMAT_PCM16:
+      memcpy(decoded, payload, count * sizeof(int16_t));
+      break;
+    case PACKET_FORMAT_ADPCM:
+      adpcmDecodeBlock(payload, header.payloadBytes, decoded);
+      break;
+    case PACKET_FORMAT_LOSSLESS:
+      if (losslessDecodeBlock(payload, header.payloadBytes, decoded, count) != count) {
+        return 0;
+      }
+      break;
+    case PACKET_FORMAT_MULAW:
+      mulawDecode(payload, count, decoded);
+      break;
+    case PACKET_FORMAT_SILENCE:
+      memset(out, 0, timeline * sizeof(int16_t));
+      return timeline;
+    default:
+      return 0;
+  }
+  if (halfRate) {
+    // Linear interpolation; the last sample is held, as the next packet is
+    // not known yet. Reading ahead of the writes keeps this in place.
+    for (size_t i = 0; i < count; i++) {
+      int16_t s = decoded[i];
+      int16_t next = i + 1 < count ? decoded[i + 1] : s;
+      out[2 * i] = s;
+      out[2 * i + 1] = (int16_t)(((int32_t)s + next) / 2);
+    }
+  }
+  return timeline;
+}
+
+void PacketLossTracker::reset() {
+  *this = PacketLossTracker();
+}
+
+bool PacketLossTracker::accept(const PacketHeader& header, size_t sampleCount, uint32_t& gapSamples) {
+  gapSamples = 0;
+  if (header.flags & PACKET_FLAG_RETRANSMIT) {
+    _retransmitted++;
+    return false;
+  }
+
+  // Backlog packets lie in the past and markers carry no audio; neither
+  // moves the live sample timeline
+  bool backlog = (header.flags & PACKET_FLAG_BACKLOG) != 0;
+  bool live = !backlog && header.format != PACKET_FORMAT_SEGMENT;
+  bool restart = live && (header.flags & PACKET_FLAG_STREAM_START);
+
+  int16_t sequenceDelta = 0;
+  if (_sequenceStarted && !restart) {
+    sequenceDelta = (int16_t)(header.sequence - _nextSequence);
+  }
+  int32_t sampleDelta = 0;
+  if (live && _started && !restart) {
+    sampleDelta = (int32_t)(header.firstSample - _nextSample);
+  }
+  if (sequenceDelta < 0 || sampleDelta < 0) {
+    _packetsDiscarded++;
+    return false;
+  }
+  _packetsLost += sequenceDelta;
+
+  if (live) {
+    _started = true;
+    gapSamples = (uint32_t)sampleDelta;
+    if (header.flags & PACKET_FLAG_DISCONTINUITY) {
+      _deviceDrops++;
+    }
+    _samplesLost += gapSamples;
+    _nextSample = header.firstSample + sampleCount;
+  } else if (backlog) {
+    _backlogPackets++;
+  }
+
+  _sequenceStarted = true;
+  _packetsReceived++;
+  _nextSequence = header.sequence + 1;
+  return true;
+}
@@ -0,0 +1,165 @@
+#ifndef PACKET_H
+#define PACKET_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Framed audio packet, one per notification.
+//
+// Header layout (little-endian):
+//   [0]     protocol version (PACKET_VERSION)
+//   [1]     payload format (PacketFormat)
+//   [2]     flags (PacketFlags)
+//   [3]     sample rate (PacketSampleRate); 0, 16 kHz, from older firmware
+//   [4..5]  sequence number, assigned when the packet is sent, wraps at 65536
+//   [6..7]  payload length in bytes
+//   [8..11] capture index of the first sample in the payload, counted from
+//           the start of the stream
+//
+// Sequence gaps mean packets lost after they left the device; jumps in the
+// sample index mean audio the device itself had to drop. Either way the
+// receiver knows exactly how much silence to insert.
+//
+// Audio captured while no client was connected is replayed later with
+// PACKET_FLAG_BACKLOG, interleaved with live packets. Backlog packets keep
+// their original sample index; a PACKET_FORMAT_SEGMENT marker sent before
+// them names the stream they belong to, so the receiver can place them.
+//
+// Under backpressure the device may lower the quality of the live stream
+// without restarting it: PACKET_FLAG_HALF_RATE packets carry every second
+// sample, mu-law packets 8-bit samples, and silence markers stand in for
+// audio it could not send at all. Sample indexes always count samples at
+// the rate in the header, so the timeline never breaks.
+//
+// Feature streams (PACKET_FORMAT_LOG_MEL) carry no audio, only log-mel
+// frames computed on the device. Payload layout (little-endian):
+//   [0..1] hop: stream samples from one frame's start to the next
+//   [2]    bytes per frame, one per mel band
+//   [3]    window length in ms
+//   [4..]  whole frames, oldest first (Dsp/log_mel.h)
+// The header's sample index is the first sample of the first frame's
+// window, and the packet covers frames * hop samples of the timeline.
+//
+// A client that NACKs missing sequence numbers gets the packets sent again
+// with PACKET_FLAG_RETRANSMIT, byte for byte as before apart from the flag,
+// so they keep their sequence number and sample index.
+
+static constexpr uint8_t PACKET_VERSION = 1;
+static constexpr size_t PACKET_HEADER_BYTES = 12;
+
+enum PacketFormat : uint8_t {
+  PACKET_FORMAT_PCM16 = 0,    // int16 little-endian samples
+  PACKET_FORMAT_ADPCM = 1,    // one IMA-ADPCM block (Codec/adpcm.h)
+  PACKET_FORMAT_LOSSLESS = 2, // one lossless block (Codec/lossless.h)
+  PACKET_FORMAT_SILENCE = 3,  // uint32 count of silent samples, no audio
+  PACKET_FORMAT_SEGMENT = 4,  // uint32 stream start time (Unix seconds, device RTC);
+                              // applies to the following packets of the same kind
+                              // (backlog or live)
+  PACKET_FORMAT_MULAW = 5,    // G.711 mu-law, one byte per sample (Codec/mulaw.h)
+  PACKET_FORMAT_LOG_MEL = 6,  // log-mel feature frames, no audio
+};
+
+// Sample rates the client can negotiate, as carried in the header
+enum PacketSampleRate : uint8_t {
+  PACKET_RATE_16000 = 0,
+  PACKET_RATE_8000 = 1,
+  PACKET_RATE_12000 = 2,
+  PACKET_RATE_24000 = 3,
+};
+static constexpr uint32_t PACKET_DEFAULT_SAMPLE_RATE = 16000;
+
+static constexpr size_t SILENCE_PAYLOAD_BYTES = 4;
+static constexpr size_t SEGMENT_PAYLOAD_BYTES = 4;
+static constexpr size_t LOG_MEL_PAYLOAD_HEADER_BYTES = 4;
+
+enum PacketFlags : uint8_t {
+  PACKET_FLAG_STREAM_START = 0x01,  // first packet of a new stream, sample index restarts at 0
+  PACKET_FLAG_DISCONTINUITY = 0x02, // the device dropped audio right before this packet
+  PACKET_FLAG_BACKLOG = 0x04,       // replayed from the store-and-forward backlog
+  PACKET_FLAG_HALF_RATE = 0x08,     // payload holds every second sample, low-passed;
+                                    // it covers twice as many samples of the timeline
+  PACKET_FLAG_RETRANSMIT = 0x10,    // sent again on request, after newer packets
+};
+
+struct PacketHeader {
+  uint8_t version;
+  uint8_t format;
+  uint8_t flags;
+  uint8_t sampleRate;   // PacketSampleRate
+  uint16_t sequence;
+  uint16_t payloadBytes;
+  uint32_t firstSample;
+};
+
+// Writes PACKET_HEADER_BYTES to out
+void packetWriteHeader(const PacketHeader& header, uint8_t* out);
+
+// Parses and validates a received packet. Fails on unknown versions and when
+// the payload length does not match the packet length.
+bool packetParseHeader(const uint8_t* packet, size_t packetBytes, PacketHeader& header);
+
+// Writes a segment marker announcing streamStart; flags is 0 or
+// PACKET_FLAG_BACKLOG. Returns the packet size.
+size_t packetWriteSegment(uint8_t* out, uint32_t streamStart, uint8_t flags);
+
+// Sample rate in Hz for a PacketSampleRate, 0 if unknown
+uint32_t packetSampleRateHz(uint8_t code);
+// PacketSampleRate for a rate in Hz; false if the rate cannot be carried
+bool packetSampleRateCode(uint32_t hz, uint8_t& code);
+
+// Stamps the sequence number into an already built packet
+void packetSetSequence(uint8_t* packet, uint16_t sequence);
+
+// Number of audio samples carried by a payload, or 0 if it is malformed.
+// Silence markers count the samples they stand for, feature frames the
+// samples their hops cover.
+size_t packetSampleCount(uint8_t format, const uint8_t* payload, size_t payloadBytes);
+
+// Samples of the stream timeline a packet covers: packetSampleCount(),
+// doubled for PACKET_FLAG_HALF_RATE
+size_t packetTimelineSamples(const PacketHeader& header, const uint8_t* payload);
+
+// Receiver side: decodes a packet's audio to 16-bit samples at the rate in
+// its header. Half-rate payloads are interpolated back to that rate and
+// silence markers decode to zeros. Returns packetTimelineSamples(), or 0 if
+// the payload is malformed, carries no audio or exceeds capacity.
+size_t packetDecodeAudio(const PacketHeader& header, const uint8_t* payload, int16_t* out, size_t capacity);
+
+// Receiver-side loss accounting. Feed every received packet header in
+// arrival order; it reports how many samples of silence to insert before the
+// packet's payload so the sample timeline stays intact. Backlog packets and
+// segment markers only count towards sequence loss. Retransmitted packets
+// arrive after the gap they fill was counted; they are left to the caller.
+class PacketLossTracker {
+public:
+  void reset();
+
+  // sampleCount is packetTimelineSamples(). Sets gapSamples to the number
+  // of missing samples before this packet.
+  // Returns false for late or duplicated packets, which should be discarded,
+  // and for retransmitted ones.
+  bool accept(const PacketHeader& header, size_t sampleCount, uint32_t& gapSamples);
+
+  uint32_t packetsReceived() const { return _packetsReceived; }
+  uint32_t packetsLost() const { return _packetsLost; }          // sequence gaps
+  uint32_t packetsDiscarded() const { return _packetsDiscarded; } // late or duplicate
+  uint32_t samplesLost() const { return _samplesLost; }          // all gaps, in samples
+  uint32_t deviceDrops() const { return _deviceDrops; }          // discontinuities flagged by the device
+  uint32_t backlogPackets() const { return _backlogPackets; }
+  uint32_t retransmitted() const { return _retransmitted; }
+
+private:
+  bool _started = false;
+  bool _sequenceStarted = false;
+  uint16_t _nextSequence = 0;
+  uint32_t _nextSample = 0;
+  uint32_t _packetsReceived = 0;
+  uint32_t _packetsLost = 0;
+  uint32_t _packetsDiscarded = 0;
+  uint32_t _samplesLost = 0;
+  uint32_t _deviceDrops = 0;
+  uint32_t _backlogPackets = 0;
+  uint32_t _retransmitted = 0;
+};
+
+#endif
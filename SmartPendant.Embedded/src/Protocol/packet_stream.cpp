@@ -0,0 +1,64 @@
+#include "packet_stream.h"
+#include <string.h>
+
+static constexpr uint8_t KNOWN_FLAGS = PACKET_FLAG_STREAM_START | PACKET_FLAG_DISCONTINUITY |
+                                       PACKET_FLAG_BACKLOG | PACKET_FLAG_HALF_RATE | PACKET_FLAG_RETRANSMIT;
+
+void PacketStreamReader::reset() {
+  _start = 0;
+  _end = 0;
+  _synced = true;
+  _packets = 0;
+  _skippedBytes = 0;
+  _resyncs = 0;
+}
+
+void PacketStreamReader::compact() {
+  if (_start == 0) {
+    return;
+  }
+  memmove(_buffer, _buffer + _start, _end - _start);
+  _end -= _start;
+  _start = 0;
+}
+
+size_t PacketStreamReader::feed(const uint8_t* data, size_t bytes) {
+  compact();
+  size_t room = sizeof(_buffer) - _end;
+  size_t taken = bytes < room ? bytes : room;
+  memcpy(_buffer + _end, data, taken);
+  _end += taken;
+  return taken;
+}
+
+bool PacketStreamReader::plausibleHeader() const {
+  const uint8_t* p = _buffer + _start;
+  size_t payloadBytes = p[6] | (p[7] << 8);
+  return p[0] == PACKET_VERSION && p[1] <= PACKET_FORMAT_LOG_MEL && (p[2] & ~KNOWN_FLAGS) == 0 &&
+         p[3] <= PACKET_RATE_24000 && PACKET_HEADER_BYTES + payloadBytes <= PACKET_STREAM_MAX_BYTES;
+}
+
+bool PacketStreamReader::next(const uint8_t*& packet, size_t& length) {
+  while (_end - _start >= PACKET_HEADER_BYTES) {
+    if (!plausibleHeader()) {
+      if (_synced) {
+        _synced = false;
+        _resyncs++;
+      }
+      _start++;
+      _skippedBytes++;
+      continue;
+    }
+    size_t total = PACKET_HEADER_BYTES + (_buffer[_start + 6] | (_buffer[_start + 7] << 8));
+    if (_end - _start < total) {
+      return false;
+    }
+    packet = _buffer + _start;
+    length = total;
+    _start += total;
+    _synced = true;
+    _packets++;
+    return true;
+  }
+  return false;
+}
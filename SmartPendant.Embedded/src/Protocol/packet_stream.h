@@ -0,0 +1,48 @@
+#ifndef PACKET_STREAM_H
+#define PACKET_STREAM_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "packet.h"
+
+// Framed packets over a byte stream (Bluetooth Classic SPP).
+//
+// The device writes the same packets it notifies over BLE back to back,
+// with nothing in between: the payload length in each header says where
+// the next one begins. Reads on the receiver may split or merge packets
+// anywhere, so this reassembles them. After a corrupt or truncated packet
+// it skips bytes until a plausible header follows and counts them.
+
+// Largest packet the reader accepts; the device never sends more than one
+// ATT MTU's worth
+static constexpr size_t PACKET_STREAM_MAX_BYTES = 1024;
+
+class PacketStreamReader {
+public:
+  void reset();
+
+  // Takes up to bytes of received data; returns how many it took. Call
+  // next() until it returns false, then feed the rest.
+  size_t feed(const uint8_t* data, size_t bytes);
+  // The next complete packet, valid until the following feed() or next()
+  bool next(const uint8_t*& packet, size_t& length);
+
+  uint32_t packets() const { return _packets; }
+  uint32_t skippedBytes() const { return _skippedBytes; }  // bytes dropped to resynchronize
+  uint32_t resyncs() const { return _resyncs; }            // times the stream lost its framing
+
+private:
+  // True if a header could start at _buffer[_start]
+  bool plausibleHeader() const;
+  void compact();
+
+  uint8_t _buffer[PACKET_STREAM_MAX_BYTES * 2];
+  size_t _start = 0;
+  size_t _end = 0;
+  bool _synced = true;
+  uint32_t _packets = 0;
+  uint32_t _skippedBytes = 0;
+  uint32_t _resyncs = 0;
+};
+
+#endif
@@ -0,0 +1,282 @@
+#include "packetizer.h"
+#include "../Codec/adpcm.h"
+#include "../Codec/mulaw.h"
+#include <string.h>
+
+// Lossless blocks are sized so that the verbatim fallback always fits
+static inline size_t losslessVerbatimSamples(size_t payloadBytes) {
+  return (payloadBytes - LOSSLESS_HEADER_BYTES) / sizeof(int16_t);
+}
+
+bool AudioPacketizer::begin(PacketFormat format, size_t maxPacketBytes, bool framed, uint32_t sampleRate) {
+  uint8_t rateCode;
+  if (!packetSampleRateCode(sampleRate, rateCode)) {
+    return false;
+  }
+  PacketFormat previousFormat = _format;
+  bool previousFramed = _framed;
+  _format = format;
+  _framed = framed;
+  if (!setMaxPacketBytes(maxPacketBytes)) {
+    _format = previousFormat;
+    _framed = previousFramed;
+    return false;
+  }
+  _sampleRate = rateCode;
+  _halfRate = false;
+  reset();
+  return true;
+}
+
+bool AudioPacketizer::setMaxPacketBytes(size_t maxPacketBytes) {
+  size_t header = _framed ? PACKET_HEADER_BYTES : 0;
+  if (maxPacketBytes <= header) {
+    return false;
+  }
+
+  size_t payload = maxPacketBytes - header;
+  switch (_format) {
+    case PACKET_FORMAT_PCM16:
+      if (payload < sizeof(int16_t)) return false;
+      break;
+    case PACKET_FORMAT_ADPCM:
+      if (payload <= ADPCM_BLOCK_HEADER_BYTES) return false;
+      if (payload > ADPCM_MAX_BLOCK_BYTES) payload = ADPCM_MAX_BLOCK_BYTES;
+      break;
+    case PACKET_FORMAT_LOSSLESS:
+      if (payload < losslessMaxBlockBytes(1)) return false;
+      break;
+    case PACKET_FORMAT_MULAW:
+      if (payload > PACKETIZER_MAX_SAMPLES) payload = PACKETIZER_MAX_SAMPLES;
+      break;
+    default:
+      return false;
+  }
+  // Silence markers share the packet size limit
+  if (_framed && payload < SILENCE_PAYLOAD_BYTES) {
+    return false;
+  }
+
+  _maxPacketBytes = maxPacketBytes;
+  _maxPayloadBytes = payload;
+  _losslessSamples = losslessVerbatimSamples(payload);
+  return true;
+}
+
+void AudioPacketizer::reset() {
+  _pendingStart = 0;
+  _pendingEnd = 0;
+  _nextSample = 0;
+  _streamStart = true;
+  _discontinuity = false;
+  _silentSamples = 0;
+  _silenceEnded = false;
+  _flushing = false;
+  _adpcmStepIndex = 0;
+  _losslessSamples = losslessVerbatimSamples(_maxPayloadBytes);
+}
+
+bool AudioPacketizer::setEncoding(PacketFormat format, bool halfRate) {
+  if (_pendingEnd > _pendingStart || (halfRate && !_framed)) {
+    return false;
+  }
+  PacketFormat previousFormat = _format;
+  _format = format;
+  if (!setMaxPacketBytes(_maxPacketBytes)) {
+    _format = previousFormat;
+    return false;
+  }
+  _halfRate = halfRate;
+  _flushing = false;
+  return true;
+}
+
+void AudioPacketizer::flush() {
+  _flushing = true;
+}
+
+size_t AudioPacketizer::append(const int16_t* samples, size_t count) {
+  // Audio after silence has to wait until the silence marker is out
+  if (_silentSamples > 0) {
+    _silenceEnded = count > 0;
+    return 0;
+  }
+
+  // Compact so the free space is contiguous
+  if (_pendingStart > 0) {
+    memmove(_pending, _pending + _pendingStart, (_pendingEnd - _pendingStart) * sizeof(int16_t));
+    _pendingEnd -= _pendingStart;
+    _pendingStart = 0;
+  }
+
+  size_t space = PACKETIZER_MAX_SAMPLES - _pendingEnd;
+  if (count > space) count = space;
+  memcpy(_pending + _pendingEnd, samples, count * sizeof(int16_t));
+  _pendingEnd += count;
+  return count;
+}
+
+bool AudioPacketizer::appendSilence(size_t count) {
+  if (!_framed) {
+    return false;
+  }
+  _silentSamples += (uint32_t)count;
+  return true;
+}
+
+void AudioPacketizer::packetDropped() {
+  _discontinuity = true;
+  // The receiver must still see where the new stream begins
+  if (_lastPacketStartedStream) {
+    _streamStart = true;
+  }
+}
+
+void AudioPacketizer::skip(size_t count) {
+  _nextSample += (uint32_t)(timelineSamples(_pendingEnd - _pendingStart) + _silentSamples + count);
+  _pendingStart = 0;
+  _pendingEnd = 0;
+  _silentSamples = 0;
+  _silenceEnded = false;
+  _discontinuity = true;
+}
+
+size_t AudioPacketizer::samplesPerPacket() const {
+  switch (_format) {
+    case PACKET_FORMAT_ADPCM:
+      return adpcmBlockSamples(_maxPayloadBytes);
+    case PACKET_FORMAT_LOSSLESS:
+      return _losslessSamples;
+    case PACKET_FORMAT_MULAW:
+      return _maxPayloadBytes;
+    default:
+      return _maxPayloadBytes / sizeof(int16_t);
+  }
+}
+
+size_t AudioPacketizer::encodePayload(uint8_t* out, size_t& samples) {
+  const int16_t* source = _pending + _pendingStart;
+
+  switch (_format) {
+    case PACKET_FORMAT_ADPCM: {
+      // samples is odd; short blocks only occur when flushing before silence
+      size_t blockBytes = ADPCM_BLOCK_HEADER_BYTES + (samples - 1) / 2;
+      adpcmEncodeBlock(source, blockBytes, _adpcmStepIndex, out);
+      return blockBytes;
+    }
+
+    case PACKET_FORMAT_LOSSLESS: {
+      size_t verbatimSamples = losslessVerbatimSamples(_maxPayloadBytes);
+      bool fullBlock = samples == _losslessSamples;
+      size_t bytes = losslessEncodeBlock(source, samples, _losslessScratch, sizeof(_losslessScratch));
+      if (bytes > _maxPayloadBytes) {
+        // Did not compress as well as the last block; fall back to a size that always fits
+        if (samples > verbatimSamples) samples = verbatimSamples;
+        _losslessSamples = verbatimSamples;
+        return losslessEncodeBlock(source, samples, out, _maxPayloadBytes);
+      }
+      memcpy(out, _losslessScratch, bytes);
+
+      // Aim the next block at ~7/8 of the payload based on this block's ratio
+      if (fullBlock) {
+        size_t next = samples * (_maxPayloadBytes * 7 / 8) / bytes;
+        if (next < verbatimSamples) next = verbatimSamples;
+        if (next > LOSSLESS_MAX_PACKET_SAMPLES) next = LOSSLESS_MAX_PACKET_SAMPLES;
+        _losslessSamples = next;
+      }
+      return bytes;
+    }
+
+    case PACKET_FORMAT_MULAW:
+      mulawEncode(source, samples, out);
+      return samples;
+
+    default:
+      memcpy(out, source, samples * sizeof(int16_t));
+      return samples * sizeof(int16_t);
+  }
+}
+
+bool AudioPacketizer::hasPacket() const {
+  if (_maxPacketBytes == 0) {
+    return false;
+  }
+  size_t pending = _pendingEnd - _pendingStart;
+  if (_silentSamples > 0) {
+    // Flush the audio before the silence, then hold the marker until the
+    // silence ends or grows long
+    return pending > 0 || _silenceEnded || _silentSamples >= SILENCE_MARKER_MAX_SAMPLES;
+  }
+  if (_flushing && pending > 0) {
+    return true;
+  }
+  return pending >= samplesPerPacket();
+}
+
+size_t AudioPacketizer::nextPacket(uint8_t* out) {
+  if (!hasPacket()) {
+    return 0;
+  }
+
+  size_t pending = _pendingEnd - _pendingStart;
+  size_t samples = samplesPerPacket();
+  if (pending < samples) {
+    // Silence follows or a flush was asked for: send what is left as a short packet
+    if (_format == PACKET_FORMAT_ADPCM) {
+      // ADPCM blocks hold an odd number of at least 3 samples; stragglers become silence
+      size_t stragglers = pending < 3 ? pending : (pending % 2 == 0 ? 1 : 0);
+      _pendingEnd -= stragglers;
+      _silentSamples += (uint32_t)timelineSamples(stragglers);
+      pending -= stragglers;
+    }
+    if (pending == 0) {
+      return nextSilencePacket(out);
+    }
+    samples = pending;
+  }
+
+  size_t payloadBytes = encodePayload(out + headerBytes(), samples);
+  _pendingStart += samples;
+  if (_pendingStart == _pendingEnd) {
+    _flushing = false;
+  }
+  return finishPacket(out, _format, payloadBytes, timelineSamples(samples));
+}
+
+size_t AudioPacketizer::nextSilencePacket(uint8_t* out) {
+  uint32_t samples = _silentSamples;
+  uint8_t* payload = out + headerBytes();
+  payload[0] = (uint8_t)(samples & 0xFF);
+  payload[1] = (uint8_t)((samples >> 8) & 0xFF);
+  payload[2] = (uint8_t)((samples >> 16) & 0xFF);
+  payload[3] = (uint8_t)((samples >> 24) & 0xFF);
+  _silentSamples = 0;
+  _silenceEnded = false;
+  return finishPacket(out, PACKET_FORMAT_SILENCE, SILENCE_PAYLOAD_BYTES, samples);
+}
+
+size_t AudioPacketizer::packInPlace(uint8_t* packet, size_t samples) {
+  return finishPacket(packet, _format, samples * sizeof(int16_t), timelineSamples(samples));
+}
+
+size_t AudioPacketizer::finishPacket(uint8_t* out, PacketFormat format, size_t payloadBytes, size_t samples) {
+  if (_framed) {
+    PacketHeader h;
+    h.version = PACKET_VERSION;
+    h.format = format;
+    h.flags = (_streamStart ? PACKET_FLAG_STREAM_START : 0) |
+              (_discontinuity ? PACKET_FLAG_DISCONTINUITY : 0) |
+              (_halfRate && format != PACKET_FORMAT_SILENCE ? PACKET_FLAG_HALF_RATE : 0);
+    h.sampleRate = _sampleRate;
+    h.sequence = 0; // stamped by the sender
+    h.payloadBytes = (uint16_t)payloadBytes;
+    h.firstSample = _nextSample;
+    packetWriteHeader(h, out);
+  }
+
+  _lastPacketStartedStream = _streamStart;
+  _streamStart = false;
+  _discontinuity = false;
+  _nextSample += (uint32_t)samples;
+  return headerBytes() + payloadBytes;
+}
@@ -0,0 +1,115 @@
+#ifndef PACKETIZER_H
+#define PACKETIZER_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "packet.h"
+#include "../Codec/lossless.h"
+
+static constexpr size_t PACKETIZER_MAX_SAMPLES = 2048;
+// Upper bound for the adaptive lossless block, leaves room for a full block in the pending buffer
+static constexpr size_t LOSSLESS_MAX_PACKET_SAMPLES = 1024;
+// Long silences are reported at least this often so the receiver's timeline keeps moving
+static constexpr uint32_t SILENCE_MARKER_MAX_SAMPLES = 16384;
+
+// Turns captured PCM into notification-sized packets. Samples are buffered
+// across capture chunks so every packet is filled to the negotiated size;
+// each packet is independently decodable (one PCM run, one ADPCM block or
+// one lossless block, one mu-law run). Framed packets start with the header
+// from packet.h.
+//
+// Framed streams can also skip silence: appendSilence() stands in for
+// samples that are not worth sending, and a compact PACKET_FORMAT_SILENCE
+// marker replaces them. Audio pending before the silence is flushed as a
+// short packet first so the stream stays in order.
+class AudioPacketizer {
+public:
+  // maxPacketBytes is the largest notification payload (ATT MTU - 3).
+  // sampleRate is only recorded in the headers; it must be a PacketSampleRate.
+  bool begin(PacketFormat format, size_t maxPacketBytes, bool framed,
+             uint32_t sampleRate = PACKET_DEFAULT_SAMPLE_RATE);
+
+  // Changes the packet size mid-stream (e.g. after an MTU exchange),
+  // keeping pending audio and the sample index
+  bool setMaxPacketBytes(size_t maxPacketBytes);
+
+  // Starts a new stream: the sample index restarts at 0 and pending audio is discarded
+  void reset();
+
+  // Changes how the following audio is packed without restarting the
+  // stream, e.g. to step down in quality under backpressure. flush() and
+  // drain the packets first; fails while audio is still pending. halfRate
+  // audio is every second sample (the caller decimates it) and goes out
+  // with PACKET_FLAG_HALF_RATE; framed streams only.
+  bool setEncoding(PacketFormat format, bool halfRate);
+
+  // Lets the pending audio go out as a short packet instead of waiting to
+  // fill one; applies until nothing is pending
+  void flush();
+
+  // Buffers as many samples as fit and returns how many were taken
+  size_t append(const int16_t* samples, size_t count);
+
+  // Framed streams only: count samples of silence follow the appended audio.
+  // While silence is pending, append() takes nothing until the marker is out.
+  bool appendSilence(size_t count);
+
+  // True once nextPacket() has a packet to build
+  bool hasPacket() const;
+
+  // Builds the next packet into out (at least maxPacketBytes) once enough
+  // samples are pending. Returns the packet size, or 0 if not ready yet.
+  size_t nextPacket(uint8_t* out);
+
+  // PCM16 only: completes a packet whose samples were captured straight into
+  // packet + headerBytes(). Returns the packet size.
+  size_t packInPlace(uint8_t* packet, size_t samples);
+
+  // The last packet returned by nextPacket could not be delivered
+  void packetDropped();
+
+  // count samples were lost before capture; pending samples are dropped too
+  void skip(size_t count);
+
+  size_t samplesPerPacket() const;
+  size_t headerBytes() const { return _framed ? PACKET_HEADER_BYTES : 0; }
+  PacketFormat format() const { return _format; }
+  uint32_t sampleRate() const { return packetSampleRateHz(_sampleRate); }
+  bool halfRate() const { return _halfRate; }
+  // Audio or silence still waiting to be packed
+  bool hasPending() const { return _pendingEnd > _pendingStart || _silentSamples > 0; }
+  size_t maxPacketBytes() const { return _maxPacketBytes; }
+  size_t maxPayloadBytes() const { return _maxPayloadBytes; }
+  uint32_t nextSample() const { return _nextSample; }
+
+private:
+  size_t encodePayload(uint8_t* out, size_t& samples);
+  size_t finishPacket(uint8_t* out, PacketFormat format, size_t payloadBytes, size_t samples);
+  size_t nextSilencePacket(uint8_t* out);
+  // Stream samples covered by pending samples
+  size_t timelineSamples(size_t samples) const { return _halfRate ? samples * 2 : samples; }
+
+  PacketFormat _format = PACKET_FORMAT_PCM16;
+  bool _framed = false;
+  uint8_t _sampleRate = PACKET_RATE_16000;
+  bool _halfRate = false;
+  bool _flushing = false;
+  size_t _maxPacketBytes = 0;
+  size_t _maxPayloadBytes = 0;
+
+  int16_t _pending[PACKETIZER_MAX_SAMPLES];
+  size_t _pendingStart = 0;
+  size_t _pendingEnd = 0;
+  uint32_t _nextSample = 0; // stream index of _pending[_pendingStart]
+  bool _streamStart = true;
+  bool _discontinuity = false;
+  bool _lastPacketStartedStream = false;
+  uint32_t _silentSamples = 0; // silence following the pending audio
+  bool _silenceEnded = false;  // audio arrived while silence was pending
+
+  uint8_t _adpcmStepIndex = 0;
+  size_t _losslessSamples = 0;
+  uint8_t _losslessScratch[losslessMaxBlockBytes(LOSSLESS_MAX_PACKET_SAMPLES)];
+};
+
+#endif
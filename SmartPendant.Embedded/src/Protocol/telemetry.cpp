@@ -0,0 +1,196 @@
+#include "telemetry.h"
+#include <string.h>
+
+static inline void putU16(uint8_t* p, uint32_t v) {
+  p[0] = (uint8_t)(v & 0xFF);
+  p[1] = (uint8_t)((v >> 8) & 0xFF);
+}
+
+static inline void putU32(uint8_t* p, uint32_t v) {
+  putU16(p, v & 0xFFFF);
+  putU16(p + 2, v >> 16);
+}
+
+static inline uint16_t getU16(const uint8_t* p) {
+  return (uint16_t)(p[0] | (p[1] << 8));
+}
+
+static inline uint32_t getU32(const uint8_t* p) {
+  return getU16(p) | ((uint32_t)getU16(p + 2) << 16);
+}
+
+// Fixed part of firmware before the client entries, which ends with the latency fields
+static constexpr size_t LATENCY_FIELDS_END = 92;
+// Client entry of firmware with the retransmit counters
+static constexpr size_t RETRANSMIT_FIELDS_END = 32;
+
+// Latencies travel in 100 us units
+static inline uint16_t latencyUnits(uint32_t us) {
+  uint32_t units = us / 100;
+  return (uint16_t)(units > 0xFFFF ? 0xFFFF : units);
+}
+
+void telemetrySetTaskName(TelemetryTask& task, const char* name) {
+  size_t length = name != nullptr ? strlen(name) : 0;
+  if (length > TELEMETRY_TASK_NAME_BYTES) {
+    length = TELEMETRY_TASK_NAME_BYTES;
+  }
+  memset(task.name, 0, sizeof(task.name));
+  if (length > 0) {
+    memcpy(task.name, name, length);
+  }
+}
+
+size_t telemetryEncode(const TelemetrySnapshot& s, uint8_t* out, size_t capacity) {
+  size_t taskCount = s.taskCount < TELEMETRY_MAX_TASKS ? s.taskCount : TELEMETRY_MAX_TASKS;
+  size_t clientCount = s.clientCount < TELEMETRY_MAX_CLIENTS ? s.clientCount : TELEMETRY_MAX_CLIENTS;
+  size_t bytes = TELEMETRY_FIXED_BYTES + taskCount * TELEMETRY_TASK_BYTES + clientCount * TELEMETRY_CLIENT_BYTES;
+  if (capacity < bytes) {
+    return 0;
+  }
+  memset(out, 0, bytes);
+
+  out[0] = TELEMETRY_VERSION;
+  out[1] = (uint8_t)TELEMETRY_FIXED_BYTES;
+  out[2] = (uint8_t)taskCount;
+  out[3] = (uint8_t)TELEMETRY_TASK_BYTES;
+  putU32(out + 4, s.uptimeMs);
+  out[8] = s.connectionState;
+  out[9] = s.pacerWindow;
+  out[10] = (uint8_t)s.rssi;
+  putU16(out + 12, s.mtu);
+  putU16(out + 14, s.connInterval);
+  putU32(out + 16, s.captures);
+  putU32(out + 20, s.capturedSamples);
+  putU32(out + 24, s.sentPackets);
+  putU32(out + 28, s.droppedPackets);
+  putU32(out + 32, s.droppedBytes);
+  putU16(out + 36, s.ringOccupancy);
+  putU16(out + 38, s.ringHighWatermark);
+  putU16(out + 40, s.ringSlots);
+  putU32(out + 44, s.freeHeap);
+  putU32(out + 48, s.minFreeHeap);
+  putU32(out + 52, s.largestFreeBlock);
+  for (size_t i = 0; i < TELEMETRY_LATENCY_COUNT; i++) {
+    uint8_t* p = out + 56 + i * 8;
+    putU16(p, latencyUnits(s.latency[i].p50Us));
+    putU16(p + 2, latencyUnits(s.latency[i].p95Us));
+    putU16(p + 4, latencyUnits(s.latency[i].p99Us));
+    putU16(p + 6, latencyUnits(s.latency[i].maxUs));
+  }
+  putU16(out + 88, s.chunkSamples);
+  out[90] = s.sendTrigger;
+  out[92] = (uint8_t)clientCount;
+  out[93] = (uint8_t)TELEMETRY_CLIENT_BYTES;
+
+  uint8_t* p = out + TELEMETRY_FIXED_BYTES;
+  for (size_t i = 0; i < taskCount; i++, p += TELEMETRY_TASK_BYTES) {
+    const TelemetryTask& t = s.tasks[i];
+    memcpy(p, t.name, strnlen(t.name, TELEMETRY_TASK_NAME_BYTES));
+    p[10] = t.core;
+    putU16(p + 12, t.stackFreeBytes);
+    putU16(p + 14, t.cpuPermille);
+  }
+  for (size_t i = 0; i < clientCount; i++, p += TELEMETRY_CLIENT_BYTES) {
+    const TelemetryClient& c = s.clients[i];
+    putU16(p, c.connId);
+    putU16(p + 2, c.mtu);
+    putU16(p + 4, c.connInterval);
+    p[6] = (uint8_t)c.rssi;
+    p[7] = c.pacerWindow;
+    putU16(p + 8, c.lagPackets);
+    putU16(p + 10, c.maxLagPackets);
+    putU32(p + 12, c.sentPackets);
+    putU32(p + 16, c.skippedPackets);
+    p[20] = c.flags;
+    putU32(p + 24, c.resentPackets);
+    putU32(p + 28, c.unrecoverablePackets);
+  }
+  return bytes;
+}
+
+bool telemetryDecode(const uint8_t* data, size_t bytes, TelemetrySnapshot& s) {
+  if (bytes < 4 || data[0] != TELEMETRY_VERSION) {
+    return false;
+  }
+  size_t fixedBytes = data[1];
+  size_t taskCount = data[2];
+  size_t taskBytes = data[3];
+  if (fixedBytes < TELEMETRY_FIXED_BYTES_MIN || taskBytes < TELEMETRY_TASK_BYTES ||
+      bytes < fixedBytes + taskCount * taskBytes) {
+    return false;
+  }
+  size_t clientCount = 0;
+  size_t clientBytes = TELEMETRY_CLIENT_BYTES;
+  if (fixedBytes >= TELEMETRY_FIXED_BYTES) {
+    clientCount = data[92];
+    clientBytes = data[93];
+    if (clientBytes < TELEMETRY_CLIENT_BYTES_MIN ||
+        bytes < fixedBytes + taskCount * taskBytes + clientCount * clientBytes) {
+      return false;
+    }
+  }
+
+  s = TelemetrySnapshot();
+  s.uptimeMs = getU32(data + 4);
+  s.connectionState = data[8];
+  s.pacerWindow = data[9];
+  s.rssi = (int8_t)data[10];
+  s.mtu = getU16(data + 12);
+  s.connInterval = getU16(data + 14);
+  s.captures = getU32(data + 16);
+  s.capturedSamples = getU32(data + 20);
+  s.sentPackets = getU32(data + 24);
+  s.droppedPackets = getU32(data + 28);
+  s.droppedBytes = getU32(data + 32);
+  s.ringOccupancy = getU16(data + 36);
+  s.ringHighWatermark = getU16(data + 38);
+  s.ringSlots = getU16(data + 40);
+  s.freeHeap = getU32(data + 44);
+  s.minFreeHeap = getU32(data + 48);
+  s.largestFreeBlock = getU32(data + 52);
+  if (fixedBytes >= LATENCY_FIELDS_END) {
+    for (size_t i = 0; i < TELEMETRY_LATENCY_COUNT; i++) {
+      const uint8_t* p = data + 56 + i * 8;
+      s.latency[i].p50Us = getU16(p) * 100u;
+      s.latency[i].p95Us = getU16(p + 2) * 100u;
+      s.latency[i].p99Us = getU16(p + 4) * 100u;
+      s.latency[i].maxUs = getU16(p + 6) * 100u;
+    }
+    s.chunkSamples = getU16(data + 88);
+    s.sendTrigger = data[90];
+  }
+
+  s.taskCount = (uint8_t)(taskCount < TELEMETRY_MAX_TASKS ? taskCount : TELEMETRY_MAX_TASKS);
+  const uint8_t* p = data + fixedBytes;
+  for (size_t i = 0; i < s.taskCount; i++, p += taskBytes) {
+    TelemetryTask& t = s.tasks[i];
+    memcpy(t.name, p, TELEMETRY_TASK_NAME_BYTES);
+    t.name[TELEMETRY_TASK_NAME_BYTES] = 0;
+    t.core = p[10];
+    t.stackFreeBytes = getU16(p + 12);
+    t.cpuPermille = getU16(p + 14);
+  }
+
+  // Clients follow every task entry, including those dropped above
+  p = data + fixedBytes + taskCount * taskBytes;
+  s.clientCount = (uint8_t)(clientCount < TELEMETRY_MAX_CLIENTS ? clientCount : TELEMETRY_MAX_CLIENTS);
+  for (size_t i = 0; i < s.clientCount; i++, p += clientBytes) {
+    TelemetryClient& c = s.clients[i];
+    c.connId = getU16(p);
+    c.mtu = getU16(p + 2);
+    c.connInterval = getU16(p + 4);
+    c.rssi = (int8_t)p[6];
+    c.pacerWindow = p[7];
+    c.lagPackets = getU16(p + 8);
+    c.maxLagPackets = getU16(p + 10);
+    c.sentPackets = getU32(p + 12);
+    c.skippedPackets = getU32(p + 16);
+    c.flags = p[20];
+    if (clientBytes >= RETRANSMIT_FIELDS_END) {
+      c.resentPackets = getU32(p + 24);
+      c.unrecoverablePackets = getU32(p + 28);
+    }
+  }
+  return true;
+}
@@ -0,0 +1,175 @@
+#ifndef TELEMETRY_H
+#define TELEMETRY_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Telemetry snapshot, the value of the telemetry characteristic.
+//
+// Layout (little-endian):
+//   [0]      schema version (TELEMETRY_VERSION)
+//   [1]      bytes in the fixed part, these four included
+//   [2]      number of task entries
+//   [3]      bytes per task entry
+//   [4..7]   uptime in ms
+//   [8]      connection state (ConnectionState)
+//   [9]      notification pacer window of the first client
+//   [10]     RSSI in dBm of the first client, TELEMETRY_RSSI_UNKNOWN until measured
+//   [11]     reserved, 0
+//   [12..13] negotiated ATT MTU of the first client
+//   [14..15] connection interval of the first client, 1.25 ms units, 0 if
+//            not reported yet
+//   [16..19] captures since connect
+//   [20..23] samples captured since connect
+//   [24..27] packets sent since connect, all clients
+//   [28..31] packets dropped since connect (ring full)
+//   [32..35] bytes dropped since connect
+//   [36..37] ring slots in use (held for the slowest client)
+//   [38..39] ring high watermark, slots
+//   [40..41] ring slots
+//   [42..43] reserved, 0
+//   [44..47] free heap, bytes
+//   [48..51] lowest free heap since boot, bytes
+//   [52..55] largest free heap block, bytes
+//   [56..87] latency, one group of four per TelemetryLatency stage:
+//            p50, p95, p99 and max, each uint16 in 100 us units (saturating)
+//   [88..89] capture chunk, samples
+//   [90]     send trigger, packets
+//   [91]     reserved, 0
+//   [92]     number of client entries
+//   [93]     bytes per client entry
+// followed by the task entries:
+//   [0..9]   task name, zero padded
+//   [10]     core the task is pinned to, TELEMETRY_ANY_CORE if not pinned
+//   [11]     reserved, 0
+//   [12..13] least free stack since the task started, bytes
+//   [14..15] CPU use over the last interval, permille of one core,
+//            TELEMETRY_CPU_UNKNOWN without FreeRTOS run-time stats
+// and the client entries, one per connected client. SPP and Wi-Fi clients
+// (TELEMETRY_CLIENT_SPP, TELEMETRY_CLIENT_WIFI) report no interval, RSSI
+// or pacer window:
+//   [0..1]   connection handle
+//   [2..3]   ATT MTU; for SPP and Wi-Fi the largest packet size plus 3
+//   [4..5]   connection interval, 1.25 ms units, 0 if not reported yet
+//   [6]      RSSI in dBm, TELEMETRY_RSSI_UNKNOWN until measured
+//   [7]      notification pacer window
+//   [8..9]   packets waiting for the client now
+//   [10..11] most packets waiting since it subscribed
+//   [12..15] packets sent to it since it subscribed
+//   [16..19] packets it skipped since it subscribed, by falling too far behind
+//   [20]     TELEMETRY_CLIENT_* flags
+//   [21..23] reserved, 0
+//   [24..27] packets resent to it on request since it connected
+//   [28..31] packets it NACKed that had already left the retransmit history
+//
+// New fields are only ever appended to the fixed part or to the entries;
+// decoders skip what they do not know using the sizes in the first four
+// bytes and in [92..93]. The version changes only when existing fields do.
+
+static constexpr uint8_t TELEMETRY_VERSION = 1;
+static constexpr size_t TELEMETRY_FIXED_BYTES = 94;
+// Snapshots from firmware before the latency fields; those fields and the
+// clients decode as 0
+static constexpr size_t TELEMETRY_FIXED_BYTES_MIN = 56;
+static constexpr size_t TELEMETRY_TASK_BYTES = 16;
+static constexpr size_t TELEMETRY_TASK_NAME_BYTES = 10;
+static constexpr size_t TELEMETRY_MAX_TASKS = 8;
+static constexpr size_t TELEMETRY_CLIENT_BYTES = 32;
+// Client entries from firmware before the retransmit counters, which decode as 0
+static constexpr size_t TELEMETRY_CLIENT_BYTES_MIN = 24;
+static constexpr size_t TELEMETRY_MAX_CLIENTS = 4;
+static constexpr size_t TELEMETRY_MAX_BYTES = TELEMETRY_FIXED_BYTES + TELEMETRY_MAX_TASKS * TELEMETRY_TASK_BYTES +
+                                              TELEMETRY_MAX_CLIENTS * TELEMETRY_CLIENT_BYTES;
+
+static constexpr int8_t TELEMETRY_RSSI_UNKNOWN = 127;
+static constexpr uint8_t TELEMETRY_ANY_CORE = 0xFF;
+static constexpr uint16_t TELEMETRY_CPU_UNKNOWN = 0xFFFF;
+
+static constexpr uint8_t TELEMETRY_CLIENT_SUBSCRIBED = 0x01;  // audio notifications on
+static constexpr uint8_t TELEMETRY_CLIENT_TELEMETRY = 0x02;   // telemetry notifications on
+static constexpr uint8_t TELEMETRY_CLIENT_SPP = 0x04;         // on Bluetooth Classic SPP, not BLE
+static constexpr uint8_t TELEMETRY_CLIENT_WIFI = 0x08;        // the Wi-Fi UDP gateway, not BLE
+
+// Latency stages of live audio, in the order they appear in the snapshot
+enum TelemetryLatency : uint8_t {
+  TELEMETRY_LATENCY_PROCESS = 0, // capture complete -> in the ring (DSP, encoding)
+  TELEMETRY_LATENCY_QUEUE,       // in the ring -> taken by sendTask, pacing and send trigger included
+  TELEMETRY_LATENCY_SEND,        // taken -> notification accepted by the stack
+  TELEMETRY_LATENCY_TOTAL,       // oldest sample of the capture -> notification
+  TELEMETRY_LATENCY_COUNT
+};
+
+struct TelemetryLatencyStats {
+  uint32_t p50Us = 0;
+  uint32_t p95Us = 0;
+  uint32_t p99Us = 0;
+  uint32_t maxUs = 0;
+};
+
+struct TelemetryTask {
+  char name[TELEMETRY_TASK_NAME_BYTES + 1] = {};  // zero terminated
+  uint8_t core = TELEMETRY_ANY_CORE;
+  uint16_t stackFreeBytes = 0;
+  uint16_t cpuPermille = TELEMETRY_CPU_UNKNOWN;
+};
+
+struct TelemetryClient {
+  uint16_t connId = 0;
+  uint16_t mtu = 0;
+  uint16_t connInterval = 0;
+  int8_t rssi = TELEMETRY_RSSI_UNKNOWN;
+  uint8_t pacerWindow = 0;
+  uint16_t lagPackets = 0;
+  uint16_t maxLagPackets = 0;
+  uint32_t sentPackets = 0;
+  uint32_t skippedPackets = 0;
+  uint8_t flags = 0;
+  uint32_t resentPackets = 0;
+  uint32_t unrecoverablePackets = 0;
+};
+
+struct TelemetrySnapshot {
+  uint32_t uptimeMs = 0;
+  uint8_t connectionState = 0;
+  uint8_t pacerWindow = 0;
+  int8_t rssi = TELEMETRY_RSSI_UNKNOWN;
+  uint16_t mtu = 0;
+  uint16_t connInterval = 0;
+
+  uint32_t captures = 0;
+  uint32_t capturedSamples = 0;
+  uint32_t sentPackets = 0;
+  uint32_t droppedPackets = 0;
+  uint32_t droppedBytes = 0;
+  uint16_t ringOccupancy = 0;
+  uint16_t ringHighWatermark = 0;
+  uint16_t ringSlots = 0;
+
+  uint32_t freeHeap = 0;
+  uint32_t minFreeHeap = 0;
+  uint32_t largestFreeBlock = 0;
+
+  // Resolution 100 us once encoded
+  TelemetryLatencyStats latency[TELEMETRY_LATENCY_COUNT];
+  uint16_t chunkSamples = 0;
+  uint8_t sendTrigger = 0;
+
+  uint8_t taskCount = 0;
+  TelemetryTask tasks[TELEMETRY_MAX_TASKS];
+
+  uint8_t clientCount = 0;
+  TelemetryClient clients[TELEMETRY_MAX_CLIENTS];
+};
+
+// Copies name into a task entry, truncated to TELEMETRY_TASK_NAME_BYTES
+void telemetrySetTaskName(TelemetryTask& task, const char* name);
+
+// Writes the snapshot; returns its size, or 0 if capacity is too small
+size_t telemetryEncode(const TelemetrySnapshot& snapshot, uint8_t* out, size_t capacity);
+
+// Receiver side. Fails on other schema versions and truncated snapshots;
+// fields appended by newer firmware are skipped, fields older firmware did
+// not send stay 0, tasks and clients beyond the maximums are dropped.
+bool telemetryDecode(const uint8_t* data, size_t bytes, TelemetrySnapshot& snapshot);
+
+#endif
@@ -0,0 +1,77 @@
+#include "trace_dump.h"
+#include <stdio.h>
+
+static const char HEX_DIGITS[] = "0123456789abcdef";
+
+static int hexValue(char c) {
+  if (c >= '0' && c <= '9') return c - '0';
+  if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+  if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+  return -1;
+}
+
+size_t traceDumpBegin(char* line, unsigned cores, uint16_t trigger) {
+  return (size_t)snprintf(line, TRACE_DUMP_LINE_BYTES, "TRACE BEGIN %u %u %u\n", TRACE_DUMP_VERSION, cores,
+                          trigger);
+}
+
+size_t traceDumpTask(char* line, uint32_t number, const char* name) {
+  // Names are one word on the line
+  char word[24];
+  size_t i = 0;
+  for (; name[i] != '\0' && i + 1 < sizeof(word); i++) {
+    word[i] = name[i] == ' ' ? '_' : name[i];
+  }
+  word[i] = '\0';
+  return (size_t)snprintf(line, TRACE_DUMP_LINE_BYTES, "TRACE TASK %u %s\n", (unsigned)number,
+                          i > 0 ? word : "?");
+}
+
+size_t traceDumpCore(char* line, unsigned core, const TraceCoreClock& clock, const TraceRing& ring) {
+  return (size_t)snprintf(line, TRACE_DUMP_LINE_BYTES, "TRACE CORE %u %u %u %llu %u %u\n", core,
+                          (unsigned)clock.mhz, (unsigned)clock.cycles, (unsigned long long)clock.us,
+                          (unsigned)ring.recorded(), (unsigned)ring.size());
+}
+
+size_t traceDumpEvents(char* line, unsigned core, const TraceRing& ring, size_t first, size_t& count) {
+  count = ring.size() > first ? ring.size() - first : 0;
+  if (count > TRACE_DUMP_EVENTS_PER_LINE) {
+    count = TRACE_DUMP_EVENTS_PER_LINE;
+  }
+  size_t length = (size_t)snprintf(line, TRACE_DUMP_LINE_BYTES, "TRACE EVENTS %u %u ", core, (unsigned)first);
+  for (size_t i = 0; i < count; i++) {
+    const TraceEvent& e = ring.at(first + i);
+    uint8_t bytes[sizeof(TraceEvent)] = {
+      (uint8_t)e.cycles, (uint8_t)(e.cycles >> 8), (uint8_t)(e.cycles >> 16), (uint8_t)(e.cycles >> 24),
+      e.type, e.reserved, (uint8_t)e.arg, (uint8_t)(e.arg >> 8),
+    };
+    for (uint8_t b : bytes) {
+      line[length++] = HEX_DIGITS[b >> 4];
+      line[length++] = HEX_DIGITS[b & 0x0F];
+    }
+  }
+  line[length++] = '\n';
+  line[length] = '\0';
+  return length;
+}
+
+size_t traceDumpEnd(char* line) {
+  return (size_t)snprintf(line, TRACE_DUMP_LINE_BYTES, "TRACE END\n");
+}
+
+bool traceDecodeEvent(const char* hex, TraceEvent& event) {
+  uint8_t bytes[sizeof(TraceEvent)];
+  for (size_t i = 0; i < sizeof(bytes); i++) {
+    int high = hexValue(hex[2 * i]);
+    int low = high < 0 ? -1 : hexValue(hex[2 * i + 1]);
+    if (low < 0) {
+      return false;
+    }
+    bytes[i] = (uint8_t)(high << 4 | low);
+  }
+  event.cycles = (uint32_t)bytes[0] | (uint32_t)bytes[1] << 8 | (uint32_t)bytes[2] << 16 | (uint32_t)bytes[3] << 24;
+  event.type = bytes[4];
+  event.reserved = bytes[5];
+  event.arg = (uint16_t)(bytes[6] | bytes[7] << 8);
+  return true;
+}
@@ -0,0 +1,49 @@
+#ifndef TRACE_DUMP_H
+#define TRACE_DUMP_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "../Pipeline/trace_ring.h"
+
+// Text dump of the trace rings (Pipeline/trace_ring.h), printed on the
+// serial console and read back by env:trace_to_chrome.
+//
+// Every line starts with "TRACE " so the dump can be picked out of a
+// monitor log with other output around it:
+//   TRACE BEGIN <version> <cores> <trigger>
+//   TRACE TASK <number> <name>
+//       one per FreeRTOS task, the number TRACE_TASK_SWITCH carries
+//   TRACE CORE <core> <mhz> <cycles> <us> <recorded> <events>
+//       the core's cycle counter read at <us> on the shared microsecond
+//       clock while it ran at <mhz>, events recorded since boot and the
+//       number that follow
+//   TRACE EVENTS <core> <index> <hex>
+//       up to TRACE_DUMP_EVENTS_PER_LINE events from index on, oldest
+//       first, 16 hex digits each: the 8 bytes of a TraceEvent,
+//       little-endian
+//   TRACE END
+static constexpr uint8_t TRACE_DUMP_VERSION = 1;
+static constexpr size_t TRACE_DUMP_EVENTS_PER_LINE = 16;
+static constexpr size_t TRACE_DUMP_EVENT_HEX = 2 * sizeof(TraceEvent);
+// Room for the longest line and its terminator
+static constexpr size_t TRACE_DUMP_LINE_BYTES = 48 + TRACE_DUMP_EVENTS_PER_LINE * TRACE_DUMP_EVENT_HEX;
+
+// A core's cycle counter against the clock both cores share, read at one instant
+struct TraceCoreClock {
+  uint32_t mhz = 0;
+  uint32_t cycles = 0;
+  uint64_t us = 0;
+};
+
+// Each writes one line, newline included, and returns its length
+size_t traceDumpBegin(char* line, unsigned cores, uint16_t trigger);
+size_t traceDumpTask(char* line, uint32_t number, const char* name);
+size_t traceDumpCore(char* line, unsigned core, const TraceCoreClock& clock, const TraceRing& ring);
+// Events first.. of the ring, as many as fit on a line; count returns how many
+size_t traceDumpEvents(char* line, unsigned core, const TraceRing& ring, size_t first, size_t& count);
+size_t traceDumpEnd(char* line);
+
+// One event from its TRACE_DUMP_EVENT_HEX digits; false if they are not hex
+bool traceDecodeEvent(const char* hex, TraceEvent& event);
+
+#endif
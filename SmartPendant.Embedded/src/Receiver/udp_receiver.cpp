@@ -0,0 +1,306 @@
+// Reference receiver for the Wi-Fi UDP stream (env:udp_receiver).
+//
+//   .pio/build/udp_receiver/program [-p port] [-o capture.wav] [-t seconds]
+//                                   [--idle seconds] [--max-loss percent]
+//
+// Listens for framed packets (Protocol/packet.h), one per datagram, and
+// writes the live audio to a WAV file with silence in place of whatever was
+// lost, so the file keeps the device's timeline. A new stream at another
+// sample rate starts a new file (capture-1.wav, ...). Every 5 s and at the
+// end it reports packet and sample loss, late or duplicated datagrams and
+// the interarrival jitter (RFC 3550) against the audio clock. Log-mel
+// feature streams are counted and checked the same way but not written.
+//
+// It stops after -t seconds, after --idle seconds without datagrams once
+// the stream has begun, or on Ctrl-C. With --max-loss it exits non-zero
+// when more audio than that was lost, so a localhost run against
+// env:udp_sender works as an end-to-end test.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <math.h>
+#include <chrono>
+#include <string>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include <unistd.h>
+#include "../Hal/wav_writer.h"
+#include "../Protocol/packet.h"
+
+static constexpr uint16_t DEFAULT_PORT = 50005;
+static constexpr double REPORT_INTERVAL_S = 5.0;
+// A datagram holds one packet; 509 bytes from the device, room for more
+static constexpr size_t MAX_DATAGRAM_BYTES = 2048;
+static constexpr size_t MAX_PACKET_SAMPLES = MAX_DATAGRAM_BYTES * 2;
+
+typedef std::chrono::steady_clock Clock;
+
+static volatile sig_atomic_t stopRequested = 0;
+
+static void onSignal(int) {
+  stopRequested = 1;
+}
+
+struct Options {
+  uint16_t port = DEFAULT_PORT;
+  const char* output = "capture.wav";
+  double seconds = 0;    // 0 runs until stopped
+  double idle = 0;       // 0 never stops for silence on the network
+  double maxLoss = -1;   // percent; negative does not check
+};
+
+// Interarrival jitter of RFC 3550: the smoothed variation of transit time,
+// arrival against the packet's place on the audio timeline
+class JitterMeter {
+public:
+  void add(double arrivalS, double mediaS) {
+    double transit = arrivalS - mediaS;
+    if (_started) {
+      double d = fabs(transit - _lastTransit);
+      _jitter += (d - _jitter) / 16.0;
+      if (d > _maxDelta) _maxDelta = d;
+    }
+    _lastTransit = transit;
+    _started = true;
+  }
+  // A new stream restarts the audio clock
+  void restart() { _started = false; }
+
+  double jitterMs() const { return _jitter * 1000.0; }
+  double maxDeltaMs() const { return _maxDelta * 1000.0; }
+
+private:
+  bool _started = false;
+  double _lastTransit = 0;
+  double _jitter = 0;
+  double _maxDelta = 0;
+};
+
+struct Stats {
+  uint64_t datagrams = 0;
+  uint64_t bytes = 0;
+  uint32_t malformed = 0;
+  uint32_t backlog = 0;   // backlog packets and segment markers, not written
+  uint64_t liveSamples = 0;
+  uint64_t silenceSamples = 0;
+  uint64_t featureSamples = 0;  // timeline covered by log-mel frames
+  uint64_t featureFrames = 0;
+};
+
+class Receiver {
+public:
+  bool begin(const Options& options) {
+    _options = options;
+    _tracker.reset();
+    return true;
+  }
+
+  void receive(const uint8_t* datagram, size_t bytes, double arrivalS) {
+    _stats.datagrams++;
+    _stats.bytes += bytes;
+    PacketHeader header;
+    if (!packetParseHeader(datagram, bytes, header)) {
+      _stats.malformed++;
+      return;
+    }
+    const uint8_t* payload = datagram + PACKET_HEADER_BYTES;
+    size_t timeline = packetTimelineSamples(header, payload);
+    uint32_t gapSamples;
+    if (!_tracker.accept(header, timeline, gapSamples)) {
+      return;
+    }
+    if ((header.flags & PACKET_FLAG_BACKLOG) || header.format == PACKET_FORMAT_SEGMENT) {
+      _stats.backlog++;
+      return;
+    }
+
+    uint32_t rate = packetSampleRateHz(header.sampleRate);
+    if (rate == 0) {
+      _stats.malformed++;
+      return;
+    }
+    if (header.format == PACKET_FORMAT_LOG_MEL) {
+      // No audio to write, but the same timeline
+      if (timeline == 0) {
+        _stats.malformed++;
+        return;
+      }
+      if (header.flags & PACKET_FLAG_STREAM_START) {
+        _jitter.restart();
+      }
+      _jitter.add(arrivalS, (double)header.firstSample / rate);
+      _stats.featureSamples += timeline;
+      _stats.featureFrames += (header.payloadBytes - LOG_MEL_PAYLOAD_HEADER_BYTES) / payload[2];
+      return;
+    }
+    if ((header.flags & PACKET_FLAG_STREAM_START) || !_wav.isOpen()) {
+      _jitter.restart();
+      if (!_wav.isOpen() || rate != _wav.sampleRate()) {
+        openFile(rate);
+      }
+    }
+    size_t count = packetDecodeAudio(header, payload, _samples, MAX_PACKET_SAMPLES);
+    if (count == 0) {
+      _stats.malformed++;
+      return;
+    }
+    _jitter.add(arrivalS, (double)header.firstSample / rate);
+    _wav.writeSilence(gapSamples);
+    _wav.write(_samples, count);
+    if (header.format == PACKET_FORMAT_SILENCE) {
+      _stats.silenceSamples += count;
+    } else {
+      _stats.liveSamples += count;
+    }
+  }
+
+  void report(const char* label, double elapsedS) const {
+    uint64_t timeline = _stats.liveSamples + _stats.silenceSamples + _tracker.samplesLost();
+    printf("%s %6.1f s: %llu datagrams (%.1f KB/s), %u lost, %u late or duplicate, %u malformed, "
+           "%.2f%% audio lost, jitter %.2f ms (max step %.1f ms)\n",
+           label, elapsedS, (unsigned long long)_stats.datagrams,
+           elapsedS > 0 ? _stats.bytes / elapsedS / 1000.0 : 0.0, _tracker.packetsLost(),
+           _tracker.packetsDiscarded(), _stats.malformed, lossPercent(), _jitter.jitterMs(),
+           _jitter.maxDeltaMs());
+    if (_wav.isOpen()) {
+      printf("%*s %.1f s of audio in %s (%u Hz), %.1f s of it silence markers, %u backlog packets skipped\n",
+             (int)strlen(label), "", timeline / (double)_wav.sampleRate(), _path.c_str(), _wav.sampleRate(),
+             _stats.silenceSamples / (double)_wav.sampleRate(), _stats.backlog);
+    }
+    if (_stats.featureFrames > 0) {
+      printf("%*s %llu log-mel frames over %.1f s\n", (int)strlen(label), "",
+             (unsigned long long)_stats.featureFrames, _stats.featureSamples / (double)PACKET_DEFAULT_SAMPLE_RATE);
+    }
+  }
+
+  double lossPercent() const {
+    uint64_t timeline = _stats.liveSamples + _stats.silenceSamples + _stats.featureSamples + _tracker.samplesLost();
+    double packets = (double)_tracker.packetsReceived() + _tracker.packetsLost();
+    // Audio the device dropped shows as sample gaps, audio lost on the
+    // network as sequence gaps too; either way it is missing from the file
+    double samples = timeline > 0 ? _tracker.samplesLost() * 100.0 / timeline : 0;
+    double sequence = packets > 0 ? _tracker.packetsLost() * 100.0 / packets : 0;
+    return samples > sequence ? samples : sequence;
+  }
+
+  bool started() const { return _stats.datagrams > 0; }
+  void finish() { _wav.close(); }
+
+private:
+  void openFile(uint32_t rate) {
+    _wav.close();
+    _path = _options.output;
+    if (_files > 0) {
+      size_t dot = _path.rfind('.');
+      std::string suffix = "-" + std::to_string(_files);
+      _path.insert(dot == std::string::npos ? _path.size() : dot, suffix);
+    }
+    _files++;
+    if (!_wav.open(_path.c_str(), rate)) {
+      printf("%s: cannot write\n", _path.c_str());
+    }
+  }
+
+  Options _options;
+  PacketLossTracker _tracker;
+  JitterMeter _jitter;
+  WavFileWriter _wav;
+  std::string _path;
+  uint32_t _files = 0;
+  Stats _stats;
+  int16_t _samples[MAX_PACKET_SAMPLES];
+};
+
+static bool parseOptions(int argc, char** argv, Options& o) {
+  for (int i = 1; i < argc; i++) {
+    const char* arg = argv[i];
+    const char* value = i + 1 < argc ? argv[i + 1] : nullptr;
+    if (value == nullptr) {
+      return false;
+    }
+    if (strcmp(arg, "-p") == 0 || strcmp(arg, "--port") == 0) {
+      o.port = (uint16_t)atoi(value);
+    } else if (strcmp(arg, "-o") == 0 || strcmp(arg, "--output") == 0) {
+      o.output = value;
+    } else if (strcmp(arg, "-t") == 0 || strcmp(arg, "--seconds") == 0) {
+      o.seconds = atof(value);
+    } else if (strcmp(arg, "--idle") == 0) {
+      o.idle = atof(value);
+    } else if (strcmp(arg, "--max-loss") == 0) {
+      o.maxLoss = atof(value);
+    } else {
+      return false;
+    }
+    i++;
+  }
+  return true;
+}
+
+int main(int argc, char** argv) {
+  Options options;
+  if (!parseOptions(argc, argv, options)) {
+    printf("usage: %s [-p port] [-o capture.wav] [-t seconds] [--idle seconds] [--max-loss percent]\n", argv[0]);
+    return 2;
+  }
+
+  int sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+  sockaddr_in address;
+  memset(&address, 0, sizeof(address));
+  address.sin_family = AF_INET;
+  address.sin_addr.s_addr = htonl(INADDR_ANY);
+  address.sin_port = htons(options.port);
+  if (sock < 0 || bind(sock, (const sockaddr*)&address, sizeof(address)) != 0) {
+    printf("cannot listen on UDP port %u\n", options.port);
+    return 2;
+  }
+  // Wake up regularly to report and to notice the end
+  timeval timeout = { 0, 200000 };
+  setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+  int bufferBytes = 1 << 20;
+  setsockopt(sock, SOL_SOCKET, SO_RCVBUF, &bufferBytes, sizeof(bufferBytes));
+  signal(SIGINT, onSignal);
+  signal(SIGTERM, onSignal);
+
+  static Receiver receiver;
+  receiver.begin(options);
+  printf("Listening on UDP port %u, writing %s\n", options.port, options.output);
+
+  Clock::time_point start = Clock::now();
+  Clock::time_point lastDatagram = start;
+  double nextReport = REPORT_INTERVAL_S;
+  static uint8_t datagram[MAX_DATAGRAM_BYTES];
+  while (!stopRequested) {
+    ssize_t bytes = recv(sock, datagram, sizeof(datagram), 0);
+    Clock::time_point now = Clock::now();
+    double elapsed = std::chrono::duration<double>(now - start).count();
+    if (bytes > 0) {
+      receiver.receive(datagram, (size_t)bytes, elapsed);
+      lastDatagram = now;
+    }
+    if (elapsed >= nextReport) {
+      receiver.report("  at", elapsed);
+      nextReport += REPORT_INTERVAL_S;
+    }
+    if (options.seconds > 0 && elapsed >= options.seconds) {
+      break;
+    }
+    if (options.idle > 0 && receiver.started() &&
+        std::chrono::duration<double>(now - lastDatagram).count() >= options.idle) {
+      break;
+    }
+  }
+  close(sock);
+
+  double elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+  receiver.report("Total", elapsed);
+  receiver.finish();
+  if (options.maxLoss >= 0) {
+    bool ok = receiver.started() && receiver.lossPercent() <= options.maxLoss;
+    printf("%s\n", !receiver.started() ? "FAIL: nothing received"
+                   : ok ? "Loss within the limit" : "FAIL: more audio lost than allowed");
+    return ok ? 0 : 1;
+  }
+  return 0;
+}
@@ -0,0 +1,200 @@
+// Host simulation of connect/disconnect storms against the connection
+// state machine (env:connection_storm_sim).
+//
+//   pio run -e connection_storm_sim -t exec
+//
+// Each storm feeds 1M events to a ConnectionStateMachine, drawn with the
+// mix of one kind of trouble: clients that connect and drop within a few
+// events, subscriptions that flap, a capture side that is slow to let go
+// of a stopped stream, and events the machine does not know. A reference
+// model written from the class comment follows along, and after every event
+// the machine has to agree with it on state(), settledState(), connected(),
+// streaming() and on whether the event changed anything. Every stop must
+// pass through DRAINING and only DRAINED may end it; transitions and
+// ignored events must add up to the events fed. A second thread reads the
+// state the whole time, as the UI and capture tasks do, and must never see
+// an unknown state or DRAINING as where a drain ends. The run exits non-zero
+// if any check fails.
+#include <stdio.h>
+#include <atomic>
+#include <thread>
+#include "../Pipeline/connection_state.h"
+
+static constexpr uint32_t EVENTS_PER_STORM = 1000000;
+static constexpr ConnectionEvent UNKNOWN_EVENT = CONNECTION_EVENT_COUNT;
+
+static uint32_t lcg(uint32_t& seed) {
+  seed = seed * 1664525 + 1013904223;
+  return seed >> 8;
+}
+
+static bool failed = false;
+
+static bool check(bool condition, const char* what, uint32_t event) {
+  if (!condition && !failed) {
+    printf("  FAIL: %s at event %u\n", what, event);
+  }
+  failed = failed || !condition;
+  return condition;
+}
+
+// Relative weights of connect, disconnect, subscribe, unsubscribe, start,
+// drained and an unknown event
+struct StormPlan {
+  const char* name;
+  uint32_t weights[CONNECTION_EVENT_COUNT + 1];
+};
+
+static const StormPlan PLANS[] = {
+  { "Every event equally likely", { 1, 1, 1, 1, 1, 1, 0 } },
+  { "Connect/disconnect storm", { 8, 8, 2, 1, 2, 2, 0 } },
+  { "Clients drop while streaming", { 3, 3, 3, 1, 4, 2, 0 } },
+  { "Subscriptions flap", { 1, 1, 6, 6, 3, 2, 0 } },
+  { "Slow capture side", { 4, 4, 3, 2, 3, 1, 0 } },
+  { "Stray and unknown events", { 2, 2, 2, 2, 2, 2, 3 } },
+};
+
+// The behaviour the class comment promises, kept apart from the table
+struct ReferenceModel {
+  ConnectionState settled = CONNECTION_ADVERTISING;
+  bool draining = false;
+
+  ConnectionState state() const { return draining ? CONNECTION_DRAINING : settled; }
+
+  static ConnectionState next(ConnectionState s, ConnectionEvent event) {
+    switch (event) {
+      case CONNECTION_EVENT_CONNECT:
+        return s == CONNECTION_ADVERTISING ? CONNECTION_CONNECTED : s;
+      case CONNECTION_EVENT_DISCONNECT:
+        return CONNECTION_ADVERTISING;
+      case CONNECTION_EVENT_SUBSCRIBE:
+        return s == CONNECTION_CONNECTED ? CONNECTION_SUBSCRIBED : s;
+      case CONNECTION_EVENT_UNSUBSCRIBE:
+        return s == CONNECTION_SUBSCRIBED || s == CONNECTION_STREAMING ? CONNECTION_CONNECTED : s;
+      case CONNECTION_EVENT_START:
+        return s == CONNECTION_CONNECTED || s == CONNECTION_SUBSCRIBED ? CONNECTION_STREAMING : s;
+      default:
+        return s;
+    }
+  }
+
+  bool handle(ConnectionEvent event) {
+    if (draining && event == CONNECTION_EVENT_DRAINED) {
+      draining = false;
+      return true;
+    }
+    ConnectionState n = next(settled, event);
+    if (n == settled) {
+      return false;
+    }
+    draining = draining || settled == CONNECTION_STREAMING;
+    settled = n;
+    return true;
+  }
+};
+
+static ConnectionEvent drawEvent(const StormPlan& plan, uint32_t& seed) {
+  uint32_t total = 0;
+  for (uint32_t w : plan.weights) total += w;
+  uint32_t pick = lcg(seed) % total;
+  uint32_t e = 0;
+  while (pick >= plan.weights[e]) {
+    pick -= plan.weights[e++];
+  }
+  // Anything past the last known event, not just the first unknown value
+  return e == CONNECTION_EVENT_COUNT ? (ConnectionEvent)(UNKNOWN_EVENT + lcg(seed) % 200) : (ConnectionEvent)e;
+}
+
+static bool runStorm(const StormPlan& plan, uint32_t seed) {
+  ConnectionStateMachine machine;
+  machine.reset();
+  ReferenceModel model;
+
+  std::atomic<bool> stop{false};
+  std::atomic<uint32_t> badReads{0};
+  std::atomic<uint32_t> reads{0};
+  std::thread reader([&]() {
+    while (!stop.load(std::memory_order_relaxed)) {
+      ConnectionState state = machine.state();
+      ConnectionState settled = machine.settledState();
+      bool bad = state >= CONNECTION_STATE_COUNT || settled >= CONNECTION_STATE_COUNT ||
+                 settled == CONNECTION_DRAINING;
+      badReads.fetch_add(bad, std::memory_order_relaxed);
+      reads.fetch_add(1, std::memory_order_relaxed);
+    }
+  });
+
+  uint32_t counts[CONNECTION_STATE_COUNT] = {};
+  uint32_t stops = 0;
+  uint32_t drainEvents = 0;
+  uint32_t unknown = 0;
+  uint32_t longestDrain = 0;
+  uint32_t drainStart = 0;
+  for (uint32_t i = 0; i < EVENTS_PER_STORM && !failed; i++) {
+    ConnectionEvent event = drawEvent(plan, seed);
+    ConnectionState before = machine.state();
+    ConnectionState settledBefore = machine.settledState();
+
+    bool changed = machine.handle(event);
+    bool expectChanged = model.handle(event);
+    ConnectionState after = machine.state();
+
+    unknown += event >= CONNECTION_EVENT_COUNT;
+    check(changed == expectChanged, "handle() reported the wrong change", i);
+    check(after == model.state(), "state differs from the reference", i);
+    check(machine.settledState() == model.settled, "settled state differs from the reference", i);
+    check(after < CONNECTION_STATE_COUNT, "unknown state", i);
+    check(after == CONNECTION_DRAINING || machine.settledState() == after, "settled state differs outside a drain", i);
+    check(machine.connected() == (model.settled != CONNECTION_ADVERTISING), "connected() is wrong", i);
+    check(machine.streaming() == (after == CONNECTION_STREAMING), "streaming() is wrong", i);
+    check(machine.transitions() + machine.ignoredEvents() == i + 1, "an event was neither applied nor ignored", i);
+    check(changed || (after == before && machine.settledState() == settledBefore), "an ignored event changed the state", i);
+    check(before != CONNECTION_STREAMING || after == CONNECTION_STREAMING || after == CONNECTION_DRAINING,
+          "left streaming without draining", i);
+    check(before != CONNECTION_DRAINING || after == CONNECTION_DRAINING || event == CONNECTION_EVENT_DRAINED,
+          "a drain ended without DRAINED", i);
+    check(event < CONNECTION_EVENT_COUNT || !changed, "an unknown event was applied", i);
+
+    if (after == CONNECTION_DRAINING && before != CONNECTION_DRAINING) {
+      stops++;
+      drainStart = i;
+    }
+    if (before == CONNECTION_DRAINING && after != CONNECTION_DRAINING) {
+      drainEvents++;
+      if (i - drainStart > longestDrain) longestDrain = i - drainStart;
+    }
+    counts[after]++;
+  }
+
+  // End the last drain, as the capture side eventually does
+  if (machine.state() == CONNECTION_DRAINING) {
+    machine.handle(CONNECTION_EVENT_DRAINED);
+    drainEvents++;
+  }
+  stop.store(true, std::memory_order_relaxed);
+  reader.join();
+
+  check(stops == drainEvents, "a stop was never drained", EVENTS_PER_STORM);
+  check(badReads.load() == 0, "a reader saw an unknown or draining settled state", EVENTS_PER_STORM);
+  bool everyState = true;
+  for (uint32_t n : counts) everyState = everyState && n > 0;
+  check(everyState, "the storm did not reach every state", EVENTS_PER_STORM);
+
+  printf("\n%s\n", plan.name);
+  printf("  %u events, %u transitions, %u ignored (%u unknown), %u stops drained, longest drain %u events\n",
+         EVENTS_PER_STORM, machine.transitions(), machine.ignoredEvents(), unknown, stops, longestDrain);
+  printf("  after each event: %u advertising, %u connected, %u subscribed, %u streaming, %u draining\n",
+         counts[CONNECTION_ADVERTISING], counts[CONNECTION_CONNECTED], counts[CONNECTION_SUBSCRIBED],
+         counts[CONNECTION_STREAMING], counts[CONNECTION_DRAINING]);
+  printf("  %u concurrent reads, %u bad\n", reads.load(), badReads.load());
+  return !failed;
+}
+
+int main() {
+  uint32_t seed = 42;
+  for (const StormPlan& plan : PLANS) {
+    runStorm(plan, seed++);
+  }
+  printf("\n%s\n", failed ? "Connection state regression" : "Connection state holds its invariants");
+  return failed ? 1 : 0;
+}
@@ -0,0 +1,233 @@
+// Host simulation of several clients reading one live stream (env:fanout_sim).
+//
+//   pio run -e fanout_sim -t exec
+//
+// The firmware's packetizer fills a FanoutRing that simulated clients read
+// at their own link throughput, joining and leaving at set times, the way
+// sendTask serves the BLE centrals. Each client checks what it receives
+// with a LoopbackTransport. The run exits non-zero if a client marked
+// "complete" misses audio while another one lags, stalls or leaves, if the
+// device drops packets, or if a slow client's lag exceeds the trim bound.
+#include <stdio.h>
+#include <vector>
+#include "../Hal/synthetic_source.h"
+#include "../Hal/loopback_transport.h"
+#include "../Pipeline/fanout_ring.h"
+#include "../Pipeline/pipeline_config.h"
+#include "../Protocol/packetizer.h"
+
+// Same shape as the firmware's live path
+static constexpr uint32_t SAMPLE_RATE = 16000;
+static constexpr size_t CAPTURE_SAMPLES = 320;               // 20 ms
+static constexpr uint32_t CAPTURE_MS = CAPTURE_SAMPLES * 1000 / SAMPLE_RATE;
+typedef PipelineConfig<SAMPLE_RATE, 2500, 5, 512, 200, 400> LivePipeline;
+static constexpr size_t MAX_PACKET_BYTES = LivePipeline::MAX_PACKET_BYTES;
+static constexpr size_t RING_SLOTS = LivePipeline::RING_SLOTS;
+static constexpr size_t CLIENT_MAX_LAG = RING_SLOTS * 3 / 4;
+static constexpr size_t ATT_OVERHEAD_BYTES = 3;              // per notification
+static constexpr uint32_t RUN_MS = 60000;
+
+struct RateStep {
+  uint32_t ms;
+  uint32_t bytesPerSecond;
+};
+
+struct ClientPlan {
+  const char* name;
+  std::vector<RateStep> rates;
+  uint32_t joinMs;
+  uint32_t leaveMs;   // RUN_MS to stay to the end
+  bool complete;      // must receive every sample from joining to leaving
+};
+
+struct Scenario {
+  const char* name;
+  std::vector<ClientPlan> clients;
+};
+
+// Full PCM needs ~32.8 KB/s with headers
+static void addScenarios(std::vector<Scenario>& scenarios) {
+  scenarios.push_back({ "fast and slow", {
+    { "phone", { { 0, 40000 } }, 0, RUN_MS, true },
+    { "desktop", { { 0, 12000 } }, 0, RUN_MS, false },
+  } });
+  scenarios.push_back({ "stall", {
+    { "phone", { { 0, 40000 } }, 0, RUN_MS, true },
+    { "desktop", { { 0, 40000 }, { 10000, 0 }, { 40000, 40000 } }, 0, RUN_MS, false },
+  } });
+  scenarios.push_back({ "leave and join", {
+    { "phone", { { 0, 40000 } }, 0, RUN_MS, true },
+    { "desktop", { { 0, 40000 } }, 0, 20000, true },
+    { "tablet", { { 0, 40000 } }, 30000, RUN_MS, true },
+  } });
+  scenarios.push_back({ "first leaves", {
+    { "desktop", { { 0, 40000 } }, 0, 15000, true },
+    { "phone", { { 0, 40000 } }, 5000, RUN_MS, true },
+    { "slow", { { 0, 20000 } }, 10000, RUN_MS, false },
+  } });
+}
+
+static uint32_t rateAt(const ClientPlan& plan, uint32_t ms) {
+  uint32_t rate = 0;
+  for (const RateStep& step : plan.rates) {
+    if (step.ms > ms) {
+      break;
+    }
+    rate = step.bytesPerSecond;
+  }
+  return rate;
+}
+
+//----------------------------------------------------------------------
+// Clients
+//----------------------------------------------------------------------
+struct SimClient {
+  const ClientPlan* plan;
+  LoopbackTransport link;
+  uint8_t reader = FanoutRing::NO_READER;
+  uint16_t sequence = 0;
+  double credit = 0;
+  size_t maxLag = 0;
+  uint32_t skipped = 0;
+};
+
+// Like serviceClient() on the device: sends what the link takes right now
+static void serviceClient(FanoutRing& ring, SimClient& c, uint32_t ms) {
+  c.credit += rateAt(*c.plan, ms) / 1000.0;
+  size_t length;
+  uint32_t tag;
+  SlotTimes times;
+  uint8_t* packet;
+  while ((packet = ring.peek(c.reader, length, tag, times)) != nullptr &&
+         c.credit >= length + ATT_OVERHEAD_BYTES) {
+    c.credit -= length + ATT_OVERHEAD_BYTES;
+    // Sequence numbers count the packets sent to this client
+    packetSetSequence(packet, c.sequence++);
+    c.link.send(c.reader, packet, length);
+    ring.release(c.reader);
+  }
+  if (packet == nullptr && c.credit > MAX_PACKET_BYTES) {
+    // An idle link does not bank throughput
+    c.credit = MAX_PACKET_BYTES;
+  }
+}
+
+static void detachClient(FanoutRing& ring, SimClient& c) {
+  c.maxLag = ring.maxLag(c.reader);
+  c.skipped = ring.skipped(c.reader);
+  ring.detach(c.reader);
+  c.reader = FanoutRing::NO_READER;
+}
+
+//----------------------------------------------------------------------
+// Device side
+//----------------------------------------------------------------------
+struct Device {
+  AudioPacketizer packetizer;
+  FanoutRing ring;
+  uint8_t scratch[MAX_PACKET_BYTES];
+  uint32_t droppedPackets = 0;
+};
+
+// Like drainPackets() on the device: drop-tail when the ring is full
+static void drainPackets(Device& d) {
+  while (d.packetizer.hasPacket()) {
+    uint8_t* slot = d.ring.reserve();
+    size_t bytes = d.packetizer.nextPacket(slot != nullptr ? slot : d.scratch);
+    if (slot != nullptr) {
+      d.ring.commit(bytes, 0);
+    } else {
+      d.packetizer.packetDropped();
+      d.droppedPackets++;
+    }
+  }
+}
+
+static bool runScenario(const Scenario& scenario) {
+  static Device d;
+  static uint8_t ringStorage[FanoutRing::storageBytes(MAX_PACKET_BYTES, RING_SLOTS)];
+  static int16_t capture[CAPTURE_SAMPLES];
+
+  if (!d.packetizer.begin(PACKET_FORMAT_PCM16, MAX_PACKET_BYTES, true, SAMPLE_RATE) ||
+      !d.ring.begin(ringStorage, MAX_PACKET_BYTES, RING_SLOTS)) {
+    printf("%s: setup failed\n", scenario.name);
+    return false;
+  }
+  d.droppedPackets = 0;
+
+  SyntheticSource source;
+  source.begin(SyntheticSource::Config());
+  std::vector<SimClient> clients(scenario.clients.size());
+  for (size_t i = 0; i < clients.size(); i++) {
+    clients[i].plan = &scenario.clients[i];
+    clients[i].link.begin(true);
+  }
+
+  for (uint32_t ms = 0; ms < RUN_MS; ms++) {
+    for (SimClient& c : clients) {
+      if (ms == c.plan->joinMs) {
+        c.reader = d.ring.attach();
+      } else if (ms == c.plan->leaveMs && c.reader != FanoutRing::NO_READER) {
+        detachClient(d.ring, c);
+      }
+    }
+    if (ms % CAPTURE_MS == 0) {
+      source.record(capture, CAPTURE_SAMPLES, SAMPLE_RATE);
+      size_t taken = 0;
+      while (taken < CAPTURE_SAMPLES) {
+        taken += d.packetizer.append(capture + taken, CAPTURE_SAMPLES - taken);
+        drainPackets(d);
+      }
+    }
+    d.ring.trim(CLIENT_MAX_LAG);
+    for (SimClient& c : clients) {
+      if (c.reader != FanoutRing::NO_READER) {
+        serviceClient(d.ring, c, ms);
+      }
+    }
+  }
+  for (SimClient& c : clients) {
+    if (c.reader != FanoutRing::NO_READER) {
+      detachClient(d.ring, c);
+    }
+  }
+
+  printf("\n%s\n", scenario.name);
+  bool ok = true;
+  for (const SimClient& c : clients) {
+    const PacketLossTracker& rx = c.link.tracker();
+    printf("  %-8s %5.1f s  %5u packets, %6u samples lost, %4u skipped, lag max %2u/%u\n",
+           c.plan->name, (c.plan->leaveMs - c.plan->joinMs) / 1000.0, rx.packetsReceived(),
+           rx.samplesLost(), c.skipped, (unsigned)c.maxLag, (unsigned)RING_SLOTS);
+    if (c.plan->complete && (rx.samplesLost() > 0 || rx.packetsLost() > 0 || c.link.malformed() > 0)) {
+      printf("  FAIL: %s missed audio\n", c.plan->name);
+      ok = false;
+    }
+    // A capture publishes up to two packets before the next trim
+    if (c.maxLag > CLIENT_MAX_LAG + 2) {
+      printf("  FAIL: %s fell further behind than the trim bound\n", c.plan->name);
+      ok = false;
+    }
+  }
+  if (d.droppedPackets > 0) {
+    printf("  FAIL: the device dropped %u packets\n", d.droppedPackets);
+    ok = false;
+  }
+  return ok;
+}
+
+int main() {
+  std::vector<Scenario> scenarios;
+  addScenarios(scenarios);
+  printf("%u-sample captures, %u-byte packets, %u ring slots, clients trimmed beyond %u\n",
+         (unsigned)CAPTURE_SAMPLES, (unsigned)MAX_PACKET_BYTES, (unsigned)RING_SLOTS, (unsigned)CLIENT_MAX_LAG);
+
+  bool ok = true;
+  for (const Scenario& scenario : scenarios) {
+    if (!runScenario(scenario)) {
+      ok = false;
+    }
+  }
+  printf("\n%s\n", ok ? "No client held up another" : "Fan-out regression");
+  return ok ? 0 : 1;
+}
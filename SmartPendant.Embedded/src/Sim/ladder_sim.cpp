@@ -0,0 +1,321 @@
+// Host simulation of the live stream's overflow policy (env:ladder_sim).
+//
+//   pio run -e ladder_sim -t exec                  built-in link traces
+//   .pio/build/ladder_sim/program trace.csv ...    recorded traces
+//
+// A trace is the link throughput over time, one "<ms>,<bytes per second>"
+// line per change; the last line marks the end. Lines starting with # are
+// comments. Each trace is replayed twice through the firmware's packetizer
+// and slot ring: once with today's drop-tail (full PCM, packets dropped when
+// the ring is full) and once with the quality ladder. A receiver tracks what
+// arrives. The run exits non-zero if the ladder loses more audio than
+// drop-tail on any trace.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+#include "../Hal/synthetic_source.h"
+#include "../Dsp/filters.h"
+#include "../Pipeline/quality_ladder.h"
+#include "../Pipeline/pipeline_config.h"
+#include "../Pipeline/slot_ring.h"
+#include "../Protocol/packetizer.h"
+
+// Same shape as the firmware's live path
+static constexpr uint32_t SAMPLE_RATE = 16000;
+static constexpr size_t CAPTURE_SAMPLES = 320;               // 20 ms
+static constexpr uint32_t CAPTURE_MS = CAPTURE_SAMPLES * 1000 / SAMPLE_RATE;
+typedef PipelineConfig<SAMPLE_RATE, 2500, 5, 512, 200, 400> LivePipeline;
+static constexpr size_t MAX_PACKET_BYTES = LivePipeline::MAX_PACKET_BYTES;
+static constexpr size_t RING_SLOTS = LivePipeline::RING_SLOTS;
+static constexpr size_t ATT_OVERHEAD_BYTES = 3;              // per notification
+
+struct TraceStep {
+  uint32_t ms;
+  uint32_t bytesPerSecond;
+};
+
+struct Trace {
+  const char* name;
+  std::vector<TraceStep> steps;  // the last step marks the end
+};
+
+//----------------------------------------------------------------------
+// Traces
+//----------------------------------------------------------------------
+// Full PCM needs ~32.8 KB/s with headers; the built-in traces dip below that
+static void addBuiltInTraces(std::vector<Trace>& traces) {
+  traces.push_back({ "steady", { { 0, 40000 }, { 60000, 0 } } });
+  traces.push_back({ "fade", { { 0, 40000 }, { 10000, 24000 }, { 20000, 12000 }, { 30000, 6000 },
+                               { 40000, 40000 }, { 60000, 0 } } });
+  traces.push_back({ "outage", { { 0, 40000 }, { 15000, 0 }, { 18000, 40000 }, { 30000, 0 },
+                                 { 30500, 40000 }, { 60000, 0 } } });
+  Trace flaky = { "flaky", {} };
+  for (uint32_t ms = 0; ms < 60000; ms += 2000) {
+    flaky.steps.push_back({ ms, (ms / 2000) % 2 == 0 ? 40000u : 14000u });
+  }
+  flaky.steps.push_back({ 60000, 0 });
+  traces.push_back(flaky);
+}
+
+static bool loadTrace(const char* path, Trace& trace) {
+  FILE* f = fopen(path, "r");
+  if (f == nullptr) {
+    return false;
+  }
+  char line[128];
+  while (fgets(line, sizeof(line), f) != nullptr) {
+    unsigned long ms, rate;
+    if (line[0] == '#' || sscanf(line, "%lu,%lu", &ms, &rate) != 2) {
+      continue;
+    }
+    if (!trace.steps.empty() && ms < trace.steps.back().ms) {
+      fclose(f);
+      return false;
+    }
+    trace.steps.push_back({ (uint32_t)ms, (uint32_t)rate });
+  }
+  fclose(f);
+  trace.name = path;
+  return trace.steps.size() >= 2;
+}
+
+static uint32_t rateAt(const Trace& trace, uint32_t ms) {
+  uint32_t rate = 0;
+  for (const TraceStep& step : trace.steps) {
+    if (step.ms > ms) break;
+    rate = step.bytesPerSecond;
+  }
+  return rate;
+}
+
+//----------------------------------------------------------------------
+// Receiver: classifies every sample of the timeline by how it arrived
+//----------------------------------------------------------------------
+enum Arrival {
+  ARRIVED_FULL = 0,
+  ARRIVED_HALF_RATE,
+  ARRIVED_MULAW,
+  ARRIVED_SILENCE,   // a marker stood in for the audio
+  ARRIVED_LOST,      // a gap in the timeline
+  ARRIVAL_COUNT
+};
+
+static const char* const ARRIVAL_NAMES[ARRIVAL_COUNT] = { "full", "half", "mu-law", "silenced", "lost" };
+
+struct Receiver {
+  PacketLossTracker tracker;
+  uint64_t samples[ARRIVAL_COUNT] = {};
+  uint32_t gaps = 0;  // hard gaps, each a cut in the audio
+
+  void receive(const uint8_t* packet, size_t length) {
+    PacketHeader header;
+    if (!packetParseHeader(packet, length, header)) {
+      return;
+    }
+    const uint8_t* payload = packet + PACKET_HEADER_BYTES;
+    size_t count = packetTimelineSamples(header, payload);
+    uint32_t gapSamples;
+    if (!tracker.accept(header, count, gapSamples)) {
+      return;
+    }
+    if (gapSamples > 0) {
+      samples[ARRIVED_LOST] += gapSamples;
+      gaps++;
+    }
+    if (header.format == PACKET_FORMAT_SILENCE) {
+      samples[ARRIVED_SILENCE] += count;
+    } else if (header.format == PACKET_FORMAT_MULAW) {
+      samples[ARRIVED_MULAW] += count;
+    } else if (header.flags & PACKET_FLAG_HALF_RATE) {
+      samples[ARRIVED_HALF_RATE] += count;
+    } else {
+      samples[ARRIVED_FULL] += count;
+    }
+  }
+};
+
+//----------------------------------------------------------------------
+// Device side
+//----------------------------------------------------------------------
+struct Device {
+  AudioPacketizer packetizer;
+  SlotRing ring;
+  QualityLadder ladder;
+  HalfBandDecimator decimator;
+  QualityLevel level = QUALITY_FULL;
+  uint8_t scratch[MAX_PACKET_BYTES];
+  int16_t decimated[CAPTURE_SAMPLES / 2 + 1];
+  uint32_t droppedPackets = 0;
+};
+
+// Like drainPackets() on the device: drop-tail when the ring is full
+static void drainPackets(Device& d) {
+  while (d.packetizer.hasPacket()) {
+    uint8_t* slot = d.ring.reserve();
+    size_t bytes = d.packetizer.nextPacket(slot != nullptr ? slot : d.scratch);
+    if (slot != nullptr) {
+      d.ring.commit(bytes, 0);
+    } else {
+      d.packetizer.packetDropped();
+      d.droppedPackets++;
+    }
+  }
+}
+
+static void packetize(Device& d, const int16_t* samples, size_t count) {
+  size_t taken = 0;
+  while (taken < count) {
+    taken += d.packetizer.append(samples + taken, count - taken);
+    drainPackets(d);
+  }
+}
+
+// Like applyQualityLevel() and packetizeAtLevel() on the device
+static void captureAtLevel(Device& d, QualityLevel level, const int16_t* samples, size_t count) {
+  if (level != d.level) {
+    d.packetizer.flush();
+    drainPackets(d);
+    if (level != QUALITY_SILENCE) {
+      bool halfRate = level >= QUALITY_HALF_RATE;
+      if (halfRate && !d.packetizer.halfRate()) {
+        d.decimator.reset();
+      }
+      d.packetizer.setEncoding(level >= QUALITY_COMPANDED ? PACKET_FORMAT_MULAW : PACKET_FORMAT_PCM16, halfRate);
+    }
+    d.level = level;
+  }
+  if (level == QUALITY_SILENCE) {
+    d.packetizer.appendSilence(count);
+    drainPackets(d);
+  } else if (level != QUALITY_FULL) {
+    size_t halfCount = d.decimator.process(samples, count, d.decimated);
+    packetize(d, d.decimated, halfCount);
+  } else {
+    packetize(d, samples, count);
+  }
+}
+
+struct Result {
+  Receiver receiver;
+  uint32_t droppedPackets = 0;
+  uint32_t stepsDown = 0;
+  uint64_t timelineSamples = 0;
+};
+
+static bool runTrace(const Trace& trace, bool useLadder, Result& result) {
+  static Device d;
+  static uint8_t ringStorage[SlotRing::storageBytes(MAX_PACKET_BYTES, RING_SLOTS)];
+  static int16_t capture[CAPTURE_SAMPLES];
+
+  if (!d.packetizer.begin(PACKET_FORMAT_PCM16, MAX_PACKET_BYTES, true, SAMPLE_RATE) ||
+      !d.ring.begin(ringStorage, MAX_PACKET_BYTES, RING_SLOTS) ||
+      !d.ladder.begin(QualityLadder::Config())) {
+    return false;
+  }
+  d.decimator.reset();
+  d.level = QUALITY_FULL;
+  d.droppedPackets = 0;
+
+  SyntheticSource source;
+  source.begin(SyntheticSource::Config());
+  result = Result();
+  Receiver& receiver = result.receiver;
+  receiver.tracker.reset();
+  uint16_t sequence = 0;
+  double credit = 0;
+
+  uint32_t endMs = trace.steps.back().ms;
+  for (uint32_t ms = 0; ms < endMs; ms++) {
+    if (ms % CAPTURE_MS == 0) {
+      source.record(capture, CAPTURE_SAMPLES, SAMPLE_RATE);
+      QualityLevel level = QUALITY_FULL;
+      if (useLadder) {
+        level = d.ladder.update(d.ring.occupancy(), d.ring.slotCount(), ms);
+      }
+      captureAtLevel(d, level, capture, CAPTURE_SAMPLES);
+      result.timelineSamples += CAPTURE_SAMPLES;
+    }
+
+    // The link takes whole notifications as its throughput allows
+    credit += rateAt(trace, ms) / 1000.0;
+    size_t length;
+    uint32_t tag;
+    uint8_t* packet;
+    while ((packet = d.ring.peek(length, tag)) != nullptr && credit >= length + ATT_OVERHEAD_BYTES) {
+      credit -= length + ATT_OVERHEAD_BYTES;
+      packetSetSequence(packet, sequence++);
+      receiver.receive(packet, length);
+      d.ring.release();
+    }
+    if (d.ring.peek(length, tag) == nullptr && credit > MAX_PACKET_BYTES) {
+      // An idle link does not bank throughput
+      credit = MAX_PACKET_BYTES;
+    }
+  }
+
+  // What is still queued would go out once capture stops
+  d.packetizer.flush();
+  drainPackets(d);
+  size_t length;
+  uint32_t tag;
+  uint8_t* packet;
+  while ((packet = d.ring.peek(length, tag)) != nullptr) {
+    packetSetSequence(packet, sequence++);
+    receiver.receive(packet, length);
+    d.ring.release();
+  }
+  result.droppedPackets = d.droppedPackets;
+  result.stepsDown = d.ladder.stepsDown();
+  return true;
+}
+
+static void printResult(const char* policy, const Result& r) {
+  const Receiver& rx = r.receiver;
+  double total = (double)r.timelineSamples;
+  printf("  %-10s", policy);
+  for (size_t i = 0; i < ARRIVAL_COUNT; i++) {
+    printf("  %s %5.1f%%", ARRIVAL_NAMES[i], rx.samples[i] * 100.0 / total);
+  }
+  printf("  | %u gaps, %u packets dropped, %u steps down\n", rx.gaps, r.droppedPackets, r.stepsDown);
+}
+
+int main(int argc, char** argv) {
+  std::vector<Trace> traces;
+  for (int i = 1; i < argc; i++) {
+    Trace trace;
+    if (!loadTrace(argv[i], trace)) {
+      printf("%s: not a link trace\n", argv[i]);
+      return 2;
+    }
+    traces.push_back(trace);
+  }
+  if (traces.empty()) {
+    addBuiltInTraces(traces);
+  }
+  printf("%u-sample captures, %u-byte packets, %u ring slots\n",
+         (unsigned)CAPTURE_SAMPLES, (unsigned)MAX_PACKET_BYTES, (unsigned)RING_SLOTS);
+
+  bool ok = true;
+  for (const Trace& trace : traces) {
+    Result dropTail;
+    Result ladder;
+    if (!runTrace(trace, false, dropTail) || !runTrace(trace, true, ladder)) {
+      printf("%s: setup failed\n", trace.name);
+      return 2;
+    }
+    printf("\n%s (%.0f s)\n", trace.name, trace.steps.back().ms / 1000.0);
+    printResult("drop-tail", dropTail);
+    printResult("ladder", ladder);
+
+    // Audio that never arrived in any form, and audio replaced by silence
+    uint64_t dropTailMissing = dropTail.receiver.samples[ARRIVED_LOST] + dropTail.receiver.samples[ARRIVED_SILENCE];
+    uint64_t ladderMissing = ladder.receiver.samples[ARRIVED_LOST] + ladder.receiver.samples[ARRIVED_SILENCE];
+    if (ladderMissing > dropTailMissing) {
+      printf("  FAIL: the ladder loses more audio than drop-tail\n");
+      ok = false;
+    }
+  }
+  printf("\n%s\n", ok ? "The ladder never lost more audio than drop-tail" : "Ladder regression");
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,329 @@
+// Host checks of the packet header and the receiver's loss accounting
+// (env:loss_tracker_sim).
+//
+//   pio run -e loss_tracker_sim -t exec
+//
+// First the header: every field through packetWriteHeader() and
+// packetParseHeader(), the byte layout packet.h documents, and the packets
+// the parser must refuse. Then PacketLossTracker on hand-made sequences:
+// the sequence wrap with and without a gap, duplicates, reordering, stream
+// restarts, device drops, backlog packets, segment markers and retransmits.
+// Last, streams over a link that loses, duplicates and reorders packets,
+// starting just before the wrap: every accept() must agree with a reference
+// that unwraps the sequence numbers, and the counters must add up to what
+// was sent. The run exits non-zero if any check fails.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <random>
+#include <vector>
+#include "../Protocol/packet.h"
+
+static bool failed = false;
+
+static void check(bool condition, const char* what) {
+  if (!condition) {
+    printf("  FAIL: %s\n", what);
+    failed = true;
+  }
+}
+
+static PacketHeader makeHeader(uint16_t sequence, uint32_t firstSample, uint8_t flags = 0,
+                               uint8_t format = PACKET_FORMAT_PCM16, uint16_t payloadBytes = 640) {
+  PacketHeader h;
+  h.version = PACKET_VERSION;
+  h.format = format;
+  h.flags = flags;
+  h.sampleRate = PACKET_RATE_16000;
+  h.sequence = sequence;
+  h.payloadBytes = payloadBytes;
+  h.firstSample = firstSample;
+  return h;
+}
+
+//----------------------------------------------------------------------
+// Header
+//----------------------------------------------------------------------
+static bool sameHeader(const PacketHeader& a, const PacketHeader& b) {
+  return a.version == b.version && a.format == b.format && a.flags == b.flags &&
+         a.sampleRate == b.sampleRate && a.sequence == b.sequence &&
+         a.payloadBytes == b.payloadBytes && a.firstSample == b.firstSample;
+}
+
+static void checkHeader() {
+  printf("Header\n");
+  uint8_t packet[PACKET_HEADER_BYTES + 64];
+  PacketHeader parsed;
+
+  // Little-endian, in the documented order
+  PacketHeader h = makeHeader(0xBEEF, 0x12345678, PACKET_FLAG_BACKLOG | PACKET_FLAG_HALF_RATE,
+                              PACKET_FORMAT_MULAW, 64);
+  h.sampleRate = PACKET_RATE_24000;
+  packetWriteHeader(h, packet);
+  const uint8_t expected[PACKET_HEADER_BYTES] = {
+    PACKET_VERSION, PACKET_FORMAT_MULAW, PACKET_FLAG_BACKLOG | PACKET_FLAG_HALF_RATE, PACKET_RATE_24000,
+    0xEF, 0xBE, 64, 0, 0x78, 0x56, 0x34, 0x12,
+  };
+  check(memcmp(packet, expected, PACKET_HEADER_BYTES) == 0, "byte layout");
+  check(packetParseHeader(packet, PACKET_HEADER_BYTES + 64, parsed) && sameHeader(h, parsed),
+        "parses what it wrote");
+
+  // Every field at its extremes
+  std::mt19937 random(3);
+  for (int i = 0; i < 10000; i++) {
+    h.format = (uint8_t)random();
+    h.flags = (uint8_t)random();
+    h.sampleRate = (uint8_t)random();
+    h.sequence = (uint16_t)(i < 2 ? i * 0xFFFF : random());
+    h.payloadBytes = (uint16_t)(random() % 65);
+    h.firstSample = i < 2 ? (uint32_t)i * 0xFFFFFFFFu : (uint32_t)random();
+    packetWriteHeader(h, packet);
+    if (!packetParseHeader(packet, PACKET_HEADER_BYTES + h.payloadBytes, parsed) || !sameHeader(h, parsed)) {
+      check(false, "random headers round trip");
+      break;
+    }
+  }
+
+  h = makeHeader(7, 0, 0, PACKET_FORMAT_PCM16, 64);
+  packetWriteHeader(h, packet);
+  check(!packetParseHeader(packet, PACKET_HEADER_BYTES - 1, parsed), "accepts a truncated header");
+  check(!packetParseHeader(packet, PACKET_HEADER_BYTES + 63, parsed), "accepts a short payload");
+  check(!packetParseHeader(packet, PACKET_HEADER_BYTES + 65, parsed), "accepts trailing bytes");
+  packet[0] = PACKET_VERSION + 1;
+  check(!packetParseHeader(packet, PACKET_HEADER_BYTES + 64, parsed), "accepts an unknown version");
+  packet[0] = PACKET_VERSION;
+
+  packetSetSequence(packet, 0xA55A);
+  check(packetParseHeader(packet, PACKET_HEADER_BYTES + 64, parsed) && parsed.sequence == 0xA55A &&
+        parsed.payloadBytes == 64, "packetSetSequence touches the sequence only");
+
+  size_t length = packetWriteSegment(packet, 0xCAFEF00D, PACKET_FLAG_BACKLOG);
+  check(length == PACKET_HEADER_BYTES + SEGMENT_PAYLOAD_BYTES && packetParseHeader(packet, length, parsed) &&
+        parsed.format == PACKET_FORMAT_SEGMENT && parsed.flags == PACKET_FLAG_BACKLOG &&
+        packet[PACKET_HEADER_BYTES] == 0x0D && packet[PACKET_HEADER_BYTES + 3] == 0xCA, "segment marker");
+
+  uint8_t code = 0xFF;
+  check(packetSampleRateCode(12000, code) && packetSampleRateHz(code) == 12000, "sample rate codes");
+  check(!packetSampleRateCode(44100, code) && packetSampleRateHz(PACKET_RATE_24000 + 1) == 0,
+        "refuses rates the header cannot carry");
+}
+
+//----------------------------------------------------------------------
+// PacketLossTracker, by hand
+//----------------------------------------------------------------------
+static constexpr size_t PACKET_SAMPLES = 320;
+
+// Feeds a live packet covering PACKET_SAMPLES; returns accept()
+static bool feed(PacketLossTracker& t, uint16_t sequence, uint32_t firstSample, uint32_t& gap, uint8_t flags = 0) {
+  return t.accept(makeHeader(sequence, firstSample, flags), PACKET_SAMPLES, gap);
+}
+
+static void checkTracker() {
+  printf("PacketLossTracker\n");
+  PacketLossTracker t;
+  uint32_t gap;
+
+  // In order across the wrap
+  bool ok = true;
+  for (uint32_t i = 0; i < 6; i++) {
+    ok = feed(t, (uint16_t)(65533 + i), i * PACKET_SAMPLES, gap) && gap == 0 && ok;
+  }
+  check(ok && t.packetsReceived() == 6 && t.packetsLost() == 0 && t.samplesLost() == 0,
+        "no loss across the sequence wrap");
+
+  // A gap across the wrap: 65534 then 2 loses 65535, 0 and 1
+  t.reset();
+  feed(t, 65534, 0, gap);
+  ok = feed(t, 2, 4 * PACKET_SAMPLES, gap);
+  check(ok && t.packetsLost() == 3 && gap == 3 * PACKET_SAMPLES && t.samplesLost() == 3 * PACKET_SAMPLES,
+        "gap across the sequence wrap");
+
+  // Duplicates are discarded and change nothing else
+  t.reset();
+  feed(t, 10, 0, gap);
+  feed(t, 11, PACKET_SAMPLES, gap);
+  ok = !feed(t, 11, PACKET_SAMPLES, gap) && gap == 0;
+  ok = !feed(t, 10, 0, gap) && ok;
+  check(ok && t.packetsDiscarded() == 2 && t.packetsReceived() == 2 && t.packetsLost() == 0,
+        "duplicates discarded");
+  check(feed(t, 12, 2 * PACKET_SAMPLES, gap) && gap == 0, "the stream goes on after duplicates");
+
+  // Reordered: 20, 22, 21. 21 was counted lost when 22 arrived and its
+  // silence is already in the timeline, so it is too late
+  t.reset();
+  feed(t, 20, 0, gap);
+  ok = feed(t, 22, 2 * PACKET_SAMPLES, gap) && gap == PACKET_SAMPLES;
+  ok = !feed(t, 21, PACKET_SAMPLES, gap) && gap == 0 && ok;
+  check(ok && t.packetsLost() == 1 && t.packetsDiscarded() == 1 && t.packetsReceived() == 2,
+        "a reordered packet is counted lost, then discarded");
+  // ... also across the wrap
+  t.reset();
+  feed(t, 65535, 0, gap);
+  feed(t, 1, 2 * PACKET_SAMPLES, gap);
+  check(!feed(t, 0, PACKET_SAMPLES, gap) && t.packetsLost() == 1 && t.packetsDiscarded() == 1,
+        "a reordered packet across the wrap");
+
+  // The device dropped audio: samples jump, sequence numbers do not
+  t.reset();
+  feed(t, 5, 0, gap);
+  ok = feed(t, 6, 3 * PACKET_SAMPLES, gap, PACKET_FLAG_DISCONTINUITY) && gap == 2 * PACKET_SAMPLES;
+  check(ok && t.packetsLost() == 0 && t.deviceDrops() == 1 && t.samplesLost() == 2 * PACKET_SAMPLES,
+        "device drops fill the timeline without sequence loss");
+
+  // A late packet whose sequence number looks new but whose samples are old
+  check(!feed(t, 7, PACKET_SAMPLES, gap), "accepts samples from the past");
+
+  // A new stream starts over, whatever came before
+  ok = feed(t, 900, 0, gap, PACKET_FLAG_STREAM_START) && gap == 0;
+  check(ok && t.packetsLost() == 0, "stream start restarts sequence and samples");
+
+  // Backlog packets and markers count towards sequence loss only
+  t.reset();
+  feed(t, 30, 1000, gap);
+  PacketHeader marker = makeHeader(31, 0, PACKET_FLAG_BACKLOG, PACKET_FORMAT_SEGMENT, SEGMENT_PAYLOAD_BYTES);
+  ok = t.accept(marker, 0, gap) && gap == 0;
+  ok = t.accept(makeHeader(33, 50, PACKET_FLAG_BACKLOG), PACKET_SAMPLES, gap) && gap == 0 && ok;
+  ok = feed(t, 34, 1000 + PACKET_SAMPLES, gap) && gap == 0 && ok;
+  check(ok && t.backlogPackets() == 2 && t.packetsLost() == 1 && t.samplesLost() == 0,
+        "backlog and markers leave the live timeline alone");
+
+  // Retransmits are left to the caller and leave the counters alone
+  uint32_t lost = t.packetsLost();
+  ok = !t.accept(makeHeader(32, 2000, PACKET_FLAG_RETRANSMIT), PACKET_SAMPLES, gap) && gap == 0;
+  check(ok && t.retransmitted() == 1 && t.packetsLost() == lost && t.packetsDiscarded() == 0,
+        "retransmits counted apart");
+  check(feed(t, 35, 1000 + 2 * PACKET_SAMPLES, gap) && gap == 0, "the stream goes on after a retransmit");
+}
+
+//----------------------------------------------------------------------
+// Lossy, duplicating, reordering link
+//----------------------------------------------------------------------
+struct LinkPlan {
+  const char* name;
+  double lossRate;
+  double duplicateRate;
+  double reorderRate;     // a packet is held back behind up to reorderDepth later ones
+  int reorderDepth;
+  double deviceDropRate;  // the device skips a capture before the packet
+};
+
+static const LinkPlan PLANS[] = {
+  { "Clean link", 0.0, 0.0, 0.0, 0, 0.0 },
+  { "5% loss", 0.05, 0.0, 0.0, 0, 0.0 },
+  { "Duplicates", 0.0, 0.05, 0.0, 0, 0.0 },
+  { "Reordering", 0.0, 0.0, 0.05, 4, 0.0 },
+  { "Everything, with device drops", 0.10, 0.05, 0.05, 8, 0.02 },
+  { "30% loss, deep reordering", 0.30, 0.02, 0.10, 40, 0.0 },
+};
+
+static constexpr uint32_t STREAM_PACKETS = 200000;
+static constexpr uint16_t FIRST_SEQUENCE = 65000;
+
+struct Sent {
+  uint32_t index;         // unwrapped sequence number
+  uint32_t firstSample;
+  bool discontinuity;
+};
+
+static bool runLink(const LinkPlan& plan, uint32_t seed) {
+  std::mt19937 random(seed);
+  std::uniform_real_distribution<double> chance(0.0, 1.0);
+
+  // The link's output, in arrival order
+  std::vector<Sent> arrivals;
+  std::vector<Sent> held;
+  uint32_t sample = 0;
+  for (uint32_t i = 0; i < STREAM_PACKETS; i++) {
+    bool drop = i > 0 && chance(random) < plan.deviceDropRate;
+    if (drop) {
+      sample += PACKET_SAMPLES * (1 + random() % 4);
+    }
+    Sent p = { i, sample, drop };
+    sample += PACKET_SAMPLES;
+    // The first packet always arrives so every sequence number is defined
+    // relative to it
+    bool lost = i > 0 && chance(random) < plan.lossRate;
+    if (!lost) {
+      if (i > 0 && plan.reorderDepth > 0 && chance(random) < plan.reorderRate) {
+        held.push_back(p);
+      } else {
+        arrivals.push_back(p);
+        if (chance(random) < plan.duplicateRate) {
+          arrivals.push_back(p);
+        }
+      }
+    }
+    // Held packets come out behind up to reorderDepth newer ones
+    for (size_t h = 0; h < held.size();) {
+      if (i - held[h].index >= (uint32_t)plan.reorderDepth || chance(random) < 0.3) {
+        arrivals.push_back(held[h]);
+        held.erase(held.begin() + h);
+      } else {
+        h++;
+      }
+    }
+  }
+  for (const Sent& p : held) {
+    arrivals.push_back(p);
+  }
+
+  // Reference: a packet is new if its unwrapped number is past the newest
+  // accepted one, and fills the samples from the end of that one
+  PacketLossTracker t;
+  uint32_t newest = 0;
+  uint32_t nextSample = 0;
+  bool started = false;
+  uint32_t mismatches = 0;
+  uint32_t accepted = 0;
+  uint32_t discarded = 0;
+  uint64_t timeline = 0;
+  uint32_t drops = 0;
+  for (const Sent& p : arrivals) {
+    uint8_t flags = p.discontinuity ? PACKET_FLAG_DISCONTINUITY : 0;
+    uint32_t gap;
+    bool got = feed(t, (uint16_t)(FIRST_SEQUENCE + p.index), p.firstSample, gap, flags);
+    bool expect = !started || p.index > newest;
+    uint32_t expectGap = started && expect ? p.firstSample - nextSample : 0;
+    if (got != expect || gap != expectGap) {
+      mismatches++;
+    }
+    if (expect) {
+      started = true;
+      newest = p.index;
+      nextSample = p.firstSample + PACKET_SAMPLES;
+      accepted++;
+      timeline += expectGap + PACKET_SAMPLES;
+      drops += p.discontinuity;
+    } else {
+      discarded++;
+    }
+  }
+
+  printf("\n%s\n", plan.name);
+  printf("  %u sent, %zu arrived: %u received, %u lost, %u discarded, %u device drops, %.2f s of silence\n",
+         STREAM_PACKETS, arrivals.size(), t.packetsReceived(), t.packetsLost(), t.packetsDiscarded(),
+         t.deviceDrops(), t.samplesLost() / 16000.0);
+  bool ok = mismatches == 0;
+  check(ok, "accept() disagrees with the reference");
+  // Every sequence number up to the newest is either received or lost
+  bool counts = t.packetsReceived() == accepted && t.packetsDiscarded() == discarded &&
+                t.packetsReceived() + t.packetsLost() == newest + 1 && t.deviceDrops() == drops;
+  check(counts, "counters do not add up");
+  // The timeline the receiver rebuilds is as long as the audio sent up to
+  // the newest packet
+  bool samples = timeline == (uint64_t)nextSample && t.samplesLost() == timeline - (uint64_t)accepted * PACKET_SAMPLES;
+  check(samples, "timeline has the wrong length");
+  return ok && counts && samples;
+}
+
+int main() {
+  checkHeader();
+  checkTracker();
+  bool ok = !failed;
+  uint32_t seed = 1;
+  for (const LinkPlan& plan : PLANS) {
+    ok = runLink(plan, seed++) && ok;
+  }
+  printf("\n%s\n", ok ? "Every packet accounted for" : "Loss accounting regression");
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,253 @@
+// Host simulation of notification pacing over a modelled BLE link
+// (env:pacer_sim).
+//
+//   pio run -e pacer_sim -t exec
+//
+// A NotifyPacer, configured as the firmware configures it, paces a sender
+// that behaves like sendTask: it wakes on new audio, on completions and
+// every PACER_POLL_MS, and sends while credits() allows. The link drains
+// the controller's queue a few packets per connection event and reports
+// each packet sent with a completion, which it may lose or fail; it may
+// also stall for a while, report congestion, or leave the controller's free
+// buffers unreported. Every credits() call is checked against AIMD: one
+// step up after a full window, halving on trouble, nothing else. Each link
+// also has to meet its own expectations: the window reaches its ceiling on
+// a clean link, lost completions time out instead of blocking the sender
+// for longer than the timeout, and the live stream keeps up within its
+// latency bound. The run exits non-zero if any check fails.
+#include <stdio.h>
+#include <algorithm>
+#include <deque>
+#include "../Pipeline/pacer.h"
+
+// As the firmware sets it up
+static constexpr uint8_t PACER_INITIAL_WINDOW = 4;
+static constexpr uint8_t PACER_MAX_WINDOW = 12;
+static constexpr uint32_t PACER_COMPLETION_TIMEOUT_MS = 100;
+static constexpr uint32_t PACER_POLL_MS = 5;
+static constexpr size_t PACKET_BYTES = 509;
+// 16 kHz PCM in 497-byte payloads
+static constexpr double LIVE_PACKETS_PER_SECOND = 32000.0 / 497;
+static constexpr uint32_t RUN_MS = 60000;
+
+static uint32_t lcg(uint32_t& seed) {
+  seed = seed * 1664525 + 1013904223;
+  return seed >> 8;
+}
+
+static bool chance(uint32_t& seed, double p) {
+  return (lcg(seed) & 0xFFFFFF) < p * 0x1000000;
+}
+
+struct LinkPlan {
+  const char* name;
+  uint32_t intervalUs;        // connection interval
+  uint32_t perEvent;          // packets the link carries per connection event
+  uint32_t controllerSlots;   // packets the controller queues
+  bool reportsCredits;        // esp_ble_get_cur_sendable_packets_num() is known
+  bool congestion;            // the stack reports congestion near a full queue
+  double completionLoss;      // completions that never arrive
+  double completionFailure;   // completions with an error status
+  uint32_t stallEveryMs;      // the link carries nothing for stallMs every stallEveryMs
+  uint32_t stallMs;
+  bool saturate;              // unlimited audio instead of the live stream
+  // Expectations
+  bool reachesMaxWindow;
+  bool expectsTimeouts;
+  double minThroughput;       // of the link's capacity when saturated, of the stream otherwise
+  uint32_t maxLatencyMs;      // live stream only: oldest packet waiting, outside stalls
+};
+
+static const LinkPlan PLANS[] = {
+  { "Clean link, saturated", 15000, 6, 10, true, false, 0, 0, 0, 0, true, true, false, 0.95, 0 },
+  { "Clean link, live stream", 7500, 4, 10, true, false, 0, 0, 0, 0, false, false, false, 1.0, 30 },
+  { "Congestion, no controller credits", 15000, 6, 8, false, true, 0, 0, 0, 0, true, false, false, 0.8, 0 },
+  { "Small controller queue, nothing reported", 15000, 6, 6, false, false, 0, 0, 0, 0, true, false, false, 0.8, 0 },
+  { "20% of completions lost", 15000, 6, 10, true, false, 0.2, 0, 0, 0, false, false, true, 1.0, 250 },
+  { "5% of completions fail", 15000, 6, 10, true, false, 0, 0.05, 0, 0, false, false, false, 1.0, 60 },
+  { "Link stalls 500 ms every 5 s", 15000, 6, 10, true, false, 0, 0, 5000, 500, false, false, true, 1.0, 80 },
+  { "Slow link near the stream rate", 45000, 3, 10, true, false, 0, 0, 0, 0, false, false, false, 1.0, 120 },
+};
+
+struct SimStats {
+  uint32_t sent = 0;
+  uint32_t refused = 0;
+  uint32_t delivered = 0;
+  uint32_t produced = 0;
+  uint32_t aimdViolations = 0;
+  uint32_t maxIdleMs = 0;     // audio waiting, link able to take it, nothing sent
+  uint32_t maxLatencyMs = 0;  // outside stalls and the recovery after them
+  uint8_t maxWindow = 0;
+};
+
+static bool stalledAt(const LinkPlan& plan, uint32_t ms) {
+  // Mid-period, so the run does not end in a stall
+  return plan.stallEveryMs > 0 && (ms + plan.stallEveryMs / 2) % plan.stallEveryMs < plan.stallMs;
+}
+
+// Calls credits() and checks the window moved the way AIMD allows
+static size_t checkedCredits(NotifyPacer& pacer, uint32_t now, uint16_t controllerCredits, SimStats& stats) {
+  uint8_t window = pacer.window();
+  uint32_t backoffs = pacer.backoffs();
+  uint32_t increases = pacer.increases();
+  size_t credits = pacer.credits(now, controllerCredits);
+  uint8_t expected = window;
+  if (pacer.backoffs() != backoffs) {
+    expected = window / 2 > 0 ? window / 2 : 1;
+  } else if (pacer.increases() != increases) {
+    expected = window + 1;
+  }
+  bool ok = pacer.window() == expected && pacer.window() <= PACER_MAX_WINDOW &&
+            pacer.backoffs() - backoffs <= 1 && pacer.increases() - increases <= 1 &&
+            credits <= (size_t)(pacer.window() > pacer.inFlight() ? pacer.window() - pacer.inFlight() : 0);
+  stats.aimdViolations += !ok;
+  return credits;
+}
+
+static bool runLink(const LinkPlan& plan) {
+  NotifyPacer pacer;
+  pacer.begin(PACER_INITIAL_WINDOW, PACER_MAX_WINDOW, PACER_COMPLETION_TIMEOUT_MS);
+  SimStats stats;
+  uint32_t seed = 17;
+
+  std::deque<uint32_t> audio;       // capture time of each packet waiting to be sent
+  uint32_t queued = 0;              // in the controller
+  bool congested = false;
+  uint32_t nextEventUs = plan.intervalUs;
+  uint32_t nextPollMs = 0;
+  double production = 0;
+  uint32_t blockedSince = 0;
+  uint32_t lastSendMs = 0;
+  uint32_t lastStallEndMs = 0;
+
+  for (uint32_t now = 0; now < RUN_MS; now++) {
+    bool wake = now >= nextPollMs;
+
+    // Connection events in this millisecond
+    bool stalled = stalledAt(plan, now);
+    if (stalled) {
+      lastStallEndMs = now + 1;
+    }
+    while (nextEventUs < (now + 1) * 1000) {
+      nextEventUs += plan.intervalUs;
+      if (stalled) {
+        continue;
+      }
+      uint32_t n = std::min(queued, plan.perEvent);
+      queued -= n;
+      stats.delivered += n;
+      for (uint32_t i = 0; i < n; i++) {
+        if (!chance(seed, plan.completionLoss)) {
+          pacer.onComplete(!chance(seed, plan.completionFailure));
+          wake = true;
+        }
+      }
+    }
+    if (plan.congestion) {
+      if (!congested && queued + 1 >= plan.controllerSlots) {
+        congested = true;
+        pacer.onCongestion(true);
+      } else if (congested && queued <= plan.controllerSlots / 2) {
+        congested = false;
+        pacer.onCongestion(false);
+        wake = true;
+      }
+    }
+
+    // recordTask hands over a capture's packets and wakes the sender
+    if (plan.saturate) {
+      while (audio.size() < 64) {
+        audio.push_back(now);
+        stats.produced++;
+      }
+    } else {
+      production += LIVE_PACKETS_PER_SECOND / 1000;
+      if (now % 20 == 0 && production >= 1) {
+        for (; production >= 1; production -= 1) {
+          audio.push_back(now);
+          stats.produced++;
+        }
+        wake = true;
+      }
+    }
+
+    // sendTask
+    if (wake) {
+      nextPollMs = now + PACER_POLL_MS;
+      uint16_t controllerCredits = plan.reportsCredits ? (uint16_t)(plan.controllerSlots - queued)
+                                                       : NotifyPacer::UNKNOWN_CONTROLLER_CREDITS;
+      while (!audio.empty() && checkedCredits(pacer, now, controllerCredits, stats) > 0) {
+        if (queued >= plan.controllerSlots) {
+          // The stack refuses the notification; the packet stays queued
+          pacer.onSendFailed();
+          stats.refused++;
+          break;
+        }
+        queued++;
+        pacer.onSent(PACKET_BYTES, now);
+        stats.sent++;
+        lastSendMs = now;
+        if (!stalled && now >= lastStallEndMs + 1000) {
+          stats.maxLatencyMs = std::max(stats.maxLatencyMs, now - audio.front());
+        }
+        audio.pop_front();
+        if (controllerCredits != NotifyPacer::UNKNOWN_CONTROLLER_CREDITS) {
+          controllerCredits--;
+        }
+      }
+    }
+    stats.maxWindow = std::max(stats.maxWindow, pacer.window());
+
+    // Audio waiting and room in the controller, but nothing went out
+    bool blocked = !audio.empty() && queued < plan.controllerSlots && !stalled && !congested;
+    if (!blocked) {
+      blockedSince = now + 1;
+    } else {
+      stats.maxIdleMs = std::max(stats.maxIdleMs, now - std::max(blockedSince, lastSendMs));
+    }
+  }
+
+  double seconds = RUN_MS / 1000.0;
+  double capacity = plan.perEvent * 1e6 / plan.intervalUs;
+  double rate = stats.delivered / seconds;
+  double target = plan.saturate ? capacity : LIVE_PACKETS_PER_SECOND;
+  uint32_t idleLimit = PACER_COMPLETION_TIMEOUT_MS + PACER_POLL_MS + plan.intervalUs / 1000 + 1;
+
+  bool aimdOk = stats.aimdViolations == 0 && pacer.maxInFlight() <= PACER_MAX_WINDOW;
+  bool windowOk = !plan.reachesMaxWindow || (stats.maxWindow == PACER_MAX_WINDOW && pacer.backoffs() == 0);
+  bool timeoutOk = (pacer.timeouts() > 0) == plan.expectsTimeouts && stats.maxIdleMs <= idleLimit;
+  bool refusedOk = !plan.reportsCredits ? stats.refused <= pacer.backoffs() : stats.refused == 0;
+  bool rateOk = rate >= plan.minThroughput * target * 0.99 &&
+                (plan.saturate || stats.produced - stats.delivered <= PACER_MAX_WINDOW + 16);
+  bool latencyOk = plan.saturate || stats.maxLatencyMs <= plan.maxLatencyMs;
+
+  printf("\n%s\n", plan.name);
+  printf("  %.0f packets/s of %.0f the link carries (%s %.0f), %u produced, %u refused\n", rate, capacity,
+         plan.saturate ? "saturated" : "stream", target, stats.produced, stats.refused);
+  printf("  window %u..%u, %u increases, %u backoffs, %u congestion events, %u failures, %u timeouts, "
+         "%u in flight at most\n", PACER_INITIAL_WINDOW, stats.maxWindow, pacer.increases(), pacer.backoffs(),
+         pacer.congestionEvents(), pacer.failures(), pacer.timeouts(), pacer.maxInFlight());
+  printf("  sender idle with audio waiting %u ms at most (limit %u)", stats.maxIdleMs, idleLimit);
+  if (!plan.saturate) {
+    printf(", latency %u ms at most (limit %u)", stats.maxLatencyMs, plan.maxLatencyMs);
+  }
+  printf("\n");
+  if (!aimdOk) printf("  FAIL: %u credits() calls broke AIMD\n", stats.aimdViolations);
+  if (!windowOk) printf("  FAIL: the window did not grow to %u on a clean link\n", PACER_MAX_WINDOW);
+  if (!timeoutOk) printf("  FAIL: completion timeouts %s\n", plan.expectsTimeouts ? "missing or too slow" : "on a link that completes");
+  if (!refusedOk) printf("  FAIL: the stack refused more sends than the pacer backed off for\n");
+  if (!rateOk) printf("  FAIL: throughput below %.0f%%\n", plan.minThroughput * 100);
+  if (!latencyOk) printf("  FAIL: latency above %u ms\n", plan.maxLatencyMs);
+  return aimdOk && windowOk && timeoutOk && refusedOk && rateOk && latencyOk;
+}
+
+int main() {
+  printf("NotifyPacer: window %u..%u, completion timeout %u ms, polled every %u ms\n", PACER_INITIAL_WINDOW,
+         PACER_MAX_WINDOW, PACER_COMPLETION_TIMEOUT_MS, PACER_POLL_MS);
+  bool ok = true;
+  for (const LinkPlan& plan : PLANS) {
+    ok = runLink(plan) && ok;
+  }
+  printf("\n%s\n", ok ? "Pacer within spec" : "Pacer regression");
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,361 @@
+// Host checks of PacketLog's recovery after power loss (env:power_cut_sim).
+//
+//   pio run -e power_cut_sim -t exec
+//
+// A small log takes records of random length, laps its storage several
+// times and is drained now and then, saving the first undelivered serial
+// the way FlashLogStorage's mark does. The run is repeated with the power
+// cut after every byte written: the interrupted write lands in part, the
+// rest of it either keeps the old bytes (RAM, NOR flash programming in
+// order) or turns to noise (a page half programmed). A fresh PacketLog then
+// recover()s from what is left, and draining it must give
+//   - every record appended before the cut, not since overwritten and not
+//     delivered before the last mark
+//   - nothing else but undelivered records and the one being written,
+//     each once, in serial order, intact
+// and take new records after them. Then a long run without power cuts
+// checks wraparound against a reference queue, with recover() rebuilding
+// the same positions at every step, and a drain of a full log is timed.
+// The run exits non-zero if any check fails.
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+#include <deque>
+#include <vector>
+#include "../Storage/packet_log.h"
+
+static constexpr size_t LOG_BYTES = 2048;
+static constexpr size_t MAX_DATA_BYTES = 300;
+static constexpr uint32_t SCENARIO_RECORDS = 60;
+
+typedef std::chrono::steady_clock Clock;
+
+static bool failed = false;
+
+static void check(bool condition, const char* what) {
+  if (!condition) {
+    printf("  FAIL: %s\n", what);
+    failed = true;
+  }
+}
+
+static uint32_t lcg(uint32_t& seed) {
+  seed = seed * 1664525 + 1013904223;
+  return seed >> 8;
+}
+
+// Record contents follow from the serial, so a record read back names itself
+static size_t recordLength(uint32_t serial) {
+  uint32_t seed = serial * 2654435761u + 1;
+  return 1 + lcg(seed) % MAX_DATA_BYTES;
+}
+
+static void fillRecord(uint32_t serial, uint8_t* data, size_t length) {
+  uint32_t seed = serial ^ 0x9E3779B9u;
+  for (size_t i = 0; i < length; i++) {
+    data[i] = (uint8_t)lcg(seed);
+  }
+}
+
+static uint32_t recordTag(uint32_t serial) {
+  return serial * 7 + 3;
+}
+
+// Memory whose power goes after a number of bytes written
+class PowerCutStorage : public LogStorage {
+public:
+  PowerCutStorage(uint8_t* memory, size_t bytes) : _memory(memory), _bytes(bytes) {}
+
+  // Power fails once budget more bytes are written; garbage fills the rest
+  // of the interrupted write with noise instead of leaving it untouched
+  void cutAfter(size_t budget, bool garbage) {
+    _budget = budget;
+    _garbage = garbage;
+    _armed = true;
+  }
+  bool powered() const { return !_armed || _budget > 0; }
+  size_t written() const { return _written; }
+
+  size_t capacity() const override { return _bytes; }
+
+  bool read(size_t offset, void* data, size_t bytes) override {
+    if (offset + bytes > _bytes) return false;
+    memcpy(data, _memory + offset, bytes);
+    return true;
+  }
+
+  bool write(size_t offset, const void* data, size_t bytes) override {
+    if (offset + bytes > _bytes || !powered()) return false;
+    size_t n = bytes;
+    if (_armed && n > _budget) n = _budget;
+    memcpy(_memory + offset, data, n);
+    _written += n;
+    if (_armed) {
+      _budget -= n;
+    }
+    if (n < bytes) {
+      if (_garbage) {
+        uint32_t seed = (uint32_t)(offset + n);
+        for (size_t i = n; i < bytes; i++) _memory[offset + i] = (uint8_t)lcg(seed);
+      }
+      return false;
+    }
+    return true;
+  }
+
+private:
+  uint8_t* _memory;
+  size_t _bytes;
+  size_t _budget = 0;
+  size_t _written = 0;
+  bool _garbage = false;
+  bool _armed = false;
+};
+
+//----------------------------------------------------------------------
+// Power cuts
+//----------------------------------------------------------------------
+// What the log held around one append, from the run without a cut
+struct AppendState {
+  uint32_t serial;
+  uint32_t oldestAfter;  // oldest record still held once the append is done
+  uint32_t mark;         // first serial not delivered, as last saved
+};
+
+// Runs the scenario seed picks until the storage loses power. Returns the
+// serial being appended when it did, or SCENARIO_RECORDS if it never did;
+// mark is the last one saved.
+static uint32_t runScenario(PowerCutStorage& storage, uint32_t seed, std::vector<AppendState>* states,
+                            uint32_t& mark) {
+  PacketLog log;
+  log.begin(&storage);
+  uint8_t data[MAX_DATA_BYTES];
+  mark = 0;
+  for (uint32_t serial = 0; serial < SCENARIO_RECORDS; serial++) {
+    size_t length = recordLength(serial);
+    fillRecord(serial, data, length);
+    if (!log.append(data, length, recordTag(serial))) {
+      return serial;
+    }
+    if (states != nullptr) {
+      states->push_back({ serial, log.oldestSerial(), mark });
+    }
+    // The receiver takes a few records now and then; the mark lags behind
+    if (lcg(seed) % 4 == 0) {
+      for (uint32_t n = lcg(seed) % 4; n > 0 && !log.empty(); n--) {
+        log.pop();
+      }
+      if (lcg(seed) % 2 == 0) {
+        mark = log.oldestSerial();
+      }
+    }
+  }
+  return SCENARIO_RECORDS;
+}
+
+// Drains a recovered log; false if a record is out of order, duplicated,
+// corrupted or outside [lowest, highest]. Serials taken are added to got.
+static bool drain(PacketLog& log, uint32_t lowest, uint32_t highest, std::vector<uint32_t>& got) {
+  uint8_t data[PACKET_LOG_MAX_RECORD_BYTES];
+  uint8_t expected[MAX_DATA_BYTES];
+  while (!log.empty()) {
+    uint32_t tag;
+    size_t length = log.peek(data, sizeof(data), tag);
+    if (length == 0) {
+      // peek() dropped what was left as unreadable
+      break;
+    }
+    uint32_t serial = (tag - 3) / 7;
+    if (tag != recordTag(serial) || serial < lowest || serial > highest ||
+        (!got.empty() && serial <= got.back()) || length != recordLength(serial)) {
+      return false;
+    }
+    fillRecord(serial, expected, length);
+    if (memcmp(data, expected, length) != 0) {
+      return false;
+    }
+    got.push_back(serial);
+    log.pop();
+  }
+  return true;
+}
+
+static bool checkPowerCuts(uint32_t seed, bool garbage) {
+  static uint8_t memory[LOG_BYTES];
+  std::vector<AppendState> states;
+  uint32_t mark;
+  memset(memory, 0, sizeof(memory));
+  PowerCutStorage full(memory, sizeof(memory));
+  runScenario(full, seed, &states, mark);
+  size_t totalBytes = full.written();
+
+  size_t failures = 0;
+  size_t lostRecords = 0;
+  size_t replayed = 0;
+  size_t tornKept = 0;
+  for (size_t cut = 0; cut <= totalBytes; cut++) {
+    memset(memory, 0, sizeof(memory));
+    PowerCutStorage storage(memory, sizeof(memory));
+    storage.cutAfter(cut, garbage);
+    uint32_t torn = runScenario(storage, seed, nullptr, mark);
+
+    // Required: what the log would still hold had the torn append gone
+    // through, less what was delivered. Allowed on top: older undelivered
+    // records not overwritten yet, and the torn one.
+    uint32_t required = states[torn < SCENARIO_RECORDS ? torn : SCENARIO_RECORDS - 1].oldestAfter;
+    if (required < mark) required = mark;
+    uint32_t highest = torn < SCENARIO_RECORDS ? torn : SCENARIO_RECORDS - 1;
+
+    PowerCutStorage after(memory, sizeof(memory));
+    PacketLog log;
+    log.begin(&after);
+    std::vector<uint32_t> got;
+    bool ok = log.recover(mark) && drain(log, mark, highest, got);
+    size_t missing = 0;
+    for (uint32_t serial = required; serial < torn; serial++) {
+      missing += !std::binary_search(got.begin(), got.end(), serial);
+    }
+    // The log goes on after the recovered records
+    uint32_t next = log.nextSerial();
+    uint8_t data[8] = { 1, 2, 3, 4, 5, 6, 7, 8 };
+    uint32_t tag;
+    uint8_t back[8];
+    ok = ok && (got.empty() || next > got.back()) && log.append(data, sizeof(data), 99) &&
+         log.peek(back, sizeof(back), tag) == sizeof(data) && tag == 99 && log.oldestSerial() == next;
+
+    if (!ok || missing > 0) {
+      if (failures < 5) {
+        printf("  cut after %u bytes (record %u, mark %u): %u records back, %u missing%s\n", (unsigned)cut,
+               (unsigned)torn, (unsigned)mark, (unsigned)got.size(), (unsigned)missing,
+               ok ? "" : ", wrong or duplicated record");
+      }
+      failures++;
+    }
+    lostRecords += missing;
+    for (uint32_t serial : got) {
+      replayed += serial < required;
+      tornKept += serial == torn;
+    }
+  }
+
+  printf("  seed %u, torn writes %s: %u cut points, %u failed, %u records lost, "
+         "%u popped since the mark replayed, torn record kept %u times\n",
+         (unsigned)seed, garbage ? "leave noise" : "keep old bytes", (unsigned)(totalBytes + 1),
+         (unsigned)failures, (unsigned)lostRecords, (unsigned)replayed, (unsigned)tornKept);
+  check(failures == 0, "a power cut lost, duplicated or corrupted a record");
+  return failures == 0;
+}
+
+//----------------------------------------------------------------------
+// Wraparound against a reference
+//----------------------------------------------------------------------
+static void checkWraparound() {
+  static uint8_t memory[LOG_BYTES];
+  memset(memory, 0, sizeof(memory));
+  MemoryLogStorage storage;
+  storage.begin(memory, sizeof(memory));
+  PacketLog log;
+  log.begin(&storage);
+
+  std::deque<uint32_t> reference;
+  uint32_t seed = 9;
+  uint8_t data[PACKET_LOG_MAX_RECORD_BYTES];
+  uint8_t expected[MAX_DATA_BYTES];
+  size_t mismatches = 0;
+  size_t recoverMismatches = 0;
+  uint32_t serial = 0;
+  uint32_t overwritten = 0;
+  const uint32_t steps = 200000;
+  for (uint32_t step = 0; step < steps; step++) {
+    if (lcg(seed) % 3 != 0) {
+      size_t length = recordLength(serial);
+      fillRecord(serial, data, length);
+      uint32_t before = log.overwritten();
+      log.append(data, length, recordTag(serial));
+      // The reference holds what fits, newest first
+      reference.push_back(serial++);
+      for (uint32_t n = log.overwritten() - before; n > 0; n--) {
+        reference.pop_front();
+        overwritten++;
+      }
+    } else if (!reference.empty()) {
+      uint32_t tag;
+      size_t length = log.peek(data, sizeof(data), tag);
+      uint32_t want = reference.front();
+      fillRecord(want, expected, recordLength(want));
+      mismatches += length != recordLength(want) || tag != recordTag(want) ||
+                    memcmp(data, expected, length) != 0;
+      log.pop();
+      reference.pop_front();
+    }
+    mismatches += log.count() != reference.size() ||
+                  (!reference.empty() && log.oldestSerial() != reference.front());
+
+    // Recovery from the storage alone finds the same records
+    if (step % 97 == 0) {
+      PacketLog recovered;
+      recovered.begin(&storage);
+      uint32_t firstUnconsumed = reference.empty() ? serial : reference.front();
+      recovered.recover(firstUnconsumed);
+      recoverMismatches += recovered.count() != log.count() || recovered.nextSerial() != serial ||
+                           (!reference.empty() && recovered.oldestSerial() != reference.front()) ||
+                           recovered.usedBytes() != log.usedBytes();
+    }
+  }
+  printf("  %u steps, %u records, %u overwritten: %u differ from the reference, %u recoveries differ\n",
+         (unsigned)steps, (unsigned)serial, (unsigned)overwritten, (unsigned)mismatches,
+         (unsigned)recoverMismatches);
+  check(mismatches == 0, "the log differs from the reference queue");
+  check(recoverMismatches == 0, "recover() rebuilt different positions");
+}
+
+//----------------------------------------------------------------------
+// Drain throughput
+//----------------------------------------------------------------------
+static void checkDrain() {
+  // A backlog the size the firmware keeps in PSRAM, of full packets
+  const size_t bytes = 512 * 1024;
+  const size_t packetBytes = 509;
+  std::vector<uint8_t> memory(bytes);
+  MemoryLogStorage storage;
+  storage.begin(memory.data(), memory.size());
+  PacketLog log;
+  log.begin(&storage);
+  uint8_t data[PACKET_LOG_MAX_RECORD_BYTES];
+  for (size_t i = 0; i < packetBytes; i++) data[i] = (uint8_t)i;
+  while (log.overwritten() == 0) {
+    log.append(data, packetBytes, 0);
+  }
+  uint32_t records = log.count();
+
+  Clock::time_point start = Clock::now();
+  uint32_t drained = 0;
+  uint32_t tag;
+  while (log.peek(data, sizeof(data), tag) == packetBytes) {
+    log.pop();
+    drained++;
+  }
+  double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+  double mbPerSecond = drained * (double)packetBytes / seconds / 1e6;
+  // 16 kHz PCM is 32 KB/s; the backlog must drain far faster than it fills
+  bool ok = drained == records && mbPerSecond >= 100 * 0.032;
+  printf("  %u records of %u bytes drained in %.2f ms: %.1f MB/s, %.0f records/s%s\n", (unsigned)drained,
+         (unsigned)packetBytes, seconds * 1000, mbPerSecond, drained / seconds, ok ? "" : "  FAIL");
+  check(ok, "drain too slow or incomplete");
+}
+
+int main() {
+  printf("PacketLog in %u bytes, records of 1-%u bytes\n\n", (unsigned)LOG_BYTES, (unsigned)MAX_DATA_BYTES);
+  printf("Power cut after every byte written, %u records\n", (unsigned)SCENARIO_RECORDS);
+  for (uint32_t seed : { 42u, 7u, 1234u }) {
+    checkPowerCuts(seed, false);
+    checkPowerCuts(seed, true);
+  }
+  printf("\nWraparound\n");
+  checkWraparound();
+  printf("\nDrain\n");
+  checkDrain();
+  printf("\n%s\n", failed ? "Packet log regression" : "No record lost or duplicated");
+  return failed ? 1 : 0;
+}
@@ -0,0 +1,371 @@
+// Host checks of NACK-driven retransmission (env:retransmit_sim).
+//
+//   pio run -e retransmit_sim -t exec
+//
+// First RetransmitHistory on its own: ranges across the sequence wrap,
+// duplicate and overlapping NACKs, NACKs for packets the history no longer
+// holds or that were never sent, pending packets overwritten before their
+// turn, a full NACK queue and reset(). Then a live stream over a lossy
+// link with a receiver that NACKs every gap it sees, the way sendTask
+// serves a client: repairs only take the link when no live packet waits.
+// Repairs can be lost too, so the receiver NACKs what is still missing
+// again every RENACK_MS. It must end with every packet bit for bit, or, when
+// a stall outlasts the history, with every missing packet counted as
+// unrecoverable. The run exits non-zero if any check fails.
+#include <stdio.h>
+#include <string.h>
+#include <deque>
+#include <map>
+#include <vector>
+#include "../Hal/synthetic_source.h"
+#include "../Pipeline/pipeline_config.h"
+#include "../Pipeline/retransmit_history.h"
+#include "../Protocol/packetizer.h"
+
+// Same shape as the firmware's live path
+static constexpr uint32_t SAMPLE_RATE = 16000;
+static constexpr size_t CAPTURE_SAMPLES = 320;               // 20 ms
+static constexpr uint32_t CAPTURE_MS = CAPTURE_SAMPLES * 1000 / SAMPLE_RATE;
+typedef PipelineConfig<SAMPLE_RATE, 2500, 5, 512, 200, 400> LivePipeline;
+static constexpr size_t MAX_PACKET_BYTES = LivePipeline::MAX_PACKET_BYTES;
+static constexpr size_t ATT_OVERHEAD_BYTES = 3;              // per notification
+// As AUDIO_RETRANSMIT_MS = 3000 sizes it on the device
+static constexpr size_t HISTORY_SLOTS = RetransmitHistory::slotCountFor(
+    3000 * SAMPLE_RATE * 2 / 1000 / LivePipeline::MIN_PAYLOAD_BYTES * 5 / 4);
+
+// The receiver asks again for what is still missing in the newest half of the history
+static constexpr uint32_t RENACK_MS = 250;
+static constexpr uint32_t RENACK_PACKETS = HISTORY_SLOTS / 2;
+
+static bool failed = false;
+
+static void check(bool condition, const char* what) {
+  if (!condition) {
+    printf("  FAIL: %s\n", what);
+    failed = true;
+  }
+}
+
+//----------------------------------------------------------------------
+// RetransmitHistory
+//----------------------------------------------------------------------
+static constexpr size_t TEST_SLOT_BYTES = 8;
+static constexpr size_t TEST_SLOTS = 64;
+
+// Packets whose bytes name their sequence number
+static void recordPackets(RetransmitHistory& h, uint16_t first, size_t count) {
+  for (size_t i = 0; i < count; i++) {
+    uint16_t s = (uint16_t)(first + i);
+    uint8_t packet[TEST_SLOT_BYTES] = { (uint8_t)s, (uint8_t)(s >> 8), 0xA5 };
+    h.record(s, packet, sizeof(packet));
+  }
+}
+
+// Takes every resend; false if one does not carry its sequence number
+static bool drain(RetransmitHistory& h, std::vector<uint16_t>& resent) {
+  resent.clear();
+  size_t length;
+  uint16_t sequence;
+  uint8_t* packet;
+  while ((packet = h.nextResend(length, sequence)) != nullptr) {
+    if (length != TEST_SLOT_BYTES || (packet[0] | (packet[1] << 8)) != sequence || packet[2] != 0xA5) {
+      return false;
+    }
+    resent.push_back(sequence);
+  }
+  return true;
+}
+
+static bool sequenceIs(const std::vector<uint16_t>& resent, uint16_t first, size_t count) {
+  if (resent.size() != count) {
+    return false;
+  }
+  for (size_t i = 0; i < count; i++) {
+    if (resent[i] != (uint16_t)(first + i)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+static void checkHistory() {
+  static uint8_t storage[RetransmitHistory::storageBytes(TEST_SLOT_BYTES, TEST_SLOTS)];
+  RetransmitHistory h;
+  std::vector<uint16_t> resent;
+
+  printf("History\n");
+  check(!h.begin(storage, TEST_SLOT_BYTES, 48), "accepts a slot count that is not a power of two");
+  check(h.begin(storage, TEST_SLOT_BYTES, TEST_SLOTS), "begin");
+  check(RetransmitHistory::slotCountFor(33) == 64 && RetransmitHistory::slotCountFor(64) == 64,
+        "slotCountFor rounds up to a power of two");
+
+  recordPackets(h, 0, 40);
+  h.nack(10, 5);
+  check(drain(h, resent) && sequenceIs(resent, 10, 5), "resends a range in order");
+  check(!h.pending(), "nothing pending after the range");
+
+  // Overlapping and repeated ranges go out once, oldest first
+  h.nack(20, 5);
+  h.nack(22, 5);
+  h.nack(18, 2);
+  h.nack(20, 1);
+  check(drain(h, resent) && sequenceIs(resent, 18, 9), "overlapping NACKs resend each packet once");
+  check(h.duplicates() == 4, "duplicates counted");
+  // A repair that was lost too is asked for again and sent again
+  h.nack(20, 1);
+  check(drain(h, resent) && sequenceIs(resent, 20, 1), "a packet NACKed after its resend goes out again");
+
+  // Across the wrap of the sequence number
+  h.reset();
+  h.resetStats();
+  recordPackets(h, 65500, 80);  // 65500..65535, 0..43
+  h.nack(65530, 20);
+  check(drain(h, resent) && sequenceIs(resent, 65530, 20), "range across the sequence wrap");
+  h.nack(2, 3);
+  h.nack(65534, 2);
+  check(drain(h, resent) && resent.size() == 5 && resent[0] == 65534 && resent[1] == 65535 && resent[2] == 2,
+        "oldest first across the wrap");
+  check(h.unrecoverable() == 0, "nothing unrecoverable within the history");
+
+  // Older than the history: 136..199 are held
+  h.reset();
+  h.resetStats();
+  recordPackets(h, 0, 200);
+  h.nack(100, 50);
+  check(drain(h, resent) && sequenceIs(resent, 136, 14), "resends the part still held");
+  check(h.unrecoverable() == 36 && h.nackedPackets() == 50, "counts the part no longer held");
+
+  // Not sent yet: ignored, not counted
+  h.resetStats();
+  h.nack(190, 20);
+  check(drain(h, resent) && sequenceIs(resent, 190, 10), "resends up to the newest packet");
+  check(h.nackedPackets() == 10 && h.unrecoverable() == 0, "ignores packets not sent yet");
+
+  // Overwritten while pending
+  h.resetStats();
+  h.nack(140, 4);
+  recordPackets(h, 200, 6);  // 136..141 leave the history
+  check(drain(h, resent) && sequenceIs(resent, 142, 2), "skips pending packets overwritten since");
+  check(h.unrecoverable() == 2, "counts pending packets overwritten");
+
+  // Packets too large for a slot are not kept
+  h.resetStats();
+  uint8_t big[TEST_SLOT_BYTES + 1] = {};
+  h.record(206, big, sizeof(big));
+  h.nack(206, 1);
+  check(drain(h, resent) && resent.empty() && h.unrecoverable() == 1, "oversized packet unrecoverable");
+
+  // Full queue
+  h.resetStats();
+  bool queued = true;
+  for (size_t i = 0; i < RetransmitHistory::NACK_QUEUE_RANGES; i++) {
+    queued = h.nack((uint16_t)(170 + i), 1) && queued;
+  }
+  check(queued && !h.nack(190, 1) && h.droppedRanges() == 1, "drops ranges beyond the queue");
+  check(drain(h, resent) && sequenceIs(resent, 170, RetransmitHistory::NACK_QUEUE_RANGES),
+        "queued ranges survive a full queue");
+
+  // A new connection forgets everything
+  h.nack(180, 5);
+  h.reset();
+  check(!h.pending() && h.held() == 0, "reset forgets packets and NACKs");
+  recordPackets(h, 0, 3);
+  h.nack(0, 3);
+  check(drain(h, resent) && sequenceIs(resent, 0, 3), "works after reset");
+
+  printf("  %s\n", failed ? "failed" : "ok");
+}
+
+//----------------------------------------------------------------------
+// Live stream with repairs
+//----------------------------------------------------------------------
+struct LossPlan {
+  const char* name;
+  uint32_t linkBytesPerSecond;
+  uint32_t dropPermille;    // random loss after the link
+  uint32_t stallStartMs;    // receiver drops everything for stallMs
+  uint32_t stallMs;
+  uint32_t nackDelayMs;     // gap seen -> NACK at the device
+  bool complete;            // every packet must arrive in the end
+};
+
+static const LossPlan PLANS[] = {
+  { "2% random loss", 40000, 20, 0, 0, 40, true },
+  { "app stall of 1 s", 48000, 5, 10000, 1000, 60, true },
+  { "stall longer than the history", 48000, 5, 10000, 5000, 60, false },
+};
+
+struct Nack {
+  uint32_t dueMs;
+  uint16_t first;
+  uint16_t count;
+};
+
+static bool runStream(const LossPlan& plan) {
+  static AudioPacketizer packetizer;
+  static uint8_t historyStorage[RetransmitHistory::storageBytes(MAX_PACKET_BYTES, HISTORY_SLOTS)];
+  static int16_t capture[CAPTURE_SAMPLES];
+  static uint8_t packet[MAX_PACKET_BYTES];
+  const uint32_t runMs = 30000;
+  const uint16_t firstSequence = 65000;  // wraps during the run
+
+  RetransmitHistory history;
+  if (!packetizer.begin(PACKET_FORMAT_PCM16, MAX_PACKET_BYTES, true, SAMPLE_RATE) ||
+      !history.begin(historyStorage, MAX_PACKET_BYTES, HISTORY_SLOTS)) {
+    printf("%s: setup failed\n", plan.name);
+    return false;
+  }
+  SyntheticSource source;
+  source.begin(SyntheticSource::Config());
+
+  std::deque<std::vector<uint8_t>> live;          // built, not sent yet
+  std::map<uint32_t, std::vector<uint8_t>> sent;  // by unwrapped sequence
+  std::map<uint32_t, std::vector<uint8_t>> received;
+  std::deque<Nack> nacks;
+  uint16_t sequence = firstSequence;
+  uint32_t sentCount = 0;
+  uint32_t expected = 0;         // unwrapped sequence the receiver waits for
+  uint32_t repairWhileLive = 0;  // repairs sent with live audio waiting
+  uint32_t repairs = 0;
+  uint32_t lossSeed = 7;
+  double credit = 0;
+
+  for (uint32_t ms = 0; ms < runMs + 2000; ms++) {
+    if (ms < runMs && ms % CAPTURE_MS == 0) {
+      source.record(capture, CAPTURE_SAMPLES, SAMPLE_RATE);
+      size_t taken = 0;
+      while (taken < CAPTURE_SAMPLES) {
+        taken += packetizer.append(capture + taken, CAPTURE_SAMPLES - taken);
+        while (packetizer.hasPacket()) {
+          size_t length = packetizer.nextPacket(packet);
+          live.push_back(std::vector<uint8_t>(packet, packet + length));
+        }
+      }
+    }
+    if (ms % RENACK_MS == 0) {
+      uint32_t n = expected > RENACK_PACKETS ? expected - RENACK_PACKETS : 0;
+      while (n < expected) {
+        if (received.count(n) != 0) {
+          n++;
+          continue;
+        }
+        uint32_t first = n;
+        while (n < expected && received.count(n) == 0) {
+          n++;
+        }
+        nacks.push_back({ ms + plan.nackDelayMs, (uint16_t)(firstSequence + first), (uint16_t)(n - first) });
+      }
+    }
+    while (!nacks.empty() && nacks.front().dueMs <= ms) {
+      history.nack(nacks.front().first, nacks.front().count);
+      nacks.pop_front();
+    }
+
+    credit += plan.linkBytesPerSecond / 1000.0;
+    while (true) {
+      // Live first, as serviceClient(); repairs only in its gaps
+      bool repair = live.empty();
+      uint8_t* data;
+      size_t length;
+      uint16_t s;
+      if (!repair) {
+        data = live.front().data();
+        length = live.front().size();
+        if (credit < length + ATT_OVERHEAD_BYTES) {
+          break;
+        }
+        s = sequence++;
+        packetSetSequence(data, s);
+        history.record(s, data, length);
+        sent[sentCount++] = std::vector<uint8_t>(data, data + length);
+      } else {
+        if (!history.pending() || credit < MAX_PACKET_BYTES + ATT_OVERHEAD_BYTES) {
+          break;
+        }
+        data = history.nextResend(length, s);
+        if (data == nullptr) {
+          break;
+        }
+        data[2] |= PACKET_FLAG_RETRANSMIT;
+        repairs++;
+        repairWhileLive += !live.empty();
+      }
+      credit -= length + ATT_OVERHEAD_BYTES;
+
+      // The receiver's side
+      lossSeed = lossSeed * 1664525 + 1013904223;
+      bool stalled = ms >= plan.stallStartMs && ms < plan.stallStartMs + plan.stallMs;
+      bool lost = stalled || (lossSeed >> 8) % 1000 < plan.dropPermille;
+      if (!lost) {
+        uint32_t n = expected + (uint16_t)(s - (uint16_t)(firstSequence + expected));
+        if (repair) {
+          // Repairs lie behind the live edge
+          n = expected - (uint16_t)((uint16_t)(firstSequence + expected) - s);
+        } else if (n > expected) {
+          // A gap: NACK it once the NACK's write gets through
+          nacks.push_back({ ms + plan.nackDelayMs, (uint16_t)(firstSequence + expected),
+                            (uint16_t)(n - expected) });
+        }
+        if (!repair && n >= expected) {
+          expected = n + 1;
+        }
+        received[n] = std::vector<uint8_t>(data, data + length);
+      }
+      if (!repair) {
+        live.pop_front();
+      }
+    }
+    if (live.empty() && credit > MAX_PACKET_BYTES + ATT_OVERHEAD_BYTES) {
+      credit = MAX_PACKET_BYTES + ATT_OVERHEAD_BYTES;
+    }
+  }
+
+  // Compare, the retransmit flag aside
+  uint32_t missing = 0;
+  uint32_t corrupt = 0;
+  for (const auto& entry : sent) {
+    if (entry.first >= expected) {
+      // Lost at the very end, where no later packet shows the gap
+      break;
+    }
+    auto r = received.find(entry.first);
+    if (r == received.end()) {
+      missing++;
+      continue;
+    }
+    std::vector<uint8_t> got = r->second;
+    got[2] &= (uint8_t)~PACKET_FLAG_RETRANSMIT;
+    corrupt += got != entry.second;
+  }
+
+  printf("\n%s\n", plan.name);
+  printf("  %u packets sent, %u NACKed, %u resent (%.1f%% more bytes), %u duplicate, %u unrecoverable\n",
+         sentCount, history.nackedPackets(), history.resentPackets(),
+         100.0 * history.resentBytes() / (sentCount * (double)MAX_PACKET_BYTES), history.duplicates(),
+         history.unrecoverable());
+  printf("  receiver: %u missing, %u differ, %u repairs sent while live audio waited\n", missing, corrupt,
+         repairWhileLive);
+  bool ok = corrupt == 0 && repairWhileLive == 0 && repairs == history.resentPackets();
+  if (plan.complete) {
+    ok = ok && missing == 0 && history.unrecoverable() == 0;
+  } else {
+    // What the history could not cover is reported, not silently lost
+    ok = ok && missing > 0 && history.unrecoverable() >= missing;
+  }
+  if (!ok) {
+    printf("  FAIL\n");
+  }
+  return ok;
+}
+
+int main() {
+  printf("Retransmit history of %u packets (%u KB per client)\n\n", (unsigned)HISTORY_SLOTS,
+         (unsigned)(RetransmitHistory::storageBytes(MAX_PACKET_BYTES, HISTORY_SLOTS) / 1024));
+  checkHistory();
+  bool ok = !failed;
+  for (const LossPlan& plan : PLANS) {
+    ok = runStream(plan) && ok;
+  }
+  printf("\n%s\n", ok ? "Every loss repaired or reported" : "Retransmission regression");
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,241 @@
+// Two-thread stress test of the single-producer/single-consumer SlotRing
+// (env:slot_ring_stress).
+//
+//   pio run -e slot_ring_stress -t exec
+//
+// A producer thread works like recordTask: it keeps several reservations
+// outstanding, fills each slot in place with a pattern derived from its
+// sequence number, sometimes drops its newest reservation, and commits in
+// order with the sequence number as tag. When the ring is full the packet
+// is dropped and counted. A consumer thread works like sendTask: it peeks,
+// sometimes looks ahead with peekAt(), and releases. Both sides run with
+// random timing, from back to back to sleeps long enough to fill or empty
+// the ring. The consumer requires every slot to arrive intact, with tags in
+// increasing order and each gap matching a packet the producer dropped; at
+// the end the producer's drops must equal the ring's overruns and every
+// commit must have been received exactly once. The run exits non-zero if any
+// check fails.
+#include <stdio.h>
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <thread>
+#include <vector>
+#include "../Pipeline/slot_ring.h"
+
+static constexpr size_t SLOT_BYTES = 61;  // not a multiple of 4, so padding is exercised
+static constexpr uint32_t PACKETS_PER_PLAN = 1000000;
+
+static uint32_t lcg(uint32_t& seed) {
+  seed = seed * 1664525 + 1013904223;
+  return seed >> 8;
+}
+
+static uint8_t patternByte(uint32_t seq, size_t i) {
+  return (uint8_t)(seq * 2654435761u >> 24) ^ (uint8_t)(i * 37);
+}
+
+static size_t lengthFor(uint32_t seq) {
+  return 1 + seq % SLOT_BYTES;
+}
+
+static void fill(uint8_t* slot, uint32_t seq) {
+  size_t length = lengthFor(seq);
+  for (size_t i = 0; i < length; i++) {
+    slot[i] = patternByte(seq, i);
+  }
+}
+
+static bool intact(const uint8_t* slot, size_t length, uint32_t seq, const SlotTimes& times) {
+  if (length != lengthFor(seq) || times.sampleUs != seq || times.commitUs != ~seq) {
+    return false;
+  }
+  for (size_t i = 0; i < length; i++) {
+    if (slot[i] != patternByte(seq, i)) return false;
+  }
+  return true;
+}
+
+// How each side paces itself; one in n operations pauses for up to pauseUs
+struct Timing {
+  uint32_t spinMax;   // busy iterations between operations
+  uint32_t pauseOneIn;
+  uint32_t pauseUs;
+};
+
+struct StressPlan {
+  const char* name;
+  size_t slots;
+  uint32_t maxReservations;  // outstanding at once, like the mic driver's queue
+  Timing producer;
+  Timing consumer;
+  bool expectsDrops;
+};
+
+static const StressPlan PLANS[] = {
+  { "Both sides back to back", 16, 4, { 0, 0, 0 }, { 0, 0, 0 }, false },
+  { "Random jitter on both sides", 8, 3, { 200, 500, 50 }, { 200, 500, 50 }, false },
+  { "Consumer stalls", 16, 4, { 50, 0, 0 }, { 50, 2000, 2000 }, true },
+  { "Producer stalls", 16, 4, { 50, 2000, 2000 }, { 50, 0, 0 }, false },
+  { "Ring of one slot", 1, 1, { 100, 1000, 20 }, { 100, 1000, 20 }, true },
+  { "Full ring, reservations held", 4, 4, { 20, 300, 100 }, { 20, 100, 300 }, true },
+};
+
+static void pace(const Timing& timing, uint32_t& seed) {
+  if (timing.spinMax > 0) {
+    volatile uint32_t spin = lcg(seed) % timing.spinMax;
+    while (spin > 0) spin = spin - 1;
+  }
+  if (timing.pauseOneIn > 0 && lcg(seed) % timing.pauseOneIn == 0) {
+    std::this_thread::sleep_for(std::chrono::microseconds(1 + lcg(seed) % timing.pauseUs));
+  } else if (lcg(seed) % 8 == 0) {
+    std::this_thread::yield();
+  }
+}
+
+struct ProducerStats {
+  uint32_t committed = 0;
+  uint32_t dropped = 0;
+  uint32_t unreserved = 0;
+  std::vector<uint32_t> droppedSeqs;
+};
+
+struct ConsumerStats {
+  uint32_t received = 0;
+  uint32_t gaps = 0;        // sequence numbers never received
+  uint32_t damaged = 0;
+  uint32_t outOfOrder = 0;
+  uint32_t lookAheads = 0;
+  uint32_t lookAheadMismatches = 0;
+  std::vector<uint32_t> missingSeqs;
+};
+
+static void produce(SlotRing& ring, const StressPlan& plan, ProducerStats& stats, std::atomic<bool>& done) {
+  uint32_t seed = 11;
+  uint32_t nextSeq = 0;
+  std::deque<uint32_t> reserved;  // sequence numbers of outstanding reservations, oldest first
+  while (nextSeq < PACKETS_PER_PLAN || !reserved.empty()) {
+    pace(plan.producer, seed);
+    uint32_t action = lcg(seed) % 16;
+    bool mayReserve = nextSeq < PACKETS_PER_PLAN && reserved.size() < plan.maxReservations;
+    if (mayReserve && (action < 9 || reserved.empty())) {
+      uint8_t* slot = ring.reserve();
+      if (slot == nullptr) {
+        // Ring full: this capture's packet is lost, as when sendTask falls behind
+        stats.dropped++;
+        stats.droppedSeqs.push_back(nextSeq++);
+        continue;
+      }
+      fill(slot, nextSeq);
+      reserved.push_back(nextSeq++);
+    } else if (action == 9 && !reserved.empty() && reserved.back() + 1 == nextSeq && nextSeq < PACKETS_PER_PLAN) {
+      // A capture failed; its number goes to the next one
+      ring.unreserve();
+      nextSeq = reserved.back();
+      reserved.pop_back();
+      stats.unreserved++;
+    } else if (!reserved.empty()) {
+      uint32_t seq = reserved.front();
+      reserved.pop_front();
+      SlotTimes times;
+      times.sampleUs = seq;
+      times.commitUs = ~seq;
+      ring.commit(lengthFor(seq), seq, times);
+      stats.committed++;
+    }
+  }
+  done.store(true, std::memory_order_release);
+}
+
+static void consume(SlotRing& ring, const StressPlan& plan, ConsumerStats& stats, std::atomic<bool>& done) {
+  uint32_t seed = 23;
+  uint32_t expected = 0;  // next sequence number if nothing was dropped
+  while (true) {
+    pace(plan.consumer, seed);
+    size_t length;
+    uint32_t tag;
+    SlotTimes times;
+    uint8_t* slot = ring.peek(length, tag, times);
+    if (slot == nullptr) {
+      if (done.load(std::memory_order_acquire) && ring.occupancy() == 0) {
+        break;
+      }
+      continue;
+    }
+
+    // Look ahead now and then, as retransmits and the fanout do
+    if (lcg(seed) % 4 == 0) {
+      size_t offset = 1 + lcg(seed) % 4;
+      size_t aheadLength;
+      uint32_t aheadTag;
+      SlotTimes aheadTimes;
+      uint8_t* ahead = ring.peekAt(offset, aheadLength, aheadTag, aheadTimes);
+      if (ahead != nullptr) {
+        stats.lookAheads++;
+        stats.lookAheadMismatches += aheadTag <= tag || !intact(ahead, aheadLength, aheadTag, aheadTimes);
+      }
+    }
+
+    if (tag < expected) {
+      stats.outOfOrder++;
+    } else {
+      for (; expected < tag; expected++) {
+        stats.gaps++;
+        stats.missingSeqs.push_back(expected);
+      }
+      expected = tag + 1;
+    }
+    stats.damaged += !intact(slot, length, tag, times);
+    stats.received++;
+    ring.release();
+  }
+  for (; expected < PACKETS_PER_PLAN; expected++) {
+    stats.gaps++;
+    stats.missingSeqs.push_back(expected);
+  }
+}
+
+static bool runPlan(const StressPlan& plan) {
+  std::vector<uint8_t> storage(SlotRing::storageBytes(SLOT_BYTES, plan.slots));
+  SlotRing ring;
+  ring.begin(storage.data(), SLOT_BYTES, plan.slots);
+
+  ProducerStats produced;
+  ConsumerStats consumed;
+  std::atomic<bool> done{false};
+  auto start = std::chrono::steady_clock::now();
+  std::thread consumer(consume, std::ref(ring), std::cref(plan), std::ref(consumed), std::ref(done));
+  std::thread producer(produce, std::ref(ring), std::cref(plan), std::ref(produced), std::ref(done));
+  producer.join();
+  consumer.join();
+  double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+  bool ordered = consumed.outOfOrder == 0 && consumed.lookAheadMismatches == 0;
+  bool intactOk = consumed.damaged == 0;
+  bool accounted = consumed.received == produced.committed && produced.committed == ring.committed() &&
+                   produced.dropped == ring.overruns() && consumed.missingSeqs == produced.droppedSeqs &&
+                   produced.committed + produced.dropped == PACKETS_PER_PLAN;
+  bool bounded = ring.highWatermark() <= plan.slots && ring.occupancy() == 0;
+  bool dropsOk = !plan.expectsDrops || produced.dropped > 0;
+
+  printf("\n%s: %u slots, up to %u reservations\n", plan.name, (unsigned)plan.slots, plan.maxReservations);
+  printf("  %u committed, %u dropped (%u overruns), %u unreserved, %u received, %u look-aheads, %.2f s\n",
+         produced.committed, produced.dropped, ring.overruns(), produced.unreserved, consumed.received,
+         consumed.lookAheads, seconds);
+  printf("  high watermark %u of %u\n", (unsigned)ring.highWatermark(), (unsigned)plan.slots);
+  if (!ordered) printf("  FAIL: %u out of order, %u look-aheads wrong\n", consumed.outOfOrder, consumed.lookAheadMismatches);
+  if (!intactOk) printf("  FAIL: %u slots damaged\n", consumed.damaged);
+  if (!accounted) printf("  FAIL: %u gaps seen for %u drops\n", consumed.gaps, produced.dropped);
+  if (!bounded) printf("  FAIL: ring over capacity or not empty at the end\n");
+  if (!dropsOk) printf("  FAIL: the plan never filled the ring\n");
+  return ordered && intactOk && accounted && bounded && dropsOk;
+}
+
+int main() {
+  bool ok = true;
+  for (const StressPlan& plan : PLANS) {
+    ok = runPlan(plan) && ok;
+  }
+  printf("\n%s\n", ok ? "Every packet delivered in order or accounted for" : "SlotRing regression");
+  return ok ? 0 : 1;
+}
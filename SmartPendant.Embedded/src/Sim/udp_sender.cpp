@@ -0,0 +1,179 @@
+// Stands in for the pendant on the Wi-Fi UDP path (env:udp_sender).
+//
+//   .pio/build/udp_sender/program [-h host] [-p port] [-t seconds] [-f pcm|adpcm|lossless|mulaw|logmel]
+//                                 [--drop-every n] [--fast] [speech.wav]
+//
+// Captures a synthetic signal (or a 16 kHz WAV file) in 20 ms chunks, packs
+// it with the firmware's packetizer and sends it through the firmware's
+// UdpTransport, paced in real time unless --fast. --drop-every n skips
+// every n-th packet to check that the receiver reports the loss; logmel
+// sends the firmware's log-mel feature frames instead of audio. With
+// env:udp_receiver on the same machine this is the end-to-end test of the
+// Wi-Fi path:
+//
+//   udp_receiver --idle 2 --max-loss 0 &  udp_sender -t 10
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include <thread>
+#include "../Hal/synthetic_source.h"
+#include "../Hal/wav_source.h"
+#include "../Hal/udp_transport.h"
+#include "../Protocol/packetizer.h"
+#include "../Protocol/feature_packetizer.h"
+#include "../Dsp/log_mel.h"
+
+// Same shape as the firmware's live path
+static constexpr uint32_t SAMPLE_RATE = 16000;
+static constexpr size_t CAPTURE_SAMPLES = 320;               // 20 ms
+static constexpr size_t MAX_PACKET_BYTES = 512 - 3;
+
+typedef std::chrono::steady_clock Clock;
+
+struct Options {
+  const char* host = "127.0.0.1";
+  uint16_t port = 50005;
+  double seconds = 10;
+  PacketFormat format = PACKET_FORMAT_PCM16;
+  uint32_t dropEvery = 0;
+  bool fast = false;
+  const char* wavPath = nullptr;
+};
+
+static bool parseFormat(const char* name, PacketFormat& format) {
+  static const struct { const char* name; PacketFormat format; } FORMATS[] = {
+    { "pcm", PACKET_FORMAT_PCM16 }, { "adpcm", PACKET_FORMAT_ADPCM },
+    { "lossless", PACKET_FORMAT_LOSSLESS }, { "mulaw", PACKET_FORMAT_MULAW },
+    { "logmel", PACKET_FORMAT_LOG_MEL },
+  };
+  for (const auto& f : FORMATS) {
+    if (strcmp(name, f.name) == 0) {
+      format = f.format;
+      return true;
+    }
+  }
+  return false;
+}
+
+static bool parseOptions(int argc, char** argv, Options& o) {
+  for (int i = 1; i < argc; i++) {
+    const char* arg = argv[i];
+    const char* value = i + 1 < argc ? argv[i + 1] : nullptr;
+    if (strcmp(arg, "--fast") == 0) {
+      o.fast = true;
+      continue;
+    }
+    if (arg[0] != '-') {
+      o.wavPath = arg;
+      continue;
+    }
+    if (value == nullptr) {
+      return false;
+    }
+    if (strcmp(arg, "-h") == 0 || strcmp(arg, "--host") == 0) {
+      o.host = value;
+    } else if (strcmp(arg, "-p") == 0 || strcmp(arg, "--port") == 0) {
+      o.port = (uint16_t)atoi(value);
+    } else if (strcmp(arg, "-t") == 0 || strcmp(arg, "--seconds") == 0) {
+      o.seconds = atof(value);
+    } else if (strcmp(arg, "-f") == 0 || strcmp(arg, "--format") == 0) {
+      if (!parseFormat(value, o.format)) {
+        return false;
+      }
+    } else if (strcmp(arg, "--drop-every") == 0) {
+      o.dropEvery = (uint32_t)atoi(value);
+    } else {
+      return false;
+    }
+    i++;
+  }
+  return true;
+}
+
+int main(int argc, char** argv) {
+  Options options;
+  if (!parseOptions(argc, argv, options)) {
+    printf("usage: %s [-h host] [-p port] [-t seconds] [-f pcm|adpcm|lossless|mulaw|logmel] "
+           "[--drop-every n] [--fast] [speech.wav]\n", argv[0]);
+    return 2;
+  }
+
+  SyntheticSource synthetic;
+  synthetic.begin(SyntheticSource::Config());
+  WavFileSource wav;
+  AudioSource* source = &synthetic;
+  if (options.wavPath != nullptr) {
+    if (!wav.open(options.wavPath) || wav.sampleRate() != SAMPLE_RATE) {
+      printf("%s: not a 16-bit %u Hz WAV file\n", options.wavPath, SAMPLE_RATE);
+      return 2;
+    }
+    source = &wav;
+  }
+
+  static AudioPacketizer packetizer;
+  static LogMelExtractor extractor;
+  static FeaturePacketizer featurePacketizer;
+  bool features = options.format == PACKET_FORMAT_LOG_MEL;
+  UdpTransport transport;
+  bool ready = features ? extractor.begin() &&
+                              featurePacketizer.begin(MAX_PACKET_BYTES, SAMPLE_RATE, LogMelExtractor::MEL_BANDS,
+                                                      LogMelExtractor::HOP_SAMPLES, LogMelExtractor::WINDOW_MS)
+                        : packetizer.begin(options.format, MAX_PACKET_BYTES, true, SAMPLE_RATE);
+  if (!ready) {
+    printf("packetizer setup failed\n");
+    return 2;
+  }
+  if (!transport.open(options.host, options.port)) {
+    printf("cannot send to %s:%u\n", options.host, options.port);
+    return 2;
+  }
+  printf("Sending %.0f s to %s:%u\n", options.seconds, options.host, options.port);
+
+  static int16_t capture[CAPTURE_SAMPLES];
+  static uint8_t packet[MAX_PACKET_BYTES];
+  uint16_t sequence = 0;
+  uint32_t built = 0;
+  uint32_t skipped = 0;
+  size_t captures = (size_t)(options.seconds * SAMPLE_RATE / CAPTURE_SAMPLES);
+  // Like notifyPacket(): a sequence number per packet sent
+  auto send = [&](size_t length) {
+    packetSetSequence(packet, sequence++);
+    built++;
+    if (options.dropEvery > 0 && built % options.dropEvery == 0) {
+      skipped++;
+      return;
+    }
+    transport.send(0, packet, length);
+  };
+  Clock::time_point start = Clock::now();
+  for (size_t c = 0; c < captures; c++) {
+    if (!options.fast) {
+      // A capture is ready once its audio has been recorded
+      std::this_thread::sleep_until(start + std::chrono::microseconds(
+          (uint64_t)(c + 1) * CAPTURE_SAMPLES * 1000000 / SAMPLE_RATE));
+    }
+    source->record(capture, CAPTURE_SAMPLES, SAMPLE_RATE);
+    size_t taken = 0;
+    while (features && taken < CAPTURE_SAMPLES) {
+      // Like extractFeatures() in the firmware
+      taken += extractor.append(capture + taken, CAPTURE_SAMPLES - taken);
+      while (extractor.frameReady()) {
+        uint8_t frame[LogMelExtractor::MEL_BANDS];
+        uint32_t firstSample = extractor.takeFrame(frame);
+        while (!featurePacketizer.append(frame, firstSample)) {
+          send(featurePacketizer.nextPacket(packet));
+        }
+      }
+    }
+    while (taken < CAPTURE_SAMPLES) {
+      taken += packetizer.append(capture + taken, CAPTURE_SAMPLES - taken);
+      while (packetizer.hasPacket()) {
+        send(packetizer.nextPacket(packet));
+      }
+    }
+  }
+  printf("%u packets: %u sent, %u refused by the network stack, %u skipped on purpose\n",
+         built, transport.datagrams(), transport.refused(), skipped);
+  return 0;
+}
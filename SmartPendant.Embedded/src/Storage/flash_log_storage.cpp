@@ -0,0 +1,78 @@
+#include "flash_log_storage.h"
+
+bool FlashLogStorage::begin(fs::FS& fs, const char* path, size_t bytes) {
+  _fs = &fs;
+  _bytes = bytes;
+  _markPath = String(path) + ".mark";
+
+  if (fs.exists(path)) {
+    _file = fs.open(path, "r+");
+    if (_file && _file.size() == bytes) {
+      return true;
+    }
+    _file.close();
+  }
+
+  // Preallocate so later writes never grow the file
+  _file = fs.open(path, "w");
+  if (!_file) {
+    return false;
+  }
+  uint8_t zeros[256] = { 0 };
+  for (size_t written = 0; written < bytes; written += sizeof(zeros)) {
+    size_t n = bytes - written < sizeof(zeros) ? bytes - written : sizeof(zeros);
+    if (_file.write(zeros, n) != n) {
+      _file.close();
+      return false;
+    }
+  }
+  _file.close();
+  fs.remove(_markPath.c_str());
+
+  _file = fs.open(path, "r+");
+  return (bool)_file;
+}
+
+bool FlashLogStorage::read(size_t offset, void* data, size_t bytes) {
+  if (!_file || offset + bytes > _bytes || !_file.seek(offset)) {
+    return false;
+  }
+  return _file.read((uint8_t*)data, bytes) == bytes;
+}
+
+bool FlashLogStorage::write(size_t offset, const void* data, size_t bytes) {
+  if (!_file || offset + bytes > _bytes || !_file.seek(offset)) {
+    return false;
+  }
+  return _file.write((const uint8_t*)data, bytes) == bytes;
+}
+
+void FlashLogStorage::sync() {
+  if (_file) {
+    _file.flush();
+  }
+}
+
+bool FlashLogStorage::saveMark(uint32_t firstUnconsumed) {
+  fs::File mark = _fs->open(_markPath.c_str(), "w");
+  if (!mark) {
+    return false;
+  }
+  uint8_t bytes[4] = {
+    (uint8_t)(firstUnconsumed & 0xFF), (uint8_t)((firstUnconsumed >> 8) & 0xFF),
+    (uint8_t)((firstUnconsumed >> 16) & 0xFF), (uint8_t)((firstUnconsumed >> 24) & 0xFF)
+  };
+  bool ok = mark.write(bytes, sizeof(bytes)) == sizeof(bytes);
+  mark.close();
+  return ok;
+}
+
+uint32_t FlashLogStorage::loadMark() {
+  fs::File mark = _fs->open(_markPath.c_str(), "r");
+  uint8_t bytes[4] = { 0 };
+  if (!mark || mark.read(bytes, sizeof(bytes)) != sizeof(bytes)) {
+    return 0;
+  }
+  mark.close();
+  return (uint32_t)bytes[0] | ((uint32_t)bytes[1] << 8) | ((uint32_t)bytes[2] << 16) | ((uint32_t)bytes[3] << 24);
+}
@@ -0,0 +1,34 @@
+#ifndef FLASH_LOG_STORAGE_H
+#define FLASH_LOG_STORAGE_H
+
+#include <FS.h>
+#include "packet_log.h"
+
+// LogStorage in a preallocated file, e.g. on LittleFS. Next to the log it
+// keeps a small mark file with the first serial not yet delivered, so a
+// restart does not replay what the receiver already has. The mark is only
+// written now and then, so a power cut may replay a few records; receivers
+// deduplicate by sample index.
+class FlashLogStorage : public LogStorage {
+public:
+  // Opens path, creating it zero-filled at the given size if needed
+  bool begin(fs::FS& fs, const char* path, size_t bytes);
+
+  size_t capacity() const override { return _bytes; }
+  bool read(size_t offset, void* data, size_t bytes) override;
+  bool write(size_t offset, const void* data, size_t bytes) override;
+
+  // Commits written records to flash
+  void sync();
+
+  bool saveMark(uint32_t firstUnconsumed);
+  uint32_t loadMark();
+
+private:
+  fs::FS* _fs = nullptr;
+  fs::File _file;
+  size_t _bytes = 0;
+  String _markPath;
+};
+
+#endif
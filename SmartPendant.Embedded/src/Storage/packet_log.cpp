@@ -0,0 +1,369 @@
+#include "packet_log.h"
+#include <string.h>
+
+static constexpr uint16_t RECORD_MAGIC = 0x4B50; // "PK"
+static constexpr uint16_t WRAP_MAGIC = 0x5750;   // "PW"
+
+static inline void putU16(uint8_t* p, uint16_t v) {
+  p[0] = (uint8_t)(v & 0xFF);
+  p[1] = (uint8_t)(v >> 8);
+}
+
+static inline void putU32(uint8_t* p, uint32_t v) {
+  putU16(p, (uint16_t)(v & 0xFFFF));
+  putU16(p + 2, (uint16_t)(v >> 16));
+}
+
+static inline uint16_t getU16(const uint8_t* p) {
+  return (uint16_t)(p[0] | (p[1] << 8));
+}
+
+static inline uint32_t getU32(const uint8_t* p) {
+  return (uint32_t)getU16(p) | ((uint32_t)getU16(p + 2) << 16);
+}
+
+// CRC-16/CCITT-FALSE
+static uint16_t crc16(uint16_t crc, const uint8_t* data, size_t bytes) {
+  for (size_t i = 0; i < bytes; i++) {
+    crc ^= (uint16_t)(data[i] << 8);
+    for (int bit = 0; bit < 8; bit++) {
+      crc = (crc & 0x8000) ? (uint16_t)((crc << 1) ^ 0x1021) : (uint16_t)(crc << 1);
+    }
+  }
+  return crc;
+}
+
+//----------------------------------------------------------------------
+// MemoryLogStorage
+//----------------------------------------------------------------------
+bool MemoryLogStorage::begin(void* memory, size_t bytes) {
+  if (memory == nullptr || bytes == 0) {
+    return false;
+  }
+  _memory = (uint8_t*)memory;
+  _bytes = bytes;
+  return true;
+}
+
+bool MemoryLogStorage::read(size_t offset, void* data, size_t bytes) {
+  if (offset + bytes > _bytes) {
+    return false;
+  }
+  memcpy(data, _memory + offset, bytes);
+  return true;
+}
+
+bool MemoryLogStorage::write(size_t offset, const void* data, size_t bytes) {
+  if (offset + bytes > _bytes) {
+    return false;
+  }
+  memcpy(_memory + offset, data, bytes);
+  return true;
+}
+
+//----------------------------------------------------------------------
+// PacketLog
+//----------------------------------------------------------------------
+bool PacketLog::begin(LogStorage* storage) {
+  if (storage == nullptr || storage->capacity() < recordBytes(1)) {
+    return false;
+  }
+  _storage = storage;
+  _capacity = storage->capacity() & ~(size_t)3;
+  _nextSerial = 0;
+  clear();
+  resetStats();
+  return true;
+}
+
+void PacketLog::clear() {
+  _head = 0;
+  _tail = 0;
+  _count = 0;
+  _tailSerial = _nextSerial;
+}
+
+size_t PacketLog::usedBytes() const {
+  if (_count == 0) {
+    return 0;
+  }
+  return _head > _tail ? _head - _tail : _capacity - _tail + _head;
+}
+
+bool PacketLog::readHeader(size_t offset, RecordInfo& info) {
+  uint8_t header[PACKET_LOG_RECORD_HEADER_BYTES];
+  if (offset + PACKET_LOG_RECORD_HEADER_BYTES > _capacity ||
+      !_storage->read(offset, header, sizeof(header))) {
+    return false;
+  }
+
+  uint16_t magic = getU16(header);
+  // A marker is its magic and zeros, so a torn record header whose first
+  // bytes happen to match cannot end the lap early
+  info.wrap = magic == WRAP_MAGIC;
+  for (size_t i = 2; i < sizeof(header) && info.wrap; i++) {
+    info.wrap = header[i] == 0;
+  }
+  if (info.wrap) {
+    return true;
+  }
+  info.length = getU16(header + 2);
+  info.serial = getU32(header + 4);
+  info.tag = getU32(header + 8);
+  info.crc = getU16(header + 12);
+  return magic == RECORD_MAGIC && info.length <= PACKET_LOG_MAX_RECORD_BYTES &&
+         offset + recordBytes(info.length) <= _capacity;
+}
+
+bool PacketLog::readValidRecord(size_t offset, RecordInfo& info) {
+  uint8_t header[PACKET_LOG_RECORD_HEADER_BYTES];
+  if (!readHeader(offset, info) || info.wrap || !_storage->read(offset, header, sizeof(header))) {
+    return false;
+  }
+
+  uint16_t crc = crc16(0xFFFF, header + 2, 10);
+  uint8_t chunk[64];
+  for (size_t done = 0; done < info.length; done += sizeof(chunk)) {
+    size_t n = info.length - done < sizeof(chunk) ? info.length - done : sizeof(chunk);
+    if (!_storage->read(offset + PACKET_LOG_RECORD_HEADER_BYTES + done, chunk, n)) {
+      return false;
+    }
+    crc = crc16(crc, chunk, n);
+  }
+  return crc == info.crc;
+}
+
+bool PacketLog::fitsAtHead(size_t bytes, bool& wrap) const {
+  wrap = false;
+  if (_count == 0) {
+    if (_head + bytes <= _capacity) return true;
+    wrap = true;
+    return bytes <= _capacity;
+  }
+  if (_head > _tail) {
+    // Live data sits in [tail, head)
+    if (_head + bytes <= _capacity) return true;
+    wrap = true;
+    return bytes <= _tail;
+  }
+  // Live data wraps: [tail, capacity) and [0, head)
+  return _head + bytes <= _tail;
+}
+
+void PacketLog::skipWrap() {
+  RecordInfo info;
+  if (_capacity - _tail < PACKET_LOG_RECORD_HEADER_BYTES ||
+      (readHeader(_tail, info) && info.wrap)) {
+    _tail = 0;
+  }
+  // Serials may jump where recovery stitched the two laps together
+  if (readHeader(_tail, info) && !info.wrap) {
+    _tailSerial = info.serial;
+  }
+}
+
+bool PacketLog::dropOldest() {
+  if (_count == 0) {
+    return false;
+  }
+  RecordInfo info;
+  if (!readHeader(_tail, info) || info.wrap) {
+    // Storage no longer matches the positions; start over
+    clear();
+    return true;
+  }
+  _tail += recordBytes(info.length);
+  _count--;
+  if (_count == 0) {
+    _tail = _head;
+    _tailSerial = _nextSerial;
+  } else {
+    skipWrap();
+  }
+  return true;
+}
+
+bool PacketLog::append(const void* data, size_t bytes, uint32_t tag) {
+  size_t size = recordBytes(bytes);
+  if (_storage == nullptr || bytes > PACKET_LOG_MAX_RECORD_BYTES || size > _capacity) {
+    return false;
+  }
+
+  bool wrap;
+  while (!fitsAtHead(size, wrap)) {
+    dropOldest();
+    _overwritten++;
+  }
+
+  if (wrap) {
+    if (_capacity - _head >= PACKET_LOG_RECORD_HEADER_BYTES) {
+      uint8_t marker[PACKET_LOG_RECORD_HEADER_BYTES] = { 0 };
+      putU16(marker, WRAP_MAGIC);
+      if (!_storage->write(_head, marker, sizeof(marker))) {
+        return false;
+      }
+    }
+    _head = 0;
+    if (_count == 0) {
+      _tail = 0;
+    }
+  }
+
+  uint8_t header[PACKET_LOG_RECORD_HEADER_BYTES] = { 0 };
+  putU16(header, RECORD_MAGIC);
+  putU16(header + 2, (uint16_t)bytes);
+  putU32(header + 4, _nextSerial);
+  putU32(header + 8, tag);
+  uint16_t crc = crc16(0xFFFF, header + 2, 10);
+  putU16(header + 12, crc16(crc, (const uint8_t*)data, bytes));
+
+  // Data first: a cut before the header lands leaves no valid record behind
+  if (!_storage->write(_head + PACKET_LOG_RECORD_HEADER_BYTES, data, bytes) ||
+      !_storage->write(_head, header, sizeof(header))) {
+    return false;
+  }
+
+  if (_count == 0) {
+    _tail = _head;
+    _tailSerial = _nextSerial;
+  }
+  _head += size;
+  _count++;
+  _nextSerial++;
+  return true;
+}
+
+size_t PacketLog::peek(void* data, size_t capacity, uint32_t& tag) {
+  while (_count > 0) {
+    RecordInfo info;
+    if (readValidRecord(_tail, info) && info.length <= capacity && info.length > 0 &&
+        _storage->read(_tail + PACKET_LOG_RECORD_HEADER_BYTES, data, info.length)) {
+      tag = info.tag;
+      return info.length;
+    }
+    // Corrupted or oversized records are skipped rather than blocking the log
+    dropOldest();
+  }
+  return 0;
+}
+
+bool PacketLog::pop() {
+  return dropOldest();
+}
+
+size_t PacketLog::walk(size_t offset, uint32_t serial, uint32_t& count, uint32_t& lastSerial, bool& reachedEnd) {
+  count = 0;
+  reachedEnd = false;
+  while (true) {
+    RecordInfo info;
+    if (_capacity - offset < PACKET_LOG_RECORD_HEADER_BYTES) {
+      reachedEnd = true;
+      break;
+    }
+    if (!readHeader(offset, info)) {
+      break;
+    }
+    if (info.wrap) {
+      reachedEnd = true;
+      break;
+    }
+    if (info.serial != serial || !readValidRecord(offset, info)) {
+      break;
+    }
+    count++;
+    lastSerial = serial++;
+    offset += recordBytes(info.length);
+  }
+  return offset;
+}
+
+bool PacketLog::recover(uint32_t firstUnconsumed) {
+  if (_storage == nullptr) {
+    return false;
+  }
+  _nextSerial = firstUnconsumed;
+  clear();
+
+  // The newest lap always starts at offset 0
+  RecordInfo info = {};
+  uint32_t newCount = 0;
+  uint32_t newLast = 0;
+  size_t headEnd = 0;
+  bool newReachedEnd = false;
+  bool haveNew = readValidRecord(0, info);
+  uint32_t firstNew = info.serial;
+  if (haveNew) {
+    headEnd = walk(0, firstNew, newCount, newLast, newReachedEnd);
+  }
+
+  // The previous lap, if any, is the chain that runs from just past the
+  // head to the end of the storage. Its first intact record starts within
+  // two records of the head: a record torn by the power cut, then the old
+  // record it partly overwrote.
+  uint32_t oldCount = 0;
+  uint32_t oldFirst = 0;
+  uint32_t oldLast = 0;
+  size_t oldStart = 0;
+  if (!newReachedEnd) {
+    size_t offset = headEnd;
+    size_t scanLimit = offset + 2 * recordBytes(PACKET_LOG_MAX_RECORD_BYTES);
+    while (offset <= scanLimit && _capacity - offset >= PACKET_LOG_RECORD_HEADER_BYTES) {
+      if (!readValidRecord(offset, info)) {
+        offset += 4;
+        continue;
+      }
+      uint32_t count;
+      uint32_t last;
+      bool reachedEnd;
+      size_t end = walk(offset, info.serial, count, last, reachedEnd);
+      if (reachedEnd) {
+        oldStart = offset;
+        oldFirst = info.serial;
+        oldCount = count;
+        oldLast = last;
+        break;
+      }
+      // Broken chain, look for the next intact record after it
+      offset = end > offset ? end : offset + 4;
+      scanLimit = offset + 2 * recordBytes(PACKET_LOG_MAX_RECORD_BYTES);
+    }
+  }
+
+  // A power cut right after wrapping leaves an older record at offset 0
+  if (haveNew && oldCount > 0 && (int32_t)(firstNew - oldLast) <= 0) {
+    headEnd = 0;
+    newCount = 0;
+  }
+
+  _head = headEnd;
+  _count = oldCount + newCount;
+  if (oldCount > 0) {
+    _tail = oldStart;
+    _tailSerial = oldFirst;
+  } else {
+    _tail = 0;
+    _tailSerial = firstNew;
+  }
+  if (newCount > 0) {
+    _nextSerial = newLast + 1;
+  } else if (oldCount > 0) {
+    _nextSerial = oldLast + 1;
+  }
+  if (_count == 0) {
+    _nextSerial = firstUnconsumed;
+    clear();
+    return true;
+  }
+
+  // Drop what was already delivered before the reset
+  while (_count > 0 && (int32_t)(_tailSerial - firstUnconsumed) < 0) {
+    dropOldest();
+  }
+  if ((int32_t)(firstUnconsumed - _nextSerial) > 0) {
+    _nextSerial = firstUnconsumed;
+    if (_count == 0) {
+      _tailSerial = _nextSerial;
+    }
+  }
+  return true;
+}
@@ -0,0 +1,110 @@
+#ifndef PACKET_LOG_H
+#define PACKET_LOG_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Byte-addressable medium a PacketLog lives in (PSRAM buffer, flash file, ...)
+class LogStorage {
+public:
+  virtual ~LogStorage() {}
+  virtual size_t capacity() const = 0;
+  virtual bool read(size_t offset, void* data, size_t bytes) = 0;
+  virtual bool write(size_t offset, const void* data, size_t bytes) = 0;
+};
+
+// LogStorage over a caller-supplied buffer
+class MemoryLogStorage : public LogStorage {
+public:
+  bool begin(void* memory, size_t bytes);
+  size_t capacity() const override { return _bytes; }
+  bool read(size_t offset, void* data, size_t bytes) override;
+  bool write(size_t offset, const void* data, size_t bytes) override;
+
+private:
+  uint8_t* _memory = nullptr;
+  size_t _bytes = 0;
+};
+
+static constexpr size_t PACKET_LOG_RECORD_HEADER_BYTES = 16;
+static constexpr size_t PACKET_LOG_MAX_RECORD_BYTES = 1024;
+
+// Ring log of variable-length records, oldest first. When full, appending
+// overwrites the oldest records, so the log always holds the most recent
+// data that fits.
+//
+// Record layout (little-endian, 4-byte aligned):
+//   [0..1]   magic
+//   [2..3]   data length
+//   [4..7]   serial, +1 per record
+//   [8..11]  caller tag
+//   [12..13] CRC-16 over length, serial, tag and data
+//   [14..15] reserved
+// A record that does not fit before the end of the storage is preceded by
+// a wrap marker and written at offset 0.
+//
+// The read/write positions are not stored anywhere: recover() rebuilds them
+// from the records themselves, so a log on flash survives power loss. A
+// record torn by the power cut fails its CRC and is ignored.
+class PacketLog {
+public:
+  bool begin(LogStorage* storage);
+
+  // Rebuilds the positions from the storage contents, dropping records with
+  // serials below firstUnconsumed (already delivered before the reset)
+  bool recover(uint32_t firstUnconsumed);
+
+  // Drops every record
+  void clear();
+
+  // Appends a record, overwriting the oldest ones if needed. Returns false
+  // if the record can never fit or the storage fails.
+  bool append(const void* data, size_t bytes, uint32_t tag);
+
+  // Copies the oldest record into data (capacity bytes). Returns its length,
+  // or 0 when empty or the record is unreadable.
+  size_t peek(void* data, size_t capacity, uint32_t& tag);
+
+  // Removes the oldest record
+  bool pop();
+
+  bool empty() const { return _count == 0; }
+  uint32_t count() const { return _count; }
+  size_t usedBytes() const;
+  size_t capacity() const { return _capacity; }
+  uint32_t oldestSerial() const { return _tailSerial; }
+  uint32_t nextSerial() const { return _nextSerial; }
+  uint32_t overwritten() const { return _overwritten; }
+  void resetStats() { _overwritten = 0; }
+
+private:
+  struct RecordInfo {
+    uint16_t length;
+    uint32_t serial;
+    uint32_t tag;
+    uint16_t crc;
+    bool wrap;
+  };
+
+  static size_t recordBytes(size_t length) {
+    return (PACKET_LOG_RECORD_HEADER_BYTES + length + 3) & ~(size_t)3;
+  }
+
+  bool readHeader(size_t offset, RecordInfo& info);
+  bool readValidRecord(size_t offset, RecordInfo& info);
+  bool fitsAtHead(size_t bytes, bool& wrap) const;
+  bool dropOldest();
+  void skipWrap();
+  size_t walk(size_t offset, uint32_t serial, uint32_t& count, uint32_t& lastSerial, bool& reachedEnd);
+
+  LogStorage* _storage = nullptr;
+  size_t _capacity = 0;
+  size_t _head = 0;  // next write offset
+  size_t _tail = 0;  // oldest record
+  uint32_t _count = 0;
+  uint32_t _nextSerial = 0;
+  uint32_t _tailSerial = 0;
+  uint32_t _overwritten = 0;
+};
+
+#endif
@@ -0,0 +1,485 @@
+// Turns a trace dump from the serial console into a Chrome trace
+// (env:trace_to_chrome), for ui.perfetto.dev or chrome://tracing.
+//
+//   .pio/build/trace_to_chrome/program [-o trace.json] [monitor.log]
+//   .pio/build/trace_to_chrome/program --self-test
+//
+// Reads a monitor log (stdin without one) and converts the last complete
+// dump in it (Protocol/trace_dump.h); other output around the TRACE lines
+// is ignored. Each core becomes a process: a "CPU" track shows which task
+// ran when (from task switches, if the firmware was built with the hooks),
+// and each task's track shows what it did: captures from mic.record() to
+// their return, their processing, ring sends, receives and drops, stack
+// notifications and UI frames. Events recorded before the first task
+// switch of a core land on an "unattributed" track.
+//
+// Cycle counts are unwrapped backwards from the dump's clock reading of
+// each core, at the clock its CPU_CLOCK events report, so both cores share
+// one timeline in microseconds.
+//
+// --self-test round-trips synthetic rings with a counter wrap and a clock
+// change through the dump format and exits non-zero if any event comes out
+// more than MAX_TIME_ERROR_US from where it was put.
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <map>
+#include <string>
+#include <vector>
+#include "../Pipeline/trace_ring.h"
+#include "../Protocol/trace_dump.h"
+
+static constexpr double MAX_TIME_ERROR_US = 0.01;
+// Track ids within a core's process; tasks use their FreeRTOS number
+static constexpr uint32_t CPU_TRACK = 100000;
+static constexpr uint32_t UNATTRIBUTED_TRACK = 100001;
+
+struct CoreDump {
+  unsigned core = 0;
+  TraceCoreClock clock;
+  uint32_t recorded = 0;
+  size_t expected = 0;
+  std::vector<TraceEvent> events;
+};
+
+struct Dump {
+  unsigned trigger = 0;
+  std::map<uint32_t, std::string> tasks;
+  std::vector<CoreDump> cores;
+};
+
+// Collects dumps line by line; a dump counts once its END arrives with
+// every event accounted for
+class DumpParser {
+public:
+  void line(const char* text) {
+    const char* p = strstr(text, "TRACE ");
+    if (p == nullptr) {
+      return;
+    }
+    p += 6;
+    if (strncmp(p, "BEGIN ", 6) == 0) {
+      unsigned version = 0, cores = 0, trigger = 0;
+      _open = sscanf(p + 6, "%u %u %u", &version, &cores, &trigger) == 3 && version == TRACE_DUMP_VERSION;
+      _current = Dump();
+      _current.trigger = trigger;
+      if (!_open) {
+        _errors++;
+      }
+      return;
+    }
+    if (!_open) {
+      return;
+    }
+    if (strncmp(p, "TASK ", 5) == 0) {
+      unsigned number = 0;
+      char name[32];
+      if (sscanf(p + 5, "%u %31s", &number, name) == 2) {
+        _current.tasks[number] = name;
+      }
+    } else if (strncmp(p, "CORE ", 5) == 0) {
+      CoreDump core;
+      unsigned mhz = 0, cycles = 0, recorded = 0, expected = 0;
+      unsigned long long us = 0;
+      if (sscanf(p + 5, "%u %u %u %llu %u %u", &core.core, &mhz, &cycles, &us, &recorded, &expected) != 6) {
+        fail();
+        return;
+      }
+      core.clock.mhz = mhz;
+      core.clock.cycles = cycles;
+      core.clock.us = us;
+      core.recorded = recorded;
+      core.expected = expected;
+      _current.cores.push_back(core);
+    } else if (strncmp(p, "EVENTS ", 7) == 0) {
+      unsigned core = 0, first = 0;
+      int consumed = 0;
+      if (_current.cores.empty() || sscanf(p + 7, "%u %u %n", &core, &first, &consumed) != 2) {
+        fail();
+        return;
+      }
+      CoreDump& c = _current.cores.back();
+      // A line lost or garbled on the way makes the whole dump unusable
+      if (core != c.core || first != c.events.size()) {
+        fail();
+        return;
+      }
+      const char* hex = p + 7 + consumed;
+      while (isHexEvent(hex)) {
+        TraceEvent e;
+        traceDecodeEvent(hex, e);
+        c.events.push_back(e);
+        hex += TRACE_DUMP_EVENT_HEX;
+      }
+    } else if (strncmp(p, "END", 3) == 0) {
+      bool complete = !_current.cores.empty();
+      for (const CoreDump& c : _current.cores) {
+        complete = complete && c.events.size() == c.expected && c.clock.mhz > 0;
+      }
+      if (complete) {
+        _last = _current;
+        _dumps++;
+      } else {
+        _errors++;
+      }
+      _open = false;
+    }
+  }
+
+  unsigned dumps() const { return _dumps; }
+  unsigned errors() const { return _errors; }
+  const Dump& last() const { return _last; }
+
+private:
+  static bool isHexEvent(const char* hex) {
+    for (size_t i = 0; i < TRACE_DUMP_EVENT_HEX; i++) {
+      if (!isxdigit((unsigned char)hex[i])) {
+        return false;
+      }
+    }
+    return true;
+  }
+  void fail() {
+    _open = false;
+    _errors++;
+  }
+
+  bool _open = false;
+  Dump _current;
+  Dump _last;
+  unsigned _dumps = 0;
+  unsigned _errors = 0;
+};
+
+// Microseconds on the shared clock of every event of a core, walking back
+// from the dump's reading of its cycle counter. A CPU_CLOCK event gives
+// the clock of the events before it.
+static std::vector<double> eventTimes(const CoreDump& core) {
+  std::vector<double> times(core.events.size());
+  double t = (double)core.clock.us;
+  uint32_t cycles = core.clock.cycles;
+  double mhz = core.clock.mhz;
+  for (size_t i = core.events.size(); i-- > 0;) {
+    const TraceEvent& e = core.events[i];
+    t -= (double)(uint32_t)(cycles - e.cycles) / mhz;
+    times[i] = t;
+    cycles = e.cycles;
+    if (e.type == TRACE_CPU_CLOCK && e.arg > 0) {
+      mhz = e.arg;
+    }
+  }
+  return times;
+}
+
+// Writes the Chrome trace event format, one JSON object per line
+class ChromeWriter {
+public:
+  ChromeWriter(FILE* out, double originUs) : _out(out), _origin(originUs) {
+    fprintf(_out, "{\"displayTimeUnit\": \"ns\", \"traceEvents\": [\n");
+  }
+  void finish() { fprintf(_out, "\n]}\n"); }
+
+  void name(const char* kind, unsigned pid, uint32_t tid, const std::string& name) {
+    next();
+    fprintf(_out, "{\"ph\": \"M\", \"name\": \"%s\", \"pid\": %u, \"tid\": %u, \"args\": {\"name\": \"%s\"}}",
+            kind, pid, (unsigned)tid, name.c_str());
+  }
+  void complete(const char* name, unsigned pid, uint32_t tid, double us, double durationUs) {
+    next();
+    fprintf(_out, "{\"ph\": \"X\", \"name\": \"%s\", \"pid\": %u, \"tid\": %u, \"ts\": %.3f, \"dur\": %.3f}",
+            name, pid, (unsigned)tid, us - _origin, durationUs);
+  }
+  // ph is B, E or i; arg is left out when argName is null
+  void event(char ph, const char* name, unsigned pid, uint32_t tid, double us, const char* argName = nullptr,
+             unsigned arg = 0) {
+    next();
+    fprintf(_out, "{\"ph\": \"%c\", \"name\": \"%s\", \"pid\": %u, \"tid\": %u, \"ts\": %.3f", ph, name, pid,
+            (unsigned)tid, us - _origin);
+    if (ph == 'i') {
+      fprintf(_out, ", \"s\": \"t\"");
+    }
+    if (argName != nullptr) {
+      fprintf(_out, ", \"args\": {\"%s\": %u}", argName, arg);
+    }
+    fprintf(_out, "}");
+  }
+  // Async slice from b to e, matched by id
+  void async(char ph, const char* name, unsigned pid, uint32_t tid, double us, unsigned id) {
+    next();
+    fprintf(_out, "{\"ph\": \"%c\", \"cat\": \"audio\", \"name\": \"%s\", \"id\": %u, \"pid\": %u, \"tid\": %u, "
+            "\"ts\": %.3f}", ph, name, id, pid, (unsigned)tid, us - _origin);
+  }
+  void counter(const char* name, unsigned pid, double us, unsigned value) {
+    next();
+    fprintf(_out, "{\"ph\": \"C\", \"name\": \"%s\", \"pid\": %u, \"ts\": %.3f, \"args\": {\"MHz\": %u}}", name,
+            pid, us - _origin, value);
+  }
+
+private:
+  void next() {
+    if (_events++ > 0) {
+      fprintf(_out, ",\n");
+    }
+  }
+
+  FILE* _out;
+  double _origin;
+  size_t _events = 0;
+};
+
+static std::string taskName(const Dump& dump, uint32_t number) {
+  auto it = dump.tasks.find(number);
+  return it != dump.tasks.end() ? it->second : "task " + std::to_string(number);
+}
+
+static void writeCore(ChromeWriter& out, const Dump& dump, const CoreDump& core, const std::vector<double>& times) {
+  unsigned pid = core.core;
+  out.name("process_name", pid, 0, "Core " + std::to_string(core.core));
+  out.name("thread_name", pid, CPU_TRACK, "CPU");
+  out.name("thread_name", pid, UNATTRIBUTED_TRACK, "unattributed");
+
+  std::map<uint32_t, bool> named;
+  uint32_t track = UNATTRIBUTED_TRACK;
+  bool running = false;
+  double runStart = 0;
+  uint32_t runTask = 0;
+  // Slices open on each track. One begun before the oldest event kept is
+  // never ended; one still open at the end is closed there.
+  std::map<uint32_t, std::vector<const char*>> stacks;
+
+  auto begin = [&](const char* name, double t, const char* argName, unsigned arg) {
+    out.event('B', name, pid, track, t, argName, arg);
+    stacks[track].push_back(name);
+  };
+  auto end = [&](const char* name, double t, const char* argName, unsigned arg) {
+    std::vector<const char*>& stack = stacks[track];
+    if (stack.empty() || strcmp(stack.back(), name) != 0) {
+      return;
+    }
+    stack.pop_back();
+    out.event('E', name, pid, track, t, argName, arg);
+  };
+
+  for (size_t i = 0; i < core.events.size(); i++) {
+    const TraceEvent& e = core.events[i];
+    double t = times[i];
+    switch (e.type) {
+      case TRACE_TASK_SWITCH: {
+        if (running) {
+          out.complete(taskName(dump, runTask).c_str(), pid, CPU_TRACK, runStart, t - runStart);
+        }
+        running = true;
+        runStart = t;
+        runTask = e.arg;
+        track = e.arg;
+        if (!named[track]) {
+          out.name("thread_name", pid, track, taskName(dump, track));
+          named[track] = true;
+        }
+        break;
+      }
+      case TRACE_RECORD_BEGIN: out.async('b', "capture", pid, track, t, e.arg); break;
+      case TRACE_RECORD_END:
+        out.async('e', "capture", pid, track, t, e.arg);
+        begin("process capture", t, "capture", e.arg);
+        break;
+      case TRACE_PROCESS_END: end("process capture", t, "packets", e.arg); break;
+      case TRACE_RING_SEND: out.event('i', "ring send", pid, track, t, "bytes", e.arg); break;
+      case TRACE_RING_RECEIVE: out.event('i', "ring receive", pid, track, t, "bytes", e.arg); break;
+      case TRACE_RING_DROP: out.event('i', "ring drop", pid, track, t, "bytes", e.arg); break;
+      case TRACE_NOTIFY_BEGIN: begin("notify", t, "connection", e.arg); break;
+      case TRACE_NOTIFY_END: end("notify", t, "sent", e.arg); break;
+      case TRACE_UI_FRAME_BEGIN: begin("UI frame", t, nullptr, 0); break;
+      case TRACE_UI_FRAME_END: end("UI frame", t, nullptr, 0); break;
+      case TRACE_CPU_CLOCK: {
+        // The new clock is the next CPU_CLOCK's argument, or the dump's
+        unsigned mhz = core.clock.mhz;
+        for (size_t j = i + 1; j < core.events.size(); j++) {
+          if (core.events[j].type == TRACE_CPU_CLOCK) {
+            mhz = core.events[j].arg;
+            break;
+          }
+        }
+        out.counter("CPU clock", pid, t, mhz);
+        break;
+      }
+      case TRACE_TRIGGER:
+        out.event('i', e.arg == TRACE_TRIGGER_DROP ? "trigger: packets dropped" : "trigger", pid, track, t);
+        break;
+      default: break;
+    }
+  }
+
+  double last = times.empty() ? 0 : times.back();
+  if (running) {
+    out.complete(taskName(dump, runTask).c_str(), pid, CPU_TRACK, runStart, last - runStart);
+  }
+  for (auto& entry : stacks) {
+    while (!entry.second.empty()) {
+      out.event('E', entry.second.back(), pid, entry.first, last);
+      entry.second.pop_back();
+    }
+  }
+}
+
+static void writeChrome(FILE* out, const Dump& dump) {
+  std::vector<std::vector<double>> times;
+  double origin = INFINITY;
+  for (const CoreDump& core : dump.cores) {
+    times.push_back(eventTimes(core));
+    if (!times.back().empty() && times.back().front() < origin) {
+      origin = times.back().front();
+    }
+  }
+  ChromeWriter writer(out, isfinite(origin) ? origin : 0);
+  for (size_t c = 0; c < dump.cores.size(); c++) {
+    writeCore(writer, dump, dump.cores[c], times[c]);
+  }
+  writer.finish();
+}
+
+// Two cores' worth of events at known times: core 0 crosses a counter wrap
+// at 240 MHz, core 1 runs at 240 MHz, drops to 80 MHz and drops packets
+static bool selfTest() {
+  static TraceEvent storage[2][64];
+  TraceRing rings[2];
+  rings[0].begin(storage[0], 64);
+  rings[1].begin(storage[1], 64);
+
+  struct Planned { double us; uint8_t type; uint16_t arg; };
+  const Planned CORE0[] = {
+    { 100, TRACE_TASK_SWITCH, 3 }, { 110, TRACE_RECORD_BEGIN, 7 }, { 250, TRACE_TASK_SWITCH, 1 },
+    { 20000, TRACE_TASK_SWITCH, 3 }, { 20010, TRACE_RECORD_END, 7 }, { 20400, TRACE_RING_SEND, 509 },
+    { 20420, TRACE_PROCESS_END, 1 }, { 20430, TRACE_TASK_SWITCH, 1 }, { 1020430, TRACE_KEEPALIVE, 0 },
+  };
+  const Planned CORE1[] = {
+    { 90, TRACE_TASK_SWITCH, 4 }, { 95, TRACE_UI_FRAME_BEGIN, 0 }, { 300, TRACE_TASK_SWITCH, 5 },
+    { 305, TRACE_RING_RECEIVE, 509 }, { 306, TRACE_NOTIFY_BEGIN, 0 }, { 340, TRACE_NOTIFY_END, 1 },
+    { 350, TRACE_TASK_SWITCH, 4 }, { 5000, TRACE_UI_FRAME_END, 0 }, { 6000, TRACE_CPU_CLOCK, 240 },
+    { 7000, TRACE_RING_DROP, 509 }, { 7000, TRACE_TRIGGER, TRACE_TRIGGER_DROP }, { 9000, TRACE_TASK_SWITCH, 2 },
+  };
+  const Planned* plans[2] = { CORE0, CORE1 };
+  const size_t counts[2] = { sizeof(CORE0) / sizeof(CORE0[0]), sizeof(CORE1) / sizeof(CORE1[0]) };
+  // Cycle counters at 0 us; core 0 wraps 20 ms in
+  const uint32_t base[2] = { 0xFFFFFFFFu - 240u * 20005u, 123456789u };
+  const double dumpUs = 1100000;
+
+  // Cycles at a time, with core 1 at 80 MHz from 6000 us on
+  auto cyclesAt = [&](int core, double us) -> uint32_t {
+    if (core == 1 && us > 6000) {
+      return base[1] + (uint32_t)(240.0 * 6000 + 80.0 * (us - 6000));
+    }
+    return base[core] + (uint32_t)llround(240.0 * us);
+  };
+
+  char text[TRACE_DUMP_LINE_BYTES];
+  std::string log = "boot noise\n";
+  log += std::string(text, traceDumpBegin(text, 2, TRACE_TRIGGER_DROP));
+  log += std::string(text, traceDumpTask(text, 1, "IDLE0"));
+  log += std::string(text, traceDumpTask(text, 2, "loopTask"));
+  log += std::string(text, traceDumpTask(text, 3, "recordTask"));
+  log += std::string(text, traceDumpTask(text, 4, "uiTask"));
+  log += std::string(text, traceDumpTask(text, 5, "sendTask"));
+  for (int core = 0; core < 2; core++) {
+    for (size_t i = 0; i < counts[core]; i++) {
+      rings[core].record(cyclesAt(core, plans[core][i].us), plans[core][i].type, plans[core][i].arg);
+    }
+    rings[core].stopAfter(0);
+    TraceCoreClock clock;
+    clock.mhz = core == 1 ? 80 : 240;
+    clock.cycles = cyclesAt(core, dumpUs);
+    clock.us = (uint64_t)dumpUs;
+    log += std::string(text, traceDumpCore(text, core, clock, rings[core]));
+    size_t count = 0;
+    for (size_t first = 0; first < rings[core].size(); first += count) {
+      log += "I (1234) monitor prefix: ";
+      log += std::string(text, traceDumpEvents(text, core, rings[core], first, count));
+    }
+  }
+  log += std::string(text, traceDumpEnd(text));
+
+  DumpParser parser;
+  size_t start = 0;
+  while (start < log.size()) {
+    size_t end = log.find('\n', start);
+    parser.line(log.substr(start, end - start).c_str());
+    start = end + 1;
+  }
+  bool ok = parser.dumps() == 1 && parser.errors() == 0 && parser.last().cores.size() == 2;
+  printf("Round trip: %u dump, %u errors\n", parser.dumps(), parser.errors());
+  double worst = 0;
+  for (int core = 0; ok && core < 2; core++) {
+    const CoreDump& c = parser.last().cores[core];
+    std::vector<double> times = eventTimes(c);
+    ok = ok && times.size() == counts[core];
+    for (size_t i = 0; ok && i < times.size(); i++) {
+      double error = fabs(times[i] - plans[core][i].us);
+      if (error > worst) worst = error;
+      ok = ok && c.events[i].type == plans[core][i].type && c.events[i].arg == plans[core][i].arg;
+    }
+  }
+  ok = ok && worst <= MAX_TIME_ERROR_US;
+  printf("Timestamps: worst error %.4f us (limit %.2f)%s\n", worst, MAX_TIME_ERROR_US, ok ? "" : "  FAIL");
+
+  FILE* sink = fopen("/dev/null", "w");
+  if (sink != nullptr) {
+    writeChrome(sink, parser.last());
+    fclose(sink);
+  }
+  printf("\n%s\n", ok ? "Trace conversion within spec" : "Trace conversion regression");
+  return ok;
+}
+
+int main(int argc, char** argv) {
+  const char* input = nullptr;
+  const char* output = "trace.json";
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--self-test") == 0) {
+      return selfTest() ? 0 : 1;
+    } else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+      output = argv[++i];
+    } else if (argv[i][0] != '-') {
+      input = argv[i];
+    } else {
+      printf("usage: %s [-o trace.json] [monitor.log] | --self-test\n", argv[0]);
+      return 2;
+    }
+  }
+
+  FILE* in = input != nullptr ? fopen(input, "r") : stdin;
+  if (in == nullptr) {
+    printf("cannot read %s\n", input);
+    return 2;
+  }
+  DumpParser parser;
+  static char line[4096];
+  while (fgets(line, sizeof(line), in) != nullptr) {
+    parser.line(line);
+  }
+  if (in != stdin) {
+    fclose(in);
+  }
+  if (parser.dumps() == 0) {
+    printf("no complete trace dump found (%u incomplete)\n", parser.errors());
+    return 1;
+  }
+
+  FILE* out = fopen(output, "w");
+  if (out == nullptr) {
+    printf("cannot write %s\n", output);
+    return 2;
+  }
+  const Dump& dump = parser.last();
+  writeChrome(out, dump);
+  fclose(out);
+  size_t events = 0;
+  for (const CoreDump& core : dump.cores) {
+    events += core.events.size();
+  }
+  printf("%u dumps found, converted the last (%s): %u events on %u cores, %u tasks -> %s\n", parser.dumps(),
+         dump.trigger == TRACE_TRIGGER_DROP ? "packets dropped" : "requested", (unsigned)events,
+         (unsigned)dump.cores.size(), (unsigned)dump.tasks.size(), output);
+  return 0;
+}
@@ -0,0 +1,161 @@
+#include "compositor.h"
+
+void UiRect::include(const UiRect& other) {
+  if (other.empty()) {
+    return;
+  }
+  if (empty()) {
+    *this = other;
+    return;
+  }
+  int16_t right = max(x + w, other.x + other.w);
+  int16_t bottom = max(y + h, other.y + other.h);
+  x = min(x, other.x);
+  y = min(y, other.y);
+  w = right - x;
+  h = bottom - y;
+}
+
+// Part of a that lies inside b, in a's coordinates
+static UiRect clipTo(const UiRect& a, const UiRect& b) {
+  UiRect r;
+  int16_t left = max(a.x, b.x);
+  int16_t top = max(a.y, b.y);
+  int16_t right = min(a.x + a.w, b.x + b.w);
+  int16_t bottom = min(a.y + a.h, b.y + b.h);
+  if (right > left && bottom > top) {
+    r.x = left;
+    r.y = top;
+    r.w = right - left;
+    r.h = bottom - top;
+  }
+  return r;
+}
+
+bool UiWidget::begin(int16_t x, int16_t y, int16_t w, int16_t h, bool psram) {
+  _bounds.x = x;
+  _bounds.y = y;
+  _bounds.w = w;
+  _bounds.h = h;
+  _canvas.setColorDepth(16);
+  _canvas.setPsram(psram);
+  if (_canvas.createSprite(w, h) == nullptr) {
+    return false;
+  }
+  _dma = !psram;
+  _canvas.fillScreen(0);
+  return true;
+}
+
+void UiWidget::markDirty(int16_t x, int16_t y, int16_t w, int16_t h) {
+  UiRect local;
+  local.w = _bounds.w;
+  local.h = _bounds.h;
+  UiRect r;
+  r.x = x;
+  r.y = y;
+  r.w = w;
+  r.h = h;
+  _dirty.include(clipTo(r, local));
+}
+
+void UiWidget::setVisible(bool visible) {
+  if (visible == _visible) {
+    return;
+  }
+  _visible = visible;
+  // Shown: push all of it; hidden: the compositor repaints what it covered
+  markDirty();
+}
+
+void UiCompositor::begin(DisplayPanel* display) {
+  _display = display;
+  _count = 0;
+  resetStats();
+}
+
+bool UiCompositor::add(UiWidget* widget) {
+  if (_count >= MAX_WIDGETS) {
+    return false;
+  }
+  _widgets[_count++] = widget;
+  return true;
+}
+
+void UiCompositor::beginFrame() {
+  if (_writing) {
+    _display->endWrite();
+    _writing = false;
+  }
+}
+
+// Marks the part of area (screen coordinates) covered by widget as dirty
+static void markScreenArea(UiWidget* widget, const UiRect& area) {
+  UiRect overlap = clipTo(area, widget->bounds());
+  if (!overlap.empty()) {
+    widget->markDirty(overlap.x - widget->bounds().x, overlap.y - widget->bounds().y,
+                      overlap.w, overlap.h);
+  }
+}
+
+uint32_t UiCompositor::flush() {
+  // Hidden widgets expose whatever lies below them
+  for (size_t i = 0; i < _count; i++) {
+    UiWidget* hidden = _widgets[i];
+    if (hidden->_visible || hidden->_dirty.empty()) {
+      continue;
+    }
+    for (size_t j = 0; j < _count; j++) {
+      if (j != i && _widgets[j]->_visible) {
+        markScreenArea(_widgets[j], hidden->_bounds);
+      }
+    }
+    hidden->_dirty = UiRect();
+  }
+
+  uint32_t pixels = 0;
+  for (size_t i = 0; i < _count; i++) {
+    UiWidget* widget = _widgets[i];
+    if (!widget->_visible || widget->_dirty.empty()) {
+      continue;
+    }
+
+    // Whole rows of the dirty area, contiguous in the sprite buffer
+    const UiRect& b = widget->_bounds;
+    UiRect band;
+    band.x = b.x;
+    band.y = b.y + widget->_dirty.y;
+    band.w = b.w;
+    band.h = widget->_dirty.h;
+    widget->_dirty = UiRect();
+
+    // Layers above get pushed again where this band overwrote them
+    for (size_t j = i + 1; j < _count; j++) {
+      if (_widgets[j]->_visible) {
+        markScreenArea(_widgets[j], band);
+      }
+    }
+
+    if (!_writing) {
+      _display->startWrite();
+      _writing = true;
+    }
+    const uint16_t* rows = (const uint16_t*)widget->_canvas.getBuffer() + (band.y - b.y) * b.w;
+    // PSRAM is not reachable by the SPI DMA
+    _display->pushImage(band.x, band.y, band.w, band.h, rows, widget->_dma);
+    if (widget->_dma) {
+      _dmaPushes++;
+    } else {
+      _blockingPushes++;
+    }
+    pixels += (uint32_t)band.w * band.h;
+  }
+  _pushedPixels += pixels;
+  return pixels;
+}
+
+void UiCompositor::resetStats() {
+  _pushedPixels = 0;
+  _dmaPushes = 0;
+  _blockingPushes = 0;
+}
@@ -0,0 +1,80 @@
+#ifndef COMPOSITOR_H
+#define COMPOSITOR_H
+
+#include <M5Unified.h>
+#include "../Hal/display.h"
+
+// Rectangle in pixels; empty when w or h is 0
+struct UiRect {
+  int16_t x = 0, y = 0, w = 0, h = 0;
+
+  bool empty() const { return w <= 0 || h <= 0; }
+  // Grows this rectangle to the bounding box of both
+  void include(const UiRect& other);
+};
+
+// One layer of the screen: an off-screen sprite at a fixed position.
+// Draw into canvas() in local coordinates, then mark what changed.
+class UiWidget {
+public:
+  // Sprites in internal RAM are pushed by DMA; psram puts large, rarely
+  // changing layers in PSRAM instead, pushed without DMA
+  bool begin(int16_t x, int16_t y, int16_t w, int16_t h, bool psram);
+
+  M5Canvas& canvas() { return _canvas; }
+  const UiRect& bounds() const { return _bounds; }
+  const UiRect& dirty() const { return _dirty; }
+  bool visible() const { return _visible; }
+  bool dma() const { return _dma; }
+
+  void markDirty() { markDirty(0, 0, _bounds.w, _bounds.h); }
+  void markDirty(int16_t x, int16_t y, int16_t w, int16_t h);
+  // Hidden widgets are never pushed; whatever lies below has to repaint the area
+  void setVisible(bool visible);
+
+private:
+  friend class UiCompositor;
+
+  M5Canvas _canvas;
+  UiRect _bounds;
+  UiRect _dirty;
+  bool _visible = false;
+  bool _dma = false;
+};
+
+// Pushes the dirty parts of the widgets to the panel, bottom layer first.
+//
+// Only the dirty band of rows of each widget is sent (a band is contiguous
+// in the sprite buffer). Widgets in internal RAM go out by DMA, so the CPU
+// is free while the panel is written; beginFrame() waits for the last
+// transfer before any sprite is touched again.
+class UiCompositor {
+public:
+  static constexpr size_t MAX_WIDGETS = 8;
+
+  void begin(DisplayPanel* display);
+  // Widgets are stacked in the order they are added
+  bool add(UiWidget* widget);
+
+  // Call before drawing into any widget
+  void beginFrame();
+  // Pushes everything marked dirty; returns the number of pixels sent
+  uint32_t flush();
+
+  uint32_t pushedPixels() const { return _pushedPixels; }
+  uint32_t dmaPushes() const { return _dmaPushes; }
+  uint32_t blockingPushes() const { return _blockingPushes; }
+  void resetStats();
+
+private:
+  DisplayPanel* _display = nullptr;
+  UiWidget* _widgets[MAX_WIDGETS];
+  size_t _count = 0;
+  bool _writing = false;
+
+  uint32_t _pushedPixels = 0;
+  uint32_t _dmaPushes = 0;
+  uint32_t _blockingPushes = 0;
+};
+
+#endif
@@ -3,9 +3,42 @@
 #include <BLEServer.h>
 #include <BLEUtils.h>
 #include <BLE2902.h>
-#include <freertos/stream_buffer.h>
 #include <freertos/task.h>
+#include <freertos/semphr.h>
+#include <freertos/event_groups.h>
+#include <esp_heap_caps.h>
+#include <esp_pm.h>
+#include <esp_gap_ble_api.h>
+#include <esp_gatts_api.h>
+#include <LittleFS.h>
+#include <time.h>
 #include "Startup/startup.h"
+#include "Protocol/packet.h"
+#include "Protocol/packetizer.h"
+#include "Protocol/feature_packetizer.h"
+#include "Protocol/telemetry.h"
+#include "Protocol/audio_format.h"
+#include "Pipeline/fanout_ring.h"
+#include "Pipeline/latency_histogram.h"
+#include "Pipeline/quality_ladder.h"
+#include "Pipeline/pacer.h"
+#include "Pipeline/connection_state.h"
+#include "Pipeline/pipeline_config.h"
+#include "Pipeline/retransmit_history.h"
+#include "Dsp/vad.h"
+#include "Dsp/frontend.h"
+#include "Dsp/level_meter.h"
+#include "Dsp/filters.h"
+#include "Dsp/decimator.h"
+#include "Dsp/log_mel.h"
+#include "Storage/packet_log.h"
+#include "Storage/flash_log_storage.h"
+#include "Ui/compositor.h"
+#include "Power/power_manager.h"
+#include "Hal/Device/m5_mic_source.h"
+#include "Hal/Device/ble_transport.h"
+#include "Hal/Device/m5_display.h"
+#include "Hal/Device/trace_recorder.h"
 #include "resources.h"
 #include <math.h>
 
@@ -20,55 +53,738 @@
 #define UI_DARKGREY   0x4208
 #define UI_LIGHTGREY  0xBDF7
 
-// audio parameters
+// audio parameters; rate and sample encoding are defaults the client can renegotiate
 #define SAMPLE_RATE      16000
 #define SAMPLE_BITS      16
-#define CHANNELS         false
 #define MTU_SIZE         512
-#define BUFFER_SIZE      5
-static constexpr size_t CHUNK_SAMPLES = 2500;
+// Captures held by the audio ring, and the longest a capture plus the send
+// trigger's hold may take to reach sendTask
+#define RING_CHUNKS      5
+#define LATENCY_BUDGET_MS 400
+
+// The live path's shape; buffer sizes derive from it and the invariants are
+// checked at compile time (Pipeline/pipeline_config.h). A partial send batch
+// is held 200 ms at most.
+typedef PipelineConfig<SAMPLE_RATE, 2500, RING_CHUNKS, MTU_SIZE, 200, LATENCY_BUDGET_MS> LivePipeline;
+static constexpr size_t CHUNK_SAMPLES = LivePipeline::CHUNK_SAMPLES;
 static constexpr size_t BYTES_PER_SAMPLE = sizeof(int16_t);
-static constexpr size_t CHUNK_SIZE_BYTES = CHUNK_SAMPLES * BYTES_PER_SAMPLE;
+static constexpr size_t CHUNK_SIZE_BYTES = LivePipeline::CHUNK_BYTES;
+static constexpr uint32_t CHUNK_DEADLINE_US = LivePipeline::CHUNK_US; // 156 ms
+// Captures can be shortened at runtime (CONTROL_CMD_SET_CHUNK) to trade efficiency for latency
+static constexpr size_t MIN_CHUNK_SAMPLES = 160; // 10 ms at 16 kHz
+
+// Packets fill the negotiated ATT MTU less the 3-byte ATT notification header
+static constexpr size_t MAX_PACKET_BYTES = LivePipeline::MAX_PACKET_BYTES;
+static constexpr uint16_t DEFAULT_ATT_MTU = 23;
+
+// Notifications are paced by completions from the stack instead of a fixed delay.
+// The window is the number of notifications allowed in the stack at once.
+static constexpr uint8_t PACER_INITIAL_WINDOW = 4;
+static constexpr uint8_t PACER_MAX_WINDOW = 12;
+static constexpr uint32_t PACER_COMPLETION_TIMEOUT_MS = 100;
+static constexpr uint32_t PACER_POLL_MS = 5;
+// Connection parameters requested from the central (1.25 ms units, timeout in 10 ms)
+static constexpr uint16_t PREFERRED_CONN_INTERVAL_MIN = 6;   // 7.5 ms
+static constexpr uint16_t PREFERRED_CONN_INTERVAL_MAX = 12;  // 15 ms
+static constexpr uint16_t PREFERRED_CONN_LATENCY = 0;
+static constexpr uint16_t PREFERRED_CONN_TIMEOUT = 400;      // 4 s
+// Largest link-layer payload (data length extension), so a notification takes fewer LL packets
+static constexpr uint16_t PREFERRED_LL_DATA_BYTES = 251;
+
+// Ring holding RING_CHUNKS captures of framed PCM, one packet per slot
+static constexpr size_t AUDIO_RING_SLOTS = LivePipeline::RING_SLOTS; // 51
+
+// Task stacks, reserved at link time; the memory report in diagnostics()
+// shows the headroom each has left
+static constexpr size_t UI_TASK_STACK_BYTES = 3072;
+static constexpr size_t RECORD_TASK_STACK_BYTES = 4096;
+static constexpr size_t SEND_TASK_STACK_BYTES = 4096;
+static constexpr size_t STORAGE_TASK_STACK_BYTES = 4096;
+// Less headroom than this is reported as a warning
+static constexpr size_t STACK_HEADROOM_WARN_BYTES = 512;
+
+// Audio codec applied between recordTask and sendTask.
+// Select with build_flags = -DAUDIO_CODEC=... in platformio.ini
+#define AUDIO_CODEC_PCM    0 // raw 16-bit PCM, 32 KB/s
+#define AUDIO_CODEC_ADPCM  1 // IMA-ADPCM, one block per packet, 8 KB/s
+#define AUDIO_CODEC_LOSSLESS 2 // bit-exact fixed-predictor + Rice blocks, ~16 KB/s on speech
+#ifndef AUDIO_CODEC
+#define AUDIO_CODEC AUDIO_CODEC_PCM
+#endif
+
+// Prefix every notification with the packet header from Protocol/packet.h.
+// Off by default so existing clients keep receiving bare audio.
+#ifndef AUDIO_FRAMING
+#define AUDIO_FRAMING 0
+#endif
+
+// Replace silence with compact markers (needs AUDIO_FRAMING).
+// AUDIO_VAD_AGGRESSIVENESS 0..3: higher suppresses more, at the risk of clipping speech.
+#ifndef AUDIO_VAD
+#define AUDIO_VAD 0
+#endif
+#ifndef AUDIO_VAD_AGGRESSIVENESS
+#define AUDIO_VAD_AGGRESSIVENESS 1
+#endif
+#if AUDIO_VAD && !AUDIO_FRAMING
+#error "AUDIO_VAD requires AUDIO_FRAMING=1: silence markers are framed packets"
+#endif
+static constexpr size_t VAD_FRAME_SAMPLES = CHUNK_SAMPLES / 10; // 15.6 ms
+
+// Clean up the microphone signal before encoding: DC blocker, high-pass and AGC.
+// The level meter driving the on-screen bars runs either way.
+#ifndef AUDIO_DSP
+#define AUDIO_DSP 1
+#endif
+static constexpr float HIGH_PASS_HZ = 80.0f;                      // below the voice fundamental
+static constexpr uint32_t LEVEL_METER_WINDOW_MS = 50;
+
+// Record at 48 kHz with the driver's averaging off and decimate to the
+// stream rate with our own FIR cascade (Dsp/decimator.h), which keeps
+// alarm tones and monitor beeps above the band from aliasing into it.
+// Captures are then at most CHUNK_SAMPLES / 6 samples (52 ms).
+#ifndef AUDIO_OVERSAMPLE
+#define AUDIO_OVERSAMPLE 0
+#endif
+
+// Keep capturing while no client is connected and replay it after reconnecting
+// (needs AUDIO_FRAMING). Audio is held in PSRAM; the oldest part spills to a
+// LittleFS ring log. When both are full the oldest audio is overwritten.
+#ifndef AUDIO_BACKLOG
+#define AUDIO_BACKLOG 0
+#endif
+#ifndef AUDIO_BACKLOG_RAM_BYTES
+#define AUDIO_BACKLOG_RAM_BYTES (3 * 1024 * 1024)  // ~95 s of PCM
+#endif
+#ifndef AUDIO_BACKLOG_FLASH_BYTES
+#define AUDIO_BACKLOG_FLASH_BYTES (512 * 1024)     // 0 keeps the backlog in PSRAM only
+#endif
+#if AUDIO_BACKLOG && !AUDIO_FRAMING
+#error "AUDIO_BACKLOG requires AUDIO_FRAMING=1: replayed audio is placed by its packet header"
+#endif
+// Packets captured with no client fit the smallest MTU phones commonly negotiate (185)
+static constexpr size_t BACKLOG_PACKET_BYTES = 182;
+// PSRAM fill level above which storageTask moves the oldest audio to flash
+static constexpr size_t BACKLOG_SPILL_BYTES = AUDIO_BACKLOG_RAM_BYTES / 4 * 3;
+static constexpr unsigned long BACKLOG_MARK_INTERVAL_MS = 2000;
+
+// When the ring backs up, step the live stream down a quality ladder (half
+// rate, mu-law, silence markers) instead of dropping packets, and back up
+// once the link recovers. Every step is visible in the packet headers.
+#ifndef AUDIO_QUALITY_LADDER
+#define AUDIO_QUALITY_LADDER AUDIO_FRAMING
+#endif
+#if AUDIO_QUALITY_LADDER && !AUDIO_FRAMING
+#error "AUDIO_QUALITY_LADDER requires AUDIO_FRAMING=1: the receiver learns each step from the packet headers"
+#endif
+
+// Also serve clients over Bluetooth Classic SPP, beside BLE. Each client
+// picks its transport by connecting to it; both carry the same packets, back
+// to back on the SPP byte stream.
+#ifndef AUDIO_SPP
+#define AUDIO_SPP 0
+#endif
+#if AUDIO_SPP
+#include "Hal/Device/spp_transport.h"
+#endif
+// The name the app's BluetoothClassicService looks for
+#define SPP_DEVICE_NAME "M5_Serial"
+
+// Also stream to a ward gateway over Wi-Fi, beside BLE: every packet as one
+// UDP datagram to WIFI_GATEWAY_HOST:WIFI_GATEWAY_PORT, while the pendant
+// holds an address. Src/Receiver/udp_receiver.cpp is a reference gateway.
+#ifndef AUDIO_WIFI
+#define AUDIO_WIFI 0
+#endif
+#if AUDIO_WIFI && !AUDIO_FRAMING
+#error "AUDIO_WIFI requires AUDIO_FRAMING=1: the gateway finds loss and order from the packet headers"
+#endif
+#if AUDIO_WIFI
+#include <WiFi.h>
+#include "Hal/udp_transport.h"
+#ifndef WIFI_SSID
+#error "AUDIO_WIFI needs WIFI_SSID and WIFI_PASSWORD in build_flags"
+#endif
+#ifndef WIFI_GATEWAY_HOST
+#error "AUDIO_WIFI needs WIFI_GATEWAY_HOST, the gateway's name or address, in build_flags"
+#endif
+#ifndef WIFI_GATEWAY_PORT
+#define WIFI_GATEWAY_PORT 50005
+#endif
+#endif
+
+// Keep the packets sent to each BLE client for AUDIO_RETRANSMIT_MS and send
+// the ones it NACKs again (CONTROL_CMD_NACK), in the gaps of the live stream
+// (needs AUDIO_FRAMING). The history sits in PSRAM.
+#ifndef AUDIO_RETRANSMIT
+#define AUDIO_RETRANSMIT 0
+#endif
+#ifndef AUDIO_RETRANSMIT_MS
+#define AUDIO_RETRANSMIT_MS 3000
+#endif
+#if AUDIO_RETRANSMIT && !AUDIO_FRAMING
+#error "AUDIO_RETRANSMIT requires AUDIO_FRAMING=1: clients NACK by sequence number"
+#endif
+// Full packets of default-rate PCM in AUDIO_RETRANSMIT_MS, a quarter more for
+// markers and short packets; smaller MTUs or packets cover less time
+static constexpr size_t RETRANSMIT_SLOTS = RetransmitHistory::slotCountFor(
+    (size_t)((uint64_t)AUDIO_RETRANSMIT_MS * SAMPLE_RATE * BYTES_PER_SAMPLE / 1000 /
+             LivePipeline::MIN_PAYLOAD_BYTES * 5 / 4));
+static_assert(RETRANSMIT_SLOTS <= RetransmitHistory::MAX_SLOTS, "AUDIO_RETRANSMIT_MS too long");
+static constexpr size_t RETRANSMIT_STORAGE_BYTES = RetransmitHistory::storageBytes(MAX_PACKET_BYTES, RETRANSMIT_SLOTS);
+
+// Stream 80-band log-mel frames (Dsp/log_mel.h) instead of audio, for
+// gateways that only run speech analytics or keyword spotting: 8 KB/s of
+// frames against 32 KB/s of PCM, computed on core 0 next to the capture.
+// Streams start with features; a client can still switch to audio and back
+// with CONTROL_CMD_SET_FORMAT (AUDIO_ENCODING_LOG_MEL, 16 kHz only). Needs
+// AUDIO_FRAMING.
+#ifndef AUDIO_FEATURES
+#define AUDIO_FEATURES 0
+#endif
+#if AUDIO_FEATURES && !AUDIO_FRAMING
+#error "AUDIO_FEATURES requires AUDIO_FRAMING=1: frames are placed on the timeline by their packet header"
+#endif
 
-// Buffer sized to hold multiple audio chunks
-static constexpr size_t STREAM_BUFFER_SIZE = CHUNK_SIZE_BYTES * BUFFER_SIZE; // Space for 12 chunks
-static constexpr size_t TRIGGER_LEVEL = 500; // Wake receiver when at least 1 chunk is available
+// Flight recorder of task switches and the live path's events on both cores
+// (Hal/Device/trace_recorder.h), to tell which task held up the audio when
+// packets are dropped. The first drop freezes it with as many events after
+// as before, and loop() prints it on the serial console; sending 't' prints
+// it on demand. env:trace_to_chrome turns the dump into a Chrome trace for
+// Perfetto. AUDIO_TRACE_EVENTS per core, 8 bytes each, in internal RAM.
+#ifndef AUDIO_TRACE
+#define AUDIO_TRACE 0
+#endif
+#ifndef AUDIO_TRACE_EVENTS
+#define AUDIO_TRACE_EVENTS 2048
+#endif
+static_assert((AUDIO_TRACE_EVENTS & (AUDIO_TRACE_EVENTS - 1)) == 0, "AUDIO_TRACE_EVENTS must be a power of two");
+#if AUDIO_TRACE
+#define TRACE_EVENT(type, arg) traceRecorder.record(type, arg)
+#define TRACE_CLOCK(mhz) traceRecorder.setClock(mhz)
+#else
+#define TRACE_EVENT(type, arg) ((void)0)
+#define TRACE_CLOCK(mhz) ((void)0)
+#endif
+
+// PCM is captured straight into ring slots unless whole chunks are needed,
+// or the capture is decimated
+#define AUDIO_CAPTURE_IN_PLACE (AUDIO_CODEC == AUDIO_CODEC_PCM && !AUDIO_VAD && !AUDIO_BACKLOG && !AUDIO_OVERSAMPLE)
+
+#if AUDIO_CODEC == AUDIO_CODEC_ADPCM
+static constexpr PacketFormat AUDIO_PACKET_FORMAT = PACKET_FORMAT_ADPCM;
+#define AUDIO_FORMAT_DESCRIPTION "IMA-ADPCM"
+#elif AUDIO_CODEC == AUDIO_CODEC_LOSSLESS
+static constexpr PacketFormat AUDIO_PACKET_FORMAT = PACKET_FORMAT_LOSSLESS;
+#define AUDIO_FORMAT_DESCRIPTION "lossless"
+#else
+static constexpr PacketFormat AUDIO_PACKET_FORMAT = PACKET_FORMAT_PCM16;
+#define AUDIO_FORMAT_DESCRIPTION "PCM16"
+#endif
+
+// How the screen and the log name a negotiated encoding
+static const char* encodingName(uint8_t encoding) {
+  switch (encoding) {
+    case AUDIO_ENCODING_MULAW: return "mu-law";
+    case AUDIO_ENCODING_LOG_MEL: return "log-mel";
+    default: return AUDIO_FORMAT_DESCRIPTION;
+  }
+}
+
+#if AUDIO_VAD && AUDIO_BACKLOG
+#define AUDIO_STREAM_DESCRIPTION "Audio Stream (" AUDIO_FORMAT_DESCRIPTION ", framed v1, VAD, backlog)"
+#elif AUDIO_BACKLOG
+#define AUDIO_STREAM_DESCRIPTION "Audio Stream (" AUDIO_FORMAT_DESCRIPTION ", framed v1, backlog)"
+#elif AUDIO_VAD
+#define AUDIO_STREAM_DESCRIPTION "Audio Stream (" AUDIO_FORMAT_DESCRIPTION ", framed v1, VAD)"
+#elif AUDIO_FRAMING
+#define AUDIO_STREAM_DESCRIPTION "Audio Stream (" AUDIO_FORMAT_DESCRIPTION ", framed v1)"
+#else
+#define AUDIO_STREAM_DESCRIPTION "Audio Stream (" AUDIO_FORMAT_DESCRIPTION ")"
+#endif
 
 // BLE UUIDs (replace with your own for production)
 #define SERVICE_UUID        "4fafc201-1fb5-459e-8fcc-c5c9c331914b"
 #define CHARACTERISTIC_UUID "beb5483e-36e1-4688-b7f5-ea07361b26a8"
+#define CONTROL_CHARACTERISTIC_UUID "beb5483f-36e1-4688-b7f5-ea07361b26a8"
+#define TELEMETRY_CHARACTERISTIC_UUID "beb54840-36e1-4688-b7f5-ea07361b26a8"
+
+// Control characteristic commands, first byte of a write
+#define CONTROL_CMD_START 0x01 // client is subscribed and ready for audio
+#define CONTROL_CMD_SET_CHUNK 0x02   // uint16 samples per capture, MIN_CHUNK_SAMPLES..CHUNK_SAMPLES
+#define CONTROL_CMD_SET_TRIGGER 0x03 // uint8 live packets queued before sendTask starts a batch
+#define CONTROL_CMD_SET_FORMAT 0x04  // AudioFormat (Protocol/audio_format.h), restarts the stream
+#define CONTROL_CMD_NACK 0x05        // pairs of uint16 first sequence, uint16 count, to send again
+
+// Connection state, changed only through postConnectionEvent()
+static ConnectionStateMachine connection;
+static SemaphoreHandle_t connectionLock = nullptr;
+// One bit per ConnectionState, only the current one set; tasks block on these
+static EventGroupHandle_t connectionBits = nullptr;
+static constexpr EventBits_t CONNECTION_ALL_BITS = (1 << CONNECTION_STATE_COUNT) - 1;
 
-// Connection state flag
-static bool clientConnected = false;
+static inline EventBits_t connectionBit(ConnectionState state) {
+  return (EventBits_t)1 << state;
+}
+
+// Packets travel from recordTask to sendTask in place, without copies; each
+// client reads them at its own pace
+static FanoutRing audioRing;
+#if AUDIO_DSP
+static AudioFrontEnd frontEnd;
+#endif
+// Level of the audio being sent, shown by the recording screen
+static LevelMeter levelMeter;
+// Bumped when the first client connects; packets tagged with an older value are stale
+static volatile uint32_t streamGeneration = 0;
+
+// Centrals connected at once, e.g. a phone and a workstation; the
+// controller accepts three by default
+static constexpr size_t MAX_CLIENTS = 3;
+// A client further behind skips its oldest packets, so a slow link never
+// fills the ring for the others
+static constexpr size_t CLIENT_MAX_LAG = AUDIO_RING_SLOTS * 3 / 4;
+
+// One connected central. The BLE callbacks own the link fields; the reader
+// and the send state belong to sendTask.
+struct AudioClient {
+  volatile bool connected = false;
+  AudioTransport* link = nullptr;             // BLE notifications or the SPP stream
+  volatile uint32_t generation = 0;           // bumped for every connection in this slot
+  uint16_t connId = 0;
+  esp_bd_addr_t address = {};
+  volatile uint16_t mtu = DEFAULT_ATT_MTU;
+  volatile bool mtuExchanged = false;
+  volatile uint16_t connInterval = 0;         // 1.25 ms units, 0 until the central reports it
+  volatile int8_t rssi = TELEMETRY_RSSI_UNKNOWN;
+  // Audio notifications; on from the connect, like the CCCD default, until
+  // the client turns them off
+  volatile bool subscribed = false;
+  volatile bool telemetrySubscribed = false;
+  // Decides how many notifications sendTask may hand to the stack for this link
+  NotifyPacer pacer;
+  uint64_t reportSentBytes = 0;  // pacer bytes at loop()'s last report
 
-// FreeRTOS objects
-static StreamBufferHandle_t audioStreamBuffer;
+  uint32_t sendGeneration = 0;                // connection the send state below is for
+  uint8_t reader = FanoutRing::NO_READER;
+  uint16_t sequence = 0;
+  bool sendBatch = false;      // the send trigger was reached; send until caught up
+  uint32_t telemetrySent = 0;  // telemetryVersion last notified
+  uint32_t sentPackets = 0;    // since it subscribed
+  uint32_t oversized = 0;      // live packets too large for its MTU, skipped
+#if AUDIO_BACKLOG
+  bool liveAnnounced = false;
+  bool backlogAnnounced = false;
+  uint32_t backlogStream = 0;
+  bool backlogTurn = false;
+#endif
+#if AUDIO_RETRANSMIT
+  // NACKed by the BLE callbacks, resent by sendTask
+  RetransmitHistory history;
+  bool historyReady = false;
+#endif
+};
+static AudioClient clients[MAX_CLIENTS];
+static volatile uint8_t clientCount = 0;
 BLECharacteristic* pAudioChar;
+// Control characteristic; its value reads back the audio format in effect
+BLECharacteristic* pControlChar;
+// Hardware behind the audio path and the UI, reached only through Hal/ interfaces
+static M5MicSource micSource;
+static BleNotifyTransport audioTransport;
+static BleNotifyTransport telemetryTransport;
+static M5DisplayPanel displayPanel;
+#if AUDIO_SPP
+static SppTransport sppTransport;
+#endif
+#if AUDIO_WIFI
+static UdpTransport udpTransport;
+#endif
+static AudioSource& mic = micSource;
+
+// Telemetry characteristic: a Protocol/telemetry.h snapshot, refreshed by
+// loop() about once a second and notified to subscribed clients
+BLECharacteristic* pTelemetryChar;
+static BLE2902* audioCccd = nullptr;
+static BLE2902* telemetryCccd = nullptr;
+static SemaphoreHandle_t telemetryLock = nullptr;
+static uint8_t telemetryBuffer[TELEMETRY_MAX_BYTES];
+static size_t telemetryBytes = 0;
+// Bumped for every snapshot; sendTask notifies it between audio packets
+static volatile uint32_t telemetryVersion = 0;
+// Tasks reported in the snapshot, with their run time at the last snapshot
+#if configUSE_TRACE_FACILITY && configGENERATE_RUN_TIME_STATS
+#define TELEMETRY_TASK_CPU 1
+static constexpr size_t TELEMETRY_SYSTEM_TASKS = 24;  // room for every task in the system
+static uint32_t telemetryTaskRunTime[TELEMETRY_MAX_TASKS];
+static uint32_t telemetryTotalRunTime = 0;
+#else
+#define TELEMETRY_TASK_CPU 0
+#endif
+static TaskHandle_t telemetryTasks[TELEMETRY_MAX_TASKS];
+static uint8_t telemetryTaskCores[TELEMETRY_MAX_TASKS];
+static size_t telemetryTaskCount = 0;
+
+#if AUDIO_BACKLOG
+// Store-and-forward backlog: PSRAM log in front, flash log behind it holding
+// the oldest audio. Each record is one framed packet tagged with its stream.
+static MemoryLogStorage backlogRamStorage;
+static PacketLog backlogRam;
+static SemaphoreHandle_t backlogRamLock = nullptr;
+static FlashLogStorage backlogFlashStorage;
+static PacketLog backlogFlash;
+static SemaphoreHandle_t backlogFlashLock = nullptr;
+static bool backlogReady = false;
+static bool backlogFlashReady = false;
+static uint32_t streamStartTime = 0;   // identifies the stream in segment markers
+static uint32_t backlogStored = 0;
+static uint32_t backlogSent = 0;
+static uint32_t backlogSpilled = 0;
+static uint32_t backlogDropped = 0;    // too large for the current MTU
+#endif
 
 // Stats for monitoring
 static uint32_t totalChunks = 0;
 static uint32_t droppedBytes = 0;
-static uint32_t bufferHighWatermark = 0;
+static uint32_t droppedPackets = 0;
+static uint32_t sentPackets = 0;
+static uint32_t bufferHighWatermark = 0;   // ring slots
+static uint32_t capturedSamples = 0;
+static uint32_t vadFrames = 0;
+static uint32_t vadSpeechFrames = 0;
+static uint32_t vadSilentSamples = 0;
+static uint64_t encodeCyclesTotal = 0;
+static uint32_t encodeCyclesMax = 0;       // worst packet
+static uint32_t encodeChunkCyclesMax = 0;  // worst chunk, compared against the chunk deadline
+static uint32_t encodedBlocks = 0;         // packets built
+static uint64_t encodedBytes = 0;          // packet bytes built, headers included
+static uint64_t dspCyclesTotal = 0;
+static uint32_t dspSamples = 0;
+#if AUDIO_OVERSAMPLE
+static uint64_t decimateCyclesTotal = 0;
+static uint32_t decimatorOutputs = 0;
+#endif
+#if AUDIO_FEATURES
+static uint64_t featureCyclesTotal = 0;
+static uint32_t featureFrames = 0;
+#endif
 static unsigned long lastReport = 0;
-static bool readyToReceive = false;
 static unsigned long connectionTime = 0;
+// Audio starts when the client says so; this is only the fallback for clients that never do
 static constexpr unsigned long RECORDING_DELAY_MS = 3500; 
 
+// What started the stream on the current connection
+enum StartReason : uint8_t {
+  START_NONE = 0,
+  START_CONTROL,  // CONTROL_CMD_START written
+  START_CCCD,     // notifications enabled on the audio characteristic
+  START_TIMEOUT,  // RECORDING_DELAY_MS elapsed
+  START_SPP,      // an SPP client connected; it has nothing to subscribe to
+  START_WIFI,     // the Wi-Fi gateway became reachable
+};
+static const char* const START_REASON_NAMES[] = { "none", "control", "CCCD", "timeout", "SPP", "Wi-Fi" };
+static volatile StartReason startReason = START_NONE;
+static unsigned long startTime = 0;
+
+// Connect-to-first-packet latency
+static volatile bool firstPacketPending = false;
+static uint32_t firstPacketLatencyMs = 0;     // current connection
+static uint32_t firstPacketLatencyMaxMs = 0;  // since boot
+static uint64_t firstPacketLatencyTotalMs = 0;
+static uint32_t firstPacketConnections = 0;
+
+static inline bool clientConnected() {
+  return connection.connected();
+}
+
+static inline bool streamLive() {
+  return connection.streaming();
+}
+
+//----------------------------------------------------------------------
+// Clients, added and removed under clientLock by the Bluetooth and Wi-Fi
+// event tasks. Those tasks also look clients up and use them under it, so a
+// slot is not reused by the other task in between.
+//----------------------------------------------------------------------
+static SemaphoreHandle_t clientLock = nullptr;
+
+static inline bool isBleClient(const AudioClient& c) {
+  return c.link == &audioTransport;
+}
+
+// Telemetry flag and log name of the client's transport
+static uint8_t clientLinkFlag(const AudioClient& c) {
+#if AUDIO_SPP
+  if (c.link == &sppTransport) return TELEMETRY_CLIENT_SPP;
+#endif
+#if AUDIO_WIFI
+  if (c.link == &udpTransport) return TELEMETRY_CLIENT_WIFI;
+#endif
+  return 0;
+}
+
+static const char* clientLinkName(const AudioClient& c) {
+  switch (clientLinkFlag(c)) {
+    case TELEMETRY_CLIENT_SPP: return "SPP";
+    case TELEMETRY_CLIENT_WIFI: return "Wi-Fi";
+    default: return "BLE";
+  }
+}
+
+// Caller holds clientLock while it uses the client
+static AudioClient* findClient(const AudioTransport* link, uint16_t connId) {
+  for (AudioClient& c : clients) {
+    if (c.connected && c.link == link && c.connId == connId) {
+      return &c;
+    }
+  }
+  return nullptr;
+}
+
+// BLE clients only, for GAP events; caller holds clientLock
+static AudioClient* findClientByAddress(const esp_bd_addr_t address) {
+  for (AudioClient& c : clients) {
+    if (c.connected && isBleClient(c) && memcmp(c.address, address, sizeof(esp_bd_addr_t)) == 0) {
+      return &c;
+    }
+  }
+  return nullptr;
+}
+
+// Takes a free slot for a new connection; nullptr when all are in use
+static AudioClient* addClient(AudioTransport* link, uint16_t connId, const esp_bd_addr_t address) {
+  for (AudioClient& c : clients) {
+    if (c.connected) {
+      continue;
+    }
+    c.link = link;
+    c.connId = connId;
+    memcpy(c.address, address, sizeof(esp_bd_addr_t));
+    // A stream link has no ATT MTU; it takes packets as large as the best BLE link
+    bool ble = link == &audioTransport;
+    c.mtu = ble ? DEFAULT_ATT_MTU : MTU_SIZE;
+    c.mtuExchanged = !ble;
+    c.connInterval = 0;
+    c.rssi = TELEMETRY_RSSI_UNKNOWN;
+    c.subscribed = true;
+    c.telemetrySubscribed = false;
+    // sendTask starts the pacer over when it sees the new generation
+    c.generation++;
+    c.connected = true;
+    clientCount++;
+    return &c;
+  }
+  return nullptr;
+}
+
+static bool removeClient(const AudioTransport* link, uint16_t connId) {
+  AudioClient* c = findClient(link, connId);
+  if (c == nullptr) {
+    return false;
+  }
+  c->connected = false;
+  c->subscribed = false;
+  c->telemetrySubscribed = false;
+  clientCount--;
+  return true;
+}
+
+static bool anySubscribed() {
+  for (const AudioClient& c : clients) {
+    if (c.connected && c.subscribed) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// The first slot in use, usually the client connected longest. It gets the
+// backlog and fills the single-client fields of the telemetry snapshot.
+static AudioClient* primaryClient() {
+  for (AudioClient& c : clients) {
+    if (c.connected) {
+      return &c;
+    }
+  }
+  return nullptr;
+}
+
+// MTU every subscribed client can take. Clients still on the default MTU
+// count only while nobody has exchanged one, so a central that just
+// connected does not shrink the packets of those already listening.
+static uint16_t streamMtu() {
+  uint16_t exchanged = 0;
+  uint16_t any = 0;
+  for (const AudioClient& c : clients) {
+    if (!c.connected || !c.subscribed) {
+      continue;
+    }
+    uint16_t mtu = c.mtu;
+    if (any == 0 || mtu < any) any = mtu;
+    if (c.mtuExchanged && (exchanged == 0 || mtu < exchanged)) exchanged = mtu;
+  }
+  if (exchanged != 0) return exchanged;
+  return any != 0 ? any : DEFAULT_ATT_MTU;
+}
+
 // UI variables
-static unsigned long lastUIUpdate = 0;
 static constexpr unsigned long UI_UPDATE_INTERVAL = 50; // Update UI every 50ms for smoother animation
-static float breathingPhase = 0.0;
+static constexpr unsigned long UI_IDLE_INTERVAL = 200;  // Static screens only poll touch and battery
 static unsigned long lastBatteryCheck = 0;
 static constexpr unsigned long BATTERY_CHECK_INTERVAL = 5000; // Check battery every 5 seconds
 static int batteryPercentage = 100;
-static bool lastClientConnected = false;
-static bool lastReadyToReceive = false;
+static constexpr uint16_t BATTERY_CAPACITY_MAH = 390; // Core2 internal cell
+static ConnectionState lastConnectionState = CONNECTION_ADVERTISING;
 static bool forceFullRedraw = true;
 
+// The screen is composed from off-screen widgets; only what changed is pushed
+static UiCompositor compositor;
+static UiWidget statusWidget;     // central area: logo and text, or the recording label
+static UiWidget batteryWidget;
+static UiWidget bluetoothWidget;
+static UiWidget ringWidget;       // breathing recording circle
+static UiWidget levelWidget;      // audio level bars
+
+// Geometry of the recording screen
+static constexpr int UI_STATUS_TOP = 40;
+static constexpr int UI_RING_BASE_RADIUS = 30;
+static constexpr int UI_RING_MARGIN = 3;     // lighter outer ring
+static constexpr int UI_RING_SIZE = 2 * (UI_RING_BASE_RADIUS + 6 + UI_RING_MARGIN) + 2;
+
+// Breathing offset in pixels, one full cycle every 64 frames (6 * sin)
+static const int8_t BREATHING_TABLE[64] = {
+  0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 5, 6, 6, 6, 6, 6, 6, 6, 6, 6, 5, 5, 5, 4, 4, 3, 3, 2, 2, 1, 1,
+  0, -1, -1, -2, -2, -3, -3, -4, -4, -5, -5, -5, -6, -6, -6, -6, -6, -6, -6, -6, -6, -5, -5, -5, -4, -4, -3, -3, -2, -2, -1, -1
+};
+static uint8_t breathingStep = 0;
+
+// UI cost on core 1
+static uint32_t uiFrames = 0;
+static uint64_t uiBusyUs = 0;
+static uint32_t uiFrameMaxUs = 0;
+static uint64_t lastReportUiBusyUs = 0;
+static uint32_t lastReportUiFrames = 0;
+
+// Gaps between live notifications
+static uint32_t lastSendUs = 0;
+static uint32_t lastSendIntervalUs = 0;
+static uint32_t sendJitterUs = 0;      // smoothed like RFC 3550 interarrival jitter
+static uint32_t sendGapMaxUs = 0;
+
+// Power management: policy runs in loop(), the backlight is driven by uiTask
+static PowerManager powerManager;
+static volatile uint32_t lastActivityMs = 0;  // touch or screen change
+static const uint8_t BACKLIGHT_BRIGHTNESS[BACKLIGHT_COUNT] = { 100, 20, 0 };
+static bool dfsAvailable = false;             // esp_pm dynamic frequency scaling and light sleep
+static constexpr int PM_MIN_CPU_MHZ = 80;     // the radio needs an 80 MHz APB
+static uint32_t captureChunkCyclesMax = 0;    // DSP and encoding of the worst chunk
+static volatile uint32_t captureDeadlineUs = CHUNK_DEADLINE_US;  // duration of the current captures
+
+// Runtime tuning of the live path, set over the control characteristic
+static volatile uint16_t captureChunkSamples = CHUNK_SAMPLES;
+static volatile uint8_t sendTrigger = 1;
+static constexpr uint8_t MAX_SEND_TRIGGER = LivePipeline::MAX_SEND_TRIGGER;
+// A partial batch goes out anyway once its oldest packet has waited this long
+static constexpr uint32_t SEND_TRIGGER_MAX_HOLD_US = LivePipeline::SEND_HOLD_US;
+
+// Audio format requested by the client. recordTask applies it whenever it
+// (re)starts a stream, which a new formatGeneration forces.
+static AudioFormat requestedFormat;
+static SemaphoreHandle_t formatLock = nullptr;
+static volatile uint32_t formatGeneration = 0;
+// Format of the audio being captured now
+static volatile uint32_t streamSampleRate = SAMPLE_RATE;
+static volatile uint8_t streamEncoding = AUDIO_ENCODING_16BIT;
+
+// Packet format of the stream at full quality
+static PacketFormat streamPacketFormat = AUDIO_PACKET_FORMAT;
+
+#if AUDIO_QUALITY_LADDER
+// Overflow policy of the live stream; recordTask owns all of it
+static QualityLadder ladder;
+static QualityLevel packetizerLevel = QUALITY_FULL;  // rung the packetizer is set up for
+static HalfBandDecimator decimator;
+static int16_t decimatedSamples[CHUNK_SAMPLES / 2 + 1];
+static uint32_t ladderSilencedSamples = 0;   // replaced by silence markers since connect
+#endif
+
+#if AUDIO_OVERSAMPLE
+// 48 kHz captures down to the stream rate; recordTask owns it
+static CaptureDecimator captureDecimator;
+#endif
+
+#if AUDIO_FEATURES
+// Log-mel frames in place of audio; recordTask owns both
+static LogMelExtractor logMel;
+static FeaturePacketizer featurePacketizer;
+#endif
+
+// Latency of live audio per stage, since connect. Each histogram is written
+// by one task: PROCESS by recordTask, the others by sendTask.
+static LatencyHistogram latency[TELEMETRY_LATENCY_COUNT];
+static const char* const LATENCY_STAGE_NAMES[TELEMETRY_LATENCY_COUNT] = { "process", "queue", "send", "total" };
+
+// A task whose stack and control block are reserved at link time, in
+// internal RAM, so creating it cannot fail and costs no heap
+template <size_t StackBytes>
+struct StaticTask {
+  // ESP-IDF's FreeRTOS counts stack depth in bytes
+  StackType_t stack[StackBytes / sizeof(StackType_t)];
+  StaticTask_t control;
+
+  TaskHandle_t start(TaskFunction_t task, const char* name, UBaseType_t priority, BaseType_t core) {
+    return xTaskCreateStaticPinnedToCore(task, name, StackBytes, nullptr, priority, stack, &control, core);
+  }
+};
+
+static StaticTask<UI_TASK_STACK_BYTES> uiTaskMemory;
+static StaticTask<RECORD_TASK_STACK_BYTES> recordTaskMemory;
+static StaticTask<SEND_TASK_STACK_BYTES> sendTaskMemory;
+#if AUDIO_BACKLOG
+static StaticTask<STORAGE_TASK_STACK_BYTES> storageTaskMemory;
+#endif
+
 // Task handles
 static TaskHandle_t uiTaskHandle = nullptr; 
+static TaskHandle_t sendTaskHandle = nullptr;
+static TaskHandle_t recordTaskHandle = nullptr;
+static TaskHandle_t storageTaskHandle = nullptr;
+
+// Internal heap once setup() is done; growth past it is churn in steady state
+static size_t setupFreeInternalHeap = 0;
+
+// Creates the widget sprites. The status area (100 KB) changes rarely and
+// lives in PSRAM; the small and animated widgets stay in DMA-capable RAM.
+static bool setupUI() {
+  int width = M5.Display.width();
+  int height = M5.Display.height();
+  int centerX = width / 2;
+  int centerY = height / 2 + 10;
 
-// UI Drawing Functions - Optimized for portrait mode and flicker-free updates
+  displayPanel.begin(&M5.Display);
+  compositor.begin(&displayPanel);
+  bool ok = statusWidget.begin(0, UI_STATUS_TOP, width, height - 2 * UI_STATUS_TOP, true) &&
+            batteryWidget.begin(width - 25 - 35 - 2, 13, 65, 16, false) &&
+            bluetoothWidget.begin(10, 10, 25, 25, false) &&
+            ringWidget.begin(centerX - UI_RING_SIZE / 2, centerY - UI_RING_SIZE / 2,
+                             UI_RING_SIZE, UI_RING_SIZE, false) &&
+            levelWidget.begin(centerX - 25, centerY + 55, 50, 15, false);
+  if (!ok) {
+    return false;
+  }
+  // Bottom to top
+  compositor.add(&statusWidget);
+  compositor.add(&batteryWidget);
+  compositor.add(&bluetoothWidget);
+  compositor.add(&ringWidget);
+  compositor.add(&levelWidget);
+  statusWidget.setVisible(true);
+  batteryWidget.setVisible(true);
+  bluetoothWidget.setVisible(true);
+  return true;
+}
+
+// UI Drawing Functions - each draws into its widget and marks it dirty
 void drawBluetoothIcon(bool connected, bool forceRedraw = false) {
   static bool lastConnectedState = false;
   
@@ -78,44 +794,42 @@ void drawBluetoothIcon(bool connected, bool forceRedraw = false) {
   
   lastConnectedState = connected;
   
-  int x = 15; // Moved to left side
-  int y = 15;
+  M5Canvas& c = bluetoothWidget.canvas();
+  int x = 5;
+  int y = 5;
   
   // Clear the area first
-  M5.Display.fillRect(x - 5, y - 5, 25, 25, UI_BLACK);
+  c.fillScreen(UI_BLACK);
   
   // Draw Bluetooth icon based on SVG path - simplified for small display
   uint16_t iconColor = connected ? UI_BLUE : UI_DARKGREY;
   
   // Draw the Bluetooth symbol (more accurate representation)
   // Main vertical line (thicker for better visibility)
-  M5.Display.drawLine(x + 7, y + 1, x + 7, y + 17, iconColor);
-  M5.Display.drawLine(x + 8, y + 1, x + 8, y + 17, iconColor);
+  c.drawLine(x + 7, y + 1, x + 7, y + 17, iconColor);
+  c.drawLine(x + 8, y + 1, x + 8, y + 17, iconColor);
   
   // Upper triangle/arrow
-  M5.Display.drawLine(x + 7, y + 1, x + 12, y + 5, iconColor);
-  M5.Display.drawLine(x + 12, y + 5, x + 7, y + 9, iconColor);
+  c.drawLine(x + 7, y + 1, x + 12, y + 5, iconColor);
+  c.drawLine(x + 12, y + 5, x + 7, y + 9, iconColor);
   
   // Lower triangle/arrow  
-  M5.Display.drawLine(x + 7, y + 9, x + 12, y + 13, iconColor);
-  M5.Display.drawLine(x + 12, y + 13, x + 7, y + 17, iconColor);
+  c.drawLine(x + 7, y + 9, x + 12, y + 13, iconColor);
+  c.drawLine(x + 12, y + 13, x + 7, y + 17, iconColor);
   
   // Cross lines for the characteristic Bluetooth shape
-  M5.Display.drawLine(x + 4, y + 6, x + 7, y + 9, iconColor);
-  M5.Display.drawLine(x + 7, y + 9, x + 4, y + 12, iconColor);
+  c.drawLine(x + 4, y + 6, x + 7, y + 9, iconColor);
+  c.drawLine(x + 7, y + 9, x + 4, y + 12, iconColor);
   
   // Fill some pixels to make it more solid
-  M5.Display.drawPixel(x + 8, y + 4, iconColor);
-  M5.Display.drawPixel(x + 9, y + 5, iconColor);
-  M5.Display.drawPixel(x + 8, y + 14, iconColor);
-  M5.Display.drawPixel(x + 9, y + 13, iconColor);
+  c.drawPixel(x + 8, y + 4, iconColor);
+  c.drawPixel(x + 9, y + 5, iconColor);
+  c.drawPixel(x + 8, y + 14, iconColor);
+  c.drawPixel(x + 9, y + 13, iconColor);
   
   // Add connection status indicator
-  if (connected) {
-    M5.Display.fillCircle(x + 16, y + 3, 2, UI_GREEN);
-  } else {
-    M5.Display.fillCircle(x + 16, y + 3, 2, UI_RED);
-  }
+  c.fillCircle(x + 16, y + 3, 2, connected ? UI_GREEN : UI_RED);
+  bluetoothWidget.markDirty();
 }
 
 void drawBatteryIcon(int percentage, bool forceRedraw = false) {
@@ -127,18 +841,18 @@ void drawBatteryIcon(int percentage, bool forceRedraw = false) {
   
   lastPercentage = percentage;
   
-  // Move to right side
+  M5Canvas& c = batteryWidget.canvas();
   int width = 25;
   int height = 12;
-  int x = M5.Display.width() - width - 35; // Leave space for percentage text
-  int y = 15;
+  int x = 2;
+  int y = 2;
   
   // Clear the area first
-  M5.Display.fillRect(x - 2, y - 2, width + 40, height + 4, UI_BLACK);
+  c.fillScreen(UI_BLACK);
   
   // Battery outline
-  M5.Display.drawRect(x, y, width, height, UI_WHITE);
-  M5.Display.drawRect(x + width, y + 3, 3, height - 6, UI_WHITE);
+  c.drawRect(x, y, width, height, UI_WHITE);
+  c.drawRect(x + width, y + 3, 3, height - 6, UI_WHITE);
   
   // Battery fill based on percentage
   int fillWidth = (width - 2) * percentage / 100;
@@ -151,103 +865,112 @@ void drawBatteryIcon(int percentage, bool forceRedraw = false) {
   }
   
   if (fillWidth > 0) {
-    M5.Display.fillRect(x + 1, y + 1, fillWidth, height - 2, fillColor);
+    c.fillRect(x + 1, y + 1, fillWidth, height - 2, fillColor);
   }
   
-  // Battery percentage text - now on the right side
-  M5.Display.setTextColor(UI_WHITE);
-  M5.Display.setTextSize(1);
-  M5.Display.setCursor(x + width + 8, y + 3);
-  M5.Display.printf("%d%%", percentage);
+  // Battery percentage text - on the right side
+  c.setTextColor(UI_WHITE);
+  c.setTextSize(1);
+  c.setCursor(x + width + 8, y + 3);
+  c.printf("%d%%", percentage);
+  batteryWidget.markDirty();
 }
 
-void drawRecordingIndicator() {
-  int centerX = M5.Display.width() / 2;
-  int centerY = M5.Display.height() / 2 + 10;
+// Redraws the breathing circle when its radius changes
+static void drawRecordingRing(bool forceRedraw) {
+  static int lastRadius = 0;
   
-  // Clear only the circle area to reduce flicker
-  static int lastBreathingRadius = 0;
-  static bool textDrawn = false;
-  
-  // Reset text drawn flag when function is called for first time in this state
-  static bool wasRecording = false;
-  if (!wasRecording) {
-    textDrawn = false;
-    wasRecording = true;
+  breathingStep = (breathingStep + 1) % 64;
+  int radius = UI_RING_BASE_RADIUS + BREATHING_TABLE[breathingStep];
+  if (!forceRedraw && radius == lastRadius) {
+    return;
   }
   
-  // Calculate breathing effect
-  breathingPhase += 0.10;
-  if (breathingPhase > 2 * PI) {
-    breathingPhase = 0;
-  }
+  M5Canvas& c = ringWidget.canvas();
+  int center = UI_RING_SIZE / 2;
+  int reach = max(radius, lastRadius) + UI_RING_MARGIN + 1;
+  lastRadius = radius;
   
-  // Base radius with breathing effect
-  int baseRadius = 30;
-  int breathingRadius = baseRadius + (int)(6 * sin(breathingPhase));
+  c.fillRect(0, center - reach, UI_RING_SIZE, 2 * reach + 1, UI_BLACK);
+  c.fillCircle(center, center, radius + UI_RING_MARGIN, c.color565(255, 100, 100)); // Light red
+  c.fillCircle(center, center, radius, UI_RED);
+  // Only the rows the old and new circle cover
+  ringWidget.markDirty(0, center - reach, UI_RING_SIZE, 2 * reach + 1);
+}
+
+// Audio level indicator from the level meter
+static void drawLevelBars(bool forceRedraw) {
+  static unsigned long lastBarUpdate = 0;
+  static int lastBarHeight = -1;
+  static uint16_t lastBarColor = 0;
   
-  // Clear previous circle if radius changed significantly
-  if (abs(breathingRadius - lastBreathingRadius) > 1) {
-    int clearRadius = max(lastBreathingRadius, breathingRadius) + 6;
-    M5.Display.fillCircle(centerX, centerY, clearRadius, UI_BLACK);
+  if (!forceRedraw && millis() - lastBarUpdate <= 100) { // Update bars every 100ms
+    return;
   }
-  lastBreathingRadius = breathingRadius;
-  
-  // Draw outer breathing circle (lighter red)
-  uint16_t outerColor = M5.Display.color565(255, 100, 100); // Light red
-  M5.Display.fillCircle(centerX, centerY, breathingRadius + 3, outerColor);
+  lastBarUpdate = millis();
   
-  // Draw main recording circle
-  M5.Display.fillCircle(centerX, centerY, breathingRadius, UI_RED);
-  
-  // Static text - only draw once or when state changes
-  if (!textDrawn) {
-    // Clear text area
-    M5.Display.fillRect(0, centerY + 45, M5.Display.width(), 60, UI_BLACK);
-    
-    // Add recording text below the circle
-    M5.Display.setTextColor(UI_WHITE);
-    M5.Display.setTextSize(1);
-    M5.Display.setTextDatum(MC_DATUM);
-    M5.Display.drawString("RECORDING", centerX, centerY + breathingRadius + 20);
-    textDrawn = true;
+  // Map -60..0 dBFS RMS onto the bar height; red once the peak gets near clipping
+  float rmsDb = LevelMeter::toDbfs(levelMeter.rms());
+  float level = constrain((rmsDb + 60.0f) / 60.0f, 0.0f, 1.0f);
+  uint16_t barColor = LevelMeter::toDbfs(levelMeter.peakHold()) > -1.0f ? UI_RED : UI_GREEN;
+  int barHeight = 2 + (int)(level * 8);
+  if (!forceRedraw && barHeight == lastBarHeight && barColor == lastBarColor) {
+    return;
   }
+  lastBarHeight = barHeight;
+  lastBarColor = barColor;
   
-  // Add audio level indicator (simple animation) - only update bars area
-  static int audioLevel = 0;
-  static unsigned long lastBarUpdate = 0;
-  
-  if (millis() - lastBarUpdate > 100) { // Update bars every 100ms
-    lastBarUpdate = millis();
-    audioLevel = (audioLevel + 1) % 20;
-    
-    // Clear bars area
-    M5.Display.fillRect(centerX - 25, centerY + 55, 50, 15, UI_BLACK);
-    
-    int barHeight = 3 + (audioLevel % 6);
-    for (int i = 0; i < 5; i++) {
-      int barX = centerX - 20 + (i * 10);
-      int barY = centerY + 65;
-      int currentHeight = barHeight - abs(i - 2); // Peak in middle
-      if (currentHeight > 0) {
-        M5.Display.fillRect(barX, barY - currentHeight, 6, currentHeight, UI_GREEN);
-      }
+  M5Canvas& c = levelWidget.canvas();
+  c.fillScreen(UI_BLACK);
+  for (int i = 0; i < 5; i++) {
+    int barX = 5 + (i * 10);
+    int barY = 10;
+    int currentHeight = barHeight - 2 * abs(i - 2); // Peak in middle
+    if (currentHeight > 0) {
+      c.fillRect(barX, barY - currentHeight, 6, currentHeight, barColor);
     }
   }
+  levelWidget.markDirty();
 }
 
-// Function to reset recording state when switching modes
-void resetRecordingTextState() {
-  // This will be called from updateUI when switching from recording mode
+void drawRecordingIndicator(bool forceRedraw) {
+  // The negotiated format is shown above the circle and may change mid-stream
+  static uint32_t lastSampleRate = 0;
+  static uint8_t lastEncoding = 0;
+  uint32_t sampleRate = streamSampleRate;
+  uint8_t encoding = streamEncoding;
+  bool formatChanged = sampleRate != lastSampleRate || encoding != lastEncoding;
+  lastSampleRate = sampleRate;
+  lastEncoding = encoding;
+
+  if (forceRedraw || formatChanged) {
+    // Static labels around the circle, on the status layer
+    M5Canvas& c = statusWidget.canvas();
+    int centerX = c.width() / 2;
+    int centerY = M5.Display.height() / 2 + 10 - UI_STATUS_TOP;
+    c.fillScreen(UI_BLACK);
+    c.setTextColor(UI_WHITE);
+    c.setTextSize(1);
+    c.setTextDatum(MC_DATUM);
+    c.drawString("RECORDING", centerX, centerY + UI_RING_BASE_RADIUS + 20);
+    char format[24];
+    snprintf(format, sizeof(format), "%u kHz %s", sampleRate / 1000, encodingName(encoding));
+    c.setTextColor(UI_LIGHTGREY);
+    c.drawString(format, centerX, centerY - UI_RING_SIZE / 2 - 10);
+    statusWidget.markDirty();
+  }
+  drawRecordingRing(forceRedraw);
+  drawLevelBars(forceRedraw);
 }
 
 void drawConnectionStatus(bool forceRedraw = false) {
   static int lastConnectionState = -1; // -1 = init, 0 = disconnected, 1 = connected, 2 = recording
   
+  ConnectionState state = connection.settledState();
   int currentState = 0;
-  if (clientConnected && readyToReceive) {
+  if (state == CONNECTION_STREAMING) {
     currentState = 2; // Recording
-  } else if (clientConnected) {
+  } else if (state != CONNECTION_ADVERTISING) {
     currentState = 1; // Connected but not ready
   } else {
     currentState = 0; // Disconnected
@@ -259,60 +982,49 @@ void drawConnectionStatus(bool forceRedraw = false) {
   
   lastConnectionState = currentState;
   
-  int centerX = M5.Display.width() / 2;
-  int centerY = M5.Display.height() / 2;
+  M5Canvas& c = statusWidget.canvas();
+  int centerX = c.width() / 2;
+  int centerY = M5.Display.height() / 2 - UI_STATUS_TOP;
   
   // Clear the central area
-  M5.Display.fillRect(0, 40, M5.Display.width(), M5.Display.height() - 80, UI_BLACK);
+  c.fillScreen(UI_BLACK);
   
-  M5.Display.setTextDatum(MC_DATUM); // Middle center
+  c.setTextDatum(MC_DATUM); // Middle center
   
-  if (!clientConnected) {
-    // Draw app icon above the device name (moved higher up)
-    int iconX = centerX - 12; // Center the 23px icon (new logo is 23x24px)
-    int iconY = centerY - 65; // Moved higher up from -50 to -65
-    M5.Display.drawXBitmap(iconX, iconY, epd_bitmap_CareSense, 24, 24, UI_WHITE);
+  if (currentState == 0) {
+    // Draw app icon above the device name
+    int iconX = centerX - 12; // Center the 24px icon
+    int iconY = centerY - 65;
+    c.drawXBitmap(iconX, iconY, epd_bitmap_CareSense, 24, 24, UI_WHITE);
     
     // Draw device name below the icon
-    M5.Display.setTextColor(UI_WHITE);
-    M5.Display.setTextSize(2);
-    M5.Display.drawString("CarePulse", centerX, centerY - 20);
+    c.setTextColor(UI_WHITE);
+    c.setTextSize(2);
+    c.drawString("CarePulse", centerX, centerY - 20);
     
     // Draw connection status
-    M5.Display.setTextColor(UI_LIGHTGREY);
-    M5.Display.setTextSize(1);
-    M5.Display.drawString("Waiting for", centerX, centerY + 10);
-    M5.Display.drawString("connection...", centerX, centerY + 25);
+    c.setTextColor(UI_LIGHTGREY);
+    c.setTextSize(1);
+    c.drawString("Waiting for", centerX, centerY + 10);
+    c.drawString("connection...", centerX, centerY + 25);
     
-  } else if (!readyToReceive) {
-    // Draw app icon above the connected status (moved higher up)
-    int iconX = centerX - 12; // Center the 23px icon (new logo is 23x24px)
-    int iconY = centerY - 65; // Moved higher up from -50 to -65
-    M5.Display.drawXBitmap(iconX, iconY, epd_bitmap_CareSense, 24, 24, UI_GREEN);
+  } else if (currentState == 1) {
+    // Draw app icon above the connected status
+    int iconX = centerX - 12; // Center the 24px icon
+    int iconY = centerY - 65;
+    c.drawXBitmap(iconX, iconY, epd_bitmap_CareSense, 24, 24, UI_GREEN);
     
     // Draw connected status
-    M5.Display.setTextColor(UI_GREEN);
-    M5.Display.setTextSize(2);
-    M5.Display.drawString("Connected", centerX, centerY - 20);
+    c.setTextColor(UI_GREEN);
+    c.setTextSize(2);
+    c.drawString("Connected", centerX, centerY - 20);
     
     // Draw preparation message
-    M5.Display.setTextColor(UI_YELLOW);
-    M5.Display.setTextSize(1);
-    M5.Display.drawString("Preparing audio...", centerX, centerY + 10);
-    
-    // // Show countdown
-    // unsigned long remaining = RECORDING_DELAY_MS - (millis() - connectionTime);
-    // M5.Display.setTextColor(UI_WHITE);
-    // M5.Display.setTextSize(2);
-    // M5.Display.drawString(String(remaining / 1000 + 1) + "s", centerX, centerY + 35);
+    c.setTextColor(UI_YELLOW);
+    c.setTextSize(1);
+    c.drawString("Preparing audio...", centerX, centerY + 10);
   }
-}
-
-// Helper function to reset recording text state
-void resetRecordingState() {
-  static bool* textDrawnPtr = nullptr;
-  // This is a simple way to reset the static variable in drawRecordingIndicator
-  // We'll clear the center area when switching modes
+  statusWidget.markDirty();
 }
 
 void updateBatteryPercentage() {
@@ -339,12 +1051,16 @@ void updateBatteryPercentage() {
 
 void updateUI() {
   // Check if we need a full redraw
-  bool stateChanged = (lastClientConnected != clientConnected) || 
-                     (lastReadyToReceive != readyToReceive) ||
-                     forceFullRedraw;
+  // Where a drain is heading is what the user cares about
+  ConnectionState state = connection.settledState();
+  bool stateChanged = (lastConnectionState != state) || forceFullRedraw;
+  bool recording = state == CONNECTION_STREAMING;
+  
+  // Sprites may still be on their way to the panel
+  compositor.beginFrame();
   
   if (forceFullRedraw) {
-    // Full screen clear only on first run or major state changes
+    // Full screen clear only on first run; widgets cover the rest
     M5.Display.fillScreen(UI_BLACK);
     forceFullRedraw = false;
   }
@@ -356,238 +1072,1872 @@ void updateUI() {
   drawBatteryIcon(batteryPercentage, stateChanged);
   
   // Draw Bluetooth status (only if changed)
-  drawBluetoothIcon(clientConnected, stateChanged);
+  drawBluetoothIcon(state != CONNECTION_ADVERTISING, stateChanged);
   
-  // Draw main content based on state
-  if (clientConnected && readyToReceive) {
-    // Clear connection status area when switching to recording
-    if (stateChanged && !lastReadyToReceive) {
-      M5.Display.fillRect(0, 40, M5.Display.width(), M5.Display.height() - 80, UI_BLACK);
-    }
-    // Show recording indicator with breathing effect (always update for animation)
-    drawRecordingIndicator();
+  // Recording layers sit on top of the status area while audio flows
+  ringWidget.setVisible(recording);
+  levelWidget.setVisible(recording);
+  if (recording) {
+    // Breathing circle and level bars redraw only when they change
+    drawRecordingIndicator(stateChanged);
   } else {
-    // Clear any recording remnants when switching from recording
-    if (stateChanged && lastReadyToReceive) {
-      M5.Display.fillRect(0, 40, M5.Display.width(), M5.Display.height() - 80, UI_BLACK);
-    }
     // Show connection status (only if state changed)
     drawConnectionStatus(stateChanged);
   }
   
+  compositor.flush();
+  
   // Update state tracking
-  lastClientConnected = clientConnected;
-  lastReadyToReceive = readyToReceive;
+  lastConnectionState = state;
+}
+
+// Dims or blanks the panel; a blanked panel also sleeps
+static void setBacklight(Backlight level, Backlight previous) {
+  if (previous == BACKLIGHT_OFF) {
+    displayPanel.wakeup();
+  }
+  displayPanel.setBrightness(BACKLIGHT_BRIGHTNESS[level]);
+  if (level == BACKLIGHT_OFF) {
+    displayPanel.sleep();
+  }
 }
 
 //----------------------------------------------------------------------
 // Task: uiTask
-//   - Handles all UI updates and rendering
+//   - Draws the widgets off-screen and pushes the changed rows by DMA
+//   - Dims and blanks the backlight after a while without activity
 //   - Runs at lower priority than audio tasks
 //----------------------------------------------------------------------
 void uiTask(void* pv) {
   // Initialize UI on this task
   forceFullRedraw = true;
+  if (!setupUI()) {
+    M5.Log(ESP_LOG_ERROR ,"Failed to allocate UI sprites, display disabled");
+    vTaskDelete(nullptr);
+    return;
+  }
+  
+  Backlight backlight = BACKLIGHT_ON;
+  lastActivityMs = millis();
   
   while (true) {
-    // Update UI with optimized rendering
-    updateUI();
+    // Touches and screen changes keep the backlight on
+    M5.update();
+    bool stateChanged = lastConnectionState != connection.settledState();
+    if (stateChanged || M5.Touch.getCount() > 0) {
+      lastActivityMs = millis();
+    }
+    Backlight wanted = PowerManager::backlightFor(millis() - lastActivityMs);
+    if (wanted != backlight) {
+      compositor.beginFrame();
+      setBacklight(wanted, backlight);
+      backlight = wanted;
+    }
     
-    // UI task delay - 50ms for smooth animation
-    vTaskDelay(pdMS_TO_TICKS(50));
+    // Nothing is drawn while the panel is blanked
+    if (backlight != BACKLIGHT_OFF) {
+      // Update UI and account for its cost on this core
+      uint32_t frameStart = micros();
+      TRACE_EVENT(TRACE_UI_FRAME_BEGIN, 0);
+      updateUI();
+      TRACE_EVENT(TRACE_UI_FRAME_END, 0);
+      uint32_t frameUs = micros() - frameStart;
+      uiFrames++;
+      uiBusyUs += frameUs;
+      if (frameUs > uiFrameMaxUs) {
+        uiFrameMaxUs = frameUs;
+      }
+    }
+    
+    // 50ms for smooth animation while recording; otherwise only touch and
+    // the battery need polling, and state changes wake us early
+    bool animating = streamLive() && backlight != BACKLIGHT_OFF;
+    ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(animating ? UI_UPDATE_INTERVAL : UI_IDLE_INTERVAL));
   }
 }
 
-// Modify the BLE Server Callbacks to reset the ready state
-class ServerCallbacks: public BLEServerCallbacks {
-    void onConnect(BLEServer* pServer) {
-        clientConnected = true;
-        readyToReceive = false;  // Not ready to receive immediately
-        connectionTime = millis(); // Record the connection time
-        
-        M5.Log(ESP_LOG_INFO ,"Client connected - preparing audio stream...");
-        // Clear the stream buffer when a new client connects
-        xStreamBufferReset(audioStreamBuffer);
-        // Reset stats on new connection
-        totalChunks = 0;
-        droppedBytes = 0;
-        bufferHighWatermark = 0;
-    }
-    
-    void onDisconnect(BLEServer* pServer) {
-        clientConnected = false;
-        readyToReceive = false;
-        M5.Log(ESP_LOG_INFO,"Client disconnected - stopping audio streaming");
-        // Restart advertising so new clients can connect
-        BLEDevice::startAdvertising();
-    }
-};
+static void wakeTask(TaskHandle_t task) {
+  if (task != nullptr) {
+    xTaskNotifyGive(task);
+  }
+}
 
+// Applies an event to the connection state and publishes the new state to
+// the tasks blocked on it. Called from the BLE stack's task and recordTask.
+static bool postConnectionEvent(ConnectionEvent event) {
+  xSemaphoreTake(connectionLock, portMAX_DELAY);
+  ConnectionState before = connection.state();
+  bool changed = connection.handle(event);
+  ConnectionState after = connection.state();
+  if (after != before) {
+    xEventGroupClearBits(connectionBits, CONNECTION_ALL_BITS & ~connectionBit(after));
+    xEventGroupSetBits(connectionBits, connectionBit(after));
+  }
+  xSemaphoreGive(connectionLock);
 
-//----------------------------------------------------------------------
-// Task: recordTask
-//   - Blocks on M5.Mic.record() only when a client is connected
-//   - Writes audio data directly to the stream buffer
-//----------------------------------------------------------------------
-// Modify recordTask to check the ready state
-void recordTask(void* pv) {
-  // Single recording buffer - no need for multiple buffers now
-  int16_t* recordBuffer = (int16_t*)malloc(CHUNK_SIZE_BYTES);
-  if (recordBuffer == nullptr) {
-    M5.Log(ESP_LOG_ERROR ,"Failed to allocate record buffer");
+  if (changed) {
+    M5.Log(ESP_LOG_DEBUG ,"Connection %s -> %s (%s, settles %s)",
+                 ConnectionStateMachine::stateName(before), ConnectionStateMachine::stateName(after),
+                 ConnectionStateMachine::eventName(event),
+                 ConnectionStateMachine::stateName(connection.settledState()));
+    // sendTask also sleeps on packets and uiTask on its frame timer
+    wakeTask(sendTaskHandle);
+    wakeTask(uiTaskHandle);
+  }
+  return changed;
+}
+
+// Blocks until the connection is in one of states or the timeout expires
+static ConnectionState waitForConnectionState(EventBits_t states, TickType_t timeout) {
+  xEventGroupWaitBits(connectionBits, states, pdFALSE, pdFALSE, timeout);
+  return connection.state();
+}
+
+// Lets audio flow on the current connection
+static void startStreaming(StartReason reason) {
+  if (!postConnectionEvent(CONNECTION_EVENT_START)) {
     return;
   }
-  
-  while (true) {
-    // Check if client is connected but not yet ready to receive
-    if (clientConnected && !readyToReceive) {
-      // Check if delay period has elapsed
-      if (millis() - connectionTime >= RECORDING_DELAY_MS) {
-        readyToReceive = true;
-        M5.Log(ESP_LOG_VERBOSE ,"Starting audio recording now");
-      } else {
-        // Still in delay period, sleep briefly and check again
-        vTaskDelay(pdMS_TO_TICKS(100));
-        continue;
-      }
-    }
-    
-    // Only record when connected AND ready to receive
-    if (clientConnected && readyToReceive) {
-      if (M5.Mic.record(recordBuffer, CHUNK_SAMPLES, SAMPLE_RATE, CHANNELS)) {
-        totalChunks++;
-        
-        // Write the data in chunks of TRIGGER_LEVEL bytes
-        size_t totalBytesWritten = 0;
-        size_t bytesRemaining = CHUNK_SIZE_BYTES;
-        uint8_t* byteBuffer = (uint8_t*)recordBuffer;
-        
-        while (bytesRemaining > 0) {
-          // Determine size of this chunk
-          size_t chunkSize = (bytesRemaining > TRIGGER_LEVEL) ? TRIGGER_LEVEL : bytesRemaining;
-          
-          // Write chunk to the stream buffer
-          size_t bytesWritten = xStreamBufferSend(
-                                  audioStreamBuffer, 
-                                  byteBuffer + totalBytesWritten,
-                                  chunkSize, 
-                                  pdMS_TO_TICKS(50)); // Allow up to 50ms to write
-          
-          totalBytesWritten += bytesWritten;
-          bytesRemaining -= bytesWritten;
-          
-          if (bytesWritten < chunkSize) {
-            droppedBytes += (chunkSize - bytesWritten);
-            M5.Log(ESP_LOG_VERBOSE ,"Stream buffer full! Dropped %u bytes\n", 
-                         (chunkSize - bytesWritten));
-            
-            // If we couldn't write the whole chunk, no point trying more
-            break;
-          }
-        }
-        
-        // Track high watermark of stream buffer usage
-        size_t bytesAvailable = xStreamBufferBytesAvailable(audioStreamBuffer);
-        if (bytesAvailable > bufferHighWatermark) {
-          bufferHighWatermark = bytesAvailable;
-          M5.Log(ESP_LOG_VERBOSE ,"New buffer high watermark: %u/%u bytes\n", 
-                       bufferHighWatermark, STREAM_BUFFER_SIZE);
-        }
-      }
-    } else {
-      // When no client is connected or not ready, just wait and check again
-      vTaskDelay(pdMS_TO_TICKS(100));
+  startReason = reason;
+  startTime = millis();
+  M5.Log(ESP_LOG_INFO ,"Starting audio (%s) %u ms after connect",
+               START_REASON_NAMES[reason], startTime - connectionTime);
+}
+
+// Called by sendTask after every live packet; tracks how evenly they go out
+static void noteSendTiming() {
+  uint32_t now = micros();
+  if (lastSendUs != 0) {
+    uint32_t interval = now - lastSendUs;
+    if (interval > sendGapMaxUs) {
+      sendGapMaxUs = interval;
     }
+    int32_t change = (int32_t)(interval - lastSendIntervalUs);
+    if (change < 0) change = -change;
+    sendJitterUs += ((int32_t)change - (int32_t)sendJitterUs) / 16;
+    lastSendIntervalUs = interval;
   }
+  lastSendUs = now;
 }
 
-// Also modify sendTask to check the ready state
-void sendTask(void* pv) {
-  // Buffer to hold data received from the stream buffer
-  uint8_t* txBuffer = (uint8_t*)malloc(TRIGGER_LEVEL);
-  if (txBuffer == nullptr) {
-    M5.Log(ESP_LOG_ERROR ,"Failed to allocate TX buffer");
+// Called by sendTask after every packet; measures the first one per connection
+static void noteFirstPacket() {
+  if (!firstPacketPending) {
     return;
   }
-  
-  while (true) {
-    if (clientConnected && readyToReceive) {
-      // Wait for TRIGGER_LEVEL bytes of data in the stream buffer
-      size_t bytesReceived = xStreamBufferReceive(
-                              audioStreamBuffer,
-                              txBuffer,
-                              TRIGGER_LEVEL,
-                              pdMS_TO_TICKS(100));
-      
-      if (bytesReceived > 0) {
-        // Send the entire chunk immediately
-        pAudioChar->setValue(txBuffer, bytesReceived);
-        pAudioChar->notify();
-        
-        // Small yield to let BLE stack work
-        M5.delay(4);
-      }
-    } else {
-      vTaskDelay(pdMS_TO_TICKS(100));
+  firstPacketPending = false;
+  firstPacketLatencyMs = millis() - connectionTime;
+  firstPacketLatencyTotalMs += firstPacketLatencyMs;
+  firstPacketConnections++;
+  if (firstPacketLatencyMs > firstPacketLatencyMaxMs) {
+    firstPacketLatencyMaxMs = firstPacketLatencyMs;
+  }
+  M5.Log(ESP_LOG_INFO ,"First audio packet %u ms after connect (start: %s)",
+               firstPacketLatencyMs, START_REASON_NAMES[startReason]);
+}
+
+// Capture length for a frame duration, within what the chunk buffers hold
+static uint16_t chunkSamplesFor(uint32_t sampleRate, uint32_t frameMs) {
+  uint32_t samples = sampleRate * frameMs / 1000;
+  if (samples < MIN_CHUNK_SAMPLES) samples = MIN_CHUNK_SAMPLES;
+  if (samples > CHUNK_SAMPLES) samples = CHUNK_SAMPLES;
+  return (uint16_t)samples;
+}
+
+// Publishes the format in effect as the value of the control characteristic
+static void updateControlValue() {
+  AudioFormat format;
+  format.sampleRate = streamSampleRate;
+  format.encoding = streamEncoding;
+  format.frameMs = (uint16_t)(captureChunkSamples * 1000UL / format.sampleRate);
+  uint8_t value[AUDIO_FORMAT_BYTES];
+  audioFormatEncode(format, value);
+  pControlChar->setValue(value, sizeof(value));
+}
+
+// Queues a client's format; recordTask switches to it by restarting the stream
+static void requestFormat(const AudioFormat& format) {
+  xSemaphoreTake(formatLock, portMAX_DELAY);
+  requestedFormat = format;
+  formatGeneration++;
+  xSemaphoreGive(formatLock);
+  M5.Log(ESP_LOG_INFO ,"Audio format requested: %u Hz, %s, %u ms frames", format.sampleRate,
+               format.encoding == AUDIO_ENCODING_16BIT ? "16-bit" : encodingName(format.encoding), format.frameMs);
+}
+
+#if AUDIO_RETRANSMIT
+// Queues the ranges of a CONTROL_CMD_NACK for the client that wrote it
+static void nackPackets(uint16_t connId, const uint8_t* ranges, size_t length) {
+  xSemaphoreTake(clientLock, portMAX_DELAY);
+  AudioClient* client = findClient(&audioTransport, connId);
+  if (client == nullptr || !client->historyReady) {
+    xSemaphoreGive(clientLock);
+    return;
+  }
+  for (; length >= 4; ranges += 4, length -= 4) {
+    uint16_t first = ranges[0] | (ranges[1] << 8);
+    uint16_t count = ranges[2] | (ranges[3] << 8);
+    if (!client->history.nack(first, count)) {
+      break;
     }
   }
+  xSemaphoreGive(clientLock);
+  wakeTask(sendTaskHandle);
 }
+#endif
 
-void setup() {
-  Serial.begin(115200);
-  M5.begin();
-  M5.Speaker.end();
-  
-  // Initialize display for UI - Portrait mode optimizations
-  //M5.Display.setRotation(0); // Portrait mode
-  M5.Display.setBrightness(100);
-  M5.Display.fillScreen(UI_BLACK);
-  M5.Display.setTextColor(UI_WHITE);
-  M5.Display.setSwapBytes(true); // Fix for some color issues
-  M5.Display.startWrite(); // Keep SPI bus open for faster updates
-  M5.Display.fillScreen(UI_BLACK);
-  M5.Display.endWrite();
-  
-  setupLogging();
+// Client writes to the control characteristic
+class ControlCallbacks: public BLECharacteristicCallbacks {
+    void onWrite(BLECharacteristic* pCharacteristic, esp_ble_gatts_cb_param_t* param) {
+        if (pCharacteristic->getLength() == 0) {
+            return;
+        }
+        const uint8_t* data = pCharacteristic->getData();
+        size_t length = pCharacteristic->getLength();
+        uint8_t command = data[0];
+        if (command == CONTROL_CMD_START) {
+            startStreaming(START_CONTROL);
+        } else if (command == CONTROL_CMD_SET_CHUNK && length >= 3) {
+            // Taken by recordTask with its next capture
+            uint16_t samples = data[1] | (data[2] << 8);
+            if (samples < MIN_CHUNK_SAMPLES) samples = MIN_CHUNK_SAMPLES;
+            if (samples > CHUNK_SAMPLES) samples = CHUNK_SAMPLES;
+            captureChunkSamples = samples;
+        } else if (command == CONTROL_CMD_SET_TRIGGER && length >= 2) {
+            uint8_t packets = data[1];
+            if (packets < 1) packets = 1;
+            if (packets > MAX_SEND_TRIGGER) packets = MAX_SEND_TRIGGER;
+            sendTrigger = packets;
+            M5.Log(ESP_LOG_INFO ,"Send trigger %u packets", packets);
+        } else if (command == CONTROL_CMD_SET_FORMAT) {
+            AudioFormat format;
+            // Features are only offered by builds that compute them
+            if (audioFormatDecode(data + 1, length - 1, format) &&
+                (AUDIO_FEATURES || format.encoding != AUDIO_ENCODING_LOG_MEL)) {
+                requestFormat(format);
+            } else {
+                M5.Log(ESP_LOG_WARN ,"Unsupported audio format request");
+            }
+#if AUDIO_RETRANSMIT
+        } else if (command == CONTROL_CMD_NACK) {
+            // Per client, unlike the other commands
+            nackPackets(param->write.conn_id, data + 1, length - 1);
+#endif
+        } else {
+            M5.Log(ESP_LOG_WARN ,"Unknown control command 0x%02x", command);
+        }
+        // The write replaced the value; reads report the format in effect
+        updateControlValue();
+    }
+};
 
-  // Create stream buffer for audio data
-  audioStreamBuffer = xStreamBufferCreate(
-                       STREAM_BUFFER_SIZE,   // Total buffer size in bytes
-                       TRIGGER_LEVEL+TRIGGER_LEVEL);       // Minimum bytes before receiver is unblocked
-  
-  if (audioStreamBuffer == NULL) {
-    M5.Log(ESP_LOG_ERROR ,"Failed to create stream buffer");
-    while (1) delay(100);
+// A client wrote a CCCD. The BLE2902 objects hold one value for all
+// clients, so subscriptions are tracked per connection here.
+static void onCccdWrite(uint16_t connId, uint16_t handle, const uint8_t* value, size_t length) {
+  if (length < 1) {
+    return;
   }
+  bool notify = (value[0] & 0x01) != 0;
+  bool audio = audioCccd != nullptr && handle == audioCccd->getHandle();
+  bool telemetry = telemetryCccd != nullptr && handle == telemetryCccd->getHandle();
+  xSemaphoreTake(clientLock, portMAX_DELAY);
+  AudioClient* client = findClient(&audioTransport, connId);
+  if (client == nullptr || !(audio || telemetry)) {
+    xSemaphoreGive(clientLock);
+    return;
+  }
+  if (telemetry) {
+    client->telemetrySubscribed = notify;
+    xSemaphoreGive(clientLock);
+    return;
+  }
+  client->subscribed = notify;
+  bool listened = anySubscribed();
+  xSemaphoreGive(clientLock);
+  M5.Log(ESP_LOG_INFO ,"Client %u %s audio", connId, notify ? "subscribed to" : "unsubscribed from");
+  if (notify) {
+    postConnectionEvent(CONNECTION_EVENT_SUBSCRIBE);
+    startStreaming(START_CCCD);
+  } else if (!listened) {
+    // The stream stops only once nobody listens
+    postConnectionEvent(CONNECTION_EVENT_UNSUBSCRIBE);
+  }
+}
 
-  // init Mic
-  if (!M5.Mic.begin()) {
-    M5.Log(ESP_LOG_ERROR ,"Mic init failed");
-    while (1) delay(100);
+// Completions and congestion drive the pacer of their connection
+static void gattsEventHandler(esp_gatts_cb_event_t event, esp_gatt_if_t gattsIf, esp_ble_gatts_cb_param_t* param) {
+  AudioClient* client;
+  switch (event) {
+    case ESP_GATTS_CONNECT_EVT:
+      audioTransport.setInterface(gattsIf);
+      telemetryTransport.setInterface(gattsIf);
+      return;
+    case ESP_GATTS_WRITE_EVT:
+      if (!param->write.is_prep) {
+        onCccdWrite(param->write.conn_id, param->write.handle, param->write.value, param->write.len);
+      }
+      return;
+    case ESP_GATTS_CONF_EVT:
+      xSemaphoreTake(clientLock, portMAX_DELAY);
+      client = findClient(&audioTransport, param->conf.conn_id);
+      if (client != nullptr) {
+        client->pacer.onComplete(param->conf.status == ESP_GATT_OK);
+      }
+      xSemaphoreGive(clientLock);
+      break;
+    case ESP_GATTS_CONGEST_EVT:
+      xSemaphoreTake(clientLock, portMAX_DELAY);
+      client = findClient(&audioTransport, param->congest.conn_id);
+      if (client != nullptr) {
+        client->pacer.onCongestion(param->congest.congested);
+      }
+      xSemaphoreGive(clientLock);
+      break;
+    default:
+      return;
   }
+  if (sendTaskHandle != nullptr) {
+    xTaskNotifyGive(sendTaskHandle);
+  }
+}
 
-  // set up BLE
-  BLEDevice::init("CareSense"); // Device name
-  BLEDevice::setMTU(MTU_SIZE);
+static void gapEventHandler(esp_gap_ble_cb_event_t event, esp_ble_gap_cb_param_t* param) {
+  if (event == ESP_GAP_BLE_UPDATE_CONN_PARAMS_EVT) {
+    xSemaphoreTake(clientLock, portMAX_DELAY);
+    AudioClient* client = findClientByAddress(param->update_conn_params.bda);
+    if (client != nullptr) {
+      client->connInterval = param->update_conn_params.conn_int;
+      M5.Log(ESP_LOG_INFO ,"Client %u: connection interval %.2f ms, latency %u", client->connId,
+                   client->connInterval * 1.25f, param->update_conn_params.latency);
+    }
+    xSemaphoreGive(clientLock);
+  } else if (event == ESP_GAP_BLE_READ_RSSI_COMPLETE_EVT) {
+    // Requested by publishTelemetry()
+    xSemaphoreTake(clientLock, portMAX_DELAY);
+    AudioClient* client = findClientByAddress(param->read_rssi_cmpl.remote_addr);
+    if (client != nullptr && param->read_rssi_cmpl.status == ESP_BT_STATUS_SUCCESS) {
+      client->rssi = param->read_rssi_cmpl.rssi;
+    }
+    xSemaphoreGive(clientLock);
+  }
+}
 
-  BLEServer* srv = BLEDevice::createServer();
-  
-  // Add connection callback handler
-  srv->setCallbacks(new ServerCallbacks());
-  
-  BLEService* svc = srv->createService(SERVICE_UUID);
-  pAudioChar = svc->createCharacteristic(CHARACTERISTIC_UUID, BLECharacteristic::PROPERTY_NOTIFY);
-  // Add descriptor for CCCD (Client Characteristic Configuration Descriptor)
-// This is required for notifications to work properly on Android
-BLE2902* p2902 = new BLE2902();
-p2902->setNotifications(true);
-pAudioChar->addDescriptor(p2902);
+// Registers a new connection on either transport; nullptr when every client
+// slot is taken. The stream and its statistics start over only with the
+// first client of a session.
+static AudioClient* connectClient(AudioTransport* link, uint16_t connId, const esp_bd_addr_t address) {
+  xSemaphoreTake(clientLock, portMAX_DELAY);
+  AudioClient* client = addClient(link, connId, address);
+  if (client == nullptr) {
+    xSemaphoreGive(clientLock);
+    M5.Log(ESP_LOG_WARN ,"No room for client %u, disconnecting", connId);
+    return nullptr;
+  }
+  M5.Log(ESP_LOG_INFO ,"%s client %u connected (%u of %u)", clientLinkName(*client),
+               client->connId, clientCount, MAX_CLIENTS);
 
+  if (clientCount == 1) {
+    connectionTime = millis(); // Record the connection time
+    startReason = START_NONE;
+    firstPacketPending = true;
+    M5.Log(ESP_LOG_INFO ,"First client - preparing audio stream...");
+    // Anything still queued belongs to the previous session; sendTask skips it
+    streamGeneration++;
+    // Reset stats on new session
+    totalChunks = 0;
+    capturedSamples = 0;
+    vadFrames = 0;
+    vadSpeechFrames = 0;
+    vadSilentSamples = 0;
+    droppedBytes = 0;
+    droppedPackets = 0;
+    sentPackets = 0;
+    bufferHighWatermark = 0;
+    encodeCyclesTotal = 0;
+    encodeCyclesMax = 0;
+    encodeChunkCyclesMax = 0;
+    encodedBlocks = 0;
+    encodedBytes = 0;
+    captureChunkCyclesMax = 0;
+    dspCyclesTotal = 0;
+    dspSamples = 0;
+#if AUDIO_OVERSAMPLE
+    decimateCyclesTotal = 0;
+    decimatorOutputs = 0;
+#endif
+#if AUDIO_FEATURES
+    featureCyclesTotal = 0;
+    featureFrames = 0;
+#endif
+    audioRing.resetStats();
+    lastSendUs = 0;
+    sendJitterUs = 0;
+    sendGapMaxUs = 0;
+    for (size_t stage = 0; stage < TELEMETRY_LATENCY_COUNT; stage++) {
+      latency[stage].reset();
+    }
+#if AUDIO_QUALITY_LADDER
+    ladder.resetStats();
+    ladderSilencedSamples = 0;
+#endif
+  }
+  // Not streaming yet with the first client; recordTask runs the start fallback
+  postConnectionEvent(CONNECTION_EVENT_CONNECT);
+  xSemaphoreGive(clientLock);
+  return client;
+}
 
-// Add user-friendly description (helps with debugging in BLE scanner apps)
-BLEDescriptor* pDesc = new BLEDescriptor(BLEUUID((uint16_t)0x2901));
-pDesc->setValue("Audio Stream");
-pAudioChar->addDescriptor(pDesc);
+// The others keep streaming; sendTask detaches the client's reader
+static bool disconnectClient(const AudioTransport* link, uint16_t connId) {
+  xSemaphoreTake(clientLock, portMAX_DELAY);
+  if (!removeClient(link, connId)) {
+    xSemaphoreGive(clientLock);
+    return false;
+  }
+  M5.Log(ESP_LOG_INFO,"Client %u disconnected, %u left", connId, clientCount);
+  if (clientCount == 0) {
+    // recordTask drains the capture before the link is idle again
+    postConnectionEvent(CONNECTION_EVENT_DISCONNECT);
+    M5.Log(ESP_LOG_INFO,"Last client gone - stopping audio streaming");
+  } else if (!anySubscribed()) {
+    postConnectionEvent(CONNECTION_EVENT_UNSUBSCRIBE);
+  }
+  xSemaphoreGive(clientLock);
+  return true;
+}
+
+// Clients connect and leave independently
+class ServerCallbacks: public BLEServerCallbacks {
+    void onConnect(BLEServer* pServer, esp_ble_gatts_cb_param_t* param) {
+        if (connectClient(&audioTransport, param->connect.conn_id, param->connect.remote_bda) == nullptr) {
+            pServer->disconnect(param->connect.conn_id);
+            return;
+        }
+        // Shorter connection events and longer LL packets carry more notifications per second
+        pServer->updateConnParams(param->connect.remote_bda, PREFERRED_CONN_INTERVAL_MIN,
+                                  PREFERRED_CONN_INTERVAL_MAX, PREFERRED_CONN_LATENCY,
+                                  PREFERRED_CONN_TIMEOUT);
+        esp_ble_gap_set_pkt_data_len(param->connect.remote_bda, PREFERRED_LL_DATA_BYTES);
+        // Stay visible while there is room for another central
+        if (clientCount < MAX_CLIENTS) {
+            BLEDevice::startAdvertising();
+        }
+    }
+    
+    void onDisconnect(BLEServer* pServer, esp_ble_gatts_cb_param_t* param) {
+        if (!disconnectClient(&audioTransport, param->disconnect.conn_id)) {
+            return;
+        }
+        // Restart advertising so new clients can connect
+        BLEDevice::startAdvertising();
+    }
+
+    void onMtuChanged(BLEServer* pServer, esp_ble_gatts_cb_param_t* param) {
+        xSemaphoreTake(clientLock, portMAX_DELAY);
+        AudioClient* client = findClient(&audioTransport, param->mtu.conn_id);
+        if (client != nullptr) {
+            client->mtu = param->mtu.mtu;
+            client->mtuExchanged = true;
+            M5.Log(ESP_LOG_INFO, "Client %u: MTU negotiated: %u bytes", client->connId, client->mtu);
+        }
+        xSemaphoreGive(clientLock);
+    }
+};
+
+
+#if AUDIO_SPP
+// SPP clients have nothing to subscribe to, so their audio starts with the
+// connection. Runs in the Bluetooth task, like the BLE callbacks.
+static void sppEventHandler(esp_spp_cb_event_t event, esp_spp_cb_param_t* param) {
+  if (event == ESP_SPP_SRV_OPEN_EVT) {
+    if (connectClient(&sppTransport, (uint16_t)param->srv_open.handle, param->srv_open.rem_bda) == nullptr) {
+      esp_spp_disconnect(param->srv_open.handle);
+      return;
+    }
+    postConnectionEvent(CONNECTION_EVENT_SUBSCRIBE);
+    startStreaming(START_SPP);
+  } else if (event == ESP_SPP_CLOSE_EVT) {
+    if (disconnectClient(&sppTransport, (uint16_t)param->close.handle)) {
+      // A BLE central may take the freed slot
+      BLEDevice::startAdvertising();
+    }
+  }
+}
+#endif
+
+#if AUDIO_WIFI
+// The gateway is a client like the BLE centrals, there while the pendant
+// holds an address; the socket stays open across reconnects. Runs in the
+// Arduino event task.
+static void onWifiEvent(arduino_event_id_t event, arduino_event_info_t info) {
+  static const esp_bd_addr_t noAddress = {};
+  if (event == ARDUINO_EVENT_WIFI_STA_GOT_IP) {
+    M5.Log(ESP_LOG_INFO ,"Wi-Fi up as %s", WiFi.localIP().toString().c_str());
+    if (!udpTransport.isOpen() && !udpTransport.open(WIFI_GATEWAY_HOST, WIFI_GATEWAY_PORT)) {
+      M5.Log(ESP_LOG_ERROR ,"Gateway %s:%u unreachable", WIFI_GATEWAY_HOST, WIFI_GATEWAY_PORT);
+      return;
+    }
+    // GOT_IP comes again on a lease renewal or address change without a
+    // disconnect in between; the gateway keeps its slot. Only this task adds
+    // or removes it, so the answer holds after the lock is given back.
+    xSemaphoreTake(clientLock, portMAX_DELAY);
+    bool already = findClient(&udpTransport, 0) != nullptr;
+    xSemaphoreGive(clientLock);
+    if (already) {
+      return;
+    }
+    if (connectClient(&udpTransport, 0, noAddress) != nullptr) {
+      postConnectionEvent(CONNECTION_EVENT_SUBSCRIBE);
+      startStreaming(START_WIFI);
+    }
+  } else if (event == ARDUINO_EVENT_WIFI_STA_DISCONNECTED || event == ARDUINO_EVENT_WIFI_STA_LOST_IP) {
+    if (disconnectClient(&udpTransport, 0)) {
+      M5.Log(ESP_LOG_INFO ,"Wi-Fi down after %u datagrams (%u refused)", udpTransport.datagrams(),
+                   udpTransport.refused());
+    }
+  }
+}
+#endif
+
+// Accounts the packetizing cost of one capture
+static void recordEncodeStats(uint32_t startCycles, size_t packets, size_t bytes) {
+  uint32_t cycles = ESP.getCycleCount() - startCycles;
+  encodeCyclesTotal += cycles;
+  encodedBlocks += packets;
+  encodedBytes += bytes;
+  if (cycles > encodeChunkCyclesMax) {
+    encodeChunkCyclesMax = cycles;
+  }
+  if (packets > 0 && cycles / packets > encodeCyclesMax) {
+    encodeCyclesMax = cycles / packets;
+  }
+}
+
+// Largest packet every subscribed client can carry in one notification
+static size_t currentPacketBytes() {
+  size_t mtuPayload = streamMtu() - 3;
+  return mtuPayload < MAX_PACKET_BYTES ? mtuPayload : MAX_PACKET_BYTES;
+}
+
+// Timing of the capture recordTask is turning into packets
+static uint32_t captureSampleUs = 0;    // its first sample was taken
+static uint32_t captureCompleteUs = 0;  // the driver handed it back
+
+// Publishes a filled slot to sendTask
+static void commitPacket(size_t bytes, uint32_t tag) {
+  SlotTimes times;
+  times.sampleUs = captureSampleUs;
+  times.commitUs = micros();
+  audioRing.commit(bytes, tag, times);
+  TRACE_EVENT(TRACE_RING_SEND, (uint16_t)bytes);
+  xTaskNotifyGive(sendTaskHandle);
+  latency[TELEMETRY_LATENCY_PROCESS].record(times.commitUs - captureCompleteUs);
+
+  size_t used = audioRing.highWatermark();
+  if (used > bufferHighWatermark) {
+    bufferHighWatermark = used;
+    M5.Log(ESP_LOG_VERBOSE ,"New ring high watermark: %u/%u slots\n", 
+                 bufferHighWatermark, audioRing.slotCount());
+  }
+}
+
+// Marks lost audio in the trace and freezes the trace around it
+static void traceDrop(size_t bytes) {
+#if AUDIO_TRACE
+  traceRecorder.record(TRACE_RING_DROP, (uint16_t)bytes);
+  traceRecorder.trigger(TRACE_TRIGGER_DROP);
+#endif
+}
+
+// Accounts a packet that found the ring full; the next packet is flagged
+template <typename Packetizer>
+static void dropPacket(Packetizer& packetizer, size_t bytes) {
+  droppedPackets++;
+  droppedBytes += bytes;
+  traceDrop(bytes);
+  packetizer.packetDropped();
+  M5.Log(ESP_LOG_VERBOSE ,"Audio ring full! Dropped %u byte packet\n", bytes);
+}
+
+// One buffer handed to mic.record(). The mic driver fills buffers in the
+// background and accepts at most two at a time, so a buffer may only be
+// read once the driver reports fewer requests outstanding.
+struct CaptureRequest {
+  int16_t* samples;
+  size_t count;
+  uint8_t* slot;       // PCM captured straight into a ring slot, or nullptr
+  bool discard;        // ring was full; only the sample count matters
+  QualityLevel level;  // how the capture is packed
+  uint16_t id;         // numbers the capture in the trace
+};
+static constexpr size_t MAX_CAPTURE_REQUESTS = 3;
+
+// Capture buffers for audio that is encoded rather than sent as captured,
+// one per outstanding mic request. Reserved even in builds that capture PCM
+// in place, so a client asking for mu-law hours in cannot run out of heap.
+static int16_t chunkBuffers[MAX_CAPTURE_REQUESTS][CHUNK_SAMPLES];
+// Capture target when the ring is full, so timing and the sample index stay exact
+static uint8_t captureScratch[MAX_PACKET_BYTES];
+
+// Latest format the client asked for, and the generation it belongs to
+static AudioFormat takeRequestedFormat(uint32_t& generation) {
+  xSemaphoreTake(formatLock, portMAX_DELAY);
+  AudioFormat format = requestedFormat;
+  generation = formatGeneration;
+  xSemaphoreGive(formatLock);
+  return format;
+}
+
+#if AUDIO_BACKLOG
+//----------------------------------------------------------------------
+// Store-and-forward backlog
+//----------------------------------------------------------------------
+// Keeps a packet that cannot go out live; the oldest audio makes room if needed
+static bool storeBacklogPacket(const uint8_t* packet, size_t bytes) {
+  if (!backlogReady) {
+    return false;
+  }
+  xSemaphoreTake(backlogRamLock, portMAX_DELAY);
+  bool stored = backlogRam.append(packet, bytes, streamStartTime);
+  xSemaphoreGive(backlogRamLock);
+  if (stored) {
+    backlogStored++;
+  }
+  return stored;
+}
+
+static size_t takeFromLog(PacketLog& log, SemaphoreHandle_t lock, uint8_t* out,
+                          size_t maxBytes, uint32_t& streamStart) {
+  xSemaphoreTake(lock, portMAX_DELAY);
+  size_t bytes = log.peek(out, MAX_PACKET_BYTES, streamStart);
+  if (bytes > 0) {
+    log.pop();
+  }
+  xSemaphoreGive(lock);
+  if (bytes > maxBytes) {
+    backlogDropped++;
+    return 0;
+  }
+  return bytes;
+}
+
+// Removes the oldest backlog packet into out. Flash only ever holds audio
+// older than PSRAM, so it drains first.
+static size_t takeBacklogPacket(uint8_t* out, size_t maxBytes, uint32_t& streamStart) {
+  if (!backlogReady) {
+    return 0;
+  }
+  if (backlogFlashReady && !backlogFlash.empty()) {
+    return takeFromLog(backlogFlash, backlogFlashLock, out, maxBytes, streamStart);
+  }
+  if (!backlogRam.empty()) {
+    return takeFromLog(backlogRam, backlogRamLock, out, maxBytes, streamStart);
+  }
+  return 0;
+}
+#endif
+
+// Moves every packet the packetizer has ready into the ring. Without a
+// client (or with the ring full) packets go to the backlog, if enabled.
+template <typename Packetizer>
+static void drainPackets(Packetizer& packetizer, uint8_t* scratch, uint32_t tag,
+                         size_t& packets, size_t& bytes) {
+  while (packetizer.hasPacket()) {
+    uint8_t* slot = streamLive() ? audioRing.reserve() : nullptr;
+    size_t packetBytes = packetizer.nextPacket(slot != nullptr ? slot : scratch);
+    if (slot != nullptr) {
+      commitPacket(packetBytes, tag);
+#if AUDIO_BACKLOG
+    } else if (storeBacklogPacket(scratch, packetBytes)) {
+      // Sent later from the backlog
+#endif
+    } else {
+      dropPacket(packetizer, packetBytes);
+    }
+    packets++;
+    bytes += packetBytes;
+  }
+}
+
+// Feeds samples to the packetizer, emitting packets as they fill up
+static void packetizeSamples(AudioPacketizer& packetizer, const int16_t* samples, size_t count,
+                             uint8_t* scratch, uint32_t tag, size_t& packets, size_t& bytes) {
+  size_t taken = 0;
+  while (taken < count) {
+    taken += packetizer.append(samples + taken, count - taken);
+    drainPackets(packetizer, scratch, tag, packets, bytes);
+  }
+}
+
+#if AUDIO_QUALITY_LADDER
+//----------------------------------------------------------------------
+// Quality ladder
+//----------------------------------------------------------------------
+// Moves the packetizer to another rung between captures. Audio still
+// pending goes out first, packed the old way.
+static void applyQualityLevel(AudioPacketizer& packetizer, QualityLevel level, uint8_t* scratch,
+                              uint32_t tag, size_t& packets, size_t& bytes) {
+  if (level == packetizerLevel) {
+    return;
+  }
+  packetizer.flush();
+  drainPackets(packetizer, scratch, tag, packets, bytes);
+  // Silence markers need no encoding; keep the last one for the way back up
+  if (level != QUALITY_SILENCE) {
+    bool halfRate = level >= QUALITY_HALF_RATE;
+    PacketFormat format = level >= QUALITY_COMPANDED ? PACKET_FORMAT_MULAW : streamPacketFormat;
+    if (halfRate && !packetizer.halfRate()) {
+      decimator.reset();
+    }
+    packetizer.setEncoding(format, halfRate);
+  }
+  M5.Log(ESP_LOG_DEBUG ,"Quality %s -> %s (leading client %u/%u slots behind)", QualityLadder::levelName(packetizerLevel),
+               QualityLadder::levelName(level), audioRing.leadingLag(), audioRing.slotCount());
+  packetizerLevel = level;
+}
+#endif
+
+// Feeds captured samples to the packetizer at the capture's quality level
+static void packetizeAtLevel(AudioPacketizer& packetizer, QualityLevel level, const int16_t* samples,
+                             size_t count, uint8_t* scratch, uint32_t tag, size_t& packets, size_t& bytes) {
+#if AUDIO_QUALITY_LADDER
+  if (level == QUALITY_SILENCE) {
+    ladderSilencedSamples += count;
+    packetizer.appendSilence(count);
+    drainPackets(packetizer, scratch, tag, packets, bytes);
+    return;
+  }
+  if (level != QUALITY_FULL) {
+    size_t halfCount = decimator.process(samples, count, decimatedSamples);
+    packetizeSamples(packetizer, decimatedSamples, halfCount, scratch, tag, packets, bytes);
+    return;
+  }
+#endif
+  packetizeSamples(packetizer, samples, count, scratch, tag, packets, bytes);
+}
+
+#if AUDIO_FEATURES
+// Turns samples into log-mel frames, and the frames into ring packets
+static void extractFeatures(const int16_t* samples, size_t count, uint8_t* scratch, uint32_t tag,
+                            size_t& packets, size_t& bytes) {
+  uint8_t frame[LogMelExtractor::MEL_BANDS];
+  size_t taken = 0;
+  while (taken < count) {
+    taken += logMel.append(samples + taken, count - taken);
+    while (logMel.frameReady()) {
+      uint32_t start = ESP.getCycleCount();
+      uint32_t firstSample = logMel.takeFrame(frame);
+      featureCyclesTotal += ESP.getCycleCount() - start;
+      featureFrames++;
+      while (!featurePacketizer.append(frame, firstSample)) {
+        drainPackets(featurePacketizer, scratch, tag, packets, bytes);
+      }
+      drainPackets(featurePacketizer, scratch, tag, packets, bytes);
+    }
+  }
+}
+#endif
+
+#if AUDIO_VAD
+static VoiceActivityDetector vad;
+#endif
+
+// Conditions captured samples in place and measures their level. Discarded
+// captures go through too so the filters stay continuous.
+static void conditionAudio(int16_t* samples, size_t count) {
+  uint32_t start = ESP.getCycleCount();
+#if AUDIO_DSP
+  frontEnd.process(samples, count);
+#endif
+  levelMeter.process(samples, count);
+  dspCyclesTotal += ESP.getCycleCount() - start;
+  dspSamples += count;
+}
+
+// Turns a finished capture into ring packets
+static void completeCapture(AudioPacketizer& packetizer, const CaptureRequest& request,
+                            uint8_t* scratch, uint32_t tag) {
+  TRACE_EVENT(TRACE_RECORD_END, request.id);
+#if AUDIO_OVERSAMPLE
+  // The mic ran at 48 kHz; every capture is a whole number of outputs
+  uint32_t decimateStart = ESP.getCycleCount();
+  captureDecimator.process(request.samples, request.count * captureDecimator.factor());
+  decimateCyclesTotal += ESP.getCycleCount() - decimateStart;
+  decimatorOutputs += request.count;
+#endif
+  totalChunks++;
+  capturedSamples += request.count;
+  // Codec leftovers from the previous capture ride with this one and are
+  // credited to it, so their total latency reads slightly low
+  captureCompleteUs = micros();
+  captureSampleUs = captureCompleteUs - (uint32_t)(request.count * 1000000ULL / streamSampleRate);
+  uint32_t captureStart = ESP.getCycleCount();
+  conditionAudio(request.samples, request.count);
+  uint32_t encodeStart = ESP.getCycleCount();
+  size_t packets = 0;
+  size_t bytes = 0;
+
+  if (request.slot != nullptr) {
+    // PCM: the samples are already in the slot, just add the header
+    bytes = packetizer.packInPlace(request.slot, request.count);
+    commitPacket(bytes, tag);
+    packets = 1;
+  } else if (request.discard) {
+    bytes = packetizer.headerBytes() + request.count * sizeof(int16_t);
+    droppedPackets++;
+    droppedBytes += bytes;
+    traceDrop(bytes);
+    packetizer.skip(request.count);
+    packets = 1;
+  } else if (streamPacketFormat == PACKET_FORMAT_LOG_MEL) {
+#if AUDIO_FEATURES
+    // Every hop becomes a frame: the ladder and the VAD only shape audio
+    extractFeatures(request.samples, request.count, scratch, tag, packets, bytes);
+#endif
+  } else {
+#if AUDIO_QUALITY_LADDER
+    applyQualityLevel(packetizer, request.level, scratch, tag, packets, bytes);
+#endif
+#if AUDIO_VAD
+    // Only frames the VAD holds open are sent; the rest become silence markers
+    for (size_t offset = 0; offset < request.count; offset += VAD_FRAME_SAMPLES) {
+      size_t frame = request.count - offset;
+      if (frame > VAD_FRAME_SAMPLES) frame = VAD_FRAME_SAMPLES;
+      vadFrames++;
+      if (vad.process(request.samples + offset, frame)) {
+        vadSpeechFrames++;
+        packetizeAtLevel(packetizer, request.level, request.samples + offset, frame, scratch, tag, packets, bytes);
+      } else {
+        vadSilentSamples += frame;
+        packetizer.appendSilence(frame);
+        drainPackets(packetizer, scratch, tag, packets, bytes);
+      }
+    }
+#else
+    // Codecs: encode straight into ring slots; leftovers wait for the next capture
+    packetizeAtLevel(packetizer, request.level, request.samples, request.count, scratch, tag, packets, bytes);
+#endif
+#if AUDIO_CAPTURE_IN_PLACE && AUDIO_QUALITY_LADDER
+    // Leave nothing pending on the way back up, so captures can go in place again
+    if (request.level == QUALITY_FULL) {
+      packetizer.flush();
+      drainPackets(packetizer, scratch, tag, packets, bytes);
+    }
+#endif
+  }
+
+  recordEncodeStats(encodeStart, packets, bytes);
+  TRACE_EVENT(TRACE_PROCESS_END, (uint16_t)packets);
+  uint32_t captureCycles = ESP.getCycleCount() - captureStart;
+  if (captureCycles > captureChunkCyclesMax) {
+    captureChunkCyclesMax = captureCycles;
+  }
+}
+
+// Waits for the mic driver to let go of every queued buffer, then forgets them
+static void abandonCaptures(size_t& inflightCount) {
+  while (mic.pending() > 0) {
+    vTaskDelay(pdMS_TO_TICKS(5));
+  }
+  audioRing.cancelReservations();
+  inflightCount = 0;
+}
+
+//----------------------------------------------------------------------
+// Task: recordTask
+//   - Keeps mic.record() requests queued only while streaming
+//   - Captures PCM straight into ring slots, or encodes chunks into them
+//   - Ends every DRAINING state once the driver has let go of its buffers
+//   - Sleeps on the connection state otherwise
+//----------------------------------------------------------------------
+void recordTask(void* pv) {
+  size_t nextChunkBuffer = 0;
+  uint8_t* scratch = captureScratch;
+
+  static AudioPacketizer packetizer;
+  CaptureRequest inflight[MAX_CAPTURE_REQUESTS];
+  size_t inflightHead = 0;
+  size_t inflightCount = 0;
+  bool streaming = false;
+  uint32_t tag = 0;
+  size_t chunkSamples = CHUNK_SAMPLES;
+  uint32_t appliedFormat = formatGeneration;
+  uint16_t nextCaptureId = 0;
+  
+  while (true) {
+    ConnectionState state = connection.state();
+    if (state == CONNECTION_DRAINING) {
+#if !AUDIO_BACKLOG
+      // Let the driver finish with our buffers before they are reused
+      if (streaming) {
+        abandonCaptures(inflightCount);
+        streaming = false;
+      }
+#endif
+      // The backlog keeps the stream going; only the sink changes
+      postConnectionEvent(CONNECTION_EVENT_DRAINED);
+      continue;
+    }
+
+    if (state == CONNECTION_CONNECTED || state == CONNECTION_SUBSCRIBED) {
+      // Fall back to starting anyway if the client never signals
+      unsigned long elapsed = millis() - connectionTime;
+      if (elapsed >= RECORDING_DELAY_MS) {
+        startStreaming(START_TIMEOUT);
+        continue;
+      }
+#if !AUDIO_BACKLOG
+      // Sleep until the stream starts, the client leaves or the fallback expires
+      waitForConnectionState(connectionBit(CONNECTION_ADVERTISING) | connectionBit(CONNECTION_STREAMING) |
+                             connectionBit(CONNECTION_DRAINING),
+                             pdMS_TO_TICKS(RECORDING_DELAY_MS - elapsed));
+      continue;
+#endif
+    }
+    
+    // Only record while streaming, or always with a backlog
+    bool live = state == CONNECTION_STREAMING;
+    if (live || AUDIO_BACKLOG) {
+      size_t packetBytes = live ? currentPacketBytes() : BACKLOG_PACKET_BYTES;
+#if AUDIO_BACKLOG
+      // One stream across connections, so backlog and live audio share a timeline
+      bool restart = !streaming;
+#else
+      bool restart = !streaming || tag != streamGeneration;
+#endif
+      // A new format always starts a new stream
+      restart = restart || appliedFormat != formatGeneration;
+      if (restart) {
+        // Captures queued for the previous client must not leak into this stream
+        if (streaming) {
+          abandonCaptures(inflightCount);
+          streaming = false;
+        }
+        AudioFormat format = takeRequestedFormat(appliedFormat);
+        bool features = format.encoding == AUDIO_ENCODING_LOG_MEL;
+        PacketFormat packetFormat = features ? PACKET_FORMAT_LOG_MEL
+                                    : format.encoding == AUDIO_ENCODING_MULAW ? PACKET_FORMAT_MULAW
+                                                                              : AUDIO_PACKET_FORMAT;
+        // Every stream starts at sample 0 on a packet boundary. The audio
+        // packetizer is set up either way; it only sees samples without features.
+        bool ready = packetizer.begin(features ? AUDIO_PACKET_FORMAT : packetFormat, packetBytes, AUDIO_FRAMING,
+                                      format.sampleRate);
+#if AUDIO_FEATURES
+        ready = ready && featurePacketizer.begin(packetBytes, format.sampleRate, LogMelExtractor::MEL_BANDS,
+                                                 LogMelExtractor::HOP_SAMPLES, LogMelExtractor::WINDOW_MS);
+        logMel.reset();
+#endif
+        if (!ready) {
+          M5.Log(ESP_LOG_ERROR ,"MTU %u too small for audio packets", streamMtu());
+          vTaskDelay(pdMS_TO_TICKS(100));
+          continue;
+        }
+        // Without a frame duration the capture keeps its length in time
+        uint32_t frameMs = format.frameMs != 0 ? format.frameMs
+                                               : captureChunkSamples * 1000UL / streamSampleRate;
+        captureChunkSamples = chunkSamplesFor(format.sampleRate, frameMs);
+        streamSampleRate = format.sampleRate;
+        streamEncoding = format.encoding;
+        streamPacketFormat = packetFormat;
+        updateControlValue();
+#if AUDIO_QUALITY_LADDER
+        ladder.reset(millis());
+        packetizerLevel = QUALITY_FULL;
+        decimator.reset();
+#endif
+        M5.Log(ESP_LOG_INFO ,"Streaming %u-byte packets (MTU %u), %u Hz %s", packetBytes, streamMtu(),
+                     format.sampleRate, encodingName(format.encoding));
+#if AUDIO_DSP
+        // Filters are designed for the sample rate
+        frontEnd.begin(format.sampleRate, HIGH_PASS_HZ, Agc::Config());
+        frontEnd.reset();
+#endif
+        levelMeter.begin(format.sampleRate * LEVEL_METER_WINDOW_MS / 1000);
+#if AUDIO_OVERSAMPLE
+        // Every negotiable rate divides 48 kHz
+        captureDecimator.begin(format.sampleRate);
+#endif
+#if AUDIO_VAD
+        // Relearn the noise floor for every stream
+        vad.begin(format.sampleRate, VAD_FRAME_SAMPLES, AUDIO_VAD_AGGRESSIVENESS);
+#endif
+#if AUDIO_BACKLOG
+        streamStartTime = (uint32_t)time(nullptr);
+#endif
+        streaming = true;
+      } else if (packetBytes != packetizer.maxPacketBytes()) {
+        // MTU exchange completed after streaming started, or clients changed
+        packetizer.setMaxPacketBytes(packetBytes);
+#if AUDIO_FEATURES
+        featurePacketizer.setMaxPacketBytes(packetBytes);
+#endif
+        M5.Log(ESP_LOG_INFO ,"Packet size changed to %u bytes (MTU %u)", packetBytes, streamMtu());
+      }
+      tag = streamGeneration;
+      if (chunkSamples != captureChunkSamples) {
+        // The worst chunk so far was measured against another deadline
+        chunkSamples = captureChunkSamples;
+        captureChunkCyclesMax = 0;
+        encodeChunkCyclesMax = 0;
+        M5.Log(ESP_LOG_INFO ,"Capture chunk %u samples", chunkSamples);
+      }
+
+      // Queue the next capture; this blocks while the driver already holds two
+      CaptureRequest request = { nullptr, 0, nullptr, false, QUALITY_FULL, nextCaptureId++ };
+#if AUDIO_QUALITY_LADDER
+      // Backpressure on the live stream lowers the quality of the next capture.
+      // It follows the client furthest ahead: slower ones skip ahead instead
+      // of degrading the stream for everyone. Feature streams have no
+      // cheaper rung to step down to.
+      if (live && streamPacketFormat != PACKET_FORMAT_LOG_MEL) {
+        request.level = ladder.update(audioRing.leadingLag(), audioRing.slotCount(), millis());
+      } else {
+        ladder.reset(millis());
+      }
+#endif
+      bool inPlace = AUDIO_CAPTURE_IN_PLACE && streamPacketFormat == PACKET_FORMAT_PCM16 &&
+                     request.level == QUALITY_FULL;
+#if AUDIO_CAPTURE_IN_PLACE && AUDIO_QUALITY_LADDER
+      // Back in place only once the packetizer is done with chunk captures,
+      // or their audio would land after this one
+      if (inPlace) {
+        bool chunksInFlight = false;
+        for (size_t i = 0; i < inflightCount; i++) {
+          const CaptureRequest& r = inflight[(inflightHead + i) % MAX_CAPTURE_REQUESTS];
+          chunksInFlight = chunksInFlight || (r.slot == nullptr && !r.discard);
+        }
+        inPlace = !chunksInFlight && packetizerLevel == QUALITY_FULL && !packetizer.hasPending();
+      }
+#endif
+      if (inPlace) {
+        // A packet per capture, shorter if the chunk size asks for it
+        request.count = packetizer.samplesPerPacket();
+        if (request.count > chunkSamples) {
+          request.count = chunkSamples;
+        }
+        request.slot = audioRing.reserve();
+        request.discard = (request.slot == nullptr);
+        request.samples = (int16_t*)(request.discard ? scratch : request.slot + packetizer.headerBytes());
+      } else {
+        request.count = chunkSamples;
+#if AUDIO_OVERSAMPLE
+        // The buffer holds the capture before decimation
+        if (request.count > CHUNK_SAMPLES / captureDecimator.factor()) {
+          request.count = CHUNK_SAMPLES / captureDecimator.factor();
+        }
+#endif
+        request.samples = chunkBuffers[nextChunkBuffer];
+        nextChunkBuffer = (nextChunkBuffer + 1) % MAX_CAPTURE_REQUESTS;
+      }
+      uint32_t sampleRate = streamSampleRate;
+      captureDeadlineUs = request.count * 1000000ULL / sampleRate;
+#if AUDIO_OVERSAMPLE
+      bool queued = mic.record(request.samples, request.count * captureDecimator.factor(),
+                               CaptureDecimator::INPUT_RATE);
+#else
+      bool queued = mic.record(request.samples, request.count, sampleRate);
+#endif
+      if (!queued) {
+        if (request.slot != nullptr) {
+          audioRing.unreserve();
+        }
+        vTaskDelay(pdMS_TO_TICKS(10));
+        continue;
+      }
+      TRACE_EVENT(TRACE_RECORD_BEGIN, request.id);
+      inflight[(inflightHead + inflightCount) % MAX_CAPTURE_REQUESTS] = request;
+      inflightCount++;
+
+      // Hand over every buffer the driver has finished with, oldest first
+      while (inflightCount > mic.pending()) {
+        completeCapture(packetizer, inflight[inflightHead], scratch, tag);
+        inflightHead = (inflightHead + 1) % MAX_CAPTURE_REQUESTS;
+        inflightCount--;
+      }
+    } else {
+      if (streaming) {
+        // Let the driver finish with our buffers before they are reused
+        abandonCaptures(inflightCount);
+        streaming = false;
+      }
+      // Sleep until a client connects
+      waitForConnectionState(CONNECTION_ALL_BITS & ~connectionBit(CONNECTION_ADVERTISING), portMAX_DELAY);
+    }
+  }
+}
+
+// Hands one packet to the client's link, bracketed in the trace
+static bool linkSend(AudioClient& client, const uint8_t* packet, size_t length) {
+  TRACE_EVENT(TRACE_NOTIFY_BEGIN, client.connId);
+  bool sent = client.link->send(client.connId, packet, length);
+  TRACE_EVENT(TRACE_NOTIFY_END, sent);
+  return sent;
+}
+
+// Stamps the client's sequence number and notifies one packet to it. False
+// if the stack refused it.
+static bool notifyPacket(AudioClient& client, uint8_t* packet, size_t length) {
+#if AUDIO_FRAMING
+  // Sequence numbers count packets sent to this client, so gaps mean loss
+  // after the device
+  packetSetSequence(packet, client.sequence++);
+#endif
+#if AUDIO_RETRANSMIT
+  // Kept even if the stack refuses it: the client sees the gap and NACKs it
+  if (client.historyReady && isBleClient(client)) {
+    client.history.record(client.sequence - 1, packet, length);
+  }
+#endif
+  if (!linkSend(client, packet, length)) {
+    client.pacer.onSendFailed();
+    return false;
+  }
+  client.pacer.onSent(length, millis());
+  client.sentPackets++;
+  sentPackets++;
+  return true;
+}
+
+// Notifies the latest telemetry snapshot to a client if it subscribed to it
+// and it fits the client's MTU (longer snapshots can still be read). Returns
+// the bytes sent.
+static size_t notifyTelemetry(AudioClient& client) {
+  client.telemetrySent = telemetryVersion;
+  if (!client.telemetrySubscribed) {
+    return 0;
+  }
+  xSemaphoreTake(telemetryLock, portMAX_DELAY);
+  size_t bytes = telemetryBytes;
+  if (bytes == 0 || bytes > (size_t)client.mtu - 3 ||
+      !telemetryTransport.send(client.connId, telemetryBuffer, bytes)) {
+    bytes = 0;
+  }
+  xSemaphoreGive(telemetryLock);
+  return bytes;
+}
+
+// True if the client's pacer allows another notification; otherwise sendTask
+// polls again within PACER_POLL_MS (completions wake it early)
+static bool hasCredit(AudioClient& client, uint32_t& waitMs) {
+#if AUDIO_SPP
+  // A full BluetoothSerial queue would block sendTask and every client with
+  // it; wait until a whole packet fits
+  if (client.link == &sppTransport) {
+    if (sppTransport.canSend((size_t)client.mtu - 3)) {
+      return true;
+    }
+    if (waitMs > PACER_POLL_MS) {
+      waitMs = PACER_POLL_MS;
+    }
+    return false;
+  }
+#endif
+  // UDP has no completions to pace by: a datagram the stack cannot buffer
+  // is refused
+  if (!isBleClient(client)) {
+    return true;
+  }
+  if (client.pacer.credits(millis(), esp_ble_get_cur_sendable_packets_num(client.connId)) > 0) {
+    return true;
+  }
+  if (waitMs > PACER_POLL_MS) {
+    waitMs = PACER_POLL_MS;
+  }
+  return false;
+}
+
+#if AUDIO_RETRANSMIT
+// Sends the oldest packet the client NACKed again, unchanged apart from
+// PACKET_FLAG_RETRANSMIT. True if one went out.
+static bool resendPacket(AudioClient& client, uint32_t& waitMs) {
+  if (!client.historyReady || !client.history.pending() || !hasCredit(client, waitMs)) {
+    return false;
+  }
+  size_t length;
+  uint16_t sequence;
+  uint8_t* packet = client.history.nextResend(length, sequence);
+  if (packet == nullptr) {
+    return false;
+  }
+  packet[2] |= PACKET_FLAG_RETRANSMIT;
+  if (!linkSend(client, packet, length)) {
+    client.pacer.onSendFailed();
+    return false;
+  }
+  client.pacer.onSent(length, millis());
+  return true;
+}
+#endif
+
+#if AUDIO_BACKLOG
+// Tells the receiver which stream the following live or backlog packets belong to
+static void notifySegment(AudioClient& client, uint32_t streamStart, uint8_t flags) {
+  uint8_t marker[PACKET_HEADER_BYTES + SEGMENT_PAYLOAD_BYTES];
+  size_t length = packetWriteSegment(marker, streamStart, flags);
+  notifyPacket(client, marker, length);
+}
+#endif
+
+// Gives every subscribed client a reader of the ring and takes it back from
+// those that unsubscribed or left. A new connection starts its sequence over.
+static void updateReaders() {
+  for (AudioClient& c : clients) {
+    uint32_t generation = c.generation;
+    bool wanted = c.connected && c.subscribed;
+    if (c.sendGeneration != generation) {
+      if (c.reader != FanoutRing::NO_READER) {
+        // The reader still belongs to the slot's previous connection
+        audioRing.detach(c.reader);
+        c.reader = FanoutRing::NO_READER;
+      }
+      // The pacer belongs to sendTask, so it starts over here rather than in addClient()
+      c.pacer.reset();
+      c.pacer.resetStats();
+      c.sendGeneration = generation;
+      c.sequence = 0;
+      c.telemetrySent = 0;
+#if AUDIO_RETRANSMIT
+      if (c.historyReady) {
+        c.history.reset();
+        c.history.resetStats();
+      }
+#endif
+#if AUDIO_BACKLOG
+      c.liveAnnounced = false;
+      c.backlogAnnounced = false;
+#endif
+    }
+    if (c.reader != FanoutRing::NO_READER && !wanted) {
+      M5.Log(ESP_LOG_INFO ,"Client %u stopped listening after %u packets (%u skipped)",
+                   c.connId, c.sentPackets, audioRing.skipped(c.reader) + c.oversized);
+      audioRing.detach(c.reader);
+      c.reader = FanoutRing::NO_READER;
+    } else if (c.reader == FanoutRing::NO_READER && wanted) {
+      c.reader = audioRing.attach();
+      c.sendBatch = false;
+      c.sentPackets = 0;
+      c.oversized = 0;
+      if (c.reader == FanoutRing::NO_READER) {
+        M5.Log(ESP_LOG_ERROR ,"No ring reader left for client %u", c.connId);
+      }
+    }
+  }
+}
+
+// Sends at most one notification to a client. Returns true if it made
+// progress; otherwise lowers waitMs to when it may have something to send.
+static bool serviceClient(AudioClient& client, uint32_t generation, uint32_t& waitMs) {
+  if (!client.connected || client.sendGeneration != client.generation) {
+    return false;
+  }
+
+  // Telemetry takes its turn in the same window as the audio
+  if (client.telemetrySent != telemetryVersion) {
+    if (!client.telemetrySubscribed) {
+      client.telemetrySent = telemetryVersion;
+    } else if (hasCredit(client, waitMs)) {
+      size_t bytes = notifyTelemetry(client);
+      if (bytes > 0) {
+        client.pacer.onSent(bytes, millis());
+      }
+      return true;
+    } else {
+      return false;
+    }
+  }
+
+  size_t length = 0;
+  uint32_t tag = 0;
+  SlotTimes times;
+  uint8_t* packet = nullptr;
+  if (client.reader != FanoutRing::NO_READER) {
+    packet = audioRing.peek(client.reader, length, tag, times);
+  }
+
+  // Packets captured for a previous session are never sent live
+  if (packet != nullptr && tag != generation) {
+#if AUDIO_BACKLOG
+    storeBacklogPacket(packet, length);
+#endif
+    audioRing.release(client.reader);
+    return true;
+  }
+  // Captured before the client joined with a smaller MTU
+  if (packet != nullptr && length > (size_t)client.mtu - 3) {
+    client.oversized++;
+    audioRing.release(client.reader);
+    return true;
+  }
+
+#if AUDIO_RETRANSMIT
+  // Repairs go out while no live packet is waiting, ahead of the backlog
+  if (packet == nullptr && resendPacket(client, waitMs)) {
+    return true;
+  }
+#endif
+
+#if AUDIO_BACKLOG
+  // Replay the backlog to the primary client in the gaps of the live
+  // stream, alternating with live packets while both are waiting, until it
+  // has caught up. Wait for the MTU exchange so backlog packets fit.
+  static uint8_t backlogPacket[MAX_PACKET_BYTES];
+  size_t maxBytes = (size_t)client.mtu - 3 < MAX_PACKET_BYTES ? (size_t)client.mtu - 3 : MAX_PACKET_BYTES;
+  if (&client == primaryClient() && client.reader != FanoutRing::NO_READER &&
+      (packet == nullptr || client.backlogTurn) && maxBytes >= BACKLOG_PACKET_BYTES) {
+    // Segment markers ride along with the packet they announce
+    if (!hasCredit(client, waitMs)) {
+      return false;
+    }
+    uint32_t streamStart;
+    size_t backlogBytes = takeBacklogPacket(backlogPacket, maxBytes, streamStart);
+    if (backlogBytes > 0) {
+      if (!client.backlogAnnounced || streamStart != client.backlogStream) {
+        notifySegment(client, streamStart, PACKET_FLAG_BACKLOG);
+        client.backlogAnnounced = true;
+        client.backlogStream = streamStart;
+      }
+      backlogPacket[2] |= PACKET_FLAG_BACKLOG;
+      notifyPacket(client, backlogPacket, backlogBytes);
+      noteFirstPacket();
+      backlogSent++;
+      client.backlogTurn = false;
+      return true;
+    }
+  }
+  client.backlogTurn = true;
+#endif
+
+  if (packet == nullptr) {
+    // Caught up; wait for recordTask to publish the next packet
+    client.sendBatch = false;
+    return false;
+  }
+
+  // Live packets wait until sendTrigger of them are queued, then go out
+  // back to back; a partial batch is held for SEND_TRIGGER_MAX_HOLD_US at most
+  if (!client.sendBatch) {
+    uint32_t heldUs = micros() - times.commitUs;
+    if (audioRing.lag(client.reader) < sendTrigger && heldUs < SEND_TRIGGER_MAX_HOLD_US) {
+#if AUDIO_RETRANSMIT
+      // The link is idle until the batch is complete
+      if (resendPacket(client, waitMs)) {
+        return true;
+      }
+#endif
+      uint32_t holdMs = (SEND_TRIGGER_MAX_HOLD_US - heldUs) / 1000 + 1;
+      if (holdMs < waitMs) {
+        waitMs = holdMs;
+      }
+      return false;
+    }
+    client.sendBatch = true;
+  }
+
+  if (!hasCredit(client, waitMs)) {
+    return false;
+  }
+#if AUDIO_BACKLOG
+  if (!client.liveAnnounced) {
+    notifySegment(client, streamStartTime, 0);
+    client.liveAnnounced = true;
+  }
+#endif
+  // Send straight from the slot; it goes back to recordTask once every
+  // client has had it
+  uint32_t dequeueUs = micros();
+  TRACE_EVENT(TRACE_RING_RECEIVE, (uint16_t)length);
+  if (notifyPacket(client, packet, length)) {
+    uint32_t notifyUs = micros();
+    latency[TELEMETRY_LATENCY_QUEUE].record(dequeueUs - times.commitUs);
+    latency[TELEMETRY_LATENCY_SEND].record(notifyUs - dequeueUs);
+    latency[TELEMETRY_LATENCY_TOTAL].record(notifyUs - times.sampleUs);
+  }
+  audioRing.release(client.reader);
+  noteFirstPacket();
+  if (&client == primaryClient()) {
+    noteSendTiming();
+  }
+  return true;
+}
+
+void sendTask(void* pv) {
+  while (true) {
+    if (streamLive()) {
+      uint32_t generation = streamGeneration;
+      updateReaders();
+      // A client that fell too far behind skips ahead instead of filling the
+      // ring for the others
+      audioRing.trim(CLIENT_MAX_LAG);
+
+      // One notification per client and round, so a slow link never holds
+      // up a fast one
+      bool progress = false;
+      uint32_t waitMs = 100;
+      for (AudioClient& c : clients) {
+        if (serviceClient(c, generation, waitMs)) {
+          progress = true;
+        }
+      }
+      if (!progress) {
+        // recordTask and the stack's completions wake us early
+        ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(waitMs));
+      }
+    } else {
+      // Sleep until the stream starts
+      waitForConnectionState(connectionBit(CONNECTION_STREAMING), portMAX_DELAY);
+    }
+  }
+}
+
+#if AUDIO_BACKLOG
+//----------------------------------------------------------------------
+// Task: storageTask
+//   - Moves the oldest PSRAM backlog to flash once PSRAM fills up
+//   - Persists how far the flash log has been delivered
+//----------------------------------------------------------------------
+void storageTask(void* pv) {
+  static uint8_t record[MAX_PACKET_BYTES];
+  uint32_t savedMark = backlogFlash.oldestSerial();
+  unsigned long lastMarkSave = 0;
+
+  while (true) {
+    bool spilled = false;
+    while (true) {
+      uint32_t streamStart;
+      xSemaphoreTake(backlogRamLock, portMAX_DELAY);
+      size_t bytes = 0;
+      if (backlogRam.usedBytes() > BACKLOG_SPILL_BYTES) {
+        bytes = backlogRam.peek(record, sizeof(record), streamStart);
+        backlogRam.pop();
+      }
+      xSemaphoreGive(backlogRamLock);
+      if (bytes == 0) {
+        break;
+      }
+
+      // Flash writes stay off the capture path; only this task waits for them
+      xSemaphoreTake(backlogFlashLock, portMAX_DELAY);
+      backlogFlash.append(record, bytes, streamStart);
+      xSemaphoreGive(backlogFlashLock);
+      backlogSpilled++;
+      spilled = true;
+    }
+
+    xSemaphoreTake(backlogFlashLock, portMAX_DELAY);
+    if (spilled) {
+      backlogFlashStorage.sync();
+    }
+    uint32_t mark = backlogFlash.oldestSerial();
+    if (mark != savedMark && millis() - lastMarkSave >= BACKLOG_MARK_INTERVAL_MS) {
+      if (backlogFlashStorage.saveMark(mark)) {
+        savedMark = mark;
+      }
+      lastMarkSave = millis();
+    }
+    xSemaphoreGive(backlogFlashLock);
+
+    vTaskDelay(pdMS_TO_TICKS(200));
+  }
+}
+
+// Allocates the PSRAM log and reopens the flash log left by the last run.
+// The log is taken from the heap once at boot: the Arduino core does not
+// place static data in PSRAM.
+static void setupBacklog() {
+  // Segment markers carry the stream start time from the RTC
+  if (M5.Rtc.isEnabled()) {
+    M5.Rtc.setSystemTimeFromRtc();
+  }
+
+  backlogRamLock = xSemaphoreCreateMutex();
+  backlogFlashLock = xSemaphoreCreateMutex();
+  void* ram = heap_caps_malloc(AUDIO_BACKLOG_RAM_BYTES, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+  if (backlogRamLock == nullptr || backlogFlashLock == nullptr ||
+      !backlogRamStorage.begin(ram, AUDIO_BACKLOG_RAM_BYTES) || !backlogRam.begin(&backlogRamStorage)) {
+    M5.Log(ESP_LOG_ERROR ,"Failed to allocate %u byte backlog in PSRAM", AUDIO_BACKLOG_RAM_BYTES);
+    return;
+  }
+  backlogReady = true;
+
+  if (AUDIO_BACKLOG_FLASH_BYTES == 0) {
+    return;
+  }
+  if (!LittleFS.begin(true) ||
+      !backlogFlashStorage.begin(LittleFS, "/backlog.log", AUDIO_BACKLOG_FLASH_BYTES) ||
+      !backlogFlash.begin(&backlogFlashStorage) ||
+      !backlogFlash.recover(backlogFlashStorage.loadMark())) {
+    M5.Log(ESP_LOG_ERROR ,"Flash backlog unavailable, keeping the backlog in PSRAM only");
+    return;
+  }
+  backlogFlashReady = true;
+  M5.Log(ESP_LOG_INFO ,"Flash backlog: %u packets recovered", backlogFlash.count());
+
+  storageTaskHandle = storageTaskMemory.start(storageTask, "storageTask", 2, 0);
+}
+#endif
+
+#if AUDIO_RETRANSMIT
+// Allocates each client slot's history in PSRAM, once at boot like the backlog
+static void setupRetransmit() {
+  for (AudioClient& c : clients) {
+    void* storage = heap_caps_malloc(RETRANSMIT_STORAGE_BYTES, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    if (!c.history.begin(storage, MAX_PACKET_BYTES, RETRANSMIT_SLOTS)) {
+      M5.Log(ESP_LOG_ERROR ,"Failed to allocate %u byte retransmit history in PSRAM", RETRANSMIT_STORAGE_BYTES);
+      free(storage);
+      return;
+    }
+    c.historyReady = true;
+  }
+  M5.Log(ESP_LOG_INFO ,"Retransmit history: %u packets per client (%u ms at full packets)", RETRANSMIT_SLOTS,
+               AUDIO_RETRANSMIT_MS);
+}
+#endif
+
+// Sets the CPU clock ceiling and light sleep, through esp_pm when the build supports it
+static void applyCpuClock(uint16_t mhz, bool lightSleep) {
+  if (dfsAvailable) {
+    esp_pm_config_esp32_t pm = {};
+    pm.max_freq_mhz = mhz;
+    pm.min_freq_mhz = PM_MIN_CPU_MHZ;
+    pm.light_sleep_enable = lightSleep;
+    if (esp_pm_configure(&pm) == ESP_OK) {
+      // The trace holds the clock at the ceiling
+      TRACE_CLOCK(mhz);
+      return;
+    }
+    dfsAvailable = false;
+    M5.Log(ESP_LOG_WARN ,"Dynamic frequency scaling unavailable (CONFIG_PM_ENABLE), switching the clock directly");
+  }
+  setCpuFrequencyMhz(mhz);
+  TRACE_CLOCK(mhz);
+}
+
+// Adds a task to the telemetry snapshot
+static void trackTelemetryTask(TaskHandle_t task, uint8_t core) {
+  if (task != nullptr && telemetryTaskCount < TELEMETRY_MAX_TASKS) {
+    telemetryTaskCores[telemetryTaskCount] = core;
+    telemetryTasks[telemetryTaskCount++] = task;
+  }
+}
+
+// Stack headroom of the tracked tasks and their CPU use since the last call
+static void collectTaskTelemetry(TelemetrySnapshot& snapshot) {
+#if TELEMETRY_TASK_CPU
+  static TaskStatus_t status[TELEMETRY_SYSTEM_TASKS];
+  uint32_t totalRunTime = 0;
+  UBaseType_t statusCount = uxTaskGetSystemState(status, TELEMETRY_SYSTEM_TASKS, &totalRunTime);
+  uint32_t interval = totalRunTime - telemetryTotalRunTime;
+  // First call, or more tasks than room: no CPU figures this time
+  bool cpuValid = statusCount > 0 && telemetryTotalRunTime != 0 && interval > 0;
+  telemetryTotalRunTime = totalRunTime;
+#endif
+
+  snapshot.taskCount = (uint8_t)telemetryTaskCount;
+  for (size_t i = 0; i < telemetryTaskCount; i++) {
+    TelemetryTask& t = snapshot.tasks[i];
+    telemetrySetTaskName(t, pcTaskGetName(telemetryTasks[i]));
+    t.core = telemetryTaskCores[i];
+    t.stackFreeBytes = (uint16_t)uxTaskGetStackHighWaterMark(telemetryTasks[i]);
+#if TELEMETRY_TASK_CPU
+    for (UBaseType_t j = 0; j < statusCount; j++) {
+      if (status[j].xHandle != telemetryTasks[i]) {
+        continue;
+      }
+      // The run-time counter is in wall time, so this is a share of one core
+      uint32_t ran = status[j].ulRunTimeCounter - telemetryTaskRunTime[i];
+      telemetryTaskRunTime[i] = status[j].ulRunTimeCounter;
+      if (cpuValid) {
+        t.cpuPermille = (uint16_t)((uint64_t)ran * 1000 / interval);
+      }
+      break;
+    }
+#endif
+  }
+}
+
+// Fills the client entries, and the single-client fields from the primary client
+static void collectClientTelemetry(TelemetrySnapshot& snapshot) {
+  const AudioClient* primary = primaryClient();
+  if (primary != nullptr) {
+    snapshot.pacerWindow = primary->pacer.window();
+    snapshot.rssi = primary->rssi;
+    snapshot.mtu = primary->mtu;
+    snapshot.connInterval = primary->connInterval;
+  }
+  snapshot.clientCount = 0;
+  for (const AudioClient& c : clients) {
+    if (!c.connected || snapshot.clientCount >= TELEMETRY_MAX_CLIENTS) {
+      continue;
+    }
+    TelemetryClient& t = snapshot.clients[snapshot.clientCount++];
+    uint8_t reader = c.reader;
+    t.connId = c.connId;
+    t.mtu = c.mtu;
+    t.connInterval = c.connInterval;
+    t.rssi = c.rssi;
+    t.pacerWindow = c.pacer.window();
+    t.lagPackets = (uint16_t)audioRing.lag(reader);
+    t.maxLagPackets = (uint16_t)audioRing.maxLag(reader);
+    t.sentPackets = c.sentPackets;
+    t.skippedPackets = audioRing.skipped(reader) + c.oversized;
+#if AUDIO_RETRANSMIT
+    if (c.historyReady) {
+      t.resentPackets = c.history.resentPackets();
+      t.unrecoverablePackets = c.history.unrecoverable();
+    }
+#endif
+    t.flags = (c.subscribed ? TELEMETRY_CLIENT_SUBSCRIBED : 0) |
+              (c.telemetrySubscribed ? TELEMETRY_CLIENT_TELEMETRY : 0) |
+              clientLinkFlag(c);
+  }
+}
+
+// Refreshes the telemetry characteristic and pushes it to subscribed clients
+static void publishTelemetry() {
+  TelemetrySnapshot s;
+  s.uptimeMs = millis();
+  s.connectionState = connection.state();
+  s.captures = totalChunks;
+  s.capturedSamples = capturedSamples;
+  s.sentPackets = sentPackets;
+  s.droppedPackets = droppedPackets;
+  s.droppedBytes = droppedBytes;
+  s.ringOccupancy = (uint16_t)audioRing.occupancy();
+  s.ringHighWatermark = (uint16_t)bufferHighWatermark;
+  s.ringSlots = (uint16_t)audioRing.slotCount();
+  s.freeHeap = ESP.getFreeHeap();
+  s.minFreeHeap = ESP.getMinFreeHeap();
+  s.largestFreeBlock = ESP.getMaxAllocHeap();
+  for (size_t stage = 0; stage < TELEMETRY_LATENCY_COUNT; stage++) {
+    const LatencyHistogram& h = latency[stage];
+    s.latency[stage].p50Us = h.percentileUs(50);
+    s.latency[stage].p95Us = h.percentileUs(95);
+    s.latency[stage].p99Us = h.percentileUs(99);
+    s.latency[stage].maxUs = h.maxUs();
+  }
+  s.chunkSamples = captureChunkSamples;
+  s.sendTrigger = sendTrigger;
+  collectClientTelemetry(s);
+  collectTaskTelemetry(s);
+
+  xSemaphoreTake(telemetryLock, portMAX_DELAY);
+  telemetryBytes = telemetryEncode(s, telemetryBuffer, sizeof(telemetryBuffer));
+  pTelemetryChar->setValue(telemetryBuffer, telemetryBytes);
+  xSemaphoreGive(telemetryLock);
+
+  if (!clientConnected()) {
+    return;
+  }
+  // One client per snapshot; the answer arrives in gapEventHandler
+  static size_t rssiClient = 0;
+  for (size_t i = 0; i < MAX_CLIENTS; i++) {
+    rssiClient = (rssiClient + 1) % MAX_CLIENTS;
+    if (clients[rssiClient].connected && isBleClient(clients[rssiClient])) {
+      esp_ble_gap_read_rssi(clients[rssiClient].address);
+      break;
+    }
+  }
+  telemetryVersion++;
+  if (streamLive()) {
+    // sendTask owns the notification windows while audio flows
+    wakeTask(sendTaskHandle);
+  } else {
+    for (AudioClient& c : clients) {
+      if (c.connected) {
+        notifyTelemetry(c);
+      }
+    }
+  }
+}
+
+// Runs the power policy: CPU clock, light sleep and the advertising interval
+static void updatePower() {
+  static uint16_t appliedMHz = 0;
+  static bool appliedLightSleep = false;
+  static uint16_t appliedAdvertising = 0;
+
+  PowerInputs in;
+  in.nowMs = millis();
+  in.connected = clientConnected();
+  in.streaming = streamLive() || AUDIO_BACKLOG;
+  in.lastActivityMs = lastActivityMs;
+  in.worstChunkCycles = captureChunkCyclesMax;
+  in.chunkDeadlineUs = captureDeadlineUs;
+  in.lightSleepAvailable = dfsAvailable;
+  const PowerDecision& d = powerManager.update(in);
+
+  if (d.cpuMHz != appliedMHz || d.lightSleep != appliedLightSleep) {
+    applyCpuClock(d.cpuMHz, d.lightSleep);
+    M5.Log(ESP_LOG_INFO ,"CPU %u MHz%s (%s)", d.cpuMHz, d.lightSleep ? ", light sleep" : "",
+                 PowerManager::stateName(d.state));
+    appliedMHz = d.cpuMHz;
+    appliedLightSleep = d.lightSleep;
+  }
+
+  // Advertise less often the longer nobody connects
+  if (!clientConnected() && d.advertisingInterval != appliedAdvertising) {
+    BLEAdvertising* advertising = BLEDevice::getAdvertising();
+    advertising->stop();
+    advertising->setMinInterval(d.advertisingInterval);
+    advertising->setMaxInterval(d.advertisingInterval + d.advertisingInterval / 4);
+    advertising->start();
+    appliedAdvertising = d.advertisingInterval;
+    M5.Log(ESP_LOG_INFO ,"Advertising every %u ms", d.advertisingInterval * 5 / 8);
+  }
+}
+
+void setup() {
+  Serial.begin(115200);
+  M5.begin();
+  M5.Speaker.end();
+  
+  // Initialize display for UI - Portrait mode optimizations
+  //M5.Display.setRotation(0); // Portrait mode
+  M5.Display.setBrightness(100);
+  M5.Display.fillScreen(UI_BLACK);
+  M5.Display.setTextColor(UI_WHITE);
+  M5.Display.setSwapBytes(true); // Fix for some color issues
+  M5.Display.startWrite(); // Keep SPI bus open for faster updates
+  M5.Display.fillScreen(UI_BLACK);
+  M5.Display.endWrite();
+  
+  setupLogging();
+
+  // The audio ring lives in DMA-capable internal RAM, reserved at link time
+  DMA_ATTR static uint8_t ringStorage[LivePipeline::RING_STORAGE_BYTES];
+  if (!audioRing.begin(ringStorage, MAX_PACKET_BYTES, AUDIO_RING_SLOTS)) {
+    M5.Log(ESP_LOG_ERROR ,"Failed to create audio ring");
+    while (1) delay(100);
+  }
+#if AUDIO_DSP
+  if (!frontEnd.begin(SAMPLE_RATE, HIGH_PASS_HZ, Agc::Config())) {
+    M5.Log(ESP_LOG_ERROR ,"Invalid audio front-end configuration");
+    while (1) delay(100);
+  }
+#endif
+  levelMeter.begin(SAMPLE_RATE * LEVEL_METER_WINDOW_MS / 1000);
+#if AUDIO_QUALITY_LADDER
+  if (!ladder.begin(QualityLadder::Config())) {
+    M5.Log(ESP_LOG_ERROR ,"Invalid quality ladder configuration");
+    while (1) delay(100);
+  }
+#endif
+#if AUDIO_VAD
+  if (!vad.begin(SAMPLE_RATE, VAD_FRAME_SAMPLES, AUDIO_VAD_AGGRESSIVENESS)) {
+    M5.Log(ESP_LOG_ERROR ,"Invalid VAD configuration");
+    while (1) delay(100);
+  }
+#endif
+#if AUDIO_BACKLOG
+  setupBacklog();
+#endif
+#if AUDIO_RETRANSMIT
+  setupRetransmit();
+#endif
+#if AUDIO_FEATURES
+  if (!logMel.begin()) {
+    M5.Log(ESP_LOG_ERROR ,"Invalid mel filterbank");
+    while (1) delay(100);
+  }
+#endif
+#if AUDIO_TRACE
+  // Internal RAM, which the scheduler's hook can write while the flash cache is off
+  static TraceEvent traceStorage[TRACE_CORES * AUDIO_TRACE_EVENTS];
+  if (!traceRecorder.begin(traceStorage, AUDIO_TRACE_EVENTS)) {
+    M5.Log(ESP_LOG_ERROR ,"Failed to start the trace recorder");
+    while (1) delay(100);
+  }
+  M5.Log(ESP_LOG_INFO ,"Trace: %u events per core, %u cycles per event; send 't' to dump it",
+               AUDIO_TRACE_EVENTS, traceRecorder.measureCost());
+#endif
+
+  // init Mic
+  // Decimated captures need the raw 48 kHz signal
+  if (!micSource.begin(!AUDIO_OVERSAMPLE)) {
+    M5.Log(ESP_LOG_ERROR ,"Mic init failed");
+    while (1) delay(100);
+  }
+
+  // Connection state shared by the BLE callbacks and the tasks
+  connectionLock = xSemaphoreCreateMutex();
+  connectionBits = xEventGroupCreate();
+  clientLock = xSemaphoreCreateMutex();
+  if (connectionLock == nullptr || connectionBits == nullptr || clientLock == nullptr) {
+    M5.Log(ESP_LOG_ERROR ,"Failed to create connection state");
+    while (1) delay(100);
+  }
+  connection.reset();
+  xEventGroupSetBits(connectionBits, connectionBit(connection.state()));
+
+  telemetryLock = xSemaphoreCreateMutex();
+  if (telemetryLock == nullptr) {
+    M5.Log(ESP_LOG_ERROR ,"Failed to create telemetry lock");
+    while (1) delay(100);
+  }
+
+  formatLock = xSemaphoreCreateMutex();
+  if (formatLock == nullptr) {
+    M5.Log(ESP_LOG_ERROR ,"Failed to create format lock");
+    while (1) delay(100);
+  }
+  requestedFormat.sampleRate = SAMPLE_RATE;
+#if AUDIO_FEATURES
+  requestedFormat.encoding = AUDIO_ENCODING_LOG_MEL;
+#endif
+
+  // set up BLE
+  BLEDevice::init("CareSense"); // Device name
+  BLEDevice::setMTU(MTU_SIZE);
+  BLEDevice::setCustomGattsHandler(gattsEventHandler);
+  BLEDevice::setCustomGapHandler(gapEventHandler);
+  for (AudioClient& c : clients) {
+    c.pacer.begin(PACER_INITIAL_WINDOW, PACER_MAX_WINDOW, PACER_COMPLETION_TIMEOUT_MS);
+  }
+
+  BLEServer* srv = BLEDevice::createServer();
+  
+  // Add connection callback handler
+  srv->setCallbacks(new ServerCallbacks());
+  
+  BLEService* svc = srv->createService(SERVICE_UUID);
+  pAudioChar = svc->createCharacteristic(CHARACTERISTIC_UUID, BLECharacteristic::PROPERTY_NOTIFY);
+  // Add descriptor for CCCD (Client Characteristic Configuration Descriptor)
+// This is required for notifications to work properly on Android
+audioCccd = new BLE2902();
+audioCccd->setNotifications(true);
+// Subscribing starts the audio without waiting for the fallback delay;
+// gattsEventHandler tracks the writes per client
+pAudioChar->addDescriptor(audioCccd);
+
+
+// Add user-friendly description (helps with debugging in BLE scanner apps)
+BLEDescriptor* pDesc = new BLEDescriptor(BLEUUID((uint16_t)0x2901));
+pDesc->setValue(AUDIO_STREAM_DESCRIPTION);
+pAudioChar->addDescriptor(pDesc);
+audioTransport.begin(pAudioChar);
+
+// Control characteristic: clients write CONTROL_CMD_START once they are ready,
+// pick the audio format with CONTROL_CMD_SET_FORMAT and may tune the live path
+// with CONTROL_CMD_SET_CHUNK and CONTROL_CMD_SET_TRIGGER. With AUDIO_RETRANSMIT
+// a client NACKs the sequence numbers it missed with CONTROL_CMD_NACK (write
+// without response keeps them cheap). Reading it returns the format in effect.
+pControlChar = svc->createCharacteristic(CONTROL_CHARACTERISTIC_UUID,
+    BLECharacteristic::PROPERTY_READ | BLECharacteristic::PROPERTY_WRITE | BLECharacteristic::PROPERTY_WRITE_NR);
+pControlChar->setCallbacks(new ControlCallbacks());
+updateControlValue();
+BLEDescriptor* pControlDesc = new BLEDescriptor(BLEUUID((uint16_t)0x2901));
+pControlDesc->setValue("Audio Control");
+pControlChar->addDescriptor(pControlDesc);
+
+// Telemetry characteristic: read it any time, or subscribe for a snapshot a second
+pTelemetryChar = svc->createCharacteristic(TELEMETRY_CHARACTERISTIC_UUID,
+    BLECharacteristic::PROPERTY_READ | BLECharacteristic::PROPERTY_NOTIFY);
+telemetryCccd = new BLE2902();
+pTelemetryChar->addDescriptor(telemetryCccd);
+BLEDescriptor* pTelemetryDesc = new BLEDescriptor(BLEUUID((uint16_t)0x2901));
+pTelemetryDesc->setValue("Telemetry v1");
+pTelemetryChar->addDescriptor(pTelemetryDesc);
+telemetryTransport.begin(pTelemetryChar);
 
 // Start the service
 svc->start();
@@ -604,23 +2954,110 @@ BLEDevice::startAdvertising();
 //BLEDevice::setMTU(MTU_SIZE);
 
   M5.Log(ESP_LOG_INFO ,"BLE audio device ready - waiting for connection...");
+#if AUDIO_WIFI
+  // Wi-Fi shares the radio with Bluetooth, which needs the default modem sleep
+  WiFi.onEvent(onWifiEvent);
+  WiFi.mode(WIFI_STA);
+  WiFi.setAutoReconnect(true);
+  WiFi.begin(WIFI_SSID, WIFI_PASSWORD);
+  M5.Log(ESP_LOG_INFO ,"Wi-Fi joining %s, gateway %s:%u", WIFI_SSID, WIFI_GATEWAY_HOST, WIFI_GATEWAY_PORT);
+#endif
+#if AUDIO_SPP
+  // The Classic controller shares the radio with BLE; start it once BLE is up
+  if (sppTransport.begin(SPP_DEVICE_NAME, sppEventHandler)) {
+    M5.Log(ESP_LOG_INFO ,"SPP server \"%s\" ready", SPP_DEVICE_NAME);
+  } else {
+    M5.Log(ESP_LOG_ERROR ,"SPP server failed to start; BLE only");
+  }
+#endif
+
+  // Full speed until the policy has measured the pipeline
+  dfsAvailable = true;
+  applyCpuClock(240, false);
+  powerManager.begin(millis(), BATTERY_CAPACITY_MAH);
 
   // Create and pin tasks to different cores with priority hierarchy
   // Priority levels: 7 = highest (record), 5 = high (send), 3 = medium (UI)
   
   // Create UI task on core 1 with medium priority
-  xTaskCreatePinnedToCore(uiTask, "uiTask", 3072, nullptr, 3, &uiTaskHandle, 1);
+  uiTaskHandle = uiTaskMemory.start(uiTask, "uiTask", 3, 1);
   
   // Create record task on core 0 with highest priority  
-  xTaskCreatePinnedToCore(recordTask, "recordTask", 4096, nullptr, 7, nullptr, 0);
+  recordTaskHandle = recordTaskMemory.start(recordTask, "recordTask", 7, 0);
   
   // Create send task on core 1 with high priority
-  xTaskCreatePinnedToCore(sendTask, "sendTask", 4096, nullptr, 5, nullptr, 1);
+  sendTaskHandle = sendTaskMemory.start(sendTask, "sendTask", 5, 1);
+
+  // Tasks in the telemetry snapshot; setup() runs in the loop task
+  trackTelemetryTask(recordTaskHandle, 0);
+  trackTelemetryTask(sendTaskHandle, 1);
+  trackTelemetryTask(uiTaskHandle, 1);
+  trackTelemetryTask(storageTaskHandle, 0);
+  trackTelemetryTask(xTaskGetCurrentTaskHandle(), ARDUINO_RUNNING_CORE);
+  trackTelemetryTask(xTaskGetIdleTaskHandleForCPU(0), 0);
+  trackTelemetryTask(xTaskGetIdleTaskHandleForCPU(1), 1);
+
+  setupFreeInternalHeap = heap_caps_get_free_size(MALLOC_CAP_INTERNAL);
+  M5.Log(ESP_LOG_INFO ,"Live path: %u-sample captures, %u ring slots (%u bytes), %u ms worst case of %u ms budget",
+               CHUNK_SAMPLES, AUDIO_RING_SLOTS, LivePipeline::RING_STORAGE_BYTES,
+               LivePipeline::WORST_LATENCY_US / 1000, LATENCY_BUDGET_MS);
+  M5.Log(ESP_LOG_INFO ,"Internal heap after setup: %u bytes free", setupFreeInternalHeap);
+}
+
+void diagnostics();
+
+// Stack headroom of the audio tasks against their reservations, and the
+// heap against what was free after setup: the figures to size them by
+static void reportMemory() {
+  static const struct { const TaskHandle_t* task; size_t stackBytes; } TASKS[] = {
+    { &recordTaskHandle, RECORD_TASK_STACK_BYTES },
+    { &sendTaskHandle, SEND_TASK_STACK_BYTES },
+    { &uiTaskHandle, UI_TASK_STACK_BYTES },
+    { &storageTaskHandle, STORAGE_TASK_STACK_BYTES },
+  };
+  for (const auto& t : TASKS) {
+    if (*t.task == nullptr) {
+      continue;
+    }
+    size_t headroom = uxTaskGetStackHighWaterMark(*t.task);
+    M5.Log(headroom < STACK_HEADROOM_WARN_BYTES ? ESP_LOG_WARN : ESP_LOG_VERBOSE,
+           "Stack %s: %u of %u bytes used at most\n", pcTaskGetName(*t.task),
+           t.stackBytes - headroom, t.stackBytes);
+  }
+  size_t internalFree = heap_caps_get_free_size(MALLOC_CAP_INTERNAL);
+  M5.Log(ESP_LOG_VERBOSE ,"Heap: %u bytes internal free (%d since setup, lowest %u, largest block %u), %u PSRAM free\n",
+               internalFree, (int)(internalFree - setupFreeInternalHeap),
+               heap_caps_get_minimum_free_size(MALLOC_CAP_INTERNAL),
+               heap_caps_get_largest_free_block(MALLOC_CAP_INTERNAL),
+               heap_caps_get_free_size(MALLOC_CAP_SPIRAM));
+}
+
+#if AUDIO_TRACE
+// Prints the trace once a drop's events are in, or when 't' arrives on the
+// console. Power, telemetry and diagnostics wait while it prints.
+static void serviceTrace() {
+  bool requested = false;
+  while (Serial.available() > 0) {
+    if (Serial.read() == 't') {
+      requested = true;
+    }
+  }
+  if (requested || traceRecorder.dumpDue(millis())) {
+    M5.Log(ESP_LOG_INFO ,"Trace dump (%s)", traceRecorder.triggered() ? "packets dropped" : "requested");
+    traceRecorder.dump(Serial);
+  }
 }
+#endif
 
 void loop() {
-  // All functionality moved to dedicated tasks
-  // Main loop is kept empty for optimal task scheduling
+  // Audio and UI run in dedicated tasks; this only applies the power
+  // policy, publishes telemetry and prints diagnostics once a second
+  updatePower();
+  publishTelemetry();
+  diagnostics();
+#if AUDIO_TRACE
+  serviceTrace();
+#endif
   vTaskDelay(pdMS_TO_TICKS(1000)); // Sleep for 1 second
 }
 
@@ -629,24 +3066,161 @@ void diagnostics() {
   //M5.update();
   
   if (millis() - lastReport > 5000) { // Report every 5 seconds
+    unsigned long elapsed = millis() - lastReport; // ms, so bytes/ms is KB/s
     lastReport = millis();
     
-    if (clientConnected) {
-      if (readyToReceive) {
-        float dropPercentage = (totalChunks > 0) ? 
-                              ((float)droppedBytes*100.0f/((float)totalChunks*CHUNK_SIZE_BYTES)) : 0;
+    if (clientConnected()) {
+      if (streamLive()) {
+        float dropPercentage = (encodedBytes > 0) ? 
+                              ((float)droppedBytes*100.0f/(float)encodedBytes) : 0;
         
-        M5.Log(ESP_LOG_VERBOSE ,"Audio stats: %u chunks, %.1f%% data dropped, buffer high: %u/%u bytes\n", 
-                     totalChunks, dropPercentage, bufferHighWatermark, STREAM_BUFFER_SIZE);
+        M5.Log(ESP_LOG_VERBOSE ,"Audio stats: %u captures, %.1f%% data dropped, ring high: %u/%u slots, now %u\n", 
+                     totalChunks, dropPercentage, bufferHighWatermark, audioRing.slotCount(),
+                     audioRing.occupancy());
+        M5.Log(ESP_LOG_VERBOSE ,"Packets: %u sent, %u dropped, %u bytes each (MTU %u)\n",
+                     sentPackets, droppedPackets, currentPacketBytes(), streamMtu());
+        if (firstPacketConnections > 0) {
+          M5.Log(ESP_LOG_VERBOSE ,"Start: %s after %u ms, first packet after %u ms (avg %u ms, max %u ms over %u connections)\n",
+                       START_REASON_NAMES[startReason], startTime - connectionTime, firstPacketLatencyMs,
+                       (uint32_t)(firstPacketLatencyTotalMs / firstPacketConnections),
+                       firstPacketLatencyMaxMs, firstPacketConnections);
+        }
+        for (AudioClient& c : clients) {
+          if (!c.connected) {
+            continue;
+          }
+          uint64_t linkBytes = c.pacer.sentBytes();
+          // sendTask clears the count when a new connection takes the slot
+          uint64_t reportedBytes = linkBytes >= c.reportSentBytes ? c.reportSentBytes : 0;
+          M5.Log(ESP_LOG_VERBOSE ,"Client %u: %.1f KB/s goodput, interval %.2f ms, window %u (max %u in flight)\n",
+                       c.connId, (float)(linkBytes - reportedBytes) / (float)elapsed, c.connInterval * 1.25f,
+                       c.pacer.window(), c.pacer.maxInFlight());
+          M5.Log(ESP_LOG_VERBOSE ,"Client %u: lag %u packets (max %u), %u sent, %u skipped\n",
+                       c.connId, audioRing.lag(c.reader), audioRing.maxLag(c.reader), c.sentPackets,
+                       audioRing.skipped(c.reader) + c.oversized);
+          M5.Log(ESP_LOG_VERBOSE ,"Client %u pacing: %u stalls, %u increases, %u backoffs, %u congestion, %u failed, %u timeouts\n",
+                       c.connId, c.pacer.stalls(), c.pacer.increases(), c.pacer.backoffs(), c.pacer.congestionEvents(),
+                       c.pacer.failures(), c.pacer.timeouts());
+#if AUDIO_RETRANSMIT
+          if (c.historyReady && c.history.nackedPackets() > 0) {
+            M5.Log(ESP_LOG_VERBOSE ,"Client %u repairs: %u packets NACKed, %u resent (%u KB), %u unrecoverable, %u duplicate, %u ranges dropped\n",
+                         c.connId, c.history.nackedPackets(), c.history.resentPackets(),
+                         c.history.resentBytes() / 1024, c.history.unrecoverable(), c.history.duplicates(),
+                         c.history.droppedRanges());
+          }
+#endif
+          c.reportSentBytes = linkBytes;
+        }
+        M5.Log(ESP_LOG_VERBOSE ,"Send timing: jitter %.2f ms, longest gap %.1f ms\n",
+                     sendJitterUs / 1000.0f, sendGapMaxUs / 1000.0f);
+        if (encodedBlocks > 0) {
+          uint32_t cpuMHz = ESP.getCpuFreqMHz();
+          M5.Log(ESP_LOG_VERBOSE ,"Encoder: %u packets, %u cycles/packet avg, %u max, ratio %.2f\n",
+                       encodedBlocks, (uint32_t)(encodeCyclesTotal / encodedBlocks), encodeCyclesMax,
+                       (float)capturedSamples * BYTES_PER_SAMPLE / (float)encodedBytes);
+          M5.Log(ESP_LOG_VERBOSE ,"Encoder worst chunk: %u us of %u us deadline\n",
+                       encodeChunkCyclesMax / cpuMHz, captureDeadlineUs);
+        }
+        M5.Log(ESP_LOG_VERBOSE ,"Live path: %u-sample captures (%.1f ms), send trigger %u packets\n",
+                     captureChunkSamples, captureChunkSamples * 1000.0f / streamSampleRate, sendTrigger);
+        for (size_t stage = 0; stage < TELEMETRY_LATENCY_COUNT; stage++) {
+          const LatencyHistogram& h = latency[stage];
+          if (h.count() > 0) {
+            M5.Log(ESP_LOG_VERBOSE ,"Latency %s: p50 %.1f ms, p95 %.1f ms, p99 %.1f ms, max %.1f ms (%u packets)\n",
+                         LATENCY_STAGE_NAMES[stage], h.percentileUs(50) / 1000.0f, h.percentileUs(95) / 1000.0f,
+                         h.percentileUs(99) / 1000.0f, h.maxUs() / 1000.0f, h.count());
+          }
+        }
+        if (dspSamples > 0) {
+#if AUDIO_DSP
+          M5.Log(ESP_LOG_VERBOSE ,"DSP: %u cycles/sample, AGC gain %.2f, level %.1f dBFS RMS, %.1f dBFS peak, %u clipped\n",
+                       (uint32_t)(dspCyclesTotal / dspSamples), frontEnd.agc().gain() / 65536.0f,
+                       LevelMeter::toDbfs(levelMeter.rms()), LevelMeter::toDbfs(levelMeter.peakHold()),
+                       levelMeter.clippedSamples());
+#else
+          M5.Log(ESP_LOG_VERBOSE ,"Level: %.1f dBFS RMS, %.1f dBFS peak, %u clipped (meter %u cycles/sample)\n",
+                       LevelMeter::toDbfs(levelMeter.rms()), LevelMeter::toDbfs(levelMeter.peakHold()),
+                       levelMeter.clippedSamples(), (uint32_t)(dspCyclesTotal / dspSamples));
+#endif
+        }
+#if AUDIO_OVERSAMPLE
+        if (decimatorOutputs > 0) {
+          uint32_t cycles = (uint32_t)(decimateCyclesTotal / decimatorOutputs);
+          M5.Log(ESP_LOG_VERBOSE ,"Decimator: 48 kHz /%u (%s), %u cycles/sample, %.1f%% of core 0\n",
+                       captureDecimator.factor(), captureDecimator.accelerated() ? "esp-dsp" : "scalar", cycles,
+                       cycles * (float)streamSampleRate / (ESP.getCpuFreqMHz() * 10000.0f));
+        }
+#endif
+#if AUDIO_FEATURES
+        if (featureFrames > 0) {
+          uint32_t cycles = (uint32_t)(featureCyclesTotal / featureFrames);
+          M5.Log(ESP_LOG_VERBOSE ,"Log-mel: %u frames, %u cycles/frame (FFT %s, bands %s), %.1f%% of core 0\n",
+                       featureFrames, cycles, logMel.acceleratedFft() ? "esp-dsp" : "scalar",
+                       logMel.acceleratedBands() ? "esp-dsp" : "scalar",
+                       cycles * 100.0f * LogMelExtractor::SAMPLE_RATE / LogMelExtractor::HOP_SAMPLES /
+                           (ESP.getCpuFreqMHz() * 1000000.0f));
+        }
+#endif
+#if AUDIO_BACKLOG
+        if (backlogReady) {
+          M5.Log(ESP_LOG_VERBOSE ,"Backlog: %u KB in PSRAM, %u packets in flash, %u stored, %u replayed, %u spilled, %u overwritten, %u too large\n",
+                       backlogRam.usedBytes() / 1024, backlogFlashReady ? backlogFlash.count() : 0,
+                       backlogStored, backlogSent, backlogSpilled,
+                       backlogRam.overwritten() + (backlogFlashReady ? backlogFlash.overwritten() : 0),
+                       backlogDropped);
+        }
+#endif
+#if AUDIO_QUALITY_LADDER
+        M5.Log(ESP_LOG_VERBOSE ,"Quality: %s, %u steps down, %u up, %u/%u/%u/%u s per rung, %u ms replaced by silence\n",
+                     QualityLadder::levelName(ladder.level()), ladder.stepsDown(), ladder.stepsUp(),
+                     ladder.residencyMs(QUALITY_FULL) / 1000, ladder.residencyMs(QUALITY_HALF_RATE) / 1000,
+                     ladder.residencyMs(QUALITY_COMPANDED) / 1000, ladder.residencyMs(QUALITY_SILENCE) / 1000,
+                     (uint32_t)(ladderSilencedSamples * 1000ULL / streamSampleRate));
+#endif
+#if AUDIO_VAD
+        if (vadFrames > 0) {
+          M5.Log(ESP_LOG_VERBOSE ,"VAD: %.1f%% speech, %u bytes of PCM not sent, floor %.1f dB\n",
+                       (float)vadSpeechFrames * 100.0f / (float)vadFrames,
+                       vadSilentSamples * BYTES_PER_SAMPLE, vad.noiseFloorDb());
+        }
+#endif
       } else {
         unsigned long remaining = RECORDING_DELAY_MS - (millis() - connectionTime);
-        M5.Log(ESP_LOG_VERBOSE ,"Client connected, waiting %u ms before starting audio...\n", remaining);
+        M5.Log(ESP_LOG_VERBOSE ,"Client connected, waiting up to %u ms for the client to start audio...\n", remaining);
       }
     } else {
       M5.Log(ESP_LOG_VERBOSE ,"Waiting for BLE client connection...");
     }
     
-    M5.Log(ESP_LOG_VERBOSE ,"Free heap: %u bytes\n", ESP.getFreeHeap());
+    // UI cost on core 1 over the last report interval
+    uint32_t frames = uiFrames - lastReportUiFrames;
+    uint64_t busyUs = uiBusyUs - lastReportUiBusyUs;
+    if (frames > 0) {
+      M5.Log(ESP_LOG_VERBOSE ,"UI: %u frames, %.2f ms/frame avg, %.2f ms max, %.1f%% of core 1, %u px pushed (%u DMA, %u blocking)\n",
+                   frames, busyUs / 1000.0f / frames, uiFrameMaxUs / 1000.0f,
+                   busyUs / 10.0f / elapsed, compositor.pushedPixels(),
+                   compositor.dmaPushes(), compositor.blockingPushes());
+    }
+    lastReportUiFrames = uiFrames;
+    lastReportUiBusyUs = uiBusyUs;
+    uiFrameMaxUs = 0;
+    compositor.resetStats();
+    
+    M5.Log(ESP_LOG_VERBOSE ,"Connection: %s, %u transitions, %u events ignored\n",
+                 ConnectionStateMachine::stateName(connection.state()), connection.transitions(),
+                 connection.ignoredEvents());
+    
+    const PowerDecision& power = powerManager.decision();
+    M5.Log(ESP_LOG_VERBOSE ,"Power: %s at %u MHz, backlight %s, ~%.0f mA (avg %.0f mA), ~%.1f h left at %d%%\n",
+                 PowerManager::stateName(power.state), power.cpuMHz, PowerManager::backlightName(power.backlight),
+                 powerManager.estimatedMa(), powerManager.averageMa(),
+                 powerManager.hoursRemaining(batteryPercentage), batteryPercentage);
+    M5.Log(ESP_LOG_VERBOSE ,"Residency: %u s advertising, %u s connected, %u s streaming, backlight off %u s, %u clock changes\n",
+                 powerManager.residencyMs(POWER_ADVERTISING) / 1000, powerManager.residencyMs(POWER_CONNECTED) / 1000,
+                 powerManager.residencyMs(POWER_STREAMING) / 1000, powerManager.backlightMs(BACKLIGHT_OFF) / 1000,
+                 powerManager.clockChanges());
+    
+    reportMemory();
   }
   
   M5.delay(100);